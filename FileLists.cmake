@@ -1,15 +1,76 @@
+SET(FLUID2D_SOLVER_HEADERS
+    ${FLUID2D_SRC_DIR}/FluidAdvection.h
+    ${FLUID2D_SRC_DIR}/FluidBoundary.h
+    ${FLUID2D_SRC_DIR}/FluidConjugateGradient.h
+    ${FLUID2D_SRC_DIR}/FluidConvergence.h
+    ${FLUID2D_SRC_DIR}/FluidDomainMultigrid.h
+    ${FLUID2D_SRC_DIR}/FluidDomainSolver.h
+    ${FLUID2D_SRC_DIR}/FluidEnsemble.h
+    ${FLUID2D_SRC_DIR}/FluidExporter.h
+    ${FLUID2D_SRC_DIR}/FluidFieldLayout.h
+    ${FLUID2D_SRC_DIR}/FluidGrid.h
+    ${FLUID2D_SRC_DIR}/FluidInitializer.h
+    ${FLUID2D_SRC_DIR}/FluidKernels.h
+    ${FLUID2D_SRC_DIR}/FluidKernelsImpl.h
+    ${FLUID2D_SRC_DIR}/FluidMultigrid.h
+    ${FLUID2D_SRC_DIR}/FluidProfiler.h
+    ${FLUID2D_SRC_DIR}/FluidScene.h
+    ${FLUID2D_SRC_DIR}/FluidScheduler.h
+    ${FLUID2D_SRC_DIR}/FluidSnapshot.h
+    ${FLUID2D_SRC_DIR}/FluidSocketTransport.h
+    ${FLUID2D_SRC_DIR}/FluidSolver.h
+    ${FLUID2D_SRC_DIR}/FluidTile.h
+    ${FLUID2D_SRC_DIR}/FluidTransport.h)
+
+SET(FLUID2D_SOLVER_SOURCES
+    ${FLUID2D_SRC_DIR}/FluidAdvection.cpp
+    ${FLUID2D_SRC_DIR}/FluidBoundary.cpp
+    ${FLUID2D_SRC_DIR}/FluidConjugateGradient.cpp
+    ${FLUID2D_SRC_DIR}/FluidDomainMultigrid.cpp
+    ${FLUID2D_SRC_DIR}/FluidDomainSolver.cpp
+    ${FLUID2D_SRC_DIR}/FluidEnsemble.cpp
+    ${FLUID2D_SRC_DIR}/FluidExporter.cpp
+    ${FLUID2D_SRC_DIR}/FluidFieldLayout.cpp
+    ${FLUID2D_SRC_DIR}/FluidGrid.cpp
+    ${FLUID2D_SRC_DIR}/FluidInitializer.cpp
+    ${FLUID2D_SRC_DIR}/FluidKernels.cpp
+    ${FLUID2D_SRC_DIR}/FluidKernelsScalar.cpp
+    ${FLUID2D_SRC_DIR}/FluidKernelsSse2.cpp
+    ${FLUID2D_SRC_DIR}/FluidKernelsAvx2.cpp
+    ${FLUID2D_SRC_DIR}/FluidKernelsAvx512.cpp
+    ${FLUID2D_SRC_DIR}/FluidKernelsNeon.cpp
+    ${FLUID2D_SRC_DIR}/FluidMultigrid.cpp
+    ${FLUID2D_SRC_DIR}/FluidProfiler.cpp
+    ${FLUID2D_SRC_DIR}/FluidScene.cpp
+    ${FLUID2D_SRC_DIR}/FluidScheduler.cpp
+    ${FLUID2D_SRC_DIR}/FluidSnapshot.cpp
+    ${FLUID2D_SRC_DIR}/FluidSocketTransport.cpp
+    ${FLUID2D_SRC_DIR}/FluidSolver.cpp
+    ${FLUID2D_SRC_DIR}/FluidTransport.cpp)
+
 SET(FLUID2D_HEADERS
-    ${FLUID2D_SRC_DIR}/FluidCharacter.h)
+    ${FLUID2D_SOLVER_HEADERS}
+    ${FLUID2D_SRC_DIR}/FluidCharacter.h
+    ${FLUID2D_SRC_DIR}/FluidGpuTimer.h)
     
 SET(FLUID2D_SOURCES
+    ${FLUID2D_SOLVER_SOURCES}
     ${FLUID2D_SRC_DIR}/FluidCharacter.cpp
+    ${FLUID2D_SRC_DIR}/FluidGpuTimer.cpp
     ${FLUID2D_SRC_DIR}/main.cpp)
     
 SET(FLUID2D_SRC_FILES
     ${FLUID2D_HEADERS}
     ${FLUID2D_SOURCES})
+
+SET(FLUID2D_HEADLESS_SRC_FILES
+    ${FLUID2D_SOLVER_HEADERS}
+    ${FLUID2D_SOLVER_SOURCES}
+    ${FLUID2D_SRC_DIR}/FluidBenchmark.h
+    ${FLUID2D_SRC_DIR}/FluidBenchmark.cpp
+    ${FLUID2D_SRC_DIR}/headless.cpp)
     
 SET(FLUID2D_CONFIG_FILES
     ${FLUID2D_SRC_DIR}/CMakeLists.txt
     ${FLUID2D_SRC_DIR}/FileLists.cmake
-    ${FLUID2D_SRC_DIR}/LibLists.cmake)
\ No newline at end of file
+    ${FLUID2D_SRC_DIR}/LibLists.cmake)
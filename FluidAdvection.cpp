@@ -0,0 +1,110 @@
+#include "FluidAdvection.h"
+
+#include <sstream>
+using namespace std;
+
+
+FluidAdvection::FluidAdvection(EScheme scheme, ELimiter limiter) :
+    _limiter(limiter)
+{
+    for(int f=0; f < FluidFieldLayout::FIELD_COUNT; ++f)
+        _schemes[f] = EScheme::SEMI_LAGRANGIAN;
+
+    setScheme(EField::DYE, scheme);
+    setScheme(EField::HEAT, scheme);
+    setScheme(EField::VELOCITY, scheme);
+}
+
+void FluidAdvection::setScheme(EField field, EScheme scheme)
+{
+    if(field == EField::DYE || field == EField::HEAT || field == EField::VELOCITY)
+        _schemes[(int) field] = scheme;
+}
+
+void FluidAdvection::setLimiter(ELimiter limiter)
+{
+    _limiter = limiter;
+}
+
+bool FluidAdvection::highOrder() const
+{
+    for(int f=0; f < FluidFieldLayout::FIELD_COUNT; ++f)
+        if(_schemes[f] != EScheme::SEMI_LAGRANGIAN)
+            return true;
+    return false;
+}
+
+bool FluidAdvection::parse(const string& policy, string& error)
+{
+    stringstream entries(policy);
+    string entry;
+    while(getline(entries, entry, ','))
+    {
+        size_t equal = entry.find('=');
+        string name = entry.substr(0, equal);
+        string value = equal != string::npos ? entry.substr(equal+1) : string();
+
+        if(name == "limiter")
+        {
+            if(value == "clamp")
+                _limiter = ELimiter::CLAMP;
+            else if(value == "revert")
+                _limiter = ELimiter::REVERT;
+            else
+            {
+                error = "Invalid limiter in '" + entry + "', use clamp or revert";
+                return false;
+            }
+            continue;
+        }
+
+        EField field;
+        if(name == "dye")
+            field = EField::DYE;
+        else if(name == "heat")
+            field = EField::HEAT;
+        else if(name == "velocity")
+            field = EField::VELOCITY;
+        else
+        {
+            error = "Only dye, heat and velocity are advected, not '" + name + "'";
+            return false;
+        }
+
+        bool ok = true;
+        EScheme scheme = schemeFromName(value, &ok);
+        if(!ok)
+        {
+            error = "Invalid scheme in '" + entry +
+                    "', use semi-lagrangian, maccormack or bfecc";
+            return false;
+        }
+        setScheme(field, scheme);
+    }
+
+    return true;
+}
+
+const char* FluidAdvection::schemeName(EScheme scheme)
+{
+    switch(scheme)
+    {
+    case EScheme::MACCORMACK : return "maccormack";
+    case EScheme::BFECC :      return "bfecc";
+    default :                  return "semi-lagrangian";
+    }
+}
+
+FluidAdvection::EScheme FluidAdvection::schemeFromName(const string& name, bool* ok)
+{
+    if(ok) *ok = true;
+    if(name == "semi-lagrangian")
+        return EScheme::SEMI_LAGRANGIAN;
+    if(name == "maccormack")
+        return EScheme::MACCORMACK;
+    if(name == "bfecc")
+        return EScheme::BFECC;
+
+    if(ok) *ok = false;
+    return EScheme::SEMI_LAGRANGIAN;
+}
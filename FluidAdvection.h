@@ -0,0 +1,61 @@
+#ifndef FLUID_ADVECTION_H
+#define FLUID_ADVECTION_H
+
+#include <string>
+
+#include "FluidFieldLayout.h"
+
+
+// Advection scheme of the dye, heat and velocity fields.
+// MACCORMACK corrects the semi-Lagrangian step by half the error a
+// backward step makes on the result. BFECC advects the source compensated
+// by that error again. Both are limited by the four texels the backtrace
+// lands between, since their correction can overshoot.
+// Shared by the GL passes and the CPU solver.
+class FluidAdvection
+{
+public:
+    typedef FluidFieldLayout::EField EField;
+    enum class EScheme {SEMI_LAGRANGIAN, MACCORMACK, BFECC};
+    // CLAMP bounds the corrected value, REVERT falls back to the
+    // semi-Lagrangian value when it is out of bounds
+    enum class ELimiter {CLAMP, REVERT};
+
+    FluidAdvection(EScheme scheme = EScheme::SEMI_LAGRANGIAN,
+                   ELimiter limiter = ELimiter::CLAMP);
+
+    // Only dye, heat and velocity are advected, others are ignored
+    void setScheme(EField field, EScheme scheme);
+    EScheme scheme(EField field) const;
+
+    void setLimiter(ELimiter limiter);
+    ELimiter limiter() const;
+
+    // Any field uses more than the semi-Lagrangian step
+    bool highOrder() const;
+
+    // Policy as "dye=bfecc,velocity=maccormack,limiter=revert"
+    bool parse(const std::string& policy, std::string& error);
+
+    static const char* schemeName(EScheme scheme);
+    static EScheme schemeFromName(const std::string& name, bool* ok = nullptr);
+
+private:
+    EScheme _schemes[FluidFieldLayout::FIELD_COUNT];
+    ELimiter _limiter;
+};
+
+
+
+// IMPLEMENTATION //
+inline FluidAdvection::EScheme FluidAdvection::scheme(EField field) const
+{
+    return _schemes[(int) field];
+}
+
+inline FluidAdvection::ELimiter FluidAdvection::limiter() const
+{
+    return _limiter;
+}
+
+#endif // FLUID_ADVECTION_H
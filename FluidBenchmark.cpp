@@ -0,0 +1,2073 @@
+#include "FluidBenchmark.h"
+
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+using namespace std;
+
+#include "FluidBoundary.h"
+#include "FluidConjugateGradient.h"
+#include "FluidDomainSolver.h"
+#include "FluidEnsemble.h"
+#include "FluidExporter.h"
+#include "FluidInitializer.h"
+#include "FluidKernels.h"
+#include "FluidMultigrid.h"
+#include "FluidScene.h"
+#include "FluidSnapshot.h"
+#include "FluidSocketTransport.h"
+#include "FluidSolver.h"
+#include "FluidTransport.h"
+
+
+namespace
+{
+    // Most of the domain is rock, the fluid fills a room in a corner
+    class CaveInitializer : public FluidInitializer
+    {
+    public:
+        virtual cellar::Vec4f initHeat(float s, float t)
+        {
+            if(cellar::Vec2f(s, t).distanceTo(0.15f, 0.1f) < 0.05f)
+                return cellar::Vec4f(5, 0, 0, 0);
+            return cellar::Vec4f();
+        }
+
+        virtual cellar::Vec4f initFrontier(float s, float t)
+        {
+            bool room = s > 0.03f && s < 0.4f && t > 0.03f && t < 0.45f;
+            return room ? cellar::Vec4f() : cellar::Vec4f(1, 1, 1, 1);
+        }
+    };
+
+    // Open box with a single small plume
+    class PlumeInitializer : public FluidInitializer
+    {
+    public:
+        virtual cellar::Vec4f initHeat(float s, float t)
+        {
+            if(cellar::Vec2f(s, t).distanceTo(0.2f, 0.15f) < 0.04f)
+                return cellar::Vec4f(5, 0, 0, 0);
+            return cellar::Vec4f();
+        }
+
+        virtual cellar::Vec4f initFrontier(float s, float t)
+        {
+            const float W = 0.03f;
+            if(s < W || s > 1-W || t < W || t > 1-W)
+                return cellar::Vec4f(1, 1, 1, 1);
+            return cellar::Vec4f();
+        }
+    };
+
+    // Sharp dye shapes carried by a uniform flow through an open box,
+    // the flow is left as is by its own advection
+    class TranslationInitializer : public FluidInitializer
+    {
+    public:
+        TranslationInitializer(float u, float v) :
+            _u(u),
+            _v(v)
+        {
+        }
+
+        static float pattern(float s, float t)
+        {
+            bool disc = cellar::Vec2f(s, t).distanceTo(0.3f, 0.35f) < 0.12f;
+            bool square = fabs(s - 0.45f) < 0.07f && fabs(t - 0.55f) < 0.07f;
+            return disc || square ? 1.0f : 0.0f;
+        }
+
+        virtual cellar::Vec4f initDye(float s, float t)
+        {
+            float value = pattern(s, t);
+            return cellar::Vec4f(value, value, value, 1);
+        }
+
+        virtual cellar::Vec4f initVelocity(float, float)
+        {
+            return cellar::Vec4f(_u, _v, 0, 0);
+        }
+
+        virtual cellar::Vec4f initHeat(float, float)
+        {
+            return cellar::Vec4f();
+        }
+
+        virtual cellar::Vec4f initFrontier(float, float)
+        {
+            return cellar::Vec4f();
+        }
+
+    private:
+        float _u;
+        float _v;
+    };
+
+    // Grid of counter-rotating vortices in a walled box, dye in stripes
+    // across them. The domain is 256 units across whatever the grid.
+    class VortexInitializer : public FluidInitializer
+    {
+    public:
+        static const int COUNT = 8;
+
+        virtual cellar::Vec4f initDye(float s, float t)
+        {
+            float value = fmod(floor((s + t) * 2 * COUNT), 2.0f);
+            return cellar::Vec4f(value, value, value, 1);
+        }
+
+        virtual cellar::Vec4f initVelocity(float s, float t)
+        {
+            const float A = 0.5f;
+            const float K = 3.14159265f * COUNT;
+            return cellar::Vec4f( A * sin(K * s) * cos(K * t),
+                                 -A * cos(K * s) * sin(K * t), 0, 0);
+        }
+
+        virtual cellar::Vec4f initHeat(float, float)
+        {
+            return cellar::Vec4f();
+        }
+
+        virtual cellar::Vec4f initFrontier(float s, float t)
+        {
+            bool wall = s < 0.01f || s > 0.99f || t < 0.01f || t > 0.99f;
+            return wall ? cellar::Vec4f(1, 1, 1, 1) : cellar::Vec4f();
+        }
+    };
+
+    // Box average of the first components of grid down to size x size
+    void coarsen(const FluidGrid& grid, int components, int size, vector<float>& out)
+    {
+        const int f = grid.width() / size;
+        out.assign(components * size * size, 0.0f);
+        for(int c=0; c < components; ++c)
+            for(int j=0; j < grid.height(); ++j)
+                for(int i=0; i < grid.width(); ++i)
+                    out[(c*size + j/f)*size + i/f] +=
+                        grid.load(c, j*grid.width() + i) / (f * f);
+    }
+
+    float maxDifference(const FluidGrid& a, const FluidGrid& b)
+    {
+        float diff = 0.0f;
+        for(int c=0; c < a.components(); ++c)
+            for(int k=0; k < a.area(); ++k)
+                diff = max(diff, fabs(a.load(c, k) - b.load(c, k)));
+        return diff;
+    }
+
+    float maxMagnitude(const FluidGrid& grid)
+    {
+        float peak = 0.0f;
+        for(int c=0; c < grid.components(); ++c)
+            for(int k=0; k < grid.area(); ++k)
+                peak = max(peak, fabs(grid.load(c, k)));
+        return peak;
+    }
+
+    // frontier.frag over the whole grid, as the solver ran it before
+    // it had a boundary index
+    void scanFrontier(const FluidGrid& frontier,
+                      const FluidGrid& velSrc, const FluidGrid& presSrc,
+                      FluidGrid& velDst, FluidGrid& presDst)
+    {
+        static const int dir[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+        for(int j=0; j < frontier.height(); ++j)
+        {
+            for(int i=0; i < frontier.width(); ++i)
+            {
+                if(frontier.fetch(0, i, j) != 1.0f)
+                {
+                    velDst.setTexel(i, j, velSrc.texel(i, j));
+                    presDst.setTexel(i, j, presSrc.texel(i, j));
+                    continue;
+                }
+
+                float accum = 0.0f;
+                cellar::Vec4f moyVelocity;
+                cellar::Vec4f moyPressure;
+                for(int d=0; d<4; ++d)
+                {
+                    int ni = i + dir[d][0];
+                    int nj = j + dir[d][1];
+                    float curr = 1.0f - frontier.fetch(0, ni, nj);
+                    for(int c=0; c < velSrc.components(); ++c)
+                        moyVelocity[c] += velSrc.fetch(c, ni, nj) * curr;
+                    for(int c=0; c < presSrc.components(); ++c)
+                        moyPressure[c] += presSrc.fetch(c, ni, nj) * curr;
+                    accum += curr;
+                }
+
+                if(accum != 0.0f)
+                {
+                    for(int c=0; c<4; ++c)
+                    {
+                        moyVelocity[c] = -moyVelocity[c] / accum;
+                        moyPressure[c] =  moyPressure[c] / accum;
+                    }
+                    velDst.setTexel(i, j, moyVelocity);
+                    presDst.setTexel(i, j, moyPressure);
+                }
+                else
+                {
+                    velDst.setTexel(i, j, cellar::Vec4f());
+                    presDst.setTexel(i, j, presSrc.texel(i, j));
+                }
+            }
+        }
+    }
+
+    bool sameIndex(const FluidBoundary& a, const FluidBoundary& b)
+    {
+        if(a.cells().size() != b.cells().size() ||
+           a.buriedSpans().size() != b.buriedSpans().size() ||
+           a.fluidSpans().size() != b.fluidSpans().size())
+            return false;
+
+        for(size_t k=0; k < a.cells().size(); ++k)
+        {
+            const FluidBoundary::Cell& ca = a.cells()[k];
+            const FluidBoundary::Cell& cb = b.cells()[k];
+            if(ca.i != cb.i || ca.j != cb.j || ca.count != cb.count ||
+               ca.accum != cb.accum ||
+               !equal(ca.neighbors, ca.neighbors + ca.count, cb.neighbors) ||
+               !equal(ca.weights, ca.weights + ca.count, cb.weights))
+                return false;
+        }
+
+        auto sameSpan = [](const FluidBoundary::Span& sa, const FluidBoundary::Span& sb)
+        {
+            return sa.j == sb.j && sa.i0 == sb.i0 && sa.i1 == sb.i1;
+        };
+        return equal(a.buriedSpans().begin(), a.buriedSpans().end(),
+                     b.buriedSpans().begin(), sameSpan) &&
+               equal(a.fluidSpans().begin(), a.fluidSpans().end(),
+                     b.fluidSpans().begin(), sameSpan);
+    }
+}
+
+
+FluidBenchmark::FluidBenchmark(ostream& out) :
+    _out(out)
+{
+}
+
+FluidBenchmark::~FluidBenchmark()
+{
+
+}
+
+bool FluidBenchmark::run(const string& name)
+{
+    if(name == "pressure")
+        pressureSolvers();
+    else if(name == "scaling")
+        gridScaling();
+    else if(name == "kernels")
+        stencilKernels();
+    else if(name == "layout")
+        fieldLayouts();
+    else if(name == "threads")
+        threadScaling();
+    else if(name == "blocking")
+        jacobiBlocking();
+    else if(name == "advection")
+        fusedAdvection();
+    else if(name == "projection")
+        fusedProjection();
+    else if(name == "snapshot")
+        snapshotRestart();
+    else if(name == "export")
+        fieldExport();
+    else if(name == "ensemble")
+        ensembleThroughput();
+    else if(name == "sparse")
+        sparseTiles();
+    else if(name == "boundary")
+        boundaryIndex();
+    else if(name == "precision")
+        mixedPrecision();
+    else if(name == "order")
+        advectionOrder();
+    else if(name == "cg")
+        conjugateGradient();
+    else if(name == "startup")
+        startupTime();
+    else if(name == "scene")
+        sceneForcing();
+    else if(name == "vorticity")
+        vorticityConfinement();
+    else if(name == "timestep")
+        adaptiveTimestep();
+    else if(name == "domain")
+        domainDecomposition();
+    else
+        return false;
+
+    return true;
+}
+
+void FluidBenchmark::listBenchmarks()
+{
+    _out << "pressure : residual against wall time of the pressure solvers"
+         << endl;
+    _out << "scaling  : step time from 64x64 to 2048x2048 grids" << endl;
+    _out << "kernels  : stencil throughput per instruction set, "
+            "checked bit for bit against scalar" << endl;
+    _out << "layout   : memory per cell and step time of RGBA32F "
+            "against packed fields" << endl;
+    _out << "threads  : step speedup from 1 thread to every hardware thread"
+         << endl;
+    _out << "blocking : memory traffic and time of temporally blocked "
+            "pressure solves" << endl;
+    _out << "advection: fused single pass against one pass per field" << endl;
+    _out << "projection : heat, gradSub and frontier fused against separate"
+         << endl;
+    _out << "snapshot : save, map and restore times, restart checked "
+            "bit for bit, also with adaptive dt and a scene" << endl;
+    _out << "export   : step rate while streaming every frame, "
+            "decoded frames checked against a rerun" << endl;
+    _out << "ensemble : cells/s of small members stepped one after the "
+            "other against one dispatch" << endl;
+    _out << "sparse   : active fraction and speedup of skipping quiet tiles "
+            "on sparse scenes" << endl;
+    _out << "boundary : frontier cost of the boundary index against a full "
+            "grid scan, incremental edits checked against a rebuild" << endl;
+    _out << "precision: bytes, step time and error of 16 bits dye and heat "
+            "against float" << endl;
+    _out << "order    : dissipation and cost of the advection schemes, "
+            "against semi-Lagrangian on 4 times the cells" << endl;
+    _out << "cg       : iterations, time and residual of the preconditioned "
+            "conjugate gradients against Jacobi and multigrid" << endl;
+    _out << "startup  : field generation and staging time of a serial "
+            "allocating pass against the pooled parallel one" << endl;
+    _out << "scene    : rasterization and forcing time of a scene's spans "
+            "against a full grid test, checked bit for bit" << endl;
+    _out << "vorticity: detail kept by confinement on 256x256 against "
+            "larger grids without it" << endl;
+    _out << "timestep : cost of the max speed reduction, steps and time of "
+            "fixed against adaptive timesteps over the same simulated time"
+         << endl;
+    _out << "domain   : ranks checked bit for bit against one solver, "
+            "strong and weak scaling from 1 to 8 ranks" << endl;
+}
+
+void FluidBenchmark::prepareProjection(FluidSolver& solver)
+{
+    FluidInitializer initializer;
+    solver.reset(initializer);
+    solver.advect();
+    solver.diffuse();
+    solver.heat();
+}
+
+bool FluidBenchmark::sameState(const FluidSolver& a, const FluidSolver& b) const
+{
+    const FluidGrid* gridsA[] = {
+        &a.dyeGrid(), &a.velocityGrid(), &a.pressureGrid(),
+        &a.heatGrid(), &a.frontierGrid()
+    };
+    const FluidGrid* gridsB[] = {
+        &b.dyeGrid(), &b.velocityGrid(), &b.pressureGrid(),
+        &b.heatGrid(), &b.frontierGrid()
+    };
+
+    for(int g=0; g < 5; ++g)
+    {
+        const FluidGrid& ga = *gridsA[g];
+        const FluidGrid& gb = *gridsB[g];
+        if(ga.components() != gb.components() || ga.area() != gb.area() ||
+           ga.precision() != gb.precision())
+            return false;
+        const void* dataA = ga.packed() ? (const void*) ga.packedPlane(0) : ga.plane(0);
+        const void* dataB = gb.packed() ? (const void*) gb.packedPlane(0) : gb.plane(0);
+        if(memcmp(dataA, dataB, ga.area() * ga.components() * ga.bytesPerComponent()) != 0)
+            return false;
+    }
+
+    return true;
+}
+
+void FluidBenchmark::pressureSolvers()
+{
+    const int SIZES[] = {256, 512, 1024};
+    const int JACOBI_ITERATIONS[] = {50, 100, 200, 400, 800};
+    const float MULTIGRID_TOLERANCES[] = {1e-1f, 1e-2f, 1e-3f, 1e-4f, 1e-5f};
+
+    _out << "pressure,size,solver,setting,iterations,time_ms,residual" << endl;
+
+    for(int size : SIZES)
+    {
+        FluidSolver base(size, size);
+        prepareProjection(base);
+
+        for(int iterations : JACOBI_ITERATIONS)
+        {
+            FluidSolver trial(base);
+            trial.setPressureSolver(FluidSolver::EPressureSolver::JACOBI);
+            trial.setPressureCriterion(ConvergenceCriterion(iterations));
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            trial.computePressure();
+            double time = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count();
+
+            _out << "pressure," << size << ",jacobi," << iterations << ","
+                 << iterations << "," << time << ","
+                 << trial.pressureResidual() << endl;
+        }
+
+        FluidMultigrid::ECycle cycles[] = {
+            FluidMultigrid::ECycle::V,
+            FluidMultigrid::ECycle::W
+        };
+        for(FluidMultigrid::ECycle cycle : cycles)
+        {
+            const char* name = cycle == FluidMultigrid::ECycle::V ?
+                        "multigrid-v" : "multigrid-w";
+
+            for(float tolerance : MULTIGRID_TOLERANCES)
+            {
+                FluidSolver trial(base);
+                trial.setPressureSolver(FluidSolver::EPressureSolver::MULTIGRID);
+                trial.setPressureTolerance(tolerance);
+                trial.multigrid().setCycle(cycle);
+
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                trial.computePressure();
+                double time = chrono::duration<double, milli>(
+                    chrono::steady_clock::now() - start).count();
+
+                _out << "pressure," << size << "," << name << ","
+                     << tolerance << "," << trial.multigrid().cycleCount() << ","
+                     << time << "," << trial.pressureResidual() << endl;
+            }
+        }
+    }
+}
+
+void FluidBenchmark::gridScaling()
+{
+    const int SIZES[][2] = {
+        {64, 64}, {128, 128}, {256, 256}, {512, 512}, {1024, 1024},
+        {2048, 2048}, {384, 200}, {1000, 600}
+    };
+
+    // Roughly the same number of updated cells for every size
+    const long long CELL_BUDGET = 1 << 22;
+    const int MAX_STEPS = 50;
+
+    _out << "scaling,width,height,steps,ms_per_step,mcells_per_s" << endl;
+
+    FluidInitializer initializer;
+    for(const int* size : SIZES)
+    {
+        FluidSolver solver(size[0], size[1]);
+        solver.reset(initializer);
+
+        long long area = (long long) size[0] * size[1];
+        int nbSteps = (int) min((long long) MAX_STEPS,
+                                max(1LL, CELL_BUDGET / area));
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int s=0; s < nbSteps; ++s)
+            solver.step();
+        double time = chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+
+        _out << "scaling," << size[0] << "," << size[1] << ","
+             << nbSteps << "," << time * 1000.0 / nbSteps << ","
+             << area * nbSteps / time / 1e6 << endl;
+    }
+}
+
+void FluidBenchmark::stencilKernels()
+{
+    const int SIZES[] = {256, 1024, 2048};
+    const long long CELL_BUDGET = 1 << 28;
+
+    // Streamed floats per cell, neighbors are assumed to hit the cache
+    const int JACOBI_FLOATS = 3;
+    const int DIVERGENCE_FLOATS = 3;
+    const int GRADSUB_FLOATS = 5;
+    const int MAXSPEED_FLOATS = 2;
+
+    _out << "kernels,size,isa,kernel,repetitions,mcells_per_s,gb_per_s,bitexact"
+         << endl;
+
+    vector<FluidKernels> sets = FluidKernels::available();
+    const FluidKernels& reference = FluidKernels::scalar();
+
+    for(int size : SIZES)
+    {
+        FluidSolver solver(size, size);
+        prepareProjection(solver);
+
+        const int area = size * size;
+        const float* u = solver.velocityGrid().plane(0);
+        const float* v = solver.velocityGrid().plane(1);
+        const float* p = solver.heatGrid().plane(0);
+        const int repetitions = (int) max(1LL, CELL_BUDGET / area);
+        const FluidTile grid(0, 0, size, size);
+
+        vector<float> a(area), b(area), c(area), d(area);
+        vector<float> refA(area), refB(area), refC(area);
+
+        // Scalar results every set is compared against
+        reference.jacobi(p, u, refA.data(), size, size, grid, -1.0f, 0.25f);
+        reference.divergence(u, v, refB.data(), size, size, grid, 0.5f);
+        refC.assign(u, u + area);
+        vector<float> refV(v, v + area);
+        reference.gradSub(p, refC.data(), refV.data(), size, size, grid, 0.5f);
+        const float refSpeed = reference.maxSpeed2(u, v, size, grid);
+
+        for(const FluidKernels& kernels : sets)
+        {
+            const char* isa = FluidKernels::isaName(kernels.isa);
+
+            for(int k=0; k<4; ++k)
+            {
+                const char* name = nullptr;
+                int floats = 0;
+                bool exact = false;
+                float speed = 0.0f;
+
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                if(k == 0)
+                {
+                    name = "jacobi";
+                    floats = JACOBI_FLOATS;
+                    for(int r=0; r < repetitions; ++r)
+                        kernels.jacobi(p, u, a.data(), size, size, grid, -1.0f, 0.25f);
+                }
+                else if(k == 1)
+                {
+                    name = "divergence";
+                    floats = DIVERGENCE_FLOATS;
+                    for(int r=0; r < repetitions; ++r)
+                        kernels.divergence(u, v, a.data(), size, size, grid, 0.5f);
+                }
+                else if(k == 3)
+                {
+                    name = "maxSpeed2";
+                    floats = MAXSPEED_FLOATS;
+                    for(int r=0; r < repetitions; ++r)
+                        speed = max(speed, kernels.maxSpeed2(u, v, size, grid));
+                }
+                else
+                {
+                    // Alternating signs keeps the fields bounded
+                    name = "gradSub";
+                    floats = GRADSUB_FLOATS;
+                    b.assign(u, u + area);
+                    c.assign(v, v + area);
+                    for(int r=0; r < repetitions; ++r)
+                        kernels.gradSub(p, b.data(), c.data(), size, size, grid,
+                                        r % 2 ? -0.5f : 0.5f);
+                }
+                double time = chrono::duration<double>(
+                    chrono::steady_clock::now() - start).count();
+
+                if(k == 0)
+                {
+                    kernels.jacobi(p, u, a.data(), size, size, grid, -1.0f, 0.25f);
+                    exact = memcmp(a.data(), refA.data(), area*sizeof(float)) == 0;
+                }
+                else if(k == 1)
+                {
+                    exact = memcmp(a.data(), refB.data(), area*sizeof(float)) == 0;
+                }
+                else if(k == 3)
+                {
+                    exact = speed == refSpeed;
+                }
+                else
+                {
+                    b.assign(u, u + area);
+                    d.assign(v, v + area);
+                    kernels.gradSub(p, b.data(), d.data(), size, size, grid, 0.5f);
+                    exact = memcmp(b.data(), refC.data(), area*sizeof(float)) == 0 &&
+                            memcmp(d.data(), refV.data(), area*sizeof(float)) == 0;
+                }
+
+                double cells = (double) area * repetitions;
+                _out << "kernels," << size << "," << isa << "," << name << ","
+                     << repetitions << "," << cells / time / 1e6 << ","
+                     << cells * floats * sizeof(float) / time / 1e9 << ","
+                     << (exact ? "yes" : "NO") << endl;
+            }
+        }
+    }
+}
+
+void FluidBenchmark::fieldLayouts()
+{
+    const int SIZES[] = {256, 512, 1024};
+    const int NB_STEPS = 10;
+
+    _out << "layout,size,layout,cpu_bytes_per_cell,gl_bytes_per_cell,ms_per_step"
+         << endl;
+
+    FluidInitializer initializer;
+    for(int size : SIZES)
+    {
+        const char* names[] = {"rgba32f", "packed", "packed-half-dye"};
+        FluidFieldLayout layouts[] = {
+            FluidFieldLayout::rgba32f(),
+            FluidFieldLayout(false),
+            FluidFieldLayout(true)
+        };
+
+        for(int l=0; l<3; ++l)
+        {
+            FluidSolver solver(size, size, layouts[l]);
+            solver.reset(initializer);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int s=0; s < NB_STEPS; ++s)
+                solver.step();
+            double time = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count();
+
+            _out << "layout," << size << "," << names[l] << ","
+                 << solver.bytesPerCell() << ","
+                 << layouts[l].bytesPerCell() << ","
+                 << time / NB_STEPS << endl;
+        }
+    }
+}
+
+void FluidBenchmark::threadScaling()
+{
+    const int SIZES[] = {512, 1024};
+    const int NB_STEPS = 5;
+    const int maxThreads = max(1, (int) thread::hardware_concurrency());
+
+    vector<int> threadCounts;
+    for(int t=1; t < maxThreads; t *= 2)
+        threadCounts.push_back(t);
+    threadCounts.push_back(maxThreads);
+
+    _out << "threads,size,threads,ms_per_step,speedup,same_result" << endl;
+
+    FluidInitializer initializer;
+    for(int size : SIZES)
+    {
+        double serialTime = 0.0;
+        vector<float> serialVelocity;
+
+        for(int threads : threadCounts)
+        {
+            FluidSolver solver(size, size);
+            solver.setThreadCount(threads);
+            solver.reset(initializer);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int s=0; s < NB_STEPS; ++s)
+                solver.step();
+            double time = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count() / NB_STEPS;
+
+            vector<float> velocity;
+            solver.velocityGrid().interleave(velocity);
+            if(threads == 1)
+            {
+                serialTime = time;
+                serialVelocity = velocity;
+            }
+
+            _out << "threads," << size << "," << threads << "," << time << ","
+                 << serialTime / time << ","
+                 << (velocity == serialVelocity ? "yes" : "NO") << endl;
+        }
+    }
+}
+
+void FluidBenchmark::jacobiBlocking()
+{
+    const int SIZES[] = {512, 1024, 2048};
+    const int DEPTHS[] = {1, 2, 4, 8, 16, 32};
+    const int ITERATIONS = 192;
+
+    _out << "blocking,size,depth,time_ms,traffic_gb,bytes_per_cell_iteration,"
+            "gb_per_s,speedup,same_result" << endl;
+
+    for(int size : SIZES)
+    {
+        FluidSolver base(size, size);
+        prepareProjection(base);
+
+        double plainTime = 0.0;
+        vector<float> plainPressure;
+
+        for(int depth : DEPTHS)
+        {
+            FluidSolver trial(base);
+            trial.setPressureCriterion(ConvergenceCriterion(ITERATIONS));
+            trial.setJacobiBlocking(depth);
+            trial.resetJacobiTraffic();
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            trial.computePressure();
+            double time = chrono::duration<double>(
+                chrono::steady_clock::now() - start).count();
+
+            vector<float> pressure;
+            trial.pressureGrid().interleave(pressure);
+            if(depth == 1)
+            {
+                plainTime = time;
+                plainPressure = pressure;
+            }
+
+            double traffic = (double) trial.jacobiTraffic();
+            _out << "blocking," << size << "," << depth << ","
+                 << time * 1000.0 << "," << traffic / 1e9 << ","
+                 << traffic / ((double) size * size * ITERATIONS) << ","
+                 << traffic / time / 1e9 << "," << plainTime / time << ","
+                 << (pressure == plainPressure ? "yes" : "NO") << endl;
+        }
+    }
+}
+
+void FluidBenchmark::fusedAdvection()
+{
+    const int SIZES[] = {256, 512, 1024, 2048};
+    const int REPETITIONS = 10;
+
+    _out << "advection,size,mode,ms_per_advect,mcells_per_s,speedup,same_result"
+         << endl;
+
+    FluidInitializer initializer;
+    for(int size : SIZES)
+    {
+        FluidSolver base(size, size);
+        base.reset(initializer);
+        base.step();
+
+        double separateTime = 0.0;
+        vector<float> separateFields;
+
+        for(bool fused : {false, true})
+        {
+            FluidSolver trial(base);
+            trial.setFusedAdvection(fused);
+
+            // Even repetitions leave the same grids in FETCH
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int r=0; r < REPETITIONS; ++r)
+                trial.advect();
+            double time = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count() / REPETITIONS;
+
+            vector<float> fields, field;
+            const FluidGrid* grids[] = {
+                &trial.dyeGrid(), &trial.heatGrid(), &trial.velocityGrid()
+            };
+            for(const FluidGrid* grid : grids)
+            {
+                grid->interleave(field);
+                fields.insert(fields.end(), field.begin(), field.end());
+            }
+
+            if(!fused)
+            {
+                separateTime = time;
+                separateFields = fields;
+            }
+
+            _out << "advection," << size << "," << (fused ? "fused" : "separate")
+                 << "," << time << "," << (double) size * size / time / 1e3
+                 << "," << separateTime / time << ","
+                 << (fields == separateFields ? "yes" : "NO") << endl;
+        }
+    }
+}
+
+void FluidBenchmark::fusedProjection()
+{
+    const int SIZES[] = {256, 512, 1024, 2048};
+    const int NB_STEPS = 4;
+
+    _out << "projection,size,mode,ms_per_step,ms_stages,speedup_stages,same_result"
+         << endl;
+
+    FluidInitializer initializer;
+    for(int size : SIZES)
+    {
+        double separateStages = 0.0;
+        vector<float> separateFields;
+
+        for(bool fused : {false, true})
+        {
+            FluidSolver solver(size, size);
+            solver.setFusedProjection(fused);
+            solver.reset(initializer);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int s=0; s < NB_STEPS; ++s)
+                solver.step();
+            double stepTime = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count() / NB_STEPS;
+
+            // Every field after the full steps, fused must match bit for bit
+            vector<float> fields, field;
+            const FluidGrid* grids[] = {
+                &solver.dyeGrid(), &solver.heatGrid(),
+                &solver.velocityGrid(), &solver.pressureGrid()
+            };
+            for(const FluidGrid* grid : grids)
+            {
+                grid->interleave(field);
+                fields.insert(fields.end(), field.begin(), field.end());
+            }
+
+            // Stages alone, without the pressure solve in between
+            solver.setPressureCriterion(ConvergenceCriterion(0));
+            start = chrono::steady_clock::now();
+            for(int s=0; s < NB_STEPS; ++s)
+            {
+                if(fused)
+                {
+                    solver.heatDivergence();
+                    solver.substractGradientFrontier();
+                }
+                else
+                {
+                    solver.heat();
+                    solver.computePressure();
+                    solver.substractPressureGradient();
+                    solver.frontier();
+                }
+            }
+            double stageTime = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count() / NB_STEPS;
+
+            if(!fused)
+            {
+                separateStages = stageTime;
+                separateFields = fields;
+            }
+
+            _out << "projection," << size << "," << (fused ? "fused" : "separate")
+                 << "," << stepTime << "," << stageTime << ","
+                 << separateStages / stageTime << ","
+                 << (fields == separateFields ? "yes" : "NO") << endl;
+        }
+    }
+}
+
+void FluidBenchmark::snapshotRestart()
+{
+    // The forced run checks the time and the scene's clock survive a restart
+    const struct {const char* name; int size; int steps; bool forced;} RUNS[] = {
+        {"fixed",  256,  5,  false},
+        {"fixed",  1024, 5,  false},
+        {"forced", 256,  20, true}
+    };
+    const char* SCENE =
+        "emitter circle=0.5,0.2,0.05 dye=0.2,0.4,1 period=7\n"
+        "force box=0.3,0.4,0.7,0.5 acceleration=0,3 start=3 stop=25\n";
+    const float CFL = 0.5f;
+    const string FILE_NAME = "fluid2d_benchmark.snap";
+
+    FluidScene scene;
+    stringstream sceneFile(SCENE);
+    string error;
+    if(!scene.parse(sceneFile, error))
+    {
+        _out << "snapshot,error," << error << endl;
+        return;
+    }
+
+    _out << "snapshot,case,size,file_mb,save_ms,map_ms,map_verify_ms,restore_ms,"
+            "same_result" << endl;
+
+    FluidInitializer initializer;
+    for(const auto& run : RUNS)
+    {
+        const int size = run.size;
+        auto configure = [&](FluidSolver& s)
+        {
+            if(!run.forced)
+                return;
+            s.setScene(scene);
+            s.setAdaptiveTimestep(true, CFL);
+        };
+
+        FluidSolver original(size, size);
+        configure(original);
+        original.reset(initializer);
+        original.setCandlePosition(cellar::Vec2f(size * 0.5f, size * 0.1f));
+        for(int s=0; s < run.steps; ++s)
+            original.step();
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if(!original.saveSnapshot(FILE_NAME, error))
+        {
+            _out << "snapshot," << run.name << "," << size
+                 << ",error : " << error << endl;
+            return;
+        }
+        double saveTime = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+
+        FluidSnapshot snapshot;
+        start = chrono::steady_clock::now();
+        snapshot.open(FILE_NAME, false);
+        double mapTime = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+
+        start = chrono::steady_clock::now();
+        snapshot.open(FILE_NAME, true);
+        double verifyTime = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+
+        // The restarted solver never sees the initializer
+        FluidSolver restarted(size, size);
+        configure(restarted);
+        start = chrono::steady_clock::now();
+        bool loaded = restarted.loadSnapshot(snapshot, error);
+        double restoreTime = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+
+        long long forcedOriginal = 0;
+        long long forcedRestarted = 0;
+        for(int s=0; s < run.steps; ++s)
+        {
+            original.step();
+            restarted.step();
+            forcedOriginal += original.forcedCells();
+            forcedRestarted += restarted.forcedCells();
+        }
+
+        _out << "snapshot," << run.name << "," << size << ","
+             << snapshot.fileSize() / (1024.0 * 1024.0) << ","
+             << saveTime << "," << mapTime << "," << verifyTime << ","
+             << restoreTime << ","
+             << (loaded && sameState(original, restarted) &&
+                 original.stepCount() == restarted.stepCount() &&
+                 original.time() == restarted.time() &&
+                 forcedOriginal == forcedRestarted ? "yes" : "NO")
+             << endl;
+
+        snapshot.close();
+        remove(FILE_NAME.c_str());
+    }
+}
+
+void FluidBenchmark::fieldExport()
+{
+    typedef FluidFieldLayout::EField EField;
+    typedef FluidExporter::EEncoding EEncoding;
+
+    const int SIZE = 512;
+    const int NB_STEPS = 30;
+    const float QUANTIZATION_STEP = 1.0f / 4096.0f;
+    const string FILE_NAME = "fluid2d_benchmark.export";
+    const vector<EField> FIELDS = {EField::DYE, EField::VELOCITY, EField::HEAT};
+    const char* MODES[] = {"none", "raw", "delta"};
+
+    _out << "export,size,encoding,steps_per_s,slowdown,written,dropped,"
+            "failed,blocked_ms,max_queue,encode_ms,write_ms,compression,max_error,"
+            "decoded_ok" << endl;
+
+    FluidInitializer initializer;
+    double baseRate = 0.0;
+    for(int m=0; m < 3; ++m)
+    {
+        FluidSolver solver(SIZE, SIZE);
+        solver.reset(initializer);
+
+        FluidExporter exporter;
+        exporter.setQuantizationStep(QUANTIZATION_STEP);
+        exporter.setEncoding(m == 2 ? EEncoding::QUANTIZED_DELTA : EEncoding::RAW);
+        string error;
+        if(m > 0 && !exporter.open(FILE_NAME, SIZE, SIZE, FIELDS,
+                                   solver.layout(), error))
+        {
+            _out << "export," << SIZE << ",error : " << error << endl;
+            return;
+        }
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int s=0; s < NB_STEPS; ++s)
+        {
+            solver.step();
+            if(exporter.isOpen())
+                solver.exportFields(exporter);
+        }
+        double rate = NB_STEPS / chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+        if(m == 0)
+            baseRate = rate;
+
+        bool closed = exporter.close(error);
+        FluidExporter::Stats stats = exporter.stats();
+
+        // Decoded frames against the same run, replayed
+        double maxError = 0.0;
+        const double halfStep = m == 2 ? QUANTIZATION_STEP * 0.5 : 0.0;
+        bool withinBound = true;
+        bool complete = true;
+        if(m > 0)
+        {
+            FluidExportReader reader;
+            FluidSolver replay(SIZE, SIZE);
+            replay.reset(initializer);
+            const FluidGrid* grids[] = {
+                &replay.dyeGrid(), &replay.velocityGrid(), &replay.heatGrid()
+            };
+
+            unsigned long long step = 0;
+            vector<float> frame;
+            int frames = 0;
+            complete = reader.open(FILE_NAME);
+            while(complete && reader.next(step, frame))
+            {
+                while(replay.stepCount() < step)
+                    replay.step();
+
+                const float* data = frame.data();
+                for(const FluidGrid* grid : grids)
+                {
+                    for(int c=0; c < grid->components(); ++c, data += grid->area())
+                        for(int k=0; k < grid->area(); ++k)
+                        {
+                            // Half a step of rounding, plus the float product
+                            float ref = grid->plane(c)[k];
+                            double diff = fabs(data[k] - ref);
+                            maxError = max(maxError, diff);
+                            withinBound = withinBound &&
+                                diff <= halfStep + fabs(ref) * 2.4e-7;
+                        }
+                }
+                ++frames;
+            }
+            complete = complete && closed && reader.error().empty() &&
+                       frames == NB_STEPS;
+            remove(FILE_NAME.c_str());
+        }
+
+        const double written = max(stats.written, 1ULL);
+        _out << "export," << SIZE << "," << MODES[m] << ","
+             << rate << "," << baseRate / rate << ","
+             << stats.written << "," << stats.dropped << ","
+             << stats.failed << "," << stats.blockedMs << "," << stats.maxQueued << ","
+             << stats.encodeMs / written << "," << stats.writeMs / written << ","
+             << (double) stats.rawBytes / max(stats.fileBytes, 1ULL) << ","
+             << maxError << ","
+             << (m == 0 ? "-" : (complete && withinBound ? "yes" : "NO"))
+             << endl;
+    }
+}
+
+void FluidBenchmark::ensembleThroughput()
+{
+    const int SIZES[] = {32, 64, 128};
+    const int MEMBER_COUNTS[] = {4, 16, 64};
+    const long long CELL_BUDGET = 1 << 22;
+
+    _out << "ensemble,size,members,threads,steps,sequential_cells_per_s,"
+            "ensemble_cells_per_s,speedup,same_result" << endl;
+
+    for(int size : SIZES)
+    {
+        for(int memberCount : MEMBER_COUNTS)
+        {
+            // Viscosities differ so members are not copies of each other
+            vector<FluidEnsemble::Member> members(memberCount);
+            for(int m=0; m < memberCount; ++m)
+            {
+                members[m].width = size;
+                members[m].height = size;
+                members[m].physics.viscosity = 0.005f * (1 + m % 8);
+                members[m].obstacles = (FluidEnsemble::EObstacles) (m % 3);
+            }
+
+            FluidEnsemble ensemble;
+            ensemble.setMembers(members);
+            const int nbSteps = (int) max(2LL, CELL_BUDGET / ensemble.cellCount());
+
+            // One process per configuration, every thread on each member
+            FluidEnsemble sequential;
+            sequential.setMembers(members);
+            for(int m=0; m < memberCount; ++m)
+                sequential.solver(m).setThreadCount(0);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int m=0; m < memberCount; ++m)
+                for(int s=0; s < nbSteps; ++s)
+                    sequential.solver(m).step();
+            double sequentialTime = chrono::duration<double>(
+                chrono::steady_clock::now() - start).count();
+
+            start = chrono::steady_clock::now();
+            for(int s=0; s < nbSteps; ++s)
+                ensemble.step();
+            double ensembleTime = chrono::duration<double>(
+                chrono::steady_clock::now() - start).count();
+
+            bool same = true;
+            for(int m=0; m < memberCount; ++m)
+                same = same && sameState(sequential.solver(m), ensemble.solver(m));
+
+            double cells = (double) ensemble.cellCount() * nbSteps;
+            _out << "ensemble," << size << "," << memberCount << ","
+                 << sequential.solver(0).scheduler().threadCount() << ","
+                 << nbSteps << ","
+                 << cells / sequentialTime << "," << cells / ensembleTime << ","
+                 << sequentialTime / ensembleTime << ","
+                 << (same ? "yes" : "NO") << endl;
+        }
+    }
+}
+
+void FluidBenchmark::sparseTiles()
+{
+    const int SIZES[] = {256, 512};
+    const float THRESHOLDS[] = {1e-4f, 1e-3f};
+    const int NB_STEPS = 10;
+    const int TILE = 32;
+
+    CaveInitializer cave;
+    PlumeInitializer plume;
+    FluidInitializer fullScene;
+    struct {const char* name; FluidInitializer* initializer;} scenes[] = {
+        {"cave", &cave}, {"plume", &plume}, {"default", &fullScene}
+    };
+
+    _out << "sparse,scene,size,threshold,active_fraction,dense_steps_per_s,"
+            "sparse_steps_per_s,speedup,velocity_error,heat_error" << endl;
+
+    for(const auto& scene : scenes)
+    {
+        for(int size : SIZES)
+        {
+            // Same tiles for both so only the skipping differs
+            FluidSolver dense(size, size);
+            dense.scheduler().setTileSize(TILE, TILE);
+            dense.reset(*scene.initializer);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int s=0; s < NB_STEPS; ++s)
+                dense.step();
+            double denseTime = chrono::duration<double>(
+                chrono::steady_clock::now() - start).count();
+
+            for(float threshold : THRESHOLDS)
+            {
+                FluidSolver sparse(size, size);
+                sparse.scheduler().setTileSize(TILE, TILE);
+                sparse.setSparse(true, threshold);
+                sparse.reset(*scene.initializer);
+
+                double activeSum = 0.0;
+                start = chrono::steady_clock::now();
+                for(int s=0; s < NB_STEPS; ++s)
+                {
+                    sparse.step();
+                    activeSum += sparse.activeFraction();
+                }
+                double sparseTime = chrono::duration<double>(
+                    chrono::steady_clock::now() - start).count();
+
+                // Relative to the largest magnitude of the dense run
+                float velocityError = maxDifference(dense.velocityGrid(),
+                                                    sparse.velocityGrid()) /
+                                      max(maxMagnitude(dense.velocityGrid()), 1e-20f);
+                float heatError = maxDifference(dense.heatGrid(),
+                                                sparse.heatGrid()) /
+                                  max(maxMagnitude(dense.heatGrid()), 1e-20f);
+
+                _out << "sparse," << scene.name << "," << size << ","
+                     << threshold << "," << activeSum / NB_STEPS << ","
+                     << NB_STEPS / denseTime << "," << NB_STEPS / sparseTime << ","
+                     << denseTime / sparseTime << ","
+                     << velocityError << "," << heatError << endl;
+            }
+        }
+    }
+}
+
+void FluidBenchmark::boundaryIndex()
+{
+    const int SIZES[] = {256, 512, 1024, 2048};
+    const int NB_REPEATS = 20;
+    const int EDIT = 16;
+
+    _out << "boundary,scene,size,boundary_cells,buried_cells,fluid_cells,"
+            "build_ms,scan_ms,index_ms,speedup,edit_ms,same_result,same_index"
+         << endl;
+
+    CaveInitializer cave;
+    FluidInitializer fullScene;
+    struct {const char* name; FluidInitializer* initializer;} scenes[] = {
+        {"default", &fullScene}, {"cave", &cave}
+    };
+
+    for(const auto& scene : scenes)
+    {
+        for(int size : SIZES)
+        {
+            FluidSolver solver(size, size);
+            solver.setFusedProjection(false);
+            solver.reset(*scene.initializer);
+            solver.setPressureCriterion(ConvergenceCriterion(20));
+            solver.step();
+            solver.advect();
+            solver.diffuse();
+            solver.heat();
+            solver.computePressure();
+            solver.substractPressureGradient();
+
+            // Full grid pass the index replaces
+            FluidGrid velocity = solver.velocityGrid();
+            FluidGrid pressure = solver.pressureGrid();
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int r=0; r < NB_REPEATS; ++r)
+                scanFrontier(solver.frontierGrid(), solver.velocityGrid(),
+                             solver.pressureGrid(), velocity, pressure);
+            double scanTime = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count() / NB_REPEATS;
+
+            // The pass is idempotent, repeats leave the same state
+            start = chrono::steady_clock::now();
+            for(int r=0; r < NB_REPEATS; ++r)
+                solver.frontier();
+            double indexTime = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count() / NB_REPEATS;
+
+            bool sameResult = maxDifference(velocity, solver.velocityGrid()) == 0.0f &&
+                              maxDifference(pressure, solver.pressureGrid()) == 0.0f;
+
+            FluidBoundary rebuilt;
+            start = chrono::steady_clock::now();
+            rebuilt.build(solver.frontierGrid());
+            double buildTime = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count();
+
+            // Drops a block in the fluid then digs it out half way,
+            // only the index update is timed
+            FluidTile block(size/4, size/4, size/4 + EDIT, size/4 + EDIT);
+            FluidTile half(size/4 + EDIT/2, size/4, size/4 + EDIT, size/4 + EDIT);
+            FluidGrid frontier = solver.frontierGrid();
+            FluidBoundary edited = rebuilt;
+            for(int j=block.j0; j < block.j1; ++j)
+                for(int i=block.i0; i < block.i1; ++i)
+                    frontier.setTexel(i, j, cellar::Vec4f(1, 1, 1, 1));
+            start = chrono::steady_clock::now();
+            edited.update(frontier, block);
+            double editTime = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count();
+
+            rebuilt.build(frontier);
+            bool sameIndexes = sameIndex(edited, rebuilt);
+
+            solver.editFrontier(block, 1.0f);
+            solver.editFrontier(half, 0.0f);
+            rebuilt.build(solver.frontierGrid());
+            sameIndexes = sameIndexes && sameIndex(solver.boundary(), rebuilt);
+
+            const FluidBoundary& boundary = solver.boundary();
+            _out << "boundary," << scene.name << "," << size << ","
+                 << boundary.cells().size() << "," << boundary.buriedCount() << ","
+                 << boundary.fluidCount() << "," << buildTime << ","
+                 << scanTime << "," << indexTime << "," << scanTime / indexTime << ","
+                 << editTime << "," << (sameResult ? "yes" : "NO") << ","
+                 << (sameIndexes ? "yes" : "NO") << endl;
+        }
+    }
+}
+
+void FluidBenchmark::mixedPrecision()
+{
+    const int SIZES[] = {512, 1024};
+    const char* POLICIES[] = {"", "dye=fp16", "dye=fp16,heat=fp16",
+                              "dye=fp16,heat=bf16", "dye=bf16,heat=bf16"};
+    const int NB_STEPS = 10;
+
+    _out << "precision,size,policy,cpu_bytes_per_cell,ms_per_step,speedup,"
+            "jacobi_gb_per_step,dye_error,heat_error,velocity_error,"
+            "blocking_identical" << endl;
+
+    FluidInitializer initializer;
+    for(int size : SIZES)
+    {
+        unique_ptr<FluidSolver> reference;
+        double referenceTime = 0.0;
+
+        for(const char* policy : POLICIES)
+        {
+            FluidFieldLayout layout;
+            string error;
+            layout.setPrecisions(policy, error);
+
+            FluidSolver trial(size, size, layout);
+            trial.setCandlePosition(cellar::Vec2f(size * 0.5f, size * 0.1f));
+            trial.reset(initializer);
+            trial.resetJacobiTraffic();
+            // Packed fields must not depend on the blocking either
+            FluidSolver blocked(trial);
+            blocked.setJacobiBlocking(4);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int s=0; s < NB_STEPS; ++s)
+                trial.step();
+            double time = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count() / NB_STEPS;
+
+            for(int s=0; s < NB_STEPS; ++s)
+                blocked.step();
+            bool identical =
+                maxDifference(trial.dyeGrid(), blocked.dyeGrid()) == 0.0f &&
+                maxDifference(trial.heatGrid(), blocked.heatGrid()) == 0.0f &&
+                maxDifference(trial.velocityGrid(), blocked.velocityGrid()) == 0.0f;
+
+            if(*policy == '\0')
+            {
+                reference.reset(new FluidSolver(trial));
+                referenceTime = time;
+            }
+
+            // Relative to the largest magnitude of the float run
+            float errors[3] = {
+                maxDifference(reference->dyeGrid(), trial.dyeGrid()) /
+                    max(maxMagnitude(reference->dyeGrid()), 1e-20f),
+                maxDifference(reference->heatGrid(), trial.heatGrid()) /
+                    max(maxMagnitude(reference->heatGrid()), 1e-20f),
+                maxDifference(reference->velocityGrid(), trial.velocityGrid()) /
+                    max(maxMagnitude(reference->velocityGrid()), 1e-20f)
+            };
+
+            _out << "precision," << size << ","
+                 << (*policy == '\0' ? "fp32" : policy) << ","
+                 << trial.bytesPerCell() << "," << time << ","
+                 << referenceTime / time << ","
+                 << trial.jacobiTraffic() / 1e9 / NB_STEPS << ","
+                 << errors[0] << "," << errors[1] << "," << errors[2] << ","
+                 << (identical ? "yes" : "no") << endl;
+        }
+    }
+}
+
+void FluidBenchmark::advectionOrder()
+{
+    typedef FluidAdvection::EScheme EScheme;
+    typedef FluidAdvection::ELimiter ELimiter;
+    const int SIZES[] = {128, 256, 512};
+    const int NB_STEPS = 100;
+    // Domain fraction travelled per step, not a whole number of cells
+    const float U = 0.31f / 128;
+    const float V = 0.17f / 128;
+
+    struct {const char* name; EScheme scheme; ELimiter limiter; int scale;} runs[] = {
+        {"semi-lagrangian",   EScheme::SEMI_LAGRANGIAN, ELimiter::CLAMP,  1},
+        {"maccormack",        EScheme::MACCORMACK,      ELimiter::CLAMP,  1},
+        {"maccormack-revert", EScheme::MACCORMACK,      ELimiter::REVERT, 1},
+        {"bfecc",             EScheme::BFECC,           ELimiter::CLAMP,  1},
+        {"bfecc-revert",      EScheme::BFECC,           ELimiter::REVERT, 1},
+        {"semi-lagrangian-2x", EScheme::SEMI_LAGRANGIAN, ELimiter::CLAMP, 2}
+    };
+
+    _out << "order,size,scheme,cells,ms_per_advect,mean_error,variance_kept,"
+            "cost_vs_2x" << endl;
+
+    for(int size : SIZES)
+    {
+        struct Result {double time; double error; double variance;};
+        vector<Result> results;
+        for(const auto& run : runs)
+        {
+            const int n = size * run.scale;
+            TranslationInitializer initializer(U * n, V * n);
+            FluidSolver solver(n, n);
+            FluidAdvection advection(EScheme::SEMI_LAGRANGIAN, run.limiter);
+            advection.setScheme(FluidFieldLayout::EField::DYE, run.scheme);
+            solver.setAdvection(advection);
+            solver.reset(initializer);
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int s=0; s < NB_STEPS; ++s)
+                solver.advect();
+            double time = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count() / NB_STEPS;
+
+            // Against the shapes moved exactly, over the domain
+            const FluidGrid& dye = solver.dyeGrid();
+            double error = 0.0;
+            double sum[2] = {0.0, 0.0};
+            double squares[2] = {0.0, 0.0};
+            for(int j=0; j<n; ++j)
+            {
+                for(int i=0; i<n; ++i)
+                {
+                    float exact = TranslationInitializer::pattern(
+                        i / (float) n - U * NB_STEPS, j / (float) n - V * NB_STEPS);
+                    float value = dye.fetch(0, i, j);
+                    error += fabs(value - exact);
+                    sum[0] += exact;
+                    sum[1] += value;
+                    squares[0] += exact * exact;
+                    squares[1] += value * value;
+                }
+            }
+            double area = (double) n * n;
+            double variance[2];
+            for(int k=0; k<2; ++k)
+                variance[k] = squares[k] / area - (sum[k] / area) * (sum[k] / area);
+
+            results.push_back(Result{time, error / area, variance[1] / variance[0]});
+        }
+
+        // The fine run comes last
+        for(size_t r=0; r < results.size(); ++r)
+        {
+            int n = size * runs[r].scale;
+            _out << "order," << size << "," << runs[r].name << "," << n * n << ","
+                 << results[r].time << "," << results[r].error << ","
+                 << results[r].variance << ","
+                 << results[r].time / results.back().time << endl;
+        }
+    }
+}
+
+void FluidBenchmark::conjugateGradient()
+{
+    typedef FluidSolver::EPressureSolver EPressureSolver;
+    typedef FluidConjugateGradient::EPreconditioner EPreconditioner;
+    const int SIZES[] = {256, 512, 1024};
+    const float TOLERANCE = 1e-6f;
+
+    struct Trial
+    {
+        const char* name;
+        EPressureSolver solver;
+        EPreconditioner preconditioner;
+        int jacobiIterations;
+    };
+    const Trial TRIALS[] = {
+        {"jacobi-200",  EPressureSolver::JACOBI,    EPreconditioner::NONE, 200},
+        {"jacobi-2000", EPressureSolver::JACOBI,    EPreconditioner::NONE, 2000},
+        {"multigrid-v", EPressureSolver::MULTIGRID, EPreconditioner::NONE, 0},
+        {"cg",    EPressureSolver::CONJUGATE_GRADIENT, EPreconditioner::NONE, 0},
+        {"cg-ic", EPressureSolver::CONJUGATE_GRADIENT,
+                  EPreconditioner::INCOMPLETE_CHOLESKY, 0},
+        {"cg-mg", EPressureSolver::CONJUGATE_GRADIENT, EPreconditioner::MULTIGRID, 0}
+    };
+
+    // Tile sums are reduced in order, so one thread must give the same field
+    _out << "cg,size,solver,iterations,time_ms,residual,thread_independent" << endl;
+
+    for(int size : SIZES)
+    {
+        FluidSolver base(size, size);
+        prepareProjection(base);
+
+        for(const Trial& t : TRIALS)
+        {
+            auto configure = [&](FluidSolver& trial)
+            {
+                trial.setPressureSolver(t.solver);
+                trial.setPressureTolerance(TOLERANCE);
+                trial.setPressureCriterion(ConvergenceCriterion(t.jacobiIterations));
+                trial.conjugateGradient().setPreconditioner(t.preconditioner);
+            };
+
+            FluidSolver trial(base);
+            configure(trial);
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            trial.computePressure();
+            double time = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count();
+
+            FluidSolver single(base);
+            single.setThreadCount(1);
+            configure(single);
+            single.computePressure();
+
+            _out << "cg," << size << "," << t.name << ","
+                 << trial.pressureStats().iterations << "," << time << ","
+                 << trial.pressureResidual() << ","
+                 << (sameState(trial, single) ? "yes" : "no") << endl;
+        }
+    }
+
+    // A ring walls the fluid into two regions, b having a different mean
+    // on each, which only has a solution region by region. Without one
+    // the residual stays above 1, single precision stalls far below.
+    const int SIZE = 256;
+    const float SOLVED = 1e-2f;
+    FluidGrid frontier(SIZE, SIZE, 1);
+    vector<float> b(SIZE * SIZE);
+    for(int j=0; j<SIZE; ++j)
+    {
+        for(int i=0; i<SIZE; ++i)
+        {
+            float r = hypot(i - SIZE * 0.5f, j - SIZE * 0.5f);
+            bool wall = r >= SIZE * 0.25f && r < SIZE * 0.25f + 3.0f;
+            frontier.setTexel(i, j, cellar::Vec4f(wall ? 1.0f : 0.0f, 0, 0, 0));
+            b[j*SIZE + i] = sin(i * 0.1f) * cos(j * 0.07f) +
+                            (r < SIZE * 0.25f ? 0.5f : 0.0f);
+        }
+    }
+
+    FluidScheduler scheduler;
+    FluidMultigrid multigrid;
+    multigrid.setup(frontier);
+    FluidConjugateGradient cg;
+    cg.setup(frontier);
+
+    _out << "cg-walled,size,solver,iterations,residual,solved" << endl;
+    vector<float> x(b.size(), 0.0f);
+    int cycles = multigrid.solve(x, b, TOLERANCE, 30);
+    _out << "cg-walled," << SIZE << ",multigrid-v," << cycles << ","
+         << multigrid.residual() << ","
+         << (multigrid.residual() <= SOLVED ? "yes" : "no") << endl;
+
+    for(const Trial& t : TRIALS)
+    {
+        if(t.solver != EPressureSolver::CONJUGATE_GRADIENT)
+            continue;
+        x.assign(b.size(), 0.0f);
+        cg.setPreconditioner(t.preconditioner);
+        int iterations = cg.solve(scheduler, x, b, TOLERANCE, 4 * SIZE, &multigrid);
+        _out << "cg-walled," << SIZE << "," << t.name << "," << iterations << ","
+             << cg.residual() << ","
+             << (cg.residual() <= SOLVED ? "yes" : "no") << endl;
+    }
+}
+
+void FluidBenchmark::startupTime()
+{
+    typedef FluidFieldLayout::EField EField;
+    const int SIZES[] = {512, 1024, 2048};
+    const int NB_RUNS = 3;
+    const FluidFieldLayout LAYOUT;
+    const EField FIELDS[] = {EField::DYE, EField::VELOCITY, EField::PRESSURE,
+                             EField::HEAT, EField::FRONTIER};
+
+    FluidInitializer initializer;
+    FluidScheduler scheduler;
+    vector<float> texels;
+
+    _out << "startup,size,threads,serial_ms,pooled_ms,speedup,"
+            "solver_reset_ms,identical" << endl;
+
+    for(int size : SIZES)
+    {
+        // As enterStage() did : fresh images filled by one thread
+        vector<FluidGrid> serial;
+        double serialTime = 0.0;
+        for(int r=0; r < NB_RUNS; ++r)
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            serial.clear();
+            for(EField field : FIELDS)
+                serial.push_back(FluidGrid(size, size, LAYOUT.components(field)));
+            for(int j=0; j<size; ++j)
+            {
+                for(int i=0; i<size; ++i)
+                {
+                    float s = i/(float)size;
+                    float t = j/(float)size;
+                    serial[0].setTexel(i, j, initializer.initDye(s, t));
+                    serial[1].setTexel(i, j, initializer.initVelocity(s, t));
+                    serial[2].setTexel(i, j, initializer.initPressure(s, t));
+                    serial[3].setTexel(i, j, initializer.initHeat(s, t));
+                    serial[4].setTexel(i, j, initializer.initFrontier(s, t));
+                }
+            }
+            for(const FluidGrid& grid : serial)
+            {
+                vector<float> staging;
+                grid.interleave(staging);
+            }
+            serialTime += chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count();
+        }
+
+        // Staging grids and buffer kept from one restart to the next
+        vector<FluidGrid> pooled;
+        for(EField field : FIELDS)
+            pooled.push_back(FluidGrid(size, size, LAYOUT.components(field)));
+        double pooledTime = 0.0;
+        for(int r=0; r < NB_RUNS; ++r)
+        {
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            initializer.generate(scheduler, &pooled[0], &pooled[1],
+                                 &pooled[2], &pooled[3], &pooled[4]);
+            for(const FluidGrid& grid : pooled)
+                grid.interleave(texels);
+            pooledTime += chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count();
+        }
+
+        bool identical = true;
+        for(size_t g=0; g < pooled.size(); ++g)
+            identical = identical && maxDifference(serial[g], pooled[g]) == 0.0f;
+
+        FluidSolver solver(size, size);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int r=0; r < NB_RUNS; ++r)
+            solver.reset(initializer);
+        double resetTime = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+
+        _out << "startup," << size << "," << scheduler.threadCount() << ","
+             << serialTime / NB_RUNS << "," << pooledTime / NB_RUNS << ","
+             << serialTime / pooledTime << "," << resetTime / NB_RUNS << ","
+             << (identical ? "yes" : "no") << endl;
+    }
+}
+
+void FluidBenchmark::sceneForcing()
+{
+    const int SIZES[] = {512, 1024, 2048};
+    const int NB_STEPS = 20;
+    const char* SCENE =
+        "base empty\n"
+        "obstacle circle=0.5,0.5,0.1\n"
+        "obstacle box=0.2,0.7,0.8,0.72\n"
+        "source circle=0.5,0.08,0.03 dye=1,0.6,0.2 heat=2 velocity=0,1\n"
+        "source box=0.05,0.3,0.08,0.34 velocity=1,0\n"
+        "emitter circle=0.8,0.2,0.02 dye=0.2,0.4,1 period=10\n"
+        "emitter box=0.3,0.85,0.32,0.9 heat=-1 start=2\n"
+        "force circle=0.3,0.4,0.05 acceleration=0,-3 stop=15\n"
+        "force box=0.6,0.3,0.7,0.35 acceleration=-2,1 period=8\n";
+
+    FluidScene scene;
+    stringstream file(SCENE);
+    string error;
+    if(!scene.parse(file, error))
+    {
+        _out << "scene,error," << error << endl;
+        return;
+    }
+
+    FluidScheduler scheduler;
+    _out << "scene,size,threads,rasterize_ms,forced_cells,forced_fraction,"
+            "span_ms,full_grid_ms,speedup,identical" << endl;
+
+    for(int size : SIZES)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        scene.rasterize(scheduler, size, size);
+        double rasterizeTime = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+
+        FluidSolver solver(size, size);
+        solver.reset(scene);
+        FluidGrid dye[2]      = {solver.dyeGrid(),      solver.dyeGrid()};
+        FluidGrid velocity[2] = {solver.velocityGrid(), solver.velocityGrid()};
+        FluidGrid heat[2]     = {solver.heatGrid(),     solver.heatGrid()};
+        const FluidGrid& frontier = solver.frontierGrid();
+
+        long long forcedCells = 0;
+        double spanTime = 0.0;
+        start = chrono::steady_clock::now();
+        for(int s=0; s < NB_STEPS; ++s)
+            forcedCells += scene.force(scheduler, s, 0.1f,
+                                       dye[0], velocity[0], heat[0], frontier);
+        spanTime = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+
+        // Every cell tested against every active region, as the init
+        // functions would
+        const vector<FluidScene::Region>& regions = scene.regions();
+        start = chrono::steady_clock::now();
+        for(int s=0; s < NB_STEPS; ++s)
+        {
+            scheduler.forEachTile(size, size, [&](const FluidTile& tile, int)
+            {
+                for(int j=tile.j0; j < tile.j1; ++j)
+                {
+                    for(int i=tile.i0; i < tile.i1; ++i)
+                    {
+                        int k = j*size + i;
+                        if(frontier.load(0, k) == 1.0f)
+                            continue;
+                        for(const FluidScene::Region& region : regions)
+                        {
+                            if(!FluidScene::active(region, s) ||
+                               !region.covers(i/(float)size, j/(float)size))
+                                continue;
+                            bool hold = region.kind == FluidScene::EKind::SOURCE;
+                            float a = FluidScene::amplitude(region, s) *
+                                      (hold ? 1.0f : 0.1f);
+                            if(region.hasDye)
+                                for(int c=0; c < dye[1].components(); ++c)
+                                    dye[1].store(c, k, a * region.dye[c] +
+                                        (hold ? 0.0f : dye[1].load(c, k)));
+                            if(region.hasHeat)
+                                heat[1].store(0, k, a * region.heat +
+                                    (hold ? 0.0f : heat[1].load(0, k)));
+                            if(region.hasVelocity)
+                                for(int c=0; c < 2; ++c)
+                                    velocity[1].store(c, k, a * region.velocity[c] +
+                                        (hold ? 0.0f : velocity[1].load(c, k)));
+                        }
+                    }
+                }
+            });
+        }
+        double fullTime = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+
+        bool identical = maxDifference(dye[0], dye[1]) == 0.0f &&
+                         maxDifference(velocity[0], velocity[1]) == 0.0f &&
+                         maxDifference(heat[0], heat[1]) == 0.0f;
+
+        _out << "scene," << size << "," << scheduler.threadCount() << ","
+             << rasterizeTime << "," << forcedCells / NB_STEPS << ","
+             << forcedCells / (double) NB_STEPS / (size * size) << ","
+             << spanTime / NB_STEPS << "," << fullTime / NB_STEPS << ","
+             << fullTime / spanTime << "," << (identical ? "yes" : "no") << endl;
+    }
+}
+
+void FluidBenchmark::vorticityConfinement()
+{
+    const int DISPLAY = 256;
+    const int NB_STEPS = 150;
+    typedef FluidAdvection::EScheme EScheme;
+    struct {int size; float strength; EScheme dye;} runs[] = {
+        {256, 0.0f, EScheme::SEMI_LAGRANGIAN}, {256, 0.02f, EScheme::SEMI_LAGRANGIAN},
+        {256, 0.04f, EScheme::SEMI_LAGRANGIAN}, {256, 0.06f, EScheme::SEMI_LAGRANGIAN},
+        {256, 0.0f, EScheme::BFECC}, {256, 0.06f, EScheme::BFECC},
+        {512, 0.0f, EScheme::SEMI_LAGRANGIAN}, {1024, 0.0f, EScheme::SEMI_LAGRANGIAN}
+    };
+
+    // Every run simulates the same domain, compared once brought back
+    // to 256x256 : mean squared curl for the swirls, mean dye gradient
+    // for the visible detail. The largest grid comes last as reference.
+    _out << "vorticity,size,strength,dye_scheme,ms_per_step,vorticity_ms,"
+            "enstrophy,dye_detail,enstrophy_vs_ref,detail_vs_ref,"
+            "velocity_error_vs_ref,cost_vs_ref" << endl;
+
+    struct Result {double time; double stage; double enstrophy; double detail;
+                   vector<float> velocity;};
+    vector<Result> results;
+    for(const auto& run : runs)
+    {
+        FluidSolver::Physics physics;
+        physics.dx = DISPLAY / (float) run.size;
+        FluidSolver solver(run.size, run.size, FluidFieldLayout(), physics);
+        solver.setPressureSolver(FluidSolver::EPressureSolver::MULTIGRID);
+        solver.setVorticityConfinement(run.strength);
+        FluidAdvection advection;
+        advection.setScheme(FluidFieldLayout::EField::DYE, run.dye);
+        solver.setAdvection(advection);
+        solver.setCandlePosition(cellar::Vec2f(-1e4f, -1e4f));
+        VortexInitializer initializer;
+        solver.reset(initializer);
+
+        FluidProfiler profiler;
+        solver.setProfiler(&profiler);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int s=0; s < NB_STEPS; ++s)
+        {
+            profiler.beginFrame();
+            solver.step();
+            profiler.endFrame();
+        }
+        double time = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count() / NB_STEPS;
+        double stage = max(0.0, profiler.average(FluidProfiler::EStage::VORTICITY));
+
+        vector<float> velocity;
+        vector<float> dye;
+        coarsen(solver.velocityGrid(), 2, DISPLAY, velocity);
+        coarsen(solver.dyeGrid(), 1, DISPLAY, dye);
+        const float* u = &velocity[0];
+        const float* v = &velocity[DISPLAY * DISPLAY];
+        double enstrophy = 0.0;
+        double detail = 0.0;
+        for(int j=1; j < DISPLAY-1; ++j)
+        {
+            for(int i=1; i < DISPLAY-1; ++i)
+            {
+                int k = j*DISPLAY + i;
+                double curl = 0.5 * ((v[k+1] - v[k-1]) - (u[k+DISPLAY] - u[k-DISPLAY]));
+                double gx = 0.5 * (dye[k+1] - dye[k-1]);
+                double gy = 0.5 * (dye[k+DISPLAY] - dye[k-DISPLAY]);
+                enstrophy += curl * curl;
+                detail += sqrt(gx*gx + gy*gy);
+            }
+        }
+        double area = (double) (DISPLAY-2) * (DISPLAY-2);
+        results.push_back(Result{time, stage, enstrophy / area, detail / area,
+                                 velocity});
+    }
+
+    const Result& ref = results.back();
+    for(size_t r=0; r < results.size(); ++r)
+    {
+        // Relative L2 distance of the coarse flows
+        double error = 0.0;
+        double norm = 0.0;
+        for(size_t k=0; k < ref.velocity.size(); ++k)
+        {
+            double d = results[r].velocity[k] - ref.velocity[k];
+            error += d * d;
+            norm += ref.velocity[k] * ref.velocity[k];
+        }
+
+        _out << "vorticity," << runs[r].size << "," << runs[r].strength << ","
+             << FluidAdvection::schemeName(runs[r].dye) << ","
+             << results[r].time << "," << results[r].stage << ","
+             << results[r].enstrophy << "," << results[r].detail << ","
+             << results[r].enstrophy / ref.enstrophy << ","
+             << results[r].detail / ref.detail << ","
+             << sqrt(error / norm) << ","
+             << results[r].time / ref.time << endl;
+    }
+}
+
+void FluidBenchmark::adaptiveTimestep()
+{
+    // Reduction cost against the step's, measured after every step
+    const int SIZES[] = {256, 512, 1024};
+    const int NB_STEPS = 20;
+    _out << "timestep,size,ms_per_step,reduction_ms,reduction_share" << endl;
+    for(int size : SIZES)
+    {
+        FluidSolver solver(size, size);
+        solver.setAdaptiveTimestep(true);
+        FluidInitializer initializer;
+        solver.reset(initializer);
+
+        FluidProfiler profiler;
+        solver.setProfiler(&profiler);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(int s=0; s < NB_STEPS; ++s)
+        {
+            profiler.beginFrame();
+            solver.step();
+            profiler.endFrame();
+        }
+        double time = chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count() / NB_STEPS;
+        double reduction = max(0.0, profiler.average(FluidProfiler::EStage::TIMESTEP));
+
+        _out << "timestep," << size << "," << time << "," << reduction << ","
+             << reduction / time << endl;
+    }
+
+    // The plume speeds up past one cell per step, which the fixed
+    // timestep lets through and the adaptive one follows
+    const int SIZE = 256;
+    const double DURATION = 300.0;
+    struct {const char* name; bool adaptive; float cfl;} runs[] = {
+        {"fixed", false, 0.0f}, {"adaptive", true, 0.5f},
+        {"adaptive", true, 1.0f}, {"adaptive", true, 2.0f}
+    };
+    _out << "timestep,mode,cfl,steps,simulated_time,wall_ms,max_speed,"
+            "max_cells_per_step,min_dt,max_dt" << endl;
+    for(const auto& run : runs)
+    {
+        FluidSolver solver(SIZE, SIZE);
+        solver.setPressureSolver(FluidSolver::EPressureSolver::MULTIGRID);
+        if(run.adaptive)
+            solver.setAdaptiveTimestep(true, run.cfl);
+        FluidInitializer initializer;
+        solver.reset(initializer);
+
+        // Speeds of the fixed run are measured outside of its timing
+        const FluidKernels& kernels = FluidKernels::best();
+        auto peakSpeed = [&]()
+        {
+            const FluidGrid& velocity = solver.velocityGrid();
+            FluidTile all(0, 0, SIZE, SIZE);
+            return sqrt(kernels.maxSpeed2(velocity.plane(0), velocity.plane(1),
+                                          SIZE, all));
+        };
+
+        int steps = 0;
+        double wall = 0.0;
+        double maxSpeed = 0.0;
+        double maxCells = 0.0;
+        double minDt = 1e30;
+        double maxDt = 0.0;
+        while(solver.time() < DURATION)
+        {
+            double dt = solver.timestep();
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            solver.step();
+            wall += chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count();
+
+            double speed = run.adaptive ? solver.maxSpeed() : peakSpeed();
+            maxSpeed = max(maxSpeed, speed);
+            maxCells = max(maxCells, speed * solver.timestep() / solver.physics().dx);
+            minDt = min(minDt, dt);
+            maxDt = max(maxDt, dt);
+            ++steps;
+        }
+
+        _out << "timestep," << run.name << "," << run.cfl << "," << steps << ","
+             << solver.time() << "," << wall << "," << maxSpeed << ","
+             << maxCells << "," << minDt << "," << maxDt << endl;
+    }
+}
+
+void FluidBenchmark::domainDecomposition()
+{
+    typedef FluidDomainSolver::EPressureSolver EPressureSolver;
+    const int RANKS[] = {1, 2, 3, 4, 8};
+    const int hardware = max(1, (int) thread::hardware_concurrency());
+
+    // Rank 0 is this process, the others write nothing
+    struct Run
+    {
+        double msPerStep;
+        double haloShare;
+        double haloBytes;
+        int splitLevels;
+        bool identical;
+    };
+    auto runRanks = [&](int ranks, int halo, int width, int height,
+                        EPressureSolver pressure, int nbSteps,
+                        const FluidGrid* reference, Run& run)
+    {
+        run = Run{0.0, 0.0, 0.0, 0, false};
+        string error;
+        int result = FluidSocketTransport::run(ranks, [&](FluidTransport& transport)
+        {
+            FluidDomainSolver solver(transport, width, height, halo);
+            if(!solver.ok())
+                return 1;
+            solver.setThreadCount(max(1, hardware / ranks));
+            solver.setPressureSolver(pressure);
+            solver.setCandlePosition(cellar::Vec2f(width * 0.5f, height * 0.1f));
+            FluidInitializer initializer;
+            solver.reset(initializer);
+
+            transport.barrier();
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for(int s=0; s < nbSteps; ++s)
+                if(!solver.step())
+                    return 1;
+            transport.barrier();
+            double time = chrono::duration<double, milli>(
+                chrono::steady_clock::now() - start).count();
+
+            // Busiest rank
+            vector<double> exchanges = {solver.haloMs() / time,
+                                        (double) solver.haloBytes() / nbSteps};
+            transport.allMax(exchanges);
+            run.msPerStep = time / nbSteps;
+            run.haloShare = exchanges[0];
+            run.haloBytes = exchanges[1];
+            run.splitLevels = solver.multigrid().splitLevelCount();
+
+            if(reference)
+            {
+                const FluidGrid* locals[] = {
+                    &solver.dyeGrid(), &solver.velocityGrid(),
+                    &solver.pressureGrid(), &solver.heatGrid()
+                };
+                run.identical = true;
+                for(int g=0; g < 4; ++g)
+                {
+                    FluidGrid whole;
+                    if(!solver.gather(*locals[g], whole))
+                        return 1;
+                    run.identical = run.identical && whole.area() == reference[g].area() &&
+                        memcmp(whole.plane(0), reference[g].plane(0),
+                               whole.area() * whole.components() * sizeof(float)) == 0;
+                }
+            }
+            return transport.ok() ? 0 : 1;
+        }, error);
+
+        if(result != 0)
+            _out << "domain,error," << error << endl;
+        return result == 0;
+    };
+
+    // Fields of every rank count against FluidSolver's, slabs not being
+    // aligned on the tiles nor on a power of two for 3 ranks.
+    // The thinnest halos exchange before every other Jacobi iteration,
+    // 1 being raised to the two rows the fused stages read.
+    const int CHECK_WIDTH = 200;
+    const int CHECK_HEIGHT = 130;
+    const int CHECK_STEPS = 10;
+    vector<pair<int, int>> checks;
+    for(int ranks : RANKS)
+        checks.push_back(make_pair(ranks, 4));
+    for(int halo : {1, 2})
+        for(int ranks : {2, 4, 8})
+            checks.push_back(make_pair(ranks, halo));
+    _out << "domain,check,pressure,ranks,halo,split_levels,identical" << endl;
+    for(EPressureSolver pressure : {EPressureSolver::JACOBI, EPressureSolver::MULTIGRID})
+    {
+        // The reference's threads are gone before the ranks are forked
+        FluidGrid reference[4];
+        {
+            FluidSolver solver(CHECK_WIDTH, CHECK_HEIGHT);
+            solver.setPressureSolver(pressure == EPressureSolver::JACOBI ?
+                FluidSolver::EPressureSolver::JACOBI :
+                FluidSolver::EPressureSolver::MULTIGRID);
+            solver.setCandlePosition(cellar::Vec2f(CHECK_WIDTH * 0.5f, CHECK_HEIGHT * 0.1f));
+            FluidInitializer initializer;
+            solver.reset(initializer);
+            for(int s=0; s < CHECK_STEPS; ++s)
+                solver.step();
+            reference[0] = solver.dyeGrid();
+            reference[1] = solver.velocityGrid();
+            reference[2] = solver.pressureGrid();
+            reference[3] = solver.heatGrid();
+        }
+
+        for(const pair<int, int>& check : checks)
+        {
+            Run run;
+            if(!runRanks(check.first, check.second, CHECK_WIDTH, CHECK_HEIGHT,
+                         pressure, CHECK_STEPS, reference, run))
+                return;
+            _out << "domain,check,"
+                 << (pressure == EPressureSolver::JACOBI ? "jacobi" : "multigrid")
+                 << "," << check.first << "," << check.second << ","
+                 << run.splitLevels << ","
+                 << (run.identical ? "yes" : "NO") << endl;
+        }
+    }
+
+    // Strong scaling splits one grid, weak scaling adds a slab per rank.
+    // Ranks share the hardware threads, with one thread at least.
+    const int STRONG_SIZE = 1024;
+    const int WEAK_WIDTH = 512;
+    const int WEAK_ROWS = 256;
+    const int NB_STEPS = 5;
+    _out << "domain,mode,width,height,ranks,threads_per_rank,ms_per_step,"
+            "speedup,efficiency,halo_share,halo_kb_per_step" << endl;
+    for(int weak=0; weak < 2; ++weak)
+    {
+        double base = 0.0;
+        for(int ranks : {1, 2, 4, 8})
+        {
+            int width = weak ? WEAK_WIDTH : STRONG_SIZE;
+            int height = weak ? WEAK_ROWS * ranks : STRONG_SIZE;
+            Run run;
+            if(!runRanks(ranks, 4, width, height, EPressureSolver::JACOBI,
+                         NB_STEPS, nullptr, run))
+                return;
+            if(ranks == 1)
+                base = run.msPerStep;
+
+            double speedup = base / run.msPerStep * (weak ? ranks : 1);
+            _out << "domain," << (weak ? "weak" : "strong") << ","
+                 << width << "," << height << "," << ranks << ","
+                 << max(1, hardware / ranks) << "," << run.msPerStep << ","
+                 << speedup << "," << speedup / ranks << ","
+                 << run.haloShare << "," << run.haloBytes / 1024.0 << endl;
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef FLUID_BENCHMARK_H
+#define FLUID_BENCHMARK_H
+
+#include <string>
+#include <ostream>
+
+class FluidSolver;
+
+
+// Headless benchmarks of the CPU solver.
+// Results are written as CSV lines prefixed by the benchmark name.
+class FluidBenchmark
+{
+public:
+    FluidBenchmark(std::ostream& out);
+    virtual ~FluidBenchmark();
+
+    bool run(const std::string& name);
+    void listBenchmarks();
+
+    void pressureSolvers();
+    void gridScaling();
+    void stencilKernels();
+    void fieldLayouts();
+    void threadScaling();
+    void jacobiBlocking();
+    void fusedAdvection();
+    void fusedProjection();
+    void snapshotRestart();
+    void fieldExport();
+    void ensembleThroughput();
+    void sparseTiles();
+    void boundaryIndex();
+    void mixedPrecision();
+    void advectionOrder();
+    void conjugateGradient();
+    void startupTime();
+    void sceneForcing();
+    void vorticityConfinement();
+    void adaptiveTimestep();
+    void domainDecomposition();
+
+
+protected:
+    // Brings the solver to the point where computePressure() is due
+    void prepareProjection(FluidSolver& solver);
+
+    // Every field of both solvers is identical, bit for bit
+    bool sameState(const FluidSolver& a, const FluidSolver& b) const;
+
+
+private:
+    std::ostream& _out;
+};
+
+#endif // FLUID_BENCHMARK_H
@@ -0,0 +1,167 @@
+#include "FluidBoundary.h"
+#include "FluidGrid.h"
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+
+namespace
+{
+    // Replaces the entries of rows [j0, j1) by fresh ones
+    template<typename T>
+    void splice(vector<T>& items, vector<int>& rows, int j0, int j1,
+                const vector<T>& fresh, const vector<int>& freshRows)
+    {
+        const int delta = (int) fresh.size() - (rows[j1] - rows[j0]);
+        items.erase(items.begin() + rows[j0], items.begin() + rows[j1]);
+        items.insert(items.begin() + rows[j0], fresh.begin(), fresh.end());
+
+        for(int j=j0; j<j1; ++j)
+            rows[j+1] = rows[j] + freshRows[j - j0];
+        for(int j=j1+1; j < (int) rows.size(); ++j)
+            rows[j] += delta;
+    }
+}
+
+
+FluidBoundary::FluidBoundary() :
+    _width(0),
+    _height(0),
+    _cells(),
+    _cellRows(1, 0),
+    _buried(),
+    _buriedRows(1, 0),
+    _fluid(),
+    _fluidRows(1, 0)
+{
+}
+
+FluidBoundary::~FluidBoundary()
+{
+}
+
+void FluidBoundary::build(const FluidGrid& frontier)
+{
+    _width = frontier.width();
+    _height = frontier.height();
+    _cells.clear();
+    _buried.clear();
+    _fluid.clear();
+    _cellRows.assign(_height + 1, 0);
+    _buriedRows.assign(_height + 1, 0);
+    _fluidRows.assign(_height + 1, 0);
+
+    update(frontier, FluidTile(0, 0, _width, _height));
+}
+
+void FluidBoundary::update(const FluidGrid& frontier, const FluidTile& region)
+{
+    // Cells next to the region see their weights change too
+    const int j0 = max(0, region.j0 - 1);
+    const int j1 = min(_height, region.j1 + 1);
+    if(j0 >= j1)
+        return;
+
+    vector<Cell> cells;
+    vector<Span> buried;
+    vector<Span> fluid;
+    vector<int> cellRows;
+    vector<int> buriedRows;
+    vector<int> fluidRows;
+    indexRows(frontier, j0, j1,
+              cells, cellRows, buried, buriedRows, fluid, fluidRows);
+
+    splice(_cells, _cellRows, j0, j1, cells, cellRows);
+    splice(_buried, _buriedRows, j0, j1, buried, buriedRows);
+    splice(_fluid, _fluidRows, j0, j1, fluid, fluidRows);
+}
+
+int FluidBoundary::buriedCount() const
+{
+    int count = 0;
+    for(const Span& span : _buried)
+        count += span.i1 - span.i0;
+    return count;
+}
+
+int FluidBoundary::fluidCount() const
+{
+    int count = 0;
+    for(const Span& span : _fluid)
+        count += span.i1 - span.i0;
+    return count;
+}
+
+void FluidBoundary::indexRows(const FluidGrid& frontier, int j0, int j1,
+                              vector<Cell>& cells, vector<int>& cellRows,
+                              vector<Span>& buried, vector<int>& buriedRows,
+                              vector<Span>& fluid, vector<int>& fluidRows) const
+{
+    static const int dir[4][2] = {
+        {-1,  0},
+        { 1,  0},
+        { 0, -1},
+        { 0,  1}
+    };
+
+    const float* front = frontier.plane(0);
+    for(int j=j0; j<j1; ++j)
+    {
+        size_t cellCount = cells.size();
+        size_t buriedCount = buried.size();
+        size_t fluidCount = fluid.size();
+
+        for(int i=0; i<_width; ++i)
+        {
+            if(front[j*_width + i] != 1.0f)
+            {
+                if(fluid.size() > fluidCount && fluid.back().i1 == i)
+                    ++fluid.back().i1;
+                else
+                    fluid.push_back(Span{j, i, i+1});
+                continue;
+            }
+
+            Cell cell;
+            cell.i = i;
+            cell.j = j;
+            cell.count = 0;
+            cell.accum = 0.0f;
+            float weights[4];
+            for(int d=0; d<4; ++d)
+            {
+                int ni = min(max(i + dir[d][0], 0), _width-1);
+                int nj = min(max(j + dir[d][1], 0), _height-1);
+                weights[d] = 1.0f - front[nj*_width + ni];
+                cell.accum += weights[d];
+                if(weights[d] != 0.0f)
+                {
+                    cell.neighbors[cell.count] = nj*_width + ni;
+                    cell.weights[cell.count] = weights[d];
+                    ++cell.count;
+                }
+            }
+
+            if(cell.accum == 0.0f)
+            {
+                if(buried.size() > buriedCount && buried.back().i1 == i)
+                    ++buried.back().i1;
+                else
+                    buried.push_back(Span{j, i, i+1});
+                continue;
+            }
+
+            float nx = weights[1] - weights[0];
+            float ny = weights[3] - weights[2];
+            float norm = sqrt(nx*nx + ny*ny);
+            cell.normal[0] = norm > 0.0f ? nx / norm : 0.0f;
+            cell.normal[1] = norm > 0.0f ? ny / norm : 0.0f;
+            cells.push_back(cell);
+        }
+
+        cellRows.push_back((int) (cells.size() - cellCount));
+        buriedRows.push_back((int) (buried.size() - buriedCount));
+        fluidRows.push_back((int) (fluid.size() - fluidCount));
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef FLUID_BOUNDARY_H
+#define FLUID_BOUNDARY_H
+
+#include <vector>
+
+#include "FluidTile.h"
+
+class FluidGrid;
+
+
+// Index of a frontier mask built once so that boundary conditions cost
+// O(obstacle border) instead of O(grid).
+// Obstacle cells are those whose frontier is 1. Those with fluid on a side
+// are listed with the neighbors frontier.frag averages, the others are
+// buried and only kept as row spans, like the fluid cells.
+class FluidBoundary
+{
+public:
+    // Obstacle cell touching fluid
+    struct Cell
+    {
+        int i;
+        int j;
+        // Neighbors of non zero weight (1 - frontier), in the left, right,
+        // bottom, top order of frontier.frag, as clamped cell indices
+        int count;
+        int neighbors[4];
+        float weights[4];
+        // Sum of the 4 weights in the shader's order
+        float accum;
+        // Unit, pointing into the fluid, null when the sides cancel out
+        float normal[2];
+    };
+
+    // Cells [i0, i1) of row j
+    struct Span
+    {
+        int j;
+        int i0;
+        int i1;
+    };
+
+    FluidBoundary();
+    virtual ~FluidBoundary();
+
+    void build(const FluidGrid& frontier);
+
+    // Re-indexes the rows a change of the frontier inside region can affect
+    void update(const FluidGrid& frontier, const FluidTile& region);
+
+    int width() const;
+    int height() const;
+
+    const std::vector<Cell>& cells() const;
+    const std::vector<Span>& buriedSpans() const;
+    const std::vector<Span>& fluidSpans() const;
+
+    int buriedCount() const;
+    int fluidCount() const;
+
+
+protected:
+    // Lists rows [j0, j1) of the frontier, rows get the entry count of each
+    void indexRows(const FluidGrid& frontier, int j0, int j1,
+                   std::vector<Cell>& cells, std::vector<int>& cellRows,
+                   std::vector<Span>& buried, std::vector<int>& buriedRows,
+                   std::vector<Span>& fluid, std::vector<int>& fluidRows) const;
+
+
+private:
+    int _width;
+    int _height;
+
+    // Entries are sorted by row, those of row j start at rows[j]
+    std::vector<Cell> _cells;
+    std::vector<int> _cellRows;
+    std::vector<Span> _buried;
+    std::vector<int> _buriedRows;
+    std::vector<Span> _fluid;
+    std::vector<int> _fluidRows;
+};
+
+
+
+// IMPLEMENTATION //
+inline int FluidBoundary::width() const
+{
+    return _width;
+}
+
+inline int FluidBoundary::height() const
+{
+    return _height;
+}
+
+inline const std::vector<FluidBoundary::Cell>& FluidBoundary::cells() const
+{
+    return _cells;
+}
+
+inline const std::vector<FluidBoundary::Span>& FluidBoundary::buriedSpans() const
+{
+    return _buried;
+}
+
+inline const std::vector<FluidBoundary::Span>& FluidBoundary::fluidSpans() const
+{
+    return _fluid;
+}
+
+#endif // FLUID_BOUNDARY_H
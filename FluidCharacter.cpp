@@ -1,13 +1,17 @@
 #include "FluidCharacter.h"
+#include "FluidSnapshot.h"
+#include "FluidSolver.h"
 
 #include <cmath>
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 using namespace std;
 
 #include <GL3/gl3w.h>
 
 #include <Misc/CellarUtils.h>
-#include <Algorithm/Noise.h>
 using namespace cellar;
 
 using namespace media;
@@ -25,25 +29,90 @@ using namespace prop2;
 using namespace scaena;
 
 
-const int FluidCharacter::WIDTH = 256;
-const int FluidCharacter::HEIGHT = 256;
-const int FluidCharacter::AREA = WIDTH * HEIGHT;
-const int FluidCharacter::POINT_SIZE = 3;
-
-
-FluidCharacter::FluidCharacter(AbstractStage& stage) :
+FluidCharacter::FluidCharacter(AbstractStage& stage,
+                               int width,
+                               int height,
+                               int pointSize,
+                               EBackend backend,
+                               const FluidFieldLayout& layout) :
     AbstractCharacter(stage, "FluidCharacter"),
+    WIDTH(width),
+    HEIGHT(height),
+    AREA(width * height),
+    POINT_SIZE(pointSize),
     DX(1.0f),
     DT(1.0f),
     VISCOSITY(0.01f),
     HEATDIFF(0.01f),
+    BACKEND(backend),
+    LAYOUT(layout),
+    _scene(),
+    _solver(),
+    _staging(),
+    _stagingScheduler(),
+    _uploadBuffer(),
+    _fusedAdvection(true),
+    _fusedProjection(true),
+    _advection(),
+    _vorticity(0.0f),
+    _dt(DT),
+    _adaptiveTimestep(false),
+    _cfl(1.0f),
+    _minDt(DT / 8.0f),
+    _maxDt(DT * 4.0f),
+    _maxSpeed(0.0f),
+    _speedPbo(0),
+    _speedFence(nullptr),
+    _stepPeriod(1.0 / 50.0),
+    _maxSubsteps(4),
+    _maxThroughput(false),
+    _renderInterval(1),
+    _accumulator(0.0),
+    _stepsSinceRender(0),
+    _upsSteps(0),
+    _upsTime(0.0),
+    _stepCount(0),
+    _time(0.0),
+    _sceneStep(0.0),
+    _candlePos(0, 0),
+    _snapshotFile("fluid2d.snap"),
+    _snapshotPbo(0),
+    _snapshotFence(nullptr),
+    _snapshotStep(0),
+    _snapshotTime(0.0),
+    _snapshotSceneStep(0.0),
+    _snapshotCandlePos(0, 0),
+    EXPORT_LATENCY(4),
+    _exportFile(),
+    _exportFields(),
+    _exporter(),
+    _exportSlots(),
+    _exportNext(0),
+    _exportStalls(0),
+    RESIDUAL_LATENCY(3),
+    _residualSlots(),
+    _diffuseCriterion(60),
+    _pressureCriterion(200),
+    _velocityDiffuseStats(),
+    _heatDiffuseStats(),
+    _pressureStats(),
+    _profiler(),
+    _gpuTimer(),
     _drawShader(),
     _vao(),
     DRAW_TEX(1),
     FETCH_TEX(0),
+    _texturesAllocated(false),
+    _frontierGrid(),
+    _boundary(),
+    _boundaryVao(0),
+    _boundaryVbo(0),
+    _boundaryPoints(0),
     _statsPanel(),
     _fps(),
-    _ups()
+    _ups(),
+    _solveStats(),
+    _stageTimes()
 {
     stage.camera().registerObserver(*this);
 }
@@ -84,6 +153,51 @@ void FluidCharacter::enterStage()
     _advectShader.popProgram();
 
 
+    GlInputsOutputs advectFusedLocations;
+    advectFusedLocations.setInput(buffPos.attribLocation, "position");
+    advectFusedLocations.setOutput(0, "Dye");
+    advectFusedLocations.setOutput(1, "Heat");
+    advectFusedLocations.setOutput(2, "Velocity");
+    _advectFusedShader.setInAndOutLocations(advectFusedLocations);
+    _advectFusedShader.addShader(GL_VERTEX_SHADER, "resources/shaders/update.vert");
+    _advectFusedShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/advectFused.frag");
+    _advectFusedShader.link();
+    _advectFusedShader.pushProgram();
+    _advectFusedShader.setInt("DyeTex", 0);
+    _advectFusedShader.setInt("HeatTex", 1);
+    _advectFusedShader.setInt("VelocityTex", 2);
+    _advectFusedShader.setInt("FrontierTex", 3);
+    _advectFusedShader.setVec2f("Size", Vec2f(WIDTH, HEIGHT));
+    _advectFusedShader.setFloat("rDx", 1.0f / DX);
+    _advectFusedShader.setFloat("Dt",  DT);
+    _advectFusedShader.popProgram();
+
+    // Higher order advection passes trace through the velocity
+    // before its own advection, in the DRAW texture by then
+    struct {media::GlProgram* program; const char* file; const char* secondTex;}
+    correctionShaders[] = {
+        {&_maccormackShader,      "resources/shaders/maccormack.frag",      "ForwardTex"},
+        {&_bfeccCompensateShader, "resources/shaders/bfeccCompensate.frag", "ForwardTex"},
+        {&_bfeccAdvectShader,     "resources/shaders/bfeccAdvect.frag",     "CompensatedTex"}
+    };
+    for(const auto& shader : correctionShaders)
+    {
+        shader.program->setInAndOutLocations(updateLocations);
+        shader.program->addShader(GL_VERTEX_SHADER, "resources/shaders/update.vert");
+        shader.program->addShader(GL_FRAGMENT_SHADER, shader.file);
+        shader.program->link();
+        shader.program->pushProgram();
+        shader.program->setInt("FragInTex", 0);
+        shader.program->setInt(shader.secondTex, 1);
+        shader.program->setInt("VelocityTex", 2);
+        shader.program->setInt("FrontierTex", 3);
+        shader.program->setVec2f("Size", Vec2f(WIDTH, HEIGHT));
+        shader.program->setFloat("rDx", 1.0f / DX);
+        shader.program->setFloat("Dt",  DT);
+        shader.program->popProgram();
+    }
+
+
     _jacobiShader.setInAndOutLocations(updateLocations);
     _jacobiShader.addShader(GL_VERTEX_SHADER, "resources/shaders/update.vert");
     _jacobiShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/jacobi.frag");
@@ -132,6 +246,7 @@ void FluidCharacter::enterStage()
     _heatShader.setInt("HeatTex", 1);
     _heatShader.setVec2f("Size", Vec2f(WIDTH, HEIGHT));
     _heatShader.setFloat("HalfrDx", 0.5f / DX);
+    _heatShader.setFloat("TimeScale", 1.0f);
     _heatShader.popProgram();
 
 
@@ -151,6 +266,113 @@ void FluidCharacter::enterStage()
     _frontierShader.popProgram();
 
 
+    GlInputsOutputs heatDivergenceLocations;
+    heatDivergenceLocations.setInput(buffPos.attribLocation, "position");
+    heatDivergenceLocations.setOutput(0, "Velocity");
+    heatDivergenceLocations.setOutput(1, "Heat");
+    heatDivergenceLocations.setOutput(2, "Divergence");
+    _heatDivergenceShader.setInAndOutLocations(heatDivergenceLocations);
+    _heatDivergenceShader.addShader(GL_VERTEX_SHADER, "resources/shaders/update.vert");
+    _heatDivergenceShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/heatDivergence.frag");
+    _heatDivergenceShader.link();
+    _heatDivergenceShader.pushProgram();
+    _heatDivergenceShader.setInt("VelocityTex", 0);
+    _heatDivergenceShader.setInt("HeatTex", 1);
+    _heatDivergenceShader.setVec2f("Size", Vec2f(WIDTH, HEIGHT));
+    _heatDivergenceShader.setFloat("HalfrDx", 0.5f / DX);
+    _heatDivergenceShader.setFloat("TimeScale", 1.0f);
+    _heatDivergenceShader.popProgram();
+
+
+    _gradSubFrontierShader.setInAndOutLocations(frontierLocations);
+    _gradSubFrontierShader.addShader(GL_VERTEX_SHADER, "resources/shaders/update.vert");
+    _gradSubFrontierShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/gradSubFrontier.frag");
+    _gradSubFrontierShader.link();
+    _gradSubFrontierShader.pushProgram();
+    _gradSubFrontierShader.setInt("VelocityTex", 0);
+    _gradSubFrontierShader.setInt("PressureTex", 1);
+    _gradSubFrontierShader.setInt("FrontierTex", 2);
+    _gradSubFrontierShader.setVec2f("Size", Vec2f(WIDTH, HEIGHT));
+    _gradSubFrontierShader.setFloat("HalfrDx", 0.5f / DX);
+    _gradSubFrontierShader.popProgram();
+
+
+    GlInputsOutputs scatterLocations;
+    scatterLocations.setInput(0, "cell");
+    scatterLocations.setInput(1, "weights");
+    scatterLocations.setOutput(0, "Velocity");
+    scatterLocations.setOutput(1, "Pressure");
+    _frontierScatterShader.setInAndOutLocations(scatterLocations);
+    _frontierScatterShader.addShader(GL_VERTEX_SHADER, "resources/shaders/frontierScatter.vert");
+    _frontierScatterShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/frontierScatter.frag");
+    _frontierScatterShader.link();
+    _frontierScatterShader.pushProgram();
+    _frontierScatterShader.setInt("VelocityTex", 0);
+    _frontierScatterShader.setInt("PressureTex", 1);
+    _frontierScatterShader.setVec2f("Size", Vec2f(WIDTH, HEIGHT));
+    _frontierScatterShader.popProgram();
+
+    _frontierCommitShader.setInAndOutLocations(scatterLocations);
+    _frontierCommitShader.addShader(GL_VERTEX_SHADER, "resources/shaders/frontierScatter.vert");
+    _frontierCommitShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/frontierCommit.frag");
+    _frontierCommitShader.link();
+    _frontierCommitShader.pushProgram();
+    _frontierCommitShader.setInt("VelocityTex", 0);
+    _frontierCommitShader.setInt("PressureTex", 1);
+    _frontierCommitShader.setVec2f("Size", Vec2f(WIDTH, HEIGHT));
+    _frontierCommitShader.popProgram();
+
+
+    _residualShader.setInAndOutLocations(updateLocations);
+    _residualShader.addShader(GL_VERTEX_SHADER, "resources/shaders/update.vert");
+    _residualShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/residual.frag");
+    _residualShader.link();
+    _residualShader.pushProgram();
+    _residualShader.setInt("NewTex", 0);
+    _residualShader.setInt("OldTex", 1);
+    _residualShader.popProgram();
+
+    _forceShader.setInAndOutLocations(updateLocations);
+    _forceShader.addShader(GL_VERTEX_SHADER, "resources/shaders/update.vert");
+    _forceShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/force.frag");
+    _forceShader.link();
+    _forceShader.pushProgram();
+    _forceShader.setInt("FrontierTex", 0);
+    _forceShader.setVec2f("Size", Vec2f(WIDTH, HEIGHT));
+    _forceShader.popProgram();
+
+    _vorticityShader.setInAndOutLocations(updateLocations);
+    _vorticityShader.addShader(GL_VERTEX_SHADER, "resources/shaders/update.vert");
+    _vorticityShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/vorticity.frag");
+    _vorticityShader.link();
+    _vorticityShader.pushProgram();
+    _vorticityShader.setInt("VelocityTex", 0);
+    _vorticityShader.setInt("FrontierTex", 1);
+    _vorticityShader.setVec2f("Size", Vec2f(WIDTH, HEIGHT));
+    _vorticityShader.setFloat("HalfrDx", 0.5f / DX);
+    _vorticityShader.popProgram();
+
+    _confineShader.setInAndOutLocations(updateLocations);
+    _confineShader.addShader(GL_VERTEX_SHADER, "resources/shaders/update.vert");
+    _confineShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/confine.frag");
+    _confineShader.link();
+    _confineShader.pushProgram();
+    _confineShader.setInt("VelocityTex", 0);
+    _confineShader.setInt("CurlTex", 1);
+    _confineShader.setInt("FrontierTex", 2);
+    _confineShader.setVec2f("Size", Vec2f(WIDTH, HEIGHT));
+    _confineShader.setFloat("HalfrDx", 0.5f / DX);
+    _confineShader.popProgram();
+
+    _maxSpeedShader.setInAndOutLocations(updateLocations);
+    _maxSpeedShader.addShader(GL_VERTEX_SHADER, "resources/shaders/update.vert");
+    _maxSpeedShader.addShader(GL_FRAGMENT_SHADER, "resources/shaders/maxSpeed.frag");
+    _maxSpeedShader.link();
+    _maxSpeedShader.pushProgram();
+    _maxSpeedShader.setInt("SrcTex", 0);
+    _maxSpeedShader.popProgram();
+
+
     GlInputsOutputs drawLocations;
     drawLocations.setInput(buffPos.attribLocation, "position");
     drawLocations.setOutput(0, "FragColor");
@@ -188,6 +410,25 @@ void FluidCharacter::enterStage()
     _ups->setHandlePosition(_statsPanel->handlePosition() + Vec2r(50, 9));
     _ups->setHorizontalAnchor(_statsPanel->horizontalAnchor());
     _ups->setVerticalAnchor(_statsPanel->verticalAnchor());
+
+    _solveStats = stage().propTeam().createTextHud();
+    _solveStats->setColor(Vec4r(1.0, 1.0, 1.0, 1.0));
+    _solveStats->setHeight(16);
+    _solveStats->setHandlePosition(_statsPanel->handlePosition() + Vec2r(0, -20));
+    _solveStats->setHorizontalAnchor(_statsPanel->horizontalAnchor());
+    _solveStats->setVerticalAnchor(_statsPanel->verticalAnchor());
+
+    for(int s=0; s < FluidProfiler::STAGE_COUNT; ++s)
+    {
+        shared_ptr<TextHud> stageTime = stage().propTeam().createTextHud();
+        stageTime->setColor(_solveStats->color());
+        stageTime->setHeight(14);
+        stageTime->setHandlePosition(_solveStats->handlePosition() +
+                                     Vec2r(0, -16 * (s+1)));
+        stageTime->setHorizontalAnchor(_statsPanel->horizontalAnchor());
+        stageTime->setVerticalAnchor(_statsPanel->verticalAnchor());
+        _stageTimes.push_back(stageTime);
+    }
     // End Stats Panel
 
     // Camera and stage size
@@ -207,128 +448,220 @@ void FluidCharacter::enterStage()
 
     // OpenGL states
     glClearColor(0.2, 0.2, 0.2, 1.0);
-    glGenTextures(2, _dyeTex);
-    glGenTextures(2, _velocityTex);
-    glGenTextures(2, _pressureTex);
-    glGenTextures(2, _heatTex);
-    glGenTextures(1, &_frontierTex);
-    glGenTextures(1, &_tempDivTex);
-
-    typedef float texComp_t;
-    typedef Vector<4, texComp_t> texVec_t;
-    vector<texVec_t> dyeImg(AREA);
-    vector<texVec_t> velocityImg(AREA);
-    vector<texVec_t> pressureImg(AREA);
-    vector<texVec_t> heatImg(AREA);
-    vector<texVec_t> frontierImg(AREA);
-    for(int i=0; i<AREA; ++i)
-    {
-        float s = (i%WIDTH)/(float)WIDTH;
-        float t = (i/WIDTH)/(float)HEIGHT;
-        dyeImg[i]      = initDye(s, t);
-        velocityImg[i] = initVelocity(s, t);
-        pressureImg[i] = initPressure(s, t);
-        heatImg[i]     = initHeat(s, t);
-        frontierImg[i] = initFrontier(s, t);
-    }
-
-    initTexture(_dyeTex[0],      dyeImg);
-    initTexture(_dyeTex[1],      dyeImg);
-    initTexture(_velocityTex[0], velocityImg);
-    initTexture(_velocityTex[1], velocityImg);
-    initTexture(_pressureTex[0], pressureImg);
-    initTexture(_pressureTex[1], pressureImg);
-    initTexture(_heatTex[0],     heatImg);
-    initTexture(_heatTex[1],     heatImg);
-    initTexture(_frontierTex,    frontierImg);
-    initTexture(_tempDivTex,     vector<texVec_t>(AREA));
-
-
-    glGenFramebuffers(1, &_fbo);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    // End OpenGL states
-}
 
-Vec4f FluidCharacter::initDye(float s, float t)
-{
-    float zoom = 4.0f;
-    float dye = SimplexNoise::noise2d(s*zoom, t*zoom);
-    return Vec4f(dye, dye, dye, 1.0);
-}
+    // Textures and staging grids are kept from one restart to the next
+    typedef FluidFieldLayout::EField EField;
+    if(!_texturesAllocated)
+    {
+        glGenTextures(2, _dyeTex);
+        glGenTextures(2, _velocityTex);
+        glGenTextures(2, _pressureTex);
+        glGenTextures(2, _heatTex);
+        glGenTextures(1, &_frontierTex);
+        glGenTextures(1, &_tempDivTex);
+        glGenTextures(3, _advectTex);
+        glGenTextures(1, &_residualTex);
+        glGenTextures(1, &_curlTex);
+        glGenFramebuffers(1, &_fbo);
+
+        struct {unsigned int* texIds; int count; FluidFieldLayout::Format format;}
+        textures[] = {
+            {_dyeTex,         2, LAYOUT.format(EField::DYE)},
+            {_velocityTex,    2, LAYOUT.format(EField::VELOCITY)},
+            {_pressureTex,    2, LAYOUT.format(EField::PRESSURE)},
+            {_heatTex,        2, LAYOUT.format(EField::HEAT)},
+            {&_frontierTex,   1, LAYOUT.format(EField::FRONTIER)},
+            {&_tempDivTex,    1, LAYOUT.format(EField::DIVERGENCE)},
+            {&_residualTex,   1, FluidFieldLayout::Format(1)},
+            {&_curlTex,       1, FluidFieldLayout::Format(1)},
+            {&_advectTex[0],  1, LAYOUT.format(EField::DYE)},
+            {&_advectTex[1],  1, LAYOUT.format(EField::HEAT)},
+            {&_advectTex[2],  1, LAYOUT.format(EField::VELOCITY)}
+        };
+        for(const auto& t : textures)
+            for(int i=0; i < t.count; ++i)
+                initTexture(t.texIds[i], t.format, nullptr);
+
+        // 4x4 blocks per level down to a few texels read back as is
+        int levelWidth = WIDTH;
+        int levelHeight = HEIGHT;
+        do
+        {
+            levelWidth = (levelWidth + 3) / 4;
+            levelHeight = (levelHeight + 3) / 4;
+            SpeedLevel level = {0, levelWidth, levelHeight};
+            glGenTextures(1, &level.tex);
+            glBindTexture(GL_TEXTURE_2D, level.tex);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, levelWidth, levelHeight, 0,
+                         GL_RED, GL_FLOAT, nullptr);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            _speedLevels.push_back(level);
+        }
+        while(levelWidth * levelHeight > 64);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        _texturesAllocated = true;
+    }
 
-Vec4f FluidCharacter::initVelocity(float s, float t)
-{
-    /* Swirl
-    const float cx = 0.5f, cy = 0.5f;
-    const float ed = 0.35f;
-    float dist = Vec2f(s, t).distanceTo(cx, cy);
-    if(dist < ed)
-        return Vec4f(t-cx, -(s-cy), 0, 0) * 3.0 + Vec4f(1.0, 1.0, 0, 0) * 1.0;
-    return Vec4f();
-    //*/
+    // The CPU solver generates its own fields, which are uploaded as is
+    const FluidGrid* images[4];
+    if(BACKEND == EBackend::CPU)
+    {
+        if(!_solver)
+            _solver.reset(new FluidSolver(WIDTH, HEIGHT, LAYOUT));
+        _solver->setDiffuseCriterion(_diffuseCriterion);
+        _solver->setPressureCriterion(_pressureCriterion);
+        _solver->setProfiler(&_profiler);
+        _solver->setAdvection(_advection);
+        _solver->setVorticityConfinement(_vorticity);
+        _solver->setAdaptiveTimestep(_adaptiveTimestep, _cfl, _minDt, _maxDt);
+        _solver->setScene(_scene);
+        _solver->reset(_scene);
+
+        images[0] = &_solver->dyeGrid();
+        images[1] = &_solver->velocityGrid();
+        images[2] = &_solver->pressureGrid();
+        images[3] = &_solver->heatGrid();
+        _frontierGrid = _solver->frontierGrid();
+    }
+    else
+    {
+        if(_staging.empty())
+        {
+            _staging.resize(4);
+            _staging[0].resize(WIDTH, HEIGHT, LAYOUT.components(EField::DYE));
+            _staging[1].resize(WIDTH, HEIGHT, LAYOUT.components(EField::VELOCITY));
+            _staging[2].resize(WIDTH, HEIGHT, LAYOUT.components(EField::PRESSURE));
+            _staging[3].resize(WIDTH, HEIGHT, LAYOUT.components(EField::HEAT));
+            _frontierGrid.resize(WIDTH, HEIGHT, LAYOUT.components(EField::FRONTIER));
+            _stagingScheduler.reset(new FluidScheduler());
+        }
+
+        _scene.generate(*_stagingScheduler, &_staging[0], &_staging[1],
+                        &_staging[2], &_staging[3], &_frontierGrid);
+        for(int i=0; i<4; ++i)
+            images[i] = &_staging[i];
+    }
 
-    /* Plank
-    if(cellar::inRange(s, 0.3f, 0.5f) &&
-       cellar::inRange(t, 0.2f, 0.40f))
+    // Each pair is uploaded once, its draw texture copied on the GPU
+    unsigned int* pairs[] = {_dyeTex, _velocityTex, _pressureTex, _heatTex};
+    for(int i=0; i<4; ++i)
     {
-        return Vec4f(0.0, 1.0, 0.0, 0.0) * (0.1-absolute(t-0.3f))*10.0;
+        uploadTexture(pairs[i][FETCH_TEX], *images[i]);
+        copyTexture(pairs[i][FETCH_TEX], pairs[i][DRAW_TEX]);
     }
-    if(cellar::inRange(s, 0.5f, 0.7f) &&
-       cellar::inRange(t, 0.6f, 0.8f))
+    uploadTexture(_frontierTex, _frontierGrid);
+    if(BACKEND == EBackend::GL)
     {
-        return Vec4f(0.0, -1.0, 0.0, 0.0) * (0.1-absolute(t-0.7f))*10.0;
+        _boundary.build(_frontierGrid);
+        glGenVertexArrays(1, &_boundaryVao);
+        glGenBuffers(1, &_boundaryVbo);
+        glBindVertexArray(_boundaryVao);
+        glBindBuffer(GL_ARRAY_BUFFER, _boundaryVbo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 6 * sizeof(float), 0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 6 * sizeof(float),
+                              (void*) (2 * sizeof(float)));
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        uploadBoundary();
     }
-    return Vec4f();
-    //*/
 
-    return Vec4f();
-}
+    cout << "Field storage : " << LAYOUT.bytesPerCell() << " bytes per cell ("
+         << FluidFieldLayout::rgba32f().bytesPerCell() << " as RGBA32F)" << endl;
 
-Vec4f FluidCharacter::initPressure(float s, float t)
-{
-    return Vec4f();
+    _residualTopLevel = 0;
+    while((max(WIDTH, HEIGHT) >> _residualTopLevel) > 1)
+        ++_residualTopLevel;
+
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    _gpuTimer.init();
+    _stepCount = 0;
+    _time = 0.0;
+    _sceneStep = 0.0;
+
+    if(!_exportFile.empty())
+    {
+        string error;
+        if(_exporter.open(_exportFile, WIDTH, HEIGHT, _exportFields, LAYOUT, error))
+        {
+            cout << "Exporting to " << _exportFile << " ("
+                 << FluidExporter::encodingName(_exporter.encoding())
+                 << ")" << endl;
+        }
+        else
+            cerr << "Could not start export : " << error << endl;
+    }
+    if(_exporter.isOpen() && BACKEND == EBackend::GL)
+    {
+        _exportSlots.resize(EXPORT_LATENCY);
+        for(ExportSlot& slot : _exportSlots)
+        {
+            glGenBuffers(1, &slot.pbo);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            glBufferData(GL_PIXEL_PACK_BUFFER,
+                         _exporter.frameFloats() * sizeof(float),
+                         nullptr, GL_STREAM_READ);
+            slot.fence = nullptr;
+            slot.step = 0;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        _exportNext = 0;
+        _exportStalls = 0;
+    }
+
+    _profiler.beginFrame();
+    _gpuTimer.beginFrame(_profiler);
+
+    // Until the first speed is read back, the smallest timestep is taken
+    _maxSpeed = 0.0f;
+    if(BACKEND == EBackend::GL)
+    {
+        applyTimestep(_adaptiveTimestep ? _minDt : DT);
+        if(_adaptiveTimestep)
+        {
+            _vao.bind();
+            reduceSpeed();
+            _vao.unbind();
+        }
+    }
+    // End OpenGL states
 }
 
-cellar::Vec4f FluidCharacter::initHeat(float s, float t)
+static GLenum glPixelFormat(int components)
 {
-    if((Vec2f(s, t) - Vec2f(0.2, 0.8)).length() < 0.08)
-        return Vec4f(-5, 0, 0, 0);
-    if((Vec2f(s, t) - Vec2f(0.5, 0.2)).length() < 0.08)
-        return Vec4f(5, 0, 0, 0);
-    return Vec4f();
+    switch(components)
+    {
+    case 1 :  return GL_RED;
+    case 2 :  return GL_RG;
+    case 3 :  return GL_RGB;
+    default : return GL_RGBA;
+    }
 }
 
-cellar::Vec4f FluidCharacter::initFrontier(float s, float t)
+static GLenum glInternalFormat(const FluidFieldLayout::Format& format)
 {
-    const Vec4f block(1.0, 1.0, 1.0, 1.0);
-    const Vec4f fluid(0.0, 0.0, 0.0, 0.0);
-
-    const float W = 0.03;
-    if(s < W || s > 1-W || t < W || t > 1-W)
-        return block;
-
-    if((t > 0.45 && t < 0.52) && (
-        !inRange(s, 0.22f, 0.24f) &&
-        !inRange(s, 0.50f, 0.53f) &&
-        !inRange(s, 0.78f, 0.80f)))
-        return block;
-/*
-    if(Vec2f(s, t).distanceTo(0.75, 0.66) < 0.2)
-        return block;
-
-    if(Vec2f(s, t).distanceTo(0.3, 0.2) < 0.03)
-        return block;
-*/
-    return fluid;
+    // There are no bfloat16 textures, half floats take the same room
+    static const GLenum FORMATS[4][4] = {
+        {GL_R32F, GL_RG32F, GL_RGB32F, GL_RGBA32F},
+        {GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F},
+        {GL_R8,   GL_RG8,   GL_RGB8,   GL_RGBA8},
+        {GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F}
+    };
+    return FORMATS[(int) format.precision][format.components - 1];
 }
 
-template<typename T>
-void FluidCharacter::initTexture(unsigned int texId, const T& img)
+void FluidCharacter::initTexture(unsigned int texId,
+                                 const FluidFieldLayout::Format& format,
+                                 const float* texels)
 {
     glBindTexture(GL_TEXTURE_2D, texId);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, WIDTH, HEIGHT, 0,
-                 GL_RGBA, GL_FLOAT, img.data());
+    glTexImage2D(GL_TEXTURE_2D, 0, glInternalFormat(format), WIDTH, HEIGHT, 0,
+                 glPixelFormat(format.components), GL_FLOAT, texels);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -336,13 +669,135 @@ void FluidCharacter::initTexture(unsigned int texId, const T& img)
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
+void FluidCharacter::uploadTexture(unsigned int texId, const FluidGrid& grid)
+{
+    grid.interleave(_uploadBuffer);
+    glBindTexture(GL_TEXTURE_2D, texId);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WIDTH, HEIGHT,
+                    glPixelFormat(grid.components()), GL_FLOAT,
+                    _uploadBuffer.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void FluidCharacter::copyTexture(unsigned int srcTex, unsigned int dstTex)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, srcTex, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindTexture(GL_TEXTURE_2D, dstTex);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, WIDTH, HEIGHT);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+void FluidCharacter::setStepRate(double stepsPerSecond)
+{
+    _stepPeriod = 1.0 / stepsPerSecond;
+}
+
+void FluidCharacter::setMaxSubsteps(int maxSubsteps)
+{
+    _maxSubsteps = max(1, maxSubsteps);
+}
+
+void FluidCharacter::setMaxThroughput(bool maxThroughput, int renderInterval)
+{
+    _maxThroughput = maxThroughput;
+    _renderInterval = max(1, renderInterval);
+    _accumulator = 0.0;
+}
+
 void FluidCharacter::beginStep(const scaena::StageTime &time)
 {
+    int steps = 0;
+    if(_maxThroughput)
+    {
+        for(; steps < _renderInterval; ++steps)
+            simulateStep();
+    }
+    else
+    {
+        _accumulator += time.elapsedTime();
+        for(; _accumulator >= _stepPeriod && steps < _maxSubsteps; ++steps)
+        {
+            simulateStep();
+            _accumulator -= _stepPeriod;
+        }
+
+        // Too slow to keep up, the simulation slows down instead
+        if(_accumulator >= _stepPeriod)
+            _accumulator = fmod(_accumulator, _stepPeriod);
+    }
+
+    _upsSteps += steps;
 }
 
 void FluidCharacter::endStep(const scaena::StageTime &time)
 {
-    _ups->setText(toString(1.0 / time.elapsedTime()));
+    // Simulation steps per second rather than update calls
+    _upsTime += time.elapsedTime();
+    if(_upsTime >= 0.5)
+    {
+        _ups->setText(toString(_upsSteps / _upsTime));
+        _upsSteps = 0;
+        _upsTime = 0.0;
+    }
+}
+
+void FluidCharacter::simulateStep()
+{
+    _vao.bind();
+
+    if(BACKEND == EBackend::CPU)
+    {
+        _solver->step();
+        _dt = _solver->timestep();
+        _maxSpeed = _solver->maxSpeed();
+        _velocityDiffuseStats = _solver->velocityDiffuseStats();
+        _heatDiffuseStats = _solver->heatDiffuseStats();
+        _pressureStats = _solver->pressureStats();
+    }
+    else
+    {
+        if(_adaptiveTimestep)
+            readSpeed();
+        glViewport(0, 0, WIDTH, HEIGHT);
+        if(_scene.hasForcing())
+            force();
+        if(_fusedAdvection)
+            advectFused();
+        else
+            advect();
+        if(_advection.highOrder())
+            correctAdvection();
+        diffuse();
+        if(_vorticity > 0.0f)
+            confineVorticity();
+        if(_fusedProjection)
+        {
+            heatDivergence();
+            solvePressure();
+            substractGradientFrontier();
+        }
+        else
+        {
+            heat();
+            computePressure();
+            substractPressureGradient();
+            frontier();
+        }
+        if(_adaptiveTimestep)
+            reduceSpeed();
+        _profiler.countStep();
+    }
+
+    _vao.unbind();
+    ++_stepsSinceRender;
+    ++_stepCount;
+    _time += _dt;
+    _sceneStep += (double) _dt / DT;
+    exportStep();
 }
 
 void FluidCharacter::draw(const scaena::StageTime &time)
@@ -351,24 +806,102 @@ void FluidCharacter::draw(const scaena::StageTime &time)
 
     _vao.bind();
 
-    glViewport(0, 0, WIDTH, HEIGHT);
-    advect();
-    diffuse();
-    heat();
-    computePressure();
-    substractPressureGradient();
-    frontier();
+    // Shows the latest simulated state
+    if(BACKEND == EBackend::CPU && _stepsSinceRender > 0)
+    {
+        FluidProfiler::Scope scope(&_profiler, FluidProfiler::EStage::UPLOAD);
+        uploadSolverFields();
+    }
+    _stepsSinceRender = 0;
 
     glViewport(0, 0, stage().width(), stage().height());
     drawFluid();
 
+    _solveStats->setText(
+        "V " + toString(_velocityDiffuseStats.iterations) +
+        " H " + toString(_heatDiffuseStats.iterations) +
+        " P " + toString(_pressureStats.iterations) +
+        " (" + toString(_pressureStats.residual) + ")" +
+        (_adaptiveTimestep ? " dt " + toString(_dt) : string()));
+
     _vao.unbind();
+    writePendingSnapshot();
+
+    // A profiler frame holds every step simulated since the last draw
+    _gpuTimer.endFrame();
+    _profiler.endFrame();
+    updateStageTimes();
+    _profiler.beginFrame();
+    _gpuTimer.beginFrame(_profiler);
+}
+
+void FluidCharacter::force()
+{
+    typedef FluidScene::EKind EKind;
+    const vector<FluidScene::Region>& regions = _scene.regions();
+    GLenum drawBuffers;
+
+    _gpuTimer.begin(FluidProfiler::EStage::FORCE);
+    _forceShader.pushProgram();
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+    glDrawBuffers(1, &(drawBuffers = GL_COLOR_ATTACHMENT0));
+    glBindTexture(GL_TEXTURE_2D, _frontierTex);
+    glEnable(GL_SCISSOR_TEST);
+    glBlendFunc(GL_ONE, GL_ONE);
+
+    // Fields are drawn in place, sources replace and the others add.
+    // Only the components the CPU solver forces are written.
+    for(size_t r=0; r < regions.size(); ++r)
+    {
+        const FluidScene::Region& region = regions[r];
+        if(!FluidScene::active(region, _sceneStep) || _scene.cellCount((int) r) == 0)
+            continue;
+
+        const bool hold = region.kind == EKind::SOURCE;
+        const float a = FluidScene::amplitude(region, _sceneStep) * (hold ? 1.0f : _dt);
+        const FluidTile& bounds = _scene.bounds((int) r);
+        glScissor(bounds.i0, bounds.j0, bounds.i1 - bounds.i0, bounds.j1 - bounds.j0);
+        if(hold)
+            glDisable(GL_BLEND);
+        else
+            glEnable(GL_BLEND);
+
+        _forceShader.setVec4f("Coords", Vec4f(region.coords[0], region.coords[1],
+                                              region.coords[2], region.coords[3]));
+        _forceShader.setInt("Circle", region.shape == FluidScene::EShape::CIRCLE);
+
+        struct {bool has; unsigned int texId; Vec4f value; int components;}
+        fields[] = {
+            {region.hasDye,      _dyeTex[FETCH_TEX],      region.dye * a, 4},
+            {region.hasHeat,     _heatTex[FETCH_TEX],
+                Vec4f(region.heat * a, 0, 0, 0), 1},
+            {region.hasVelocity, _velocityTex[FETCH_TEX],
+                Vec4f(region.velocity[0] * a, region.velocity[1] * a, 0, 0), 2}
+        };
+        for(const auto& f : fields)
+        {
+            if(!f.has)
+                continue;
+            glColorMask(GL_TRUE, f.components > 1, f.components > 2, f.components > 3);
+            glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                   GL_TEXTURE_2D,       f.texId, 0);
+            _forceShader.setVec4f("Value", f.value);
+            glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        }
+    }
+
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+    _forceShader.popProgram();
+    _gpuTimer.end();
 }
 
 void FluidCharacter::advect()
 {
     GLenum drawBuffers;
 
+    _gpuTimer.begin(FluidProfiler::EStage::ADVECT);
     _advectShader.pushProgram();
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
     glDrawBuffers(1, &(drawBuffers = GL_COLOR_ATTACHMENT0));
@@ -401,59 +934,292 @@ void FluidCharacter::advect()
     swap(_velocityTex[FETCH_TEX], _velocityTex[DRAW_TEX]);
 
     _advectShader.popProgram();
+    _gpuTimer.end();
 }
 
-void FluidCharacter::diffuse()
+void FluidCharacter::advectFused()
+{
+    GLenum drawBuffers [] = {
+        GL_COLOR_ATTACHMENT0,
+        GL_COLOR_ATTACHMENT1,
+        GL_COLOR_ATTACHMENT2
+    };
+
+    _gpuTimer.begin(FluidProfiler::EStage::ADVECT);
+    _advectFusedShader.pushProgram();
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+    glDrawBuffers(3, drawBuffers);
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, _frontierTex);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, _velocityTex[FETCH_TEX]);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, _heatTex[FETCH_TEX]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _dyeTex[FETCH_TEX]);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D,       _dyeTex[DRAW_TEX],      0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                           GL_TEXTURE_2D,       _heatTex[DRAW_TEX],     0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT2,
+                           GL_TEXTURE_2D,       _velocityTex[DRAW_TEX], 0);
+
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    // Later passes only draw to their own attachments
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                           GL_TEXTURE_2D, 0, 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT2,
+                           GL_TEXTURE_2D, 0, 0);
+
+    swap(_dyeTex[FETCH_TEX],      _dyeTex[DRAW_TEX]);
+    swap(_heatTex[FETCH_TEX],     _heatTex[DRAW_TEX]);
+    swap(_velocityTex[FETCH_TEX], _velocityTex[DRAW_TEX]);
+
+    _advectFusedShader.popProgram();
+    _gpuTimer.end();
+}
+
+void FluidCharacter::correctAdvection()
 {
+    typedef FluidAdvection::EScheme EScheme;
     GLenum drawBuffers;
 
-    _jacobiShader.pushProgram();
+    // The semi-Lagrangian step is in FETCH, the source fields in DRAW
+    struct {unsigned int* tex; FluidFieldLayout::EField field;} fields[] = {
+        {_dyeTex,      FluidFieldLayout::EField::DYE},
+        {_heatTex,     FluidFieldLayout::EField::HEAT},
+        {_velocityTex, FluidFieldLayout::EField::VELOCITY}
+    };
+    const int revert = _advection.limiter() == FluidAdvection::ELimiter::REVERT;
 
+    _gpuTimer.begin(FluidProfiler::EStage::ADVECT);
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
     glDrawBuffers(1, &(drawBuffers = GL_COLOR_ATTACHMENT0));
 
-    const int NB_ITERATIONS = 60;
-
-
-    // Velocity
-    _jacobiShader.setFloat("Alpha", DX*DX / (VISCOSITY*DT));
-    _jacobiShader.setFloat("rBeta", 1.0f / (4.0f + DX*DX/(VISCOSITY*DT)) );
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, _frontierTex);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, _velocityTex[DRAW_TEX]);
 
-    for(int i=0; i < (NB_ITERATIONS/2)*2; ++i)
+    for(int f=0; f<3; ++f)
     {
+        unsigned int* tex = fields[f].tex;
+        EScheme scheme = _advection.scheme(fields[f].field);
+        if(scheme == EScheme::SEMI_LAGRANGIAN)
+            continue;
+
+        media::GlProgram& first = scheme == EScheme::MACCORMACK ?
+            _maccormackShader : _bfeccCompensateShader;
+        first.pushProgram();
+        if(scheme == EScheme::MACCORMACK)
+            first.setInt("Revert", revert);
         glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, _velocityTex[FETCH_TEX]);
+        glBindTexture(GL_TEXTURE_2D, tex[FETCH_TEX]);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _velocityTex[FETCH_TEX]);
+        glBindTexture(GL_TEXTURE_2D, tex[DRAW_TEX]);
         glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                               GL_TEXTURE_2D,       _velocityTex[DRAW_TEX], 0);
-
+                               GL_TEXTURE_2D,       _advectTex[f], 0);
         glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        first.popProgram();
 
-        // Swap textures
-        swap(_velocityTex[FETCH_TEX], _velocityTex[DRAW_TEX]);
-    }
+        if(scheme == EScheme::MACCORMACK)
+        {
+            swap(tex[FETCH_TEX], _advectTex[f]);
+            continue;
+        }
 
-    // Heat
-    _jacobiShader.setFloat("Alpha", DX*DX / (HEATDIFF*DT));
-    _jacobiShader.setFloat("rBeta", 1.0f / (4.0f + DX*DX/(HEATDIFF*DT)) );
-    for(int i=0; i < (NB_ITERATIONS/2)*2; ++i)
-    {
+        // Advects the compensated source over the semi-Lagrangian step
+        _bfeccAdvectShader.pushProgram();
+        _bfeccAdvectShader.setInt("Revert", revert);
         glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, _heatTex[FETCH_TEX]);
+        glBindTexture(GL_TEXTURE_2D, _advectTex[f]);
         glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, _heatTex[FETCH_TEX]);
         glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                               GL_TEXTURE_2D,       _heatTex[DRAW_TEX], 0);
+                               GL_TEXTURE_2D,       tex[FETCH_TEX], 0);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        _bfeccAdvectShader.popProgram();
+    }
+
+    _gpuTimer.end();
+}
+
+void FluidCharacter::diffuse()
+{
+    GLenum drawBuffers;
+
+    _jacobiShader.pushProgram();
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+    glDrawBuffers(1, &(drawBuffers = GL_COLOR_ATTACHMENT0));
+
+
+    // Velocity
+    _gpuTimer.begin(FluidProfiler::EStage::DIFFUSE_VELOCITY);
+    _jacobiShader.setFloat("Alpha", DX*DX / (VISCOSITY*_dt));
+    _jacobiShader.setFloat("rBeta", 1.0f / (4.0f + DX*DX/(VISCOSITY*_dt)) );
+    _velocityDiffuseStats = jacobiSolve(_velocityTex, 0, _diffuseCriterion);
+    _gpuTimer.end();
+
+    // Heat
+    _gpuTimer.begin(FluidProfiler::EStage::DIFFUSE_HEAT);
+    _jacobiShader.setFloat("Alpha", DX*DX / (HEATDIFF*_dt));
+    _jacobiShader.setFloat("rBeta", 1.0f / (4.0f + DX*DX/(HEATDIFF*_dt)) );
+    _heatDiffuseStats = jacobiSolve(_heatTex, 0, _diffuseCriterion);
+    _gpuTimer.end();
+
+
+    _jacobiShader.popProgram();
+}
+
+void FluidCharacter::reduceSpeed()
+{
+    // One readback in flight at a time, a step late or more
+    if(_speedFence != nullptr)
+        return;
+
+    GLenum drawBuffers;
 
+    _gpuTimer.begin(FluidProfiler::EStage::TIMESTEP);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+    glDrawBuffers(1, &(drawBuffers = GL_COLOR_ATTACHMENT0));
+
+    // Mipmaps average, each level here keeps the max of 4x4 texels
+    _maxSpeedShader.pushProgram();
+    glActiveTexture(GL_TEXTURE0);
+    unsigned int srcTex = _velocityTex[FETCH_TEX];
+    Vec2f srcSize(WIDTH, HEIGHT);
+    for(size_t l=0; l < _speedLevels.size(); ++l)
+    {
+        const SpeedLevel& level = _speedLevels[l];
+        _maxSpeedShader.setInt("FromVelocity", l == 0 ? 1 : 0);
+        _maxSpeedShader.setVec2f("Size", srcSize);
+        glBindTexture(GL_TEXTURE_2D, srcTex);
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D,       level.tex, 0);
+        glViewport(0, 0, level.width, level.height);
         glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        srcTex = level.tex;
+        srcSize = Vec2f(level.width, level.height);
+    }
+    _maxSpeedShader.popProgram();
+    glViewport(0, 0, WIDTH, HEIGHT);
 
-        // Swap textures
-        swap(_heatTex[FETCH_TEX], _heatTex[DRAW_TEX]);
+    const SpeedLevel& top = _speedLevels.back();
+    if(_speedPbo == 0)
+    {
+        glGenBuffers(1, &_speedPbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _speedPbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, top.width * top.height * sizeof(float),
+                     nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _speedPbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, top.tex, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glReadPixels(0, 0, top.width, top.height, GL_RED, GL_FLOAT, 0);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    _speedFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _gpuTimer.end();
+}
+
+void FluidCharacter::readSpeed()
+{
+    if(_speedFence == nullptr)
+        return;
+
+    GLsync fence = (GLsync) _speedFence;
+    if(glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        return;
+    glDeleteSync(fence);
+    _speedFence = nullptr;
+
+    const SpeedLevel& top = _speedLevels.back();
+    float peak = 0.0f;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _speedPbo);
+    const float* texels = (const float*) glMapBuffer(GL_PIXEL_PACK_BUFFER,
+                                                     GL_READ_ONLY);
+    if(texels)
+    {
+        for(int i=0; i < top.width * top.height; ++i)
+            peak = max(peak, texels[i]);
     }
+    bool mapped = glUnmapBuffer(GL_PIXEL_PACK_BUFFER) == GL_TRUE && texels;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if(!mapped)
+        return;
+
+    // Same rule as the CPU solver's, from the speed of the step before
+    _maxSpeed = sqrt(peak);
+    float dt = _maxDt;
+    if(_maxSpeed * _maxDt > _cfl * DX)
+        dt = max(_minDt, _cfl * DX / _maxSpeed);
+    applyTimestep(dt);
+}
 
+void FluidCharacter::applyTimestep(float dt)
+{
+    _dt = dt;
 
-    _jacobiShader.popProgram();
+    media::GlProgram* advections[] = {
+        &_advectShader, &_advectFusedShader, &_maccormackShader,
+        &_bfeccCompensateShader, &_bfeccAdvectShader
+    };
+    for(media::GlProgram* program : advections)
+    {
+        program->pushProgram();
+        program->setFloat("Dt", _dt);
+        program->popProgram();
+    }
+
+    // Buoyancy is given per unit of the fixed timestep
+    media::GlProgram* lifts[] = {&_heatShader, &_heatDivergenceShader};
+    for(media::GlProgram* program : lifts)
+    {
+        program->pushProgram();
+        program->setFloat("TimeScale", _dt / DT);
+        program->popProgram();
+    }
+}
+
+void FluidCharacter::confineVorticity()
+{
+    GLenum drawBuffers;
+
+    _gpuTimer.begin(FluidProfiler::EStage::VORTICITY);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+    glDrawBuffers(1, &(drawBuffers = GL_COLOR_ATTACHMENT0));
+
+    _vorticityShader.pushProgram();
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, _frontierTex);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _velocityTex[FETCH_TEX]);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D,       _curlTex, 0);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    _vorticityShader.popProgram();
+
+    _confineShader.pushProgram();
+    _confineShader.setFloat("Scale", _vorticity * DX * _dt);
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, _frontierTex);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, _curlTex);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _velocityTex[FETCH_TEX]);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D,       _velocityTex[DRAW_TEX], 0);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    swap(_velocityTex[FETCH_TEX], _velocityTex[DRAW_TEX]);
+    _confineShader.popProgram();
+    _gpuTimer.end();
 }
 
 void FluidCharacter::heat()
@@ -463,6 +1229,7 @@ void FluidCharacter::heat()
         GL_COLOR_ATTACHMENT1,
     };
 
+    _gpuTimer.begin(FluidProfiler::EStage::HEAT);
     _heatShader.pushProgram();
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
     glDrawBuffers(2, drawBuffers);
@@ -481,12 +1248,14 @@ void FluidCharacter::heat()
     swap(_velocityTex[FETCH_TEX], _velocityTex[DRAW_TEX]);
 
     _heatShader.popProgram();
+    _gpuTimer.end();
 }
 
 void FluidCharacter::computePressure()
 {
     GLenum drawBuffers;
 
+    _gpuTimer.begin(FluidProfiler::EStage::DIVERGENCE);
     _divergenceShader.pushProgram();
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
     glDrawBuffers(1, &(drawBuffers = GL_COLOR_ATTACHMENT0));
@@ -496,39 +1265,147 @@ void FluidCharacter::computePressure()
                            GL_TEXTURE_2D,       _tempDivTex, 0);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
     _divergenceShader.popProgram();
+    _gpuTimer.end();
 
+    solvePressure();
+}
 
+void FluidCharacter::solvePressure()
+{
+    GLenum drawBuffers;
 
+    _gpuTimer.begin(FluidProfiler::EStage::PRESSURE_SOLVE);
     _jacobiShader.pushProgram();
     _jacobiShader.setFloat("Alpha", -DX*DX);
     _jacobiShader.setFloat("rBeta", 1.0f / 4.0f);
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
     glDrawBuffers(1, &(drawBuffers = GL_COLOR_ATTACHMENT0));
 
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, _tempDivTex);
-    glActiveTexture(GL_TEXTURE0);
+    _pressureStats = jacobiSolve(_pressureTex, _tempDivTex, _pressureCriterion);
+
+    _jacobiShader.popProgram();
+    _gpuTimer.end();
+}
 
-    const int NB_ITERATIONS = 200;
-    for(int i=0; i < (NB_ITERATIONS/2)*2; ++i)
+ConvergenceStats FluidCharacter::jacobiSolve(unsigned int tex[2],
+                                             unsigned int bTex,
+                                             const ConvergenceCriterion& criterion)
+{
+    ConvergenceStats stats;
+    const int nbIterations = (criterion.maxIterations/2)*2;
+    const bool early = criterion.tolerance > 0.0f && criterion.checkInterval > 0;
+    int queued = 0;
+    int read = 0;
+
+    while(stats.iterations < nbIterations)
     {
-        glBindTexture(GL_TEXTURE_2D, _pressureTex[FETCH_TEX]);
+        ++stats.iterations;
+
+        // A zero b texture solves against the current iterate
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, bTex != 0 ? bTex : tex[FETCH_TEX]);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, tex[FETCH_TEX]);
         glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                               GL_TEXTURE_2D,       _pressureTex[DRAW_TEX], 0);
+                               GL_TEXTURE_2D,       tex[DRAW_TEX], 0);
 
         glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 
         // Swap textures
-        swap(_pressureTex[FETCH_TEX], _pressureTex[DRAW_TEX]);
+        swap(tex[FETCH_TEX], tex[DRAW_TEX]);
+
+        // Only measured with an active criterion, a check is skipped when
+        // every slot is still in flight
+        if(early && (stats.iterations % criterion.checkInterval == 0 ||
+                     stats.iterations == nbIterations))
+        {
+            if(queued - read < RESIDUAL_LATENCY)
+            {
+                measureUpdate(tex[FETCH_TEX], tex[DRAW_TEX],
+                              queued % RESIDUAL_LATENCY);
+                ++queued;
+            }
+
+            bool converged = false;
+            while(read < queued &&
+                  readUpdate(read % RESIDUAL_LATENCY, stats.residual))
+            {
+                ++read;
+                converged = converged || stats.residual <= criterion.tolerance;
+            }
+            if(converged)
+                break;
+        }
     }
 
-    _jacobiShader.popProgram();
+    // Readbacks still in flight are dropped
+    for(; read < queued; ++read)
+    {
+        ResidualSlot& slot = _residualSlots[read % RESIDUAL_LATENCY];
+        glDeleteSync((GLsync) slot.fence);
+        slot.fence = nullptr;
+    }
+
+    return stats;
+}
+
+void FluidCharacter::measureUpdate(unsigned int newTex, unsigned int oldTex,
+                                   int slot)
+{
+    _residualShader.pushProgram();
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, oldTex);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, newTex);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D,       _residualTex, 0);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    // The last mipmap level holds the mean squared update
+    glBindTexture(GL_TEXTURE_2D, _residualTex);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    if(_residualSlots.empty())
+        _residualSlots.assign(RESIDUAL_LATENCY, ResidualSlot{0, nullptr});
+    ResidualSlot& target = _residualSlots[slot];
+    if(target.pbo == 0)
+    {
+        glGenBuffers(1, &target.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, target.pbo);
+        glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(float), nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, target.pbo);
+    glGetTexImage(GL_TEXTURE_2D, _residualTopLevel, GL_RED, GL_FLOAT, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    target.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    _residualShader.popProgram();
+}
+
+bool FluidCharacter::readUpdate(int slot, float& residual)
+{
+    ResidualSlot& source = _residualSlots[slot];
+    GLsync fence = (GLsync) source.fence;
+    if(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+        return false;
+    glDeleteSync(fence);
+    source.fence = nullptr;
+
+    float meanSquare = 0.0f;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, source.pbo);
+    glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(float), &meanSquare);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    residual = sqrt(meanSquare);
+    return true;
 }
 
 void FluidCharacter::substractPressureGradient()
 {
     GLenum drawBuffers;
 
+    _gpuTimer.begin(FluidProfiler::EStage::GRADIENT_SUB);
     _gradSubShader.pushProgram();
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
     glDrawBuffers(1, &(drawBuffers = GL_COLOR_ATTACHMENT0));
@@ -544,6 +1421,7 @@ void FluidCharacter::substractPressureGradient()
     swap(_velocityTex[FETCH_TEX], _velocityTex[DRAW_TEX]);
 
     _gradSubShader.popProgram();
+    _gpuTimer.end();
 }
 
 void FluidCharacter::frontier()
@@ -553,7 +1431,152 @@ void FluidCharacter::frontier()
         GL_COLOR_ATTACHMENT1,
     };
 
-    _frontierShader.pushProgram();
+    _gpuTimer.begin(FluidProfiler::EStage::FRONTIER);
+    glBindVertexArray(_boundaryVao);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+    glDrawBuffers(2, drawBuffers);
+
+    // Obstacle cells are computed in the DRAW textures...
+    _frontierScatterShader.pushProgram();
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D,       _velocityTex[DRAW_TEX], 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                           GL_TEXTURE_2D,       _pressureTex[DRAW_TEX], 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, _pressureTex[FETCH_TEX]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _velocityTex[FETCH_TEX]);
+    glDrawArrays(GL_POINTS, 0, _boundaryPoints);
+    _frontierScatterShader.popProgram();
+
+    // ...and copied back, the FETCH textures hold every other cell already
+    _frontierCommitShader.pushProgram();
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D,       _velocityTex[FETCH_TEX], 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                           GL_TEXTURE_2D,       _pressureTex[FETCH_TEX], 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, _pressureTex[DRAW_TEX]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _velocityTex[DRAW_TEX]);
+    glDrawArrays(GL_POINTS, 0, _boundaryPoints);
+    _frontierCommitShader.popProgram();
+
+    _vao.bind();
+    _gpuTimer.end();
+}
+
+void FluidCharacter::uploadBoundary()
+{
+    vector<float> points;
+    points.reserve((_boundary.cells().size() + _boundary.buriedCount()) * 6);
+    for(const FluidBoundary::Cell& cell : _boundary.cells())
+    {
+        // The shader wants the 4 weights, null ones included
+        float weights[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for(int n=0; n < cell.count; ++n)
+        {
+            int ni = cell.neighbors[n] % WIDTH;
+            int nj = cell.neighbors[n] / WIDTH;
+            int d = ni < cell.i ? 0 : ni > cell.i ? 1 : nj < cell.j ? 2 : 3;
+            weights[d] = cell.weights[n];
+        }
+        points.insert(points.end(), {(float) cell.i, (float) cell.j,
+                                     weights[0], weights[1], weights[2], weights[3]});
+    }
+    for(const FluidBoundary::Span& span : _boundary.buriedSpans())
+        for(int i=span.i0; i < span.i1; ++i)
+            points.insert(points.end(), {(float) i, (float) span.j,
+                                         0.0f, 0.0f, 0.0f, 0.0f});
+
+    _boundaryPoints = (int) points.size() / 6;
+    glBindBuffer(GL_ARRAY_BUFFER, _boundaryVbo);
+    glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(float),
+                 points.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void FluidCharacter::editFrontier(const FluidTile& region, float value)
+{
+    if(BACKEND == EBackend::CPU)
+    {
+        _solver->editFrontier(region, value);
+        return;
+    }
+
+    FluidTile clipped(max(region.i0, 0), max(region.j0, 0),
+                      min(region.i1, WIDTH), min(region.j1, HEIGHT));
+    if(clipped.i0 >= clipped.i1 || clipped.j0 >= clipped.j1)
+        return;
+
+    // Only the region is uploaded
+    const int components = _frontierGrid.components();
+    _uploadBuffer.clear();
+    for(int j=clipped.j0; j<clipped.j1; ++j)
+    {
+        for(int i=clipped.i0; i<clipped.i1; ++i)
+        {
+            for(int c=0; c < components; ++c)
+            {
+                _frontierGrid.plane(c)[j*WIDTH + i] = value;
+                _uploadBuffer.push_back(value);
+            }
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, _frontierTex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, clipped.i0, clipped.j0,
+                    clipped.i1 - clipped.i0, clipped.j1 - clipped.j0,
+                    glPixelFormat(components), GL_FLOAT, _uploadBuffer.data());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    _boundary.update(_frontierGrid, clipped);
+    uploadBoundary();
+}
+
+void FluidCharacter::heatDivergence()
+{
+    GLenum drawBuffers [] = {
+        GL_COLOR_ATTACHMENT0,
+        GL_COLOR_ATTACHMENT1,
+        GL_COLOR_ATTACHMENT2
+    };
+
+    _gpuTimer.begin(FluidProfiler::EStage::HEAT_DIVERGENCE);
+    _heatDivergenceShader.pushProgram();
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
+    glDrawBuffers(3, drawBuffers);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, _heatTex[FETCH_TEX]);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, _velocityTex[FETCH_TEX]);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D,       _velocityTex[DRAW_TEX], 0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                           GL_TEXTURE_2D,       _heatTex[DRAW_TEX],     0);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT2,
+                           GL_TEXTURE_2D,       _tempDivTex,            0);
+
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT2,
+                           GL_TEXTURE_2D, 0, 0);
+    swap(_heatTex[FETCH_TEX],     _heatTex[DRAW_TEX]);
+    swap(_velocityTex[FETCH_TEX], _velocityTex[DRAW_TEX]);
+
+    _heatDivergenceShader.popProgram();
+    _gpuTimer.end();
+}
+
+void FluidCharacter::substractGradientFrontier()
+{
+    GLenum drawBuffers [] = {
+        GL_COLOR_ATTACHMENT0,
+        GL_COLOR_ATTACHMENT1,
+    };
+
+    _gpuTimer.begin(FluidProfiler::EStage::GRADIENT_FRONTIER);
+    _gradSubFrontierShader.pushProgram();
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _fbo);
     glDrawBuffers(2, drawBuffers);
 
@@ -574,11 +1597,13 @@ void FluidCharacter::frontier()
     swap(_velocityTex[FETCH_TEX], _velocityTex[DRAW_TEX]);
     swap(_pressureTex[FETCH_TEX], _pressureTex[DRAW_TEX]);
 
-    _frontierShader.popProgram();
+    _gradSubFrontierShader.popProgram();
+    _gpuTimer.end();
 }
 
 void FluidCharacter::drawFluid()
 {
+    _gpuTimer.begin(FluidProfiler::EStage::DRAW);
     _drawShader.pushProgram();
 
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
@@ -597,13 +1622,400 @@ void FluidCharacter::drawFluid()
     glPointSize(1.0f);
 
     _drawShader.popProgram();
+    _gpuTimer.end();
+}
+
+void FluidCharacter::uploadSolverFields()
+{
+    const FluidGrid* grids[] = {
+        &_solver->dyeGrid(),
+        &_solver->velocityGrid(),
+        &_solver->pressureGrid(),
+        &_solver->heatGrid()
+    };
+    const unsigned int texIds[] = {
+        _dyeTex[FETCH_TEX],
+        _velocityTex[FETCH_TEX],
+        _pressureTex[FETCH_TEX],
+        _heatTex[FETCH_TEX]
+    };
+
+    for(int i=0; i<4; ++i)
+        uploadTexture(texIds[i], *grids[i]);
+}
+
+void FluidCharacter::updateStageTimes()
+{
+    for(int s=0; s < FluidProfiler::STAGE_COUNT; ++s)
+    {
+        FluidProfiler::EStage stage = (FluidProfiler::EStage) s;
+        if(!_profiler.ran(stage))
+        {
+            _stageTimes[s]->setText("");
+            continue;
+        }
+
+        ostringstream text;
+        text << FluidProfiler::stageName(stage) << " "
+             << fixed << setprecision(2) << _profiler.average(stage) << " ms "
+             << FluidProfiler::clockName(_profiler.clock(stage));
+        _stageTimes[s]->setText(text.str());
+    }
+}
+
+bool FluidCharacter::openTrace(const string& fileName)
+{
+    return _profiler.openTrace(fileName);
+}
+
+void FluidCharacter::setSnapshotFile(const string& fileName)
+{
+    _snapshotFile = fileName;
+}
+
+void FluidCharacter::saveSnapshot()
+{
+    if(BACKEND == EBackend::CPU)
+    {
+        string error;
+        if(_solver->saveSnapshot(_snapshotFile, error))
+            cout << "Snapshot saved to " << _snapshotFile << endl;
+        else
+            cerr << "Could not save snapshot : " << error << endl;
+        return;
+    }
+
+    // One readback in flight at a time
+    if(_snapshotFence != nullptr)
+        return;
+
+    typedef FluidFieldLayout::EField EField;
+    const EField FIELDS[FluidSnapshot::FIELD_COUNT] = {
+        EField::DYE, EField::VELOCITY, EField::PRESSURE,
+        EField::HEAT, EField::FRONTIER
+    };
+    const unsigned int texIds[FluidSnapshot::FIELD_COUNT] = {
+        _dyeTex[FETCH_TEX], _velocityTex[FETCH_TEX], _pressureTex[FETCH_TEX],
+        _heatTex[FETCH_TEX], _frontierTex
+    };
+
+    int floats = 0;
+    for(EField field : FIELDS)
+        floats += AREA * LAYOUT.components(field);
+
+    if(_snapshotPbo == 0)
+        glGenBuffers(1, &_snapshotPbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _snapshotPbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, floats * sizeof(float),
+                 nullptr, GL_STREAM_READ);
+
+    // Fields are packed back to back as texels of their component count
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    size_t offset = 0;
+    for(int f=0; f < FluidSnapshot::FIELD_COUNT; ++f)
+    {
+        int components = LAYOUT.components(FIELDS[f]);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, texIds[f], 0);
+        glReadPixels(0, 0, WIDTH, HEIGHT, glPixelFormat(components),
+                     GL_FLOAT, (void*) offset);
+        offset += AREA * components * sizeof(float);
+    }
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    _snapshotFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _snapshotStep = _stepCount;
+    _snapshotTime = _time;
+    _snapshotSceneStep = _sceneStep;
+    _snapshotCandlePos = _candlePos;
+}
+
+void FluidCharacter::writePendingSnapshot()
+{
+    if(_snapshotFence == nullptr)
+        return;
+
+    GLsync fence = (GLsync) _snapshotFence;
+    if(glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        return;
+    glDeleteSync(fence);
+    _snapshotFence = nullptr;
+
+    typedef FluidFieldLayout::EField EField;
+    FluidGrid grids[FluidSnapshot::FIELD_COUNT];
+    const FluidGrid* fields[FluidSnapshot::FIELD_COUNT];
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, _snapshotPbo);
+    const float* texels = (const float*) glMapBuffer(GL_PIXEL_PACK_BUFFER,
+                                                     GL_READ_ONLY);
+    for(int f=0; f < FluidSnapshot::FIELD_COUNT; ++f)
+    {
+        grids[f].resize(WIDTH, HEIGHT, LAYOUT.components((EField) f));
+        if(texels)
+        {
+            grids[f].deinterleave(texels);
+            texels += grids[f].area() * grids[f].components();
+        }
+        fields[f] = &grids[f];
+    }
+    bool mapped = glUnmapBuffer(GL_PIXEL_PACK_BUFFER) == GL_TRUE && texels;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    FluidSnapshot::Parameters parameters;
+    parameters.dx = DX;
+    parameters.dt = DT;
+    parameters.viscosity = VISCOSITY;
+    parameters.heatDiffusion = HEATDIFF;
+    parameters.candleX = _snapshotCandlePos[0];
+    parameters.candleY = _snapshotCandlePos[1];
+    parameters.time = _snapshotTime;
+    parameters.sceneStep = _snapshotSceneStep;
+
+    string error = "Readback buffer lost";
+    if(mapped && FluidSnapshot::save(_snapshotFile, _snapshotStep,
+                                     parameters, fields, error))
+        cout << "Snapshot saved to " << _snapshotFile << endl;
+    else
+        cerr << "Could not save snapshot : " << error << endl;
+}
+
+bool FluidCharacter::loadSnapshot()
+{
+    FluidSnapshot snapshot;
+    if(!snapshot.open(_snapshotFile))
+    {
+        cerr << "Could not load snapshot : " << snapshot.error() << endl;
+        return false;
+    }
+    if(snapshot.width() != WIDTH || snapshot.height() != HEIGHT)
+    {
+        cerr << "Could not load snapshot : it is "
+             << snapshot.width() << "x" << snapshot.height() << endl;
+        return false;
+    }
+
+    if(BACKEND == EBackend::CPU)
+    {
+        string error;
+        if(!_solver->loadSnapshot(snapshot, error))
+        {
+            cerr << "Could not load snapshot : " << error << endl;
+            return false;
+        }
+        _stepsSinceRender = max(_stepsSinceRender, 1);
+    }
+    else
+    {
+        typedef FluidFieldLayout::EField EField;
+        struct {EField field; unsigned int texId;} fields[] = {
+            {EField::DYE,      _dyeTex[FETCH_TEX]},
+            {EField::VELOCITY, _velocityTex[FETCH_TEX]},
+            {EField::PRESSURE, _pressureTex[FETCH_TEX]},
+            {EField::HEAT,     _heatTex[FETCH_TEX]},
+            {EField::FRONTIER, _frontierTex}
+        };
+        for(const auto& f : fields)
+        {
+            FluidGrid grid(WIDTH, HEIGHT, LAYOUT.components(f.field));
+            snapshot.read(f.field, grid);
+            if(f.field == EField::FRONTIER)
+                _frontierGrid = grid;
+            grid.interleave(_uploadBuffer);
+            glBindTexture(GL_TEXTURE_2D, f.texId);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, WIDTH, HEIGHT,
+                            glPixelFormat(grid.components()), GL_FLOAT,
+                            _uploadBuffer.data());
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        _boundary.build(_frontierGrid);
+        uploadBoundary();
+    }
+
+    const FluidSnapshot::Parameters& parameters = snapshot.parameters();
+    setCandlePosition(Vec2f(parameters.candleX, parameters.candleY));
+    _stepCount = snapshot.stepCount();
+    _time = parameters.time;
+    _sceneStep = parameters.sceneStep;
+    cout << "Snapshot of step " << _stepCount << " loaded from "
+         << _snapshotFile << endl;
+    return true;
+}
+
+void FluidCharacter::setExport(const string& fileName,
+                               const vector<FluidFieldLayout::EField>& fields,
+                               FluidExporter::EEncoding encoding)
+{
+    _exportFile = fileName;
+    _exportFields = fields;
+    _exporter.setEncoding(encoding);
+}
+
+void FluidCharacter::exportStep()
+{
+    if(!_exporter.isOpen())
+        return;
+
+    if(BACKEND == EBackend::CPU)
+    {
+        _solver->exportFields(_exporter);
+        return;
+    }
+
+    // The slot is the oldest of the ring, waiting on it keeps the order
+    ExportSlot& slot = _exportSlots[_exportNext];
+    if(slot.fence != nullptr)
+    {
+        ++_exportStalls;
+        glClientWaitSync((GLsync) slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                         GL_TIMEOUT_IGNORED);
+        collectExports(false);
+    }
+
+    typedef FluidFieldLayout::EField EField;
+    _gpuTimer.begin(FluidProfiler::EStage::EXPORT);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    size_t offset = 0;
+    for(EField field : _exportFields)
+    {
+        unsigned int texId = 0;
+        switch(field)
+        {
+        case EField::DYE :        texId = _dyeTex[FETCH_TEX];      break;
+        case EField::VELOCITY :   texId = _velocityTex[FETCH_TEX]; break;
+        case EField::PRESSURE :   texId = _pressureTex[FETCH_TEX]; break;
+        case EField::HEAT :       texId = _heatTex[FETCH_TEX];     break;
+        case EField::FRONTIER :   texId = _frontierTex;            break;
+        case EField::DIVERGENCE : texId = _tempDivTex;             break;
+        }
+
+        int components = LAYOUT.components(field);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, texId, 0);
+        glReadPixels(0, 0, WIDTH, HEIGHT, glPixelFormat(components),
+                     GL_FLOAT, (void*) offset);
+        offset += AREA * components * sizeof(float);
+    }
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    _gpuTimer.end();
+
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.step = _stepCount;
+    _exportNext = (_exportNext + 1) % EXPORT_LATENCY;
+
+    collectExports(false);
+}
+
+void FluidCharacter::collectExports(bool wait)
+{
+    // Oldest first, so frames reach the exporter in order
+    for(int k=0; k < (int) _exportSlots.size(); ++k)
+    {
+        ExportSlot& slot = _exportSlots[(_exportNext + k) % EXPORT_LATENCY];
+        if(slot.fence == nullptr)
+            continue;
+
+        GLsync fence = (GLsync) slot.fence;
+        GLenum status = glClientWaitSync(fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+                                         wait ? GL_TIMEOUT_IGNORED : 0);
+        if(status == GL_TIMEOUT_EXPIRED)
+            break;
+        glDeleteSync(fence);
+        slot.fence = nullptr;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        const float* texels = (const float*) glMapBuffer(GL_PIXEL_PACK_BUFFER,
+                                                         GL_READ_ONLY);
+        FluidExporter::Frame* frame = texels ? _exporter.acquire() : nullptr;
+        if(frame)
+        {
+            // Texels to planes, field by field
+            float* dst = frame->data.data();
+            for(int f=0; f < (int) _exportFields.size(); ++f)
+            {
+                const int components = _exporter.components(f);
+                for(int c=0; c < components; ++c, dst += AREA)
+                    for(int i=0; i < AREA; ++i)
+                        dst[i] = texels[i * components + c];
+                texels += AREA * components;
+            }
+            frame->step = slot.step;
+            _exporter.submit(frame);
+        }
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
 }
 
 void FluidCharacter::exitStage()
 {
+    if(_exporter.isOpen())
+    {
+        collectExports(true);
+        for(ExportSlot& slot : _exportSlots)
+            glDeleteBuffers(1, &slot.pbo);
+        _exportSlots.clear();
+        string error;
+        if(!_exporter.close(error))
+            cerr << "Export to " << _exportFile << " incomplete : " << error << endl;
+
+        FluidExporter::Stats stats = _exporter.stats();
+        cout << "Exported " << stats.written << " frames to " << _exportFile
+             << ", " << stats.dropped << " dropped, " << stats.failed << " failed, "
+             << (double) stats.rawBytes / max(stats.fileBytes, 1ULL)
+             << "x compression, waited " << stats.blockedMs
+             << " ms on the writer and " << _exportStalls
+             << " times on the GPU" << endl;
+    }
+
+    if(_snapshotFence != nullptr)
+    {
+        glClientWaitSync((GLsync) _snapshotFence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                         GL_TIMEOUT_IGNORED);
+        writePendingSnapshot();
+    }
+    if(_snapshotPbo != 0)
+        glDeleteBuffers(1, &_snapshotPbo);
+    _snapshotPbo = 0;
+
+    if(_speedFence != nullptr)
+        glDeleteSync((GLsync) _speedFence);
+    _speedFence = nullptr;
+    if(_speedPbo != 0)
+        glDeleteBuffers(1, &_speedPbo);
+    _speedPbo = 0;
+
+    for(ResidualSlot& slot : _residualSlots)
+        if(slot.pbo != 0)
+            glDeleteBuffers(1, &slot.pbo);
+    _residualSlots.clear();
+
+    if(_boundaryVao != 0)
+    {
+        glDeleteVertexArrays(1, &_boundaryVao);
+        glDeleteBuffers(1, &_boundaryVbo);
+    }
+    _boundaryVao = 0;
+    _boundaryVbo = 0;
+
+    _gpuTimer.release();
+    _profiler.endFrame();
+    for(auto& stageTime : _stageTimes)
+        stage().propTeam().deleteTextHud(stageTime);
+    _stageTimes.clear();
     stage().propTeam().deleteImageHud(_statsPanel);
     stage().propTeam().deleteTextHud(_fps);
     stage().propTeam().deleteTextHud(_ups);
+    stage().propTeam().deleteTextHud(_solveStats);
 }
 
 bool FluidCharacter::keyPressEvent(const KeyboardEvent &event)
@@ -613,10 +2025,105 @@ bool FluidCharacter::keyPressEvent(const KeyboardEvent &event)
         stage().play().restart();
         return true;
     }
+    else if(event.getAscii() == 'A')
+    {
+        _fusedAdvection = !_fusedAdvection;
+        if(_solver)
+            _solver->setFusedAdvection(_fusedAdvection);
+        cout << "Advection : " << (_fusedAdvection ? "fused" : "separate")
+             << endl;
+        return true;
+    }
+    else if(event.getAscii() == 'M')
+    {
+        typedef FluidAdvection::EScheme EScheme;
+        FluidAdvection advection = _advection;
+        EScheme scheme = advection.scheme(FluidFieldLayout::EField::DYE);
+        scheme = scheme == EScheme::SEMI_LAGRANGIAN ? EScheme::MACCORMACK :
+                 scheme == EScheme::MACCORMACK ? EScheme::BFECC :
+                 EScheme::SEMI_LAGRANGIAN;
+        advection.setScheme(FluidFieldLayout::EField::DYE, scheme);
+        setAdvection(advection);
+        cout << "Dye advection : " << FluidAdvection::schemeName(scheme) << endl;
+        return true;
+    }
+    else if(event.getAscii() == 'F')
+    {
+        _fusedProjection = !_fusedProjection;
+        if(_solver)
+            _solver->setFusedProjection(_fusedProjection);
+        cout << "Projection : " << (_fusedProjection ? "fused" : "separate")
+             << endl;
+        return true;
+    }
+    else if(event.getAscii() == 'V')
+    {
+        const float STRENGTHS[] = {0.0f, 0.03f, 0.06f, 0.12f};
+        const int COUNT = sizeof(STRENGTHS) / sizeof(STRENGTHS[0]);
+        int next = 0;
+        while(next < COUNT && STRENGTHS[next] <= _vorticity)
+            ++next;
+        setVorticityConfinement(STRENGTHS[next % COUNT]);
+        cout << "Vorticity confinement : " << _vorticity << endl;
+        return true;
+    }
+    else if(event.getAscii() == 'D')
+    {
+        setAdaptiveTimestep(!_adaptiveTimestep, _cfl, _minDt, _maxDt);
+        cout << "Timestep : " << (_adaptiveTimestep ? "adaptive" : "fixed")
+             << endl;
+        return true;
+    }
+    else if(event.getAscii() == 'J')
+    {
+        // Off by default so that the solves run their fixed iterations
+        const float TOLERANCE = 1e-5f;
+        float tolerance = _pressureCriterion.tolerance > 0.0f ? 0.0f : TOLERANCE;
+        _diffuseCriterion.tolerance = tolerance;
+        _pressureCriterion.tolerance = tolerance;
+        if(_solver)
+        {
+            _solver->setDiffuseCriterion(_diffuseCriterion);
+            _solver->setPressureCriterion(_pressureCriterion);
+        }
+        cout << "Jacobi early termination : "
+             << (tolerance > 0.0f ? "on" : "off") << endl;
+        return true;
+    }
+    else if(event.getAscii() == 'T')
+    {
+        setMaxThroughput(!_maxThroughput, _renderInterval);
+        cout << "Stepping : " << (_maxThroughput ? "max throughput" : "fixed rate")
+             << endl;
+        return true;
+    }
+    else if(event.getAscii() == 'K')
+    {
+        saveSnapshot();
+        return true;
+    }
+    else if(event.getAscii() == 'L')
+    {
+        loadSnapshot();
+        return true;
+    }
+    else if(event.getAscii() == 'O')
+    {
+        const int HALF = 4;
+        int i = (int) _candlePos[0];
+        int j = (int) _candlePos[1];
+        const FluidGrid& frontier = _solver ? _solver->frontierGrid() : _frontierGrid;
+        float value = frontier.fetch(0, i, j) == 1.0f ? 0.0f : 1.0f;
+        editFrontier(FluidTile(i-HALF, j-HALF, i+HALF, j+HALF), value);
+        return true;
+    }
     else if(event.getAscii() == 'S')
     {
         _fps->setIsVisible(!_statsPanel->isVisible());
         _ups->setIsVisible(!_statsPanel->isVisible());
+        _solveStats->setIsVisible(!_statsPanel->isVisible());
+        for(auto& stageTime : _stageTimes)
+            stageTime->setIsVisible(!_statsPanel->isVisible());
         _statsPanel->setIsVisible(!_statsPanel->isVisible());
     }
 
@@ -627,11 +2134,62 @@ bool FluidCharacter::mouseMoveEvent(const scaena::MouseEvent &event)
 {
     Vec2f candlePos(event.position().x(), stage().height() - event.position().y());
     candlePos *= 2.0f / POINT_SIZE;
+    setCandlePosition(candlePos);
+    cout << candlePos << endl;
+    return true;
+}
+
+void FluidCharacter::setAdvection(const FluidAdvection& advection)
+{
+    _advection = advection;
+    if(_solver)
+        _solver->setAdvection(advection);
+}
+
+void FluidCharacter::setScene(const FluidScene& scene)
+{
+    _scene = scene;
+}
+
+void FluidCharacter::setVorticityConfinement(float strength)
+{
+    _vorticity = max(0.0f, strength);
+    if(_solver)
+        _solver->setVorticityConfinement(_vorticity);
+}
+
+void FluidCharacter::setAdaptiveTimestep(bool adaptive, float cfl,
+                                         float minDt, float maxDt)
+{
+    _adaptiveTimestep = adaptive;
+    _cfl = cfl;
+    _minDt = minDt > 0.0f ? minDt : DT / 8.0f;
+    _maxDt = maxDt > 0.0f ? max(maxDt, _minDt) : max(DT * 4.0f, _minDt);
+
+    // A reading still in flight would be taken for the next mode's
+    if(!_adaptiveTimestep && _speedFence != nullptr)
+    {
+        glDeleteSync((GLsync) _speedFence);
+        _speedFence = nullptr;
+    }
+
+    if(_solver)
+        _solver->setAdaptiveTimestep(_adaptiveTimestep, _cfl, _minDt, _maxDt);
+    else if(!_adaptiveTimestep && _texturesAllocated)
+        applyTimestep(DT);
+}
+
+void FluidCharacter::setCandlePosition(const Vec2f& candlePos)
+{
+    _candlePos = candlePos;
     _heatShader.pushProgram();
     _heatShader.setVec2f("MousePos", candlePos);
     _heatShader.popProgram();
-    cout << candlePos << endl;
-    return true;
+    _heatDivergenceShader.pushProgram();
+    _heatDivergenceShader.setVec2f("MousePos", candlePos);
+    _heatDivergenceShader.popProgram();
+    if(_solver)
+        _solver->setCandlePosition(candlePos);
 }
 
 void FluidCharacter::notify(media::CameraMsg &)
@@ -2,6 +2,8 @@
 #define FLUID_CHARACTER_H
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include <DesignPattern/SpecificObserver.h>
 #include <Camera/Camera.h>
@@ -14,11 +16,30 @@
 
 #include <Character/AbstractCharacter.h>
 
+#include "FluidAdvection.h"
+#include "FluidBoundary.h"
+#include "FluidConvergence.h"
+#include "FluidExporter.h"
+#include "FluidFieldLayout.h"
+#include "FluidGpuTimer.h"
+#include "FluidGrid.h"
+#include "FluidScene.h"
+
+class FluidScheduler;
+class FluidSolver;
+
 class FluidCharacter : public scaena::AbstractCharacter,
                        public cellar::SpecificObserver<media::CameraMsg>
 {
 public:
-    FluidCharacter(scaena::AbstractStage& stage);
+    enum class EBackend {GL, CPU};
+
+    FluidCharacter(scaena::AbstractStage& stage,
+                   int width = 256,
+                   int height = 256,
+                   int pointSize = 3,
+                   EBackend backend = EBackend::GL,
+                   const FluidFieldLayout& layout = FluidFieldLayout());
     virtual ~FluidCharacter();
 
     virtual void enterStage();
@@ -32,61 +53,281 @@ public:
 
     virtual void notify(media::CameraMsg &msg);
 
-    static const int WIDTH;
-    static const int HEIGHT;
-    static const int AREA;
-    static const int POINT_SIZE;
+    // Convergence of the last frame's solves
+    const ConvergenceStats& velocityDiffuseStats() const;
+    const ConvergenceStats& heatDiffuseStats() const;
+    const ConvergenceStats& pressureStats() const;
 
+    // The update loop steps the simulation at a fixed rate, at most
+    // maxSubsteps times per update, dropping the time it cannot catch up on
+    void setStepRate(double stepsPerSecond);
+    void setMaxSubsteps(int maxSubsteps);
 
-protected:
-    cellar::Vec4f initDye(float s, float t);
-    cellar::Vec4f initVelocity(float s, float t);
-    cellar::Vec4f initPressure(float s, float t);
-    cellar::Vec4f initHeat(float s, float t);
-    cellar::Vec4f initFrontier(float s, float t);
+    // Steps back to back, renderInterval of them per update, and only
+    // renders the latest state in between
+    void setMaxThroughput(bool maxThroughput, int renderInterval);
+
+    // 'K' saves the state to this file and 'L' loads it back.
+    // GL fields are read back asynchronously and written frames later.
+    void setSnapshotFile(const std::string& fileName);
+    void saveSnapshot();
+    bool loadSnapshot();
+
+    // Streams the fields of every step to fileName from enterStage() on.
+    // GL fields go through a ring of pixel buffers and are only mapped
+    // once their fence signaled, a few steps later.
+    void setExport(const std::string& fileName,
+                   const std::vector<FluidFieldLayout::EField>& fields,
+                   FluidExporter::EEncoding encoding);
+
+    // Sets the frontier of the cells in region, 1 being an obstacle.
+    // 'O' toggles a block of obstacles under the candle.
+    void editFrontier(const FluidTile& region, float value);
+
+    // Scheme of each advected field, 'M' cycles the dye's
+    void setAdvection(const FluidAdvection& advection);
+
+    // Takes effect at the next restart
+    void setScene(const FluidScene& scene);
 
-    template<typename T>
-    void initTexture(unsigned int texId, const T& img);
+    // Strength of the vorticity confinement, 0 disables it. 'V' cycles it.
+    void setVorticityConfinement(float strength);
 
+    // Steps by the largest timestep keeping the fastest cell under cfl
+    // cells per step, within [minDt, maxDt], 0 keeping the defaults.
+    // GL measures the speed on the GPU and reads it back a step late.
+    // 'D' toggles it.
+    void setAdaptiveTimestep(bool adaptive, float cfl = 1.0f,
+                             float minDt = 0.0f, float maxDt = 0.0f);
+
+    // Per stage times, GL stages are timed on the GPU
+    const FluidProfiler& profiler() const;
+    bool openTrace(const std::string& fileName);
+
+
+protected:
+    // texels are packed at the format's component count, nullptr leaves it empty
+    void initTexture(unsigned int texId, const FluidFieldLayout::Format& format,
+                     const float* texels);
+    void uploadTexture(unsigned int texId, const FluidGrid& grid);
+    // GPU side copy of a texture of the stage's size and the same format
+    void copyTexture(unsigned int srcTex, unsigned int dstTex);
+
+    void simulateStep();
+    // Scissored quads over the bounds of the scene's active regions
+    void force();
     void advect();
+    void advectFused();
+    void correctAdvection();
     void diffuse();
+    void confineVorticity();
     void heat();
     void computePressure();
     void substractPressureGradient();
     void frontier();
+    void solvePressure();
+    void heatDivergence();
+    void substractGradientFrontier();
     void drawFluid();
+    void uploadSolverFields();
+    void uploadBoundary();
+    void updateStageTimes();
+    void setCandlePosition(const cellar::Vec2f& candlePos);
+    void writePendingSnapshot();
+    void exportStep();
+    void collectExports(bool wait);
+    // Max reduction of the speed, its readback and the resulting timestep
+    void reduceSpeed();
+    void readSpeed();
+    void applyTimestep(float dt);
+
+    // A zero bTex solves against the current iterate. Residuals are read
+    // back without stalling, so the solve stops up to RESIDUAL_LATENCY
+    // checks after the one that converged and stats hold the last residual
+    // read.
+    ConvergenceStats jacobiSolve(unsigned int tex[2], unsigned int bTex,
+                                 const ConvergenceCriterion& criterion);
+    // Queues the update norm in a residual slot, read once its fence passed
+    void measureUpdate(unsigned int newTex, unsigned int oldTex, int slot);
+    bool readUpdate(int slot, float& residual);
 
 
 private:
     // Size
+    const int WIDTH;
+    const int HEIGHT;
+    const int AREA;
+    const int POINT_SIZE;
     const float DX;
     const float DT;
     const float VISCOSITY;
     const float HEATDIFF;
 
+    // Simulation backend
+    const EBackend BACKEND;
+    const FluidFieldLayout LAYOUT;
+    FluidScene _scene;
+    std::shared_ptr<FluidSolver> _solver;
+    // GL backend's initial fields, generated on their own pool
+    std::vector<FluidGrid> _staging;
+    std::unique_ptr<FluidScheduler> _stagingScheduler;
+    std::vector<float> _uploadBuffer;
+    bool _fusedAdvection;
+    bool _fusedProjection;
+    FluidAdvection _advection;
+    float _vorticity;
+
+    // Adaptive timestep, the fence is a GLsync
+    float _dt;
+    bool _adaptiveTimestep;
+    float _cfl;
+    float _minDt;
+    float _maxDt;
+    float _maxSpeed;
+    unsigned int _speedPbo;
+    void* _speedFence;
+
+    // Fixed timestep stepping
+    double _stepPeriod;
+    int _maxSubsteps;
+    bool _maxThroughput;
+    int _renderInterval;
+    double _accumulator;
+    int _stepsSinceRender;
+    int _upsSteps;
+    double _upsTime;
+    unsigned long long _stepCount;
+    double _time;
+    // Steps of DT simulated, the scene's clock
+    double _sceneStep;
+    cellar::Vec2f _candlePos;
+
+    // Snapshot readback, the fence is a GLsync
+    std::string _snapshotFile;
+    unsigned int _snapshotPbo;
+    void* _snapshotFence;
+    unsigned long long _snapshotStep;
+    double _snapshotTime;
+    double _snapshotSceneStep;
+    cellar::Vec2f _snapshotCandlePos;
+
+    // Export readback ring, fences are GLsync
+    struct ExportSlot
+    {
+        unsigned int pbo;
+        void* fence;
+        unsigned long long step;
+    };
+    const int EXPORT_LATENCY;
+    std::string _exportFile;
+    std::vector<FluidFieldLayout::EField> _exportFields;
+    FluidExporter _exporter;
+    std::vector<ExportSlot> _exportSlots;
+    int _exportNext;
+    int _exportStalls;
+
+    // Jacobi early termination, LINF is measured as L2 on GL
+    struct ResidualSlot
+    {
+        unsigned int pbo;
+        void* fence;
+    };
+    const int RESIDUAL_LATENCY;
+    std::vector<ResidualSlot> _residualSlots;
+    ConvergenceCriterion _diffuseCriterion;
+    ConvergenceCriterion _pressureCriterion;
+    ConvergenceStats _velocityDiffuseStats;
+    ConvergenceStats _heatDiffuseStats;
+    ConvergenceStats _pressureStats;
+
+    // Stage timing
+    FluidProfiler _profiler;
+    FluidGpuTimer _gpuTimer;
+
     // Fluid simulation GL specific attributes
     media::GlProgram _advectShader;
+    media::GlProgram _advectFusedShader;
+    media::GlProgram _maccormackShader;
+    media::GlProgram _bfeccCompensateShader;
+    media::GlProgram _bfeccAdvectShader;
     media::GlProgram _heatShader;
     media::GlProgram _jacobiShader;
     media::GlProgram _divergenceShader;
     media::GlProgram _gradSubShader;
     media::GlProgram _frontierShader;
+    media::GlProgram _heatDivergenceShader;
+    media::GlProgram _gradSubFrontierShader;
+    media::GlProgram _frontierScatterShader;
+    media::GlProgram _frontierCommitShader;
+    media::GlProgram _residualShader;
+    media::GlProgram _forceShader;
+    media::GlProgram _vorticityShader;
+    media::GlProgram _confineShader;
+    media::GlProgram _maxSpeedShader;
     media::GlProgram _drawShader;
     media::GlVao _vao;
     const int DRAW_TEX;
     const int FETCH_TEX;
+    bool _texturesAllocated;
     unsigned int _dyeTex[2];
     unsigned int _velocityTex[2];
     unsigned int _pressureTex[2];
     unsigned int _heatTex[2];
     unsigned int _frontierTex;
     unsigned int _tempDivTex;
+    // Intermediate dye, heat and velocity of the higher order schemes
+    unsigned int _advectTex[3];
+    unsigned int _residualTex;
+    unsigned int _curlTex;
+    // Levels of the speed reduction, each a quarter of the previous one's
+    // width and height
+    struct SpeedLevel
+    {
+        unsigned int tex;
+        int width;
+        int height;
+    };
+    std::vector<SpeedLevel> _speedLevels;
+    int _residualTopLevel;
     unsigned int _fbo;
 
+    // Obstacle cells frontier() draws as points, one per cell of the
+    // boundary index and of its buried spans
+    FluidGrid _frontierGrid;
+    FluidBoundary _boundary;
+    unsigned int _boundaryVao;
+    unsigned int _boundaryVbo;
+    int _boundaryPoints;
+
     // Stats panel (FPS, UPS)
     std::shared_ptr<prop2::ImageHud> _statsPanel;
     std::shared_ptr<prop2::TextHud> _fps;
     std::shared_ptr<prop2::TextHud> _ups;
+    std::shared_ptr<prop2::TextHud> _solveStats;
+    std::vector<std::shared_ptr<prop2::TextHud>> _stageTimes;
 };
 
+
+
+// IMPLEMENTATION //
+inline const ConvergenceStats& FluidCharacter::velocityDiffuseStats() const
+{
+    return _velocityDiffuseStats;
+}
+
+inline const ConvergenceStats& FluidCharacter::heatDiffuseStats() const
+{
+    return _heatDiffuseStats;
+}
+
+inline const ConvergenceStats& FluidCharacter::pressureStats() const
+{
+    return _pressureStats;
+}
+
+inline const FluidProfiler& FluidCharacter::profiler() const
+{
+    return _profiler;
+}
+
 #endif // FLUID_CHARACTER_H
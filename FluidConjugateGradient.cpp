@@ -0,0 +1,466 @@
+#include "FluidConjugateGradient.h"
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+#include "FluidGrid.h"
+#include "FluidMultigrid.h"
+#include "FluidScheduler.h"
+
+
+namespace
+{
+    // Modified incomplete Cholesky parameters
+    const float MIC_TAU = 0.97f;
+    const float MIC_SIGMA = 0.25f;
+}
+
+
+FluidConjugateGradient::FluidConjugateGradient() :
+    _width(0),
+    _height(0),
+    _fluid(),
+    _wx(),
+    _wy(),
+    _diag(),
+    _spans(),
+    _rows(1, 0),
+    _fluidCount(0),
+    _region(),
+    _regionSizes(),
+    _regionSums(),
+    _bMeans(),
+    _zMeans(),
+    _preconditioner(EPreconditioner::INCOMPLETE_CHOLESKY),
+    _icPrecon(),
+    _factorized(false),
+    _r(),
+    _z(),
+    _p(),
+    _q(),
+    _e(),
+    _tileSums(),
+    _tileSums2(),
+    _residual(0.0f),
+    _iterationCount(0)
+{
+}
+
+FluidConjugateGradient::~FluidConjugateGradient()
+{
+
+}
+
+void FluidConjugateGradient::setup(const FluidGrid& frontier)
+{
+    _width = frontier.width();
+    _height = frontier.height();
+    const int W = _width;
+    const int area = _width * _height;
+
+    _fluid.resize(area);
+    for(int j=0; j<_height; ++j)
+        for(int i=0; i<W; ++i)
+            _fluid[j*W + i] = frontier.fetch(0, i, j) != 1.0f;
+
+    // A face is open when it separates two fluid cells
+    _wx.assign(area, 0.0f);
+    _wy.assign(area, 0.0f);
+    _diag.assign(area, 0.0f);
+    _spans.clear();
+    _rows.assign(_height + 1, 0);
+    _fluidCount = 0;
+    for(int j=0; j<_height; ++j)
+    {
+        for(int i=0; i<W; ++i)
+        {
+            int c = j*W + i;
+            if(!_fluid[c])
+                continue;
+
+            if(i+1 < W && _fluid[c+1])
+                _wx[c] = 1.0f;
+            if(j+1 < _height && _fluid[c+W])
+                _wy[c] = 1.0f;
+
+            if(!_spans.empty() && _spans.back().j == j && _spans.back().i1 == i)
+                ++_spans.back().i1;
+            else
+                _spans.push_back(Span{j, i, i+1});
+            ++_fluidCount;
+        }
+        _rows[j+1] = (int) _spans.size();
+    }
+
+    for(int j=0; j<_height; ++j)
+    {
+        for(int i=0; i<W; ++i)
+        {
+            int c = j*W + i;
+            _diag[c] = (i > 0 ? _wx[c-1] : 0.0f) + _wx[c] +
+                       (j > 0 ? _wy[c-W] : 0.0f) + _wy[c];
+        }
+    }
+
+    int nbRegions = FluidMultigrid::labelRegions(_width, _height, _fluid,
+                                                 _wx, _wy, _region);
+    _regionSizes.assign(nbRegions, 0);
+    for(int label : _region)
+        if(label >= 0)
+            ++_regionSizes[label];
+
+    _r.assign(area, 0.0f);
+    _z.assign(area, 0.0f);
+    _p.assign(area, 0.0f);
+    _q.assign(area, 0.0f);
+    _e.assign(area, 0.0f);
+    _icPrecon.clear();
+    _factorized = false;
+}
+
+void FluidConjugateGradient::setPreconditioner(EPreconditioner preconditioner)
+{
+    _preconditioner = preconditioner;
+}
+
+int FluidConjugateGradient::solve(FluidScheduler& scheduler, vector<float>& x,
+                                  const vector<float>& b, float tolerance,
+                                  int maxIterations, FluidMultigrid* multigrid)
+{
+    const int W = _width;
+    const int nbTiles = scheduler.tileCount(_width, _height);
+    _tileSums.assign(nbTiles, 0.0);
+    _tileSums2.assign(nbTiles, 0.0);
+    _iterationCount = 0;
+
+    EPreconditioner preconditioner = _preconditioner;
+    if(preconditioner == EPreconditioner::MULTIGRID && multigrid == nullptr)
+        preconditioner = EPreconditioner::INCOMPLETE_CHOLESKY;
+    if(preconditioner == EPreconditioner::INCOMPLETE_CHOLESKY && !_factorized)
+        factorize();
+
+    // Pure Neumann problem on every region : only a right hand side of
+    // zero mean on each one has a solution
+    regionMeans(scheduler, b, _bMeans);
+
+    // A is the negated Laplacian, so A x = mean - b
+    auto residual = [&]()
+    {
+        _tileSums.assign(nbTiles, 0.0);
+        _tileSums2.assign(nbTiles, 0.0);
+        forEachFluidRun(scheduler, [&](int c0, int c1, int index)
+        {
+            double rr = 0.0;
+            double bb = 0.0;
+            for(int c=c0; c<c1; ++c)
+            {
+                double ax = _diag[c] * (double) x[c];
+                if(_wx[c] != 0.0f)             ax -= _wx[c]   * x[c+1];
+                if(c > 0 && _wx[c-1] != 0.0f)  ax -= _wx[c-1] * x[c-1];
+                if(_wy[c] != 0.0f)             ax -= _wy[c]   * x[c+W];
+                if(c >= W && _wy[c-W] != 0.0f) ax -= _wy[c-W] * x[c-W];
+
+                float rhs = _bMeans[_region[c]] - b[c];
+                _r[c] = (float) (rhs - ax);
+                rr += (double) _r[c] * _r[c];
+                bb += (double) rhs * rhs;
+            }
+            _tileSums[index] += rr;
+            _tileSums2[index] += bb;
+        });
+        return reduce(_tileSums);
+    };
+
+    double rr = residual();
+    const double bNorm = sqrt(reduce(_tileSums2));
+    _residual = bNorm != 0.0 ? (float) (sqrt(rr) / bNorm) : 0.0f;
+
+    const bool plain = preconditioner == EPreconditioner::NONE;
+    vector<float>& z = plain ? _r : _z;
+
+    // The recurred residual drifts from b - A x in single precision.
+    // Once it converges, the correction is added to x and the iterations
+    // restart from the true residual, unless it stalls as with multigrid.
+    const float STALL_RATIO = 0.9f;
+    while(_residual > tolerance && _iterationCount < maxIterations)
+    {
+        precondition(scheduler, preconditioner, multigrid);
+        _tileSums.assign(nbTiles, 0.0);
+        forEachFluidRun(scheduler, [&](int c0, int c1, int index)
+        {
+            double sum = 0.0;
+            for(int c=c0; c<c1; ++c)
+            {
+                _e[c] = 0.0f;
+                _p[c] = z[c];
+                sum += (double) _r[c] * z[c];
+            }
+            _tileSums[index] += sum;
+        });
+        double rz = reduce(_tileSums);
+
+        while(_iterationCount < maxIterations)
+        {
+            double pq = applyOperator(scheduler, _p, _q);
+            if(!(pq > 0.0))
+                break;
+
+            const float alpha = (float) (rz / pq);
+            _tileSums.assign(nbTiles, 0.0);
+            forEachFluidRun(scheduler, [&](int c0, int c1, int index)
+            {
+                double sum = 0.0;
+                for(int c=c0; c<c1; ++c)
+                {
+                    _e[c] += alpha * _p[c];
+                    _r[c] -= alpha * _q[c];
+                    sum += (double) _r[c] * _r[c];
+                }
+                _tileSums[index] += sum;
+            });
+            rr = reduce(_tileSums);
+            ++_iterationCount;
+
+            if(sqrt(rr) / bNorm <= tolerance)
+                break;
+
+            // Polak-Ribiere : z.(r - r_old) with r_old = r + alpha q
+            precondition(scheduler, preconditioner, multigrid);
+            _tileSums.assign(nbTiles, 0.0);
+            _tileSums2.assign(nbTiles, 0.0);
+            forEachFluidRun(scheduler, [&](int c0, int c1, int index)
+            {
+                double zr = 0.0;
+                double zq = 0.0;
+                for(int c=c0; c<c1; ++c)
+                {
+                    zr += (double) z[c] * _r[c];
+                    zq += (double) z[c] * _q[c];
+                }
+                _tileSums[index] += zr;
+                _tileSums2[index] += zq;
+            });
+            double rzNew = reduce(_tileSums);
+            double zq = reduce(_tileSums2);
+            const float beta = (float) (-alpha * zq / rz);
+            rz = rzNew;
+
+            forEachFluidRun(scheduler, [&](int c0, int c1, int)
+            {
+                for(int c=c0; c<c1; ++c)
+                    _p[c] = z[c] + beta * _p[c];
+            });
+        }
+
+        forEachFluidRun(scheduler, [&](int c0, int c1, int)
+        {
+            for(int c=c0; c<c1; ++c)
+                x[c] += _e[c];
+        });
+
+        float lastResidual = _residual;
+        _residual = (float) (sqrt(residual()) / bNorm);
+        if(_residual > lastResidual * STALL_RATIO)
+            break;
+    }
+
+    extrapolate(x);
+
+    return _iterationCount;
+}
+
+template<typename Visit>
+void FluidConjugateGradient::forEachFluidRun(FluidScheduler& scheduler,
+                                             const Visit& visit)
+{
+    scheduler.forEachTile(_width, _height, [&](const FluidTile& tile, int index)
+    {
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            for(int s=_rows[j]; s < _rows[j+1]; ++s)
+            {
+                int i0 = max(_spans[s].i0, tile.i0);
+                int i1 = min(_spans[s].i1, tile.i1);
+                if(i0 < i1)
+                    visit(j*_width + i0, j*_width + i1, index);
+            }
+        }
+    });
+}
+
+double FluidConjugateGradient::reduce(const vector<double>& tileSums) const
+{
+    double sum = 0.0;
+    for(double tileSum : tileSums)
+        sum += tileSum;
+    return sum;
+}
+
+double FluidConjugateGradient::applyOperator(FluidScheduler& scheduler,
+                                             const vector<float>& p,
+                                             vector<float>& q)
+{
+    const int W = _width;
+    _tileSums.assign(_tileSums.size(), 0.0);
+    forEachFluidRun(scheduler, [&](int c0, int c1, int index)
+    {
+        double sum = 0.0;
+        for(int c=c0; c<c1; ++c)
+        {
+            float ap = _diag[c] * p[c];
+            if(_wx[c] != 0.0f)             ap -= _wx[c]   * p[c+1];
+            if(c > 0 && _wx[c-1] != 0.0f)  ap -= _wx[c-1] * p[c-1];
+            if(_wy[c] != 0.0f)             ap -= _wy[c]   * p[c+W];
+            if(c >= W && _wy[c-W] != 0.0f) ap -= _wy[c-W] * p[c-W];
+            q[c] = ap;
+            sum += (double) p[c] * ap;
+        }
+        _tileSums[index] += sum;
+    });
+    return reduce(_tileSums);
+}
+
+void FluidConjugateGradient::precondition(FluidScheduler& scheduler,
+                                          EPreconditioner preconditioner,
+                                          FluidMultigrid* multigrid)
+{
+    const int W = _width;
+    switch(preconditioner)
+    {
+    case EPreconditioner::NONE :
+        break;
+
+    case EPreconditioner::MULTIGRID :
+        multigrid->precondition(_r, _z);
+        break;
+
+    case EPreconditioner::INCOMPLETE_CHOLESKY :
+    {
+        const float* pre = _icPrecon.data();
+        float* z = _z.data();
+
+        // L t = r then L^T z = t, in place, closed faces weigh 0
+        for(const Span& span : _spans)
+        {
+            for(int c=span.j*W + span.i0; c < span.j*W + span.i1; ++c)
+            {
+                float t = _r[c];
+                if(c > 0)  t += _wx[c-1] * pre[c-1] * z[c-1];
+                if(c >= W) t += _wy[c-W] * pre[c-W] * z[c-W];
+                z[c] = t * pre[c];
+            }
+        }
+        for(auto span = _spans.rbegin(); span != _spans.rend(); ++span)
+        {
+            for(int c=span->j*W + span->i1 - 1; c >= span->j*W + span->i0; --c)
+            {
+                float t = z[c];
+                if(_wx[c] != 0.0f) t += _wx[c] * pre[c] * z[c+1];
+                if(_wy[c] != 0.0f) t += _wy[c] * pre[c] * z[c+W];
+                z[c] = t * pre[c];
+            }
+        }
+        break;
+    }
+    }
+
+    // Constants of every region are in the null space of A, a constant
+    // part of z only costs precision in A p
+    if(preconditioner != EPreconditioner::NONE)
+        removeMean(scheduler, _z);
+}
+
+void FluidConjugateGradient::regionMeans(FluidScheduler& scheduler,
+                                         const vector<float>& v,
+                                         vector<float>& means)
+{
+    means.assign(_regionSizes.size(), 0.0f);
+    if(_regionSizes.size() == 1)
+    {
+        _tileSums2.assign(_tileSums2.size(), 0.0);
+        forEachFluidRun(scheduler, [&](int c0, int c1, int index)
+        {
+            double sum = 0.0;
+            for(int c=c0; c<c1; ++c)
+                sum += v[c];
+            _tileSums2[index] += sum;
+        });
+        means[0] = (float) (reduce(_tileSums2) / _fluidCount);
+        return;
+    }
+
+    // Several regions are summed in span order, on one thread
+    _regionSums.assign(_regionSizes.size(), 0.0);
+    for(const Span& span : _spans)
+        for(int c=span.j*_width + span.i0; c < span.j*_width + span.i1; ++c)
+            _regionSums[_region[c]] += v[c];
+    for(size_t r=0; r < means.size(); ++r)
+        means[r] = (float) (_regionSums[r] / _regionSizes[r]);
+}
+
+void FluidConjugateGradient::removeMean(FluidScheduler& scheduler, vector<float>& v)
+{
+    regionMeans(scheduler, v, _zMeans);
+    forEachFluidRun(scheduler, [&](int c0, int c1, int)
+    {
+        for(int c=c0; c<c1; ++c)
+            v[c] -= _zMeans[_region[c]];
+    });
+}
+
+void FluidConjugateGradient::factorize()
+{
+    const int W = _width;
+    _icPrecon.assign(_width * _height, 0.0f);
+    float* pre = _icPrecon.data();
+
+    for(const Span& span : _spans)
+    {
+        for(int c=span.j*W + span.i0; c < span.j*W + span.i1; ++c)
+        {
+            float left = c > 0 ? _wx[c-1] * pre[c-1] : 0.0f;
+            float bottom = c >= W ? _wy[c-W] * pre[c-W] : 0.0f;
+            float e = _diag[c] - left*left - bottom*bottom;
+            if(c > 0)
+                e -= MIC_TAU * _wx[c-1] * _wy[c-1] * pre[c-1] * pre[c-1];
+            if(c >= W)
+                e -= MIC_TAU * _wy[c-W] * _wx[c-W] * pre[c-W] * pre[c-W];
+
+            if(e < MIC_SIGMA * _diag[c])
+                e = _diag[c];
+            pre[c] = e > 0.0f ? 1.0f / sqrt(e) : 0.0f;
+        }
+    }
+
+    _factorized = true;
+}
+
+void FluidConjugateGradient::extrapolate(vector<float>& x) const
+{
+    const int W = _width;
+    const int H = _height;
+    const unsigned char* fluid = _fluid.data();
+
+    // Obstacle cells take the mean of their fluid neighbors, as after a
+    // multigrid solve
+    for(int j=0; j<H; ++j)
+    {
+        for(int i=0; i<W; ++i)
+        {
+            int c = j*W + i;
+            if(fluid[c])
+                continue;
+
+            float sum = 0.0f;
+            int nb = 0;
+            if(i > 0   && fluid[c-1]) {sum += x[c-1]; ++nb;}
+            if(i < W-1 && fluid[c+1]) {sum += x[c+1]; ++nb;}
+            if(j > 0   && fluid[c-W]) {sum += x[c-W]; ++nb;}
+            if(j < H-1 && fluid[c+W]) {sum += x[c+W]; ++nb;}
+
+            if(nb != 0)
+                x[c] = sum / nb;
+        }
+    }
+}
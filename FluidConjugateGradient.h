@@ -0,0 +1,135 @@
+#ifndef FLUID_CONJUGATE_GRADIENT_H
+#define FLUID_CONJUGATE_GRADIENT_H
+
+#include <vector>
+
+class FluidGrid;
+class FluidMultigrid;
+class FluidScheduler;
+
+
+// Preconditioned conjugate gradient for the pressure Poisson equation,
+// on the system FluidMultigrid solves : sum(x_n - x_c) = b_c on fluid cells,
+// obstacle faces being closed. Fluid regions walled off from each other
+// are solved with b's mean removed on each one.
+// Only the fluid cells are visited, as row spans, and the 5 point stencil is
+// applied from the face weights instead of an assembled matrix.
+// Stencils and dot products run as tile tasks, partial sums are reduced in
+// tile order so that results do not depend on the thread count.
+class FluidConjugateGradient
+{
+public:
+    // INCOMPLETE_CHOLESKY is the modified IC(0) of the fluid cells, its
+    // triangular solves run on a single thread.
+    // MULTIGRID applies one cycle of the multigrid given to solve(), set
+    // up on the same frontier. Since its cycle is not exactly symmetric,
+    // the Polak-Ribiere update of the search direction is used throughout.
+    enum class EPreconditioner {NONE, INCOMPLETE_CHOLESKY, MULTIGRID};
+
+    FluidConjugateGradient();
+    virtual ~FluidConjugateGradient();
+
+    void setup(const FluidGrid& frontier);
+
+    void setPreconditioner(EPreconditioner preconditioner);
+    EPreconditioner preconditioner() const;
+
+    // x is used as initial guess, returns the number of iterations.
+    // Stops once the relative L2 residual falls to tolerance.
+    int solve(FluidScheduler& scheduler, std::vector<float>& x,
+              const std::vector<float>& b, float tolerance, int maxIterations,
+              FluidMultigrid* multigrid = nullptr);
+
+    // Relative L2 residual of the last solve, recomputed from its result
+    float residual() const;
+    int iterationCount() const;
+    int fluidCount() const;
+
+
+protected:
+    // Cells [i0, i1) of row j
+    struct Span
+    {
+        int j;
+        int i0;
+        int i1;
+    };
+
+    // Runs visit(c0, c1, index) on the runs [c0, c1) of fluid cells of
+    // every tile, index being the tile's
+    template<typename Visit>
+    void forEachFluidRun(FluidScheduler& scheduler, const Visit& visit);
+    double reduce(const std::vector<double>& tileSums) const;
+
+    // q = A p with A the negated Laplacian, returns p.q
+    double applyOperator(FluidScheduler& scheduler,
+                         const std::vector<float>& p, std::vector<float>& q);
+    void precondition(FluidScheduler& scheduler, EPreconditioner preconditioner,
+                      FluidMultigrid* multigrid);
+    // Mean of v on every fluid region
+    void regionMeans(FluidScheduler& scheduler, const std::vector<float>& v,
+                     std::vector<float>& means);
+    void removeMean(FluidScheduler& scheduler, std::vector<float>& v);
+    void factorize();
+    void extrapolate(std::vector<float>& x) const;
+
+
+private:
+    int _width;
+    int _height;
+    std::vector<unsigned char> _fluid;
+    std::vector<float> _wx;
+    std::vector<float> _wy;
+    std::vector<float> _diag;
+    std::vector<Span> _spans;
+    std::vector<int> _rows;
+    int _fluidCount;
+    std::vector<int> _region;
+    std::vector<int> _regionSizes;
+    std::vector<double> _regionSums;
+    std::vector<float> _bMeans;
+    std::vector<float> _zMeans;
+
+    EPreconditioner _preconditioner;
+    std::vector<float> _icPrecon;
+    bool _factorized;
+
+    std::vector<float> _r;
+    std::vector<float> _z;
+    std::vector<float> _p;
+    std::vector<float> _q;
+    // Correction of x, kept apart so that small steps are not lost in
+    // the rounding of x
+    std::vector<float> _e;
+    std::vector<double> _tileSums;
+    std::vector<double> _tileSums2;
+
+    float _residual;
+    int _iterationCount;
+};
+
+
+
+// IMPLEMENTATION //
+inline FluidConjugateGradient::EPreconditioner
+    FluidConjugateGradient::preconditioner() const
+{
+    return _preconditioner;
+}
+
+inline float FluidConjugateGradient::residual() const
+{
+    return _residual;
+}
+
+inline int FluidConjugateGradient::iterationCount() const
+{
+    return _iterationCount;
+}
+
+inline int FluidConjugateGradient::fluidCount() const
+{
+    return _fluidCount;
+}
+
+#endif // FLUID_CONJUGATE_GRADIENT_H
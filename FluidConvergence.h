@@ -0,0 +1,43 @@
+#ifndef FLUID_CONVERGENCE_H
+#define FLUID_CONVERGENCE_H
+
+
+// Early termination of the Jacobi loops.
+// The residual is the norm of the Jacobi update (x[k] - x[k-1]), which is
+// the system residual scaled by rBeta. It is measured every checkInterval
+// iterations and the loop stops once it falls to the tolerance.
+// A zero tolerance always runs maxIterations.
+struct ConvergenceCriterion
+{
+    // L2 is the root mean square over cells, LINF the largest update
+    enum class ENorm {L2, LINF};
+
+    ConvergenceCriterion(int maxIterations,
+                         int checkInterval = 10,
+                         float tolerance = 0.0f,
+                         ENorm norm = ENorm::L2) :
+        maxIterations(maxIterations),
+        checkInterval(checkInterval),
+        tolerance(tolerance),
+        norm(norm)
+    {}
+
+    int maxIterations;
+    int checkInterval;
+    float tolerance;
+    ENorm norm;
+};
+
+// Iterations used and last residual measured by a solve
+struct ConvergenceStats
+{
+    ConvergenceStats() :
+        iterations(0),
+        residual(0.0f)
+    {}
+
+    int iterations;
+    float residual;
+};
+
+#endif // FLUID_CONVERGENCE_H
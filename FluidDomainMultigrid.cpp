@@ -0,0 +1,521 @@
+#include "FluidDomainMultigrid.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+#include "FluidGrid.h"
+#include "FluidTransport.h"
+
+
+const int FluidDomainMultigrid::COARSEST_SIZE = 8;
+const int FluidDomainMultigrid::COARSEST_ITERATIONS = 100;
+const int FluidDomainMultigrid::MIN_ROWS = 4;
+
+
+FluidDomainMultigrid::FluidDomainMultigrid() :
+    _transport(nullptr),
+    _cycle(ECycle::V),
+    _preSmoothing(2),
+    _postSmoothing(2),
+    _levels(),
+    _splitLevels(0),
+    _rowSums(),
+    _residual(0.0f),
+    _cycleCount(0)
+{
+}
+
+FluidDomainMultigrid::~FluidDomainMultigrid()
+{
+
+}
+
+void FluidDomainMultigrid::setup(FluidTransport& transport, const FluidGrid& frontier,
+                                 int frontierRow0, int row0, int rows, int height)
+{
+    _transport = &transport;
+    _levels.clear();
+
+    // Every rank's slab, to know how deep they can all be split
+    const int size = transport.size();
+    int slab[2] = {row0, rows};
+    vector<char> gathered;
+    transport.allGather(slab, sizeof(slab), gathered);
+    vector<int> slabs(2 * size, 0);
+    if(gathered.size() == slabs.size() * sizeof(int))
+        memcpy(slabs.data(), gathered.data(), gathered.size());
+
+    auto allocate = [](Level& level)
+    {
+        const size_t count = (size_t) (level.rows + 2) * level.width;
+        level.fluid.assign(count, 0);
+        level.wx.assign(count, 0.0f);
+        level.wy.assign(count, 0.0f);
+        level.x.assign(count, 0.0f);
+        level.f.assign(count, 0.0f);
+        level.r.assign(count, 0.0f);
+    };
+
+    Level fine;
+    fine.width = frontier.width();
+    fine.height = height;
+    fine.row0 = row0;
+    fine.rows = rows;
+    fine.split = true;
+    fine.h2 = 1.0f;
+    allocate(fine);
+
+    // The frontier covers the halo rows, no exchange is needed here
+    const int j0 = max(0, row0 - 1);
+    const int j1 = min(height, row0 + rows + 1);
+    for(int j=j0; j<j1; ++j)
+        for(int i=0; i<fine.width; ++i)
+            fine.fluid[at(fine, i, j)] = frontier.fetch(0, i, j - frontierRow0) != 1.0f;
+
+    // A face is open when it separates two fluid cells, the one under
+    // the slab being read by its first row
+    for(int j=j0; j < row0 + rows; ++j)
+    {
+        for(int i=0; i<fine.width; ++i)
+        {
+            int c = at(fine, i, j);
+            if(j >= row0 && i+1 < fine.width && fine.fluid[c] && fine.fluid[c+1])
+                fine.wx[c] = 1.0f;
+            if(j+1 < height && fine.fluid[c] && fine.fluid[c+fine.width])
+                fine.wy[c] = 1.0f;
+        }
+    }
+    _levels.push_back(fine);
+
+    while(_levels.back().width  > COARSEST_SIZE &&
+          _levels.back().height > COARSEST_SIZE)
+    {
+        const Level& f = _levels.back();
+        Level c;
+        c.width  = (f.width  + 1) / 2;
+        c.height = (f.height + 1) / 2;
+        c.h2 = f.h2 * 4.0f;
+
+        // Split while every slab keeps enough rows and starts on an even
+        // row, so that the next level is restricted within the slabs too
+        c.split = f.split;
+        for(int r=0; r < size && c.split; ++r)
+        {
+            int fineRow0 = slabs[2*r];
+            int coarseRows = (fineRow0 + slabs[2*r+1] + 1) / 2 - fineRow0 / 2;
+            c.split = (fineRow0 / 2) % 2 == 0 && coarseRows >= MIN_ROWS;
+        }
+        for(int r=0; r < size; ++r)
+        {
+            int fineRow0 = slabs[2*r];
+            slabs[2*r+1] = (fineRow0 + slabs[2*r+1] + 1) / 2 - fineRow0 / 2;
+            slabs[2*r] = fineRow0 / 2;
+        }
+        c.row0 = c.split ? f.row0 / 2 : 0;
+        c.rows = c.split ? (f.row0 + f.rows + 1) / 2 - f.row0 / 2 : c.height;
+        allocate(c);
+
+        for(int j=f.row0; j < f.row0 + f.rows; ++j)
+        {
+            for(int i=0; i<f.width; ++i)
+            {
+                int fc = at(f, i, j);
+                int cc = at(c, i/2, j/2);
+                c.fluid[cc] |= f.fluid[fc];
+
+                // Fine faces lying on a coarse face
+                if(i & 1)
+                    c.wx[cc] += f.wx[fc] * 0.5f;
+                if(j & 1)
+                    c.wy[cc] += f.wy[fc] * 0.5f;
+            }
+        }
+
+        if(c.split)
+        {
+            exchangeHalo(c, c.fluid);
+            exchangeHalo(c, c.wy);
+        }
+        else if(f.split)
+        {
+            gatherRows(f, c, c.fluid);
+            gatherRows(f, c, c.wx);
+            gatherRows(f, c, c.wy);
+        }
+        _levels.push_back(c);
+    }
+
+    _splitLevels = 0;
+    for(const Level& level : _levels)
+        _splitLevels += level.split ? 1 : 0;
+}
+
+void FluidDomainMultigrid::setCycle(ECycle cycle)
+{
+    _cycle = cycle;
+}
+
+void FluidDomainMultigrid::setSmoothingSteps(int preSmoothing, int postSmoothing)
+{
+    _preSmoothing = preSmoothing;
+    _postSmoothing = postSmoothing;
+}
+
+int FluidDomainMultigrid::solve(vector<float>& x, const vector<float>& b,
+                                float tolerance, int maxCycles)
+{
+    Level& fine = _levels.front();
+    const int W = fine.width;
+    copy_n(x.begin(), fine.rows * W, fine.x.begin() + W);
+    copy_n(b.begin(), fine.rows * W, fine.f.begin() + W);
+
+    // Pure Neumann problem : only a zero mean right hand side has a solution
+    removeMean(fine);
+
+    _rowSums.assign(fine.rows, 0.0);
+    for(int j=0; j < fine.rows; ++j)
+    {
+        for(int i=0; i<W; ++i)
+        {
+            int c = (j+1)*W + i;
+            if(fine.fluid[c])
+                _rowSums[j] += fine.f[c] * fine.f[c];
+        }
+    }
+    double bNorm;
+    reduceRows(fine, _rowSums, 1, &bNorm);
+    bNorm = sqrt(bNorm);
+
+    _cycleCount = 0;
+    if(bNorm == 0.0)
+    {
+        _residual = 0.0f;
+        return 0;
+    }
+
+    // Also stop once the residual stalls at single precision round-off
+    const float STALL_RATIO = 0.9f;
+    float lastResidual = computeResidual(fine) / bNorm;
+    _residual = lastResidual;
+    while(_residual > tolerance && _cycleCount < maxCycles)
+    {
+        cycle(0);
+        ++_cycleCount;
+        _residual = computeResidual(fine) / bNorm;
+
+        if(_residual > lastResidual * STALL_RATIO)
+            break;
+        lastResidual = _residual;
+    }
+
+    extrapolate(fine);
+    copy_n(fine.x.begin() + W, fine.rows * W, x.begin());
+
+    return _cycleCount;
+}
+
+void FluidDomainMultigrid::cycle(int l)
+{
+    Level& level = _levels[l];
+    if(l+1 == (int) _levels.size())
+    {
+        removeMean(level);
+        smooth(level, COARSEST_ITERATIONS);
+        return;
+    }
+
+    Level& coarse = _levels[l+1];
+    smooth(level, _preSmoothing);
+    computeResidual(level);
+    restrict(level, coarse);
+
+    coarse.x.assign(coarse.x.size(), 0.0f);
+    int nbVisits = _cycle == ECycle::W ? 2 : 1;
+    for(int v=0; v < nbVisits; ++v)
+        cycle(l+1);
+
+    prolongate(coarse, level);
+    smooth(level, _postSmoothing);
+}
+
+void FluidDomainMultigrid::smooth(Level& level, int iterations)
+{
+    const int W = level.width;
+    float* x = level.x.data();
+    const float* f = level.f.data();
+    const float* wx = level.wx.data();
+    const float* wy = level.wy.data();
+
+    // Red-black Gauss-Seidel, a color only reads the other one
+    for(int it=0; it < iterations; ++it)
+    {
+        for(int color=0; color < 2; ++color)
+        {
+            exchangeHalo(level, level.x);
+            for(int j=level.row0; j < level.row0 + level.rows; ++j)
+            {
+                for(int i=(j+color)&1; i<W; i+=2)
+                {
+                    int c = at(level, i, j);
+                    float wL = i > 0 ? wx[c-1] : 0.0f;
+                    float wR = wx[c];
+                    float wB = j > 0 ? wy[c-W] : 0.0f;
+                    float wT = wy[c];
+                    float diag = wL + wR + wB + wT;
+                    if(diag == 0.0f)
+                        continue;
+
+                    float sum = 0.0f;
+                    if(wL != 0.0f) sum += wL * x[c-1];
+                    if(wR != 0.0f) sum += wR * x[c+1];
+                    if(wB != 0.0f) sum += wB * x[c-W];
+                    if(wT != 0.0f) sum += wT * x[c+W];
+
+                    x[c] = (sum - level.h2 * f[c]) / diag;
+                }
+            }
+        }
+    }
+}
+
+float FluidDomainMultigrid::computeResidual(Level& level)
+{
+    const int W = level.width;
+    const float* x = level.x.data();
+    const float* wx = level.wx.data();
+    const float* wy = level.wy.data();
+    const unsigned char* fluid = level.fluid.data();
+    const float rH2 = 1.0f / level.h2;
+
+    exchangeHalo(level, level.x);
+    _rowSums.assign(level.rows, 0.0);
+    for(int j=level.row0; j < level.row0 + level.rows; ++j)
+    {
+        double& norm = _rowSums[j - level.row0];
+        for(int i=0; i<W; ++i)
+        {
+            int c = at(level, i, j);
+            if(!fluid[c])
+            {
+                level.r[c] = 0.0f;
+                continue;
+            }
+
+            float lap = 0.0f;
+            if(i > 0 && wx[c-1] != 0.0f) lap += wx[c-1] * (x[c-1] - x[c]);
+            if(wx[c] != 0.0f)            lap += wx[c]   * (x[c+1] - x[c]);
+            if(j > 0 && wy[c-W] != 0.0f) lap += wy[c-W] * (x[c-W] - x[c]);
+            if(wy[c] != 0.0f)            lap += wy[c]   * (x[c+W] - x[c]);
+
+            float r = level.f[c] - lap * rH2;
+            level.r[c] = r;
+            norm += r * r;
+        }
+    }
+
+    // Only the fine level's norm is used, the others skip the reduction
+    if(&level != &_levels.front())
+        return 0.0f;
+
+    double norm;
+    reduceRows(level, _rowSums, 1, &norm);
+    return (float) sqrt(norm);
+}
+
+void FluidDomainMultigrid::restrict(Level& fine, Level& coarse)
+{
+    coarse.f.assign(coarse.f.size(), 0.0f);
+
+    for(int j=fine.row0; j < fine.row0 + fine.rows; ++j)
+    {
+        for(int i=0; i<fine.width; ++i)
+        {
+            int c = at(fine, i, j);
+            if(!fine.fluid[c])
+                continue;
+
+            // Volume weighted : partially fluid coarse cells get a
+            // proportionally smaller right hand side, as do their faces
+            coarse.f[at(coarse, i/2, j/2)] += 0.25f * fine.r[c];
+        }
+    }
+
+    if(fine.split && !coarse.split)
+        gatherRows(fine, coarse, coarse.f);
+}
+
+void FluidDomainMultigrid::prolongate(Level& coarse, Level& fine)
+{
+    const int CW = coarse.width;
+    const int CH = coarse.height;
+
+    exchangeHalo(coarse, coarse.x);
+
+    // Cell centered bilinear interpolation through open coarse faces only
+    for(int j=fine.row0; j < fine.row0 + fine.rows; ++j)
+    {
+        for(int i=0; i<fine.width; ++i)
+        {
+            int c = at(fine, i, j);
+            if(!fine.fluid[c])
+                continue;
+
+            int I = i/2;
+            int J = j/2;
+            int C = at(coarse, I, J);
+            int nI = I + ((i & 1) ? 1 : -1);
+            int nJ = J + ((j & 1) ? 1 : -1);
+            bool openI = nI >= 0 && nI < CW &&
+                    coarse.wx[(i & 1) ? C : C-1] != 0.0f;
+            bool openJ = nJ >= 0 && nJ < CH &&
+                    coarse.wy[(j & 1) ? C : C-CW] != 0.0f;
+
+            float sum = 9.0f * coarse.x[C];
+            float weight = 9.0f;
+            if(openI)
+            {
+                sum += 3.0f * coarse.x[at(coarse, nI, J)];
+                weight += 3.0f;
+            }
+            if(openJ)
+            {
+                sum += 3.0f * coarse.x[at(coarse, I, nJ)];
+                weight += 3.0f;
+            }
+            if(openI && openJ)
+            {
+                sum += coarse.x[at(coarse, nI, nJ)];
+                weight += 1.0f;
+            }
+
+            fine.x[c] += sum / weight;
+        }
+    }
+}
+
+void FluidDomainMultigrid::removeMean(Level& level)
+{
+    const int W = level.width;
+    _rowSums.assign(2 * level.rows, 0.0);
+    for(int j=0; j < level.rows; ++j)
+    {
+        for(int i=0; i<W; ++i)
+        {
+            int c = (j+1)*W + i;
+            if(level.fluid[c])
+            {
+                _rowSums[2*j] += level.f[c];
+                _rowSums[2*j+1] += 1.0;
+            }
+        }
+    }
+
+    double totals[2];
+    reduceRows(level, _rowSums, 2, totals);
+    if(totals[1] == 0.0)
+        return;
+
+    float mean = (float) (totals[0] / totals[1]);
+    for(int c = W; c < (level.rows + 1) * W; ++c)
+        if(level.fluid[c])
+            level.f[c] -= mean;
+}
+
+void FluidDomainMultigrid::extrapolate(Level& level)
+{
+    const int W = level.width;
+    const int H = level.height;
+    float* x = level.x.data();
+    const unsigned char* fluid = level.fluid.data();
+
+    exchangeHalo(level, level.x);
+
+    // Obstacle cells take the mean of their fluid neighbors so that the
+    // pressure gradient has a zero normal component at the frontier
+    for(int j=level.row0; j < level.row0 + level.rows; ++j)
+    {
+        for(int i=0; i<W; ++i)
+        {
+            int c = at(level, i, j);
+            if(fluid[c])
+                continue;
+
+            float sum = 0.0f;
+            int nb = 0;
+            if(i > 0   && fluid[c-1]) {sum += x[c-1]; ++nb;}
+            if(i < W-1 && fluid[c+1]) {sum += x[c+1]; ++nb;}
+            if(j > 0   && fluid[c-W]) {sum += x[c-W]; ++nb;}
+            if(j < H-1 && fluid[c+W]) {sum += x[c+W]; ++nb;}
+
+            if(nb != 0)
+                x[c] = sum / nb;
+        }
+    }
+}
+
+template<typename T>
+void FluidDomainMultigrid::exchangeHalo(const Level& level, vector<T>& data)
+{
+    if(!level.split || _transport->size() == 1)
+        return;
+
+    const int W = level.width;
+    const size_t bytes = W * sizeof(T);
+    const int rank = _transport->rank();
+    const bool lower = level.row0 > 0;
+    const bool upper = level.row0 + level.rows < level.height;
+
+    // Even ranks trade with the rank above first and odd ranks with the
+    // one below, so that both sides of every boundary meet
+    for(int phase=0; phase < 2; ++phase)
+    {
+        bool up = (rank % 2 == 0) == (phase == 0);
+        if(up && upper)
+            _transport->exchange(rank + 1, &data[level.rows * W],
+                                 &data[(level.rows + 1) * W], bytes);
+        else if(!up && lower)
+            _transport->exchange(rank - 1, &data[W], &data[0], bytes);
+    }
+}
+
+template<typename T>
+void FluidDomainMultigrid::gatherRows(const Level& fine, const Level& coarse,
+                                      vector<T>& data)
+{
+    if(_transport->size() == 1)
+        return;
+
+    const int W = coarse.width;
+    const int c0 = fine.row0 / 2;
+    const int c1 = (fine.row0 + fine.rows + 1) / 2;
+    vector<char> all;
+    _transport->allGather(&data[at(coarse, 0, c0)],
+                          (size_t) (c1 - c0) * W * sizeof(T), all);
+    if(all.size() == (size_t) coarse.height * W * sizeof(T))
+        memcpy(&data[at(coarse, 0, 0)], all.data(), all.size());
+}
+
+void FluidDomainMultigrid::reduceRows(const Level& level,
+                                      const vector<double>& rowValues,
+                                      int stride, double* totals)
+{
+    const double* values = rowValues.data();
+    size_t count = level.rows;
+
+    vector<char> all;
+    if(level.split && _transport->size() > 1)
+    {
+        _transport->allGather(rowValues.data(),
+                              rowValues.size() * sizeof(double), all);
+        values = (const double*) all.data();
+        count = all.size() / (stride * sizeof(double));
+    }
+
+    for(int s=0; s < stride; ++s)
+        totals[s] = 0.0;
+    for(size_t row=0; row < count; ++row)
+        for(int s=0; s < stride; ++s)
+            totals[s] += values[row * stride + s];
+}
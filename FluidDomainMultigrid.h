@@ -0,0 +1,137 @@
+#ifndef FLUID_DOMAIN_MULTIGRID_H
+#define FLUID_DOMAIN_MULTIGRID_H
+
+#include <vector>
+
+#include "FluidMultigrid.h"
+
+class FluidGrid;
+class FluidTransport;
+
+
+// FluidMultigrid on the row slabs of a decomposed grid, one per rank.
+// Levels keep a halo row on each side, exchanged before every stencil
+// reads it, and red-black sweeps exchange between colors. Once the slabs
+// of a level would get thinner than MIN_ROWS, it and the coarser levels
+// are gathered and solved whole on every rank.
+// Every level applies FluidMultigrid's operations cell by cell, and sums
+// are reduced over rows in row order, so the result does not depend on
+// the number of ranks.
+class FluidDomainMultigrid
+{
+public:
+    typedef FluidMultigrid::ECycle ECycle;
+
+    FluidDomainMultigrid();
+    virtual ~FluidDomainMultigrid();
+
+    // Owns rows [row0, row0 + rows) of a grid of the given height.
+    // frontier holds rows [frontierRow0, frontierRow0 + frontier.height())
+    // and must cover the rows next to the slab. Row slabs go up with the
+    // rank and start on even rows.
+    void setup(FluidTransport& transport, const FluidGrid& frontier,
+               int frontierRow0, int row0, int rows, int height);
+
+    void setCycle(ECycle cycle);
+    void setSmoothingSteps(int preSmoothing, int postSmoothing);
+
+    // x and b hold the slab's rows, x is used as initial guess.
+    // Returns the number of cycles.
+    int solve(std::vector<float>& x, const std::vector<float>& b,
+              float tolerance, int maxCycles);
+
+    // Relative L2 residual of the last solve
+    float residual() const;
+    int cycleCount() const;
+    int levelCount() const;
+    // Levels split over the ranks, the others being solved whole
+    int splitLevelCount() const;
+
+
+protected:
+    // Local row r holds row row0 - 1 + r, from one halo row under the
+    // slab to one above it
+    struct Level
+    {
+        int width;
+        int height;
+        int row0;
+        int rows;
+        bool split;
+        float h2;
+        std::vector<unsigned char> fluid;
+        std::vector<float> wx;
+        std::vector<float> wy;
+        std::vector<float> x;
+        std::vector<float> f;
+        std::vector<float> r;
+    };
+
+    void cycle(int l);
+    void smooth(Level& level, int iterations);
+    float computeResidual(Level& level);
+    void restrict(Level& fine, Level& coarse);
+    void prolongate(Level& coarse, Level& fine);
+    void removeMean(Level& level);
+    void extrapolate(Level& level);
+
+    // Cell (i, j) of the level, j being a grid row
+    static int at(const Level& level, int i, int j);
+
+    // Refreshes the halo rows of a split level
+    template<typename T>
+    void exchangeHalo(const Level& level, std::vector<T>& data);
+    // Collects the rows each rank computed of a level solved whole,
+    // those of the fine level's slab on this rank
+    template<typename T>
+    void gatherRows(const Level& fine, const Level& coarse, std::vector<T>& data);
+    // Sums stride values per row over the rows of the level, in row order
+    void reduceRows(const Level& level, const std::vector<double>& rowValues,
+                    int stride, double* totals);
+
+
+private:
+    static const int COARSEST_SIZE;
+    static const int COARSEST_ITERATIONS;
+    static const int MIN_ROWS;
+
+    FluidTransport* _transport;
+    ECycle _cycle;
+    int _preSmoothing;
+    int _postSmoothing;
+    std::vector<Level> _levels;
+    int _splitLevels;
+    std::vector<double> _rowSums;
+    float _residual;
+    int _cycleCount;
+};
+
+
+
+// IMPLEMENTATION //
+inline float FluidDomainMultigrid::residual() const
+{
+    return _residual;
+}
+
+inline int FluidDomainMultigrid::cycleCount() const
+{
+    return _cycleCount;
+}
+
+inline int FluidDomainMultigrid::levelCount() const
+{
+    return (int) _levels.size();
+}
+
+inline int FluidDomainMultigrid::splitLevelCount() const
+{
+    return _splitLevels;
+}
+
+inline int FluidDomainMultigrid::at(const Level& level, int i, int j)
+{
+    return (j - level.row0 + 1) * level.width + i;
+}
+
+#endif // FLUID_DOMAIN_MULTIGRID_H
@@ -0,0 +1,763 @@
+#include "FluidDomainSolver.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+using namespace cellar;
+
+#include "FluidInitializer.h"
+#include "FluidTransport.h"
+
+
+const int FluidDomainSolver::MIN_HALO = 2;
+
+
+FluidDomainSolver::FluidDomainSolver(FluidTransport& transport,
+                                     int width, int height, int halo,
+                                     const FluidSolver::Physics& physics) :
+    WIDTH(width),
+    HEIGHT(height),
+    HALO(max(MIN_HALO, halo)),
+    DX(physics.dx),
+    DT(physics.dt),
+    VISCOSITY(physics.viscosity),
+    HEATDIFF(physics.heatDiffusion),
+    DRAW_GRID(1),
+    FETCH_GRID(0),
+    _transport(transport),
+    _error(),
+    _row0(0),
+    _rows(height),
+    _first(0),
+    _localHeight(height),
+    _boundary(),
+    _ownedCells(),
+    _kernels(&FluidKernels::best()),
+    _scheduler(new FluidScheduler()),
+    _profiler(nullptr),
+    _rowNorms(),
+    _haloSend(),
+    _haloRecv(),
+    _candlePos(0, 0),
+    _stepCount(0),
+    _dt(physics.dt),
+    _time(0.0),
+    _adaptiveTimestep(false),
+    _cfl(1.0f),
+    _minDt(physics.dt / 8),
+    _maxDt(physics.dt * 4),
+    _maxSpeed(0.0f),
+    _tileSpeeds(),
+    _diffuseCriterion(60),
+    _pressureCriterion(200),
+    _velocityDiffuseStats(),
+    _heatDiffuseStats(),
+    _pressureStats(),
+    _pressureSolver(EPressureSolver::JACOBI),
+    _pressureTolerance(1e-3f),
+    _multigrid(),
+    _pressureX(),
+    _pressureB(),
+    _haloBytes(0),
+    _haloMessages(0),
+    _haloMs(0.0),
+    _tileClipped(),
+    _clippedTraces(0)
+{
+    if(!split(HEIGHT, _transport.size(), _transport.rank(), HALO, _row0, _rows))
+    {
+        // Every rank comes to the same conclusion, none of them steps
+        _error = "Slabs of " + to_string(HEIGHT) + " rows over " +
+                 to_string(_transport.size()) + " ranks are thinner than " +
+                 to_string(HALO) + " halo rows";
+        _row0 = 0;
+        _rows = 0;
+        _localHeight = 0;
+        return;
+    }
+
+    const int haloLow  = _row0 > 0 ? HALO : 0;
+    const int haloHigh = _row0 + _rows < HEIGHT ? HALO : 0;
+    _first = _row0 - haloLow;
+    _localHeight = haloLow + _rows + haloHigh;
+
+    typedef FluidFieldLayout::EField EField;
+    const FluidFieldLayout layout;
+    for(int i=0; i<2; ++i)
+    {
+        _dyeGrid[i].resize(WIDTH, _localHeight, layout.components(EField::DYE));
+        _velocityGrid[i].resize(WIDTH, _localHeight, layout.components(EField::VELOCITY));
+        _pressureGrid[i].resize(WIDTH, _localHeight, layout.components(EField::PRESSURE));
+        _heatGrid[i].resize(WIDTH, _localHeight, layout.components(EField::HEAT));
+    }
+    _frontierGrid.resize(WIDTH, _localHeight, layout.components(EField::FRONTIER));
+    _tempDivGrid.resize(WIDTH, _localHeight, layout.components(EField::DIVERGENCE));
+    _pressureX.resize(WIDTH * _rows);
+    _pressureB.resize(WIDTH * _rows);
+}
+
+FluidDomainSolver::~FluidDomainSolver()
+{
+
+}
+
+bool FluidDomainSolver::split(int height, int ranks, int rank, int halo,
+                              int& row0, int& rows)
+{
+    // Multigrid levels stay split while slabs start on even rows.
+    // Alignment costs at most a 16th of a slab to the last rank.
+    const int share = height / max(1, ranks);
+    int align = 2;
+    while(align * 2 * 16 <= share)
+        align *= 2;
+
+    const int base = share / align * align;
+    row0 = rank * base;
+    rows = rank == ranks-1 ? height - row0 : base;
+    return ranks == 1 || base >= max(MIN_HALO, halo);
+}
+
+void FluidDomainSolver::reset(FluidInitializer& initializer)
+{
+    if(!ok())
+        return;
+
+    // Halo rows are generated like the owned ones, no exchange is needed
+    initializer.generateRows(*_scheduler, _first, HEIGHT,
+                             &_dyeGrid[FETCH_GRID], &_velocityGrid[FETCH_GRID],
+                             &_pressureGrid[FETCH_GRID], &_heatGrid[FETCH_GRID],
+                             &_frontierGrid);
+
+    _dyeGrid[DRAW_GRID]      = _dyeGrid[FETCH_GRID];
+    _velocityGrid[DRAW_GRID] = _velocityGrid[FETCH_GRID];
+    _pressureGrid[DRAW_GRID] = _pressureGrid[FETCH_GRID];
+    _heatGrid[DRAW_GRID]     = _heatGrid[FETCH_GRID];
+    _tempDivGrid.fill(Vec4f());
+
+    // Boundary cells of the halo rows are the neighbors' to average
+    const int owned0 = _row0 - _first;
+    _boundary.build(_frontierGrid);
+    _ownedCells.clear();
+    for(const FluidBoundary::Cell& cell : _boundary.cells())
+        if(cell.j >= owned0 && cell.j < owned0 + _rows)
+            _ownedCells.push_back(cell);
+    _multigrid.setup(_transport, _frontierGrid, _first, _row0, _rows, HEIGHT);
+
+    _stepCount = 0;
+    _time = 0.0;
+    _haloBytes = 0;
+    _haloMessages = 0;
+    _haloMs = 0.0;
+    _clippedTraces = 0;
+    if(_adaptiveTimestep)
+        measureSpeed();
+}
+
+bool FluidDomainSolver::step()
+{
+    if(!ok())
+        return false;
+
+    advect();
+    diffuse();
+    heatDivergence();
+    solvePressure();
+    substractGradientFrontier();
+
+    _time += _dt;
+    ++_stepCount;
+    if(_adaptiveTimestep)
+        measureSpeed();
+    if(_profiler)
+        _profiler->countStep();
+
+    return _transport.ok();
+}
+
+void FluidDomainSolver::setCandlePosition(const Vec2f& pos)
+{
+    _candlePos = pos;
+}
+
+void FluidDomainSolver::setThreadCount(int threadCount)
+{
+    int tileWidth = _scheduler->tileWidth();
+    int tileHeight = _scheduler->tileHeight();
+    _scheduler.reset(new FluidScheduler(threadCount));
+    _scheduler->setTileSize(tileWidth, tileHeight);
+}
+
+void FluidDomainSolver::setKernels(const FluidKernels& kernels)
+{
+    _kernels = &kernels;
+}
+
+void FluidDomainSolver::setProfiler(FluidProfiler* profiler)
+{
+    _profiler = profiler;
+}
+
+void FluidDomainSolver::setAdaptiveTimestep(bool adaptive, float cfl,
+                                            float minDt, float maxDt)
+{
+    _adaptiveTimestep = adaptive;
+    _cfl = cfl;
+    _minDt = minDt > 0.0f ? minDt : DT / 8;
+    _maxDt = maxDt > 0.0f ? max(maxDt, _minDt) : max(DT * 4, _minDt);
+    if(_adaptiveTimestep)
+        measureSpeed();
+    else
+        _dt = DT;
+}
+
+void FluidDomainSolver::setPressureSolver(EPressureSolver solver)
+{
+    _pressureSolver = solver;
+}
+
+void FluidDomainSolver::setDiffuseCriterion(const ConvergenceCriterion& criterion)
+{
+    _diffuseCriterion = criterion;
+}
+
+void FluidDomainSolver::setPressureCriterion(const ConvergenceCriterion& criterion)
+{
+    _pressureCriterion = criterion;
+}
+
+void FluidDomainSolver::setPressureTolerance(float tolerance)
+{
+    _pressureTolerance = tolerance;
+}
+
+bool FluidDomainSolver::gather(const FluidGrid& local, FluidGrid& whole)
+{
+    if(!ok())
+        return false;
+
+    const int owned0 = _row0 - _first;
+    const size_t planeFloats = (size_t) _rows * WIDTH;
+    vector<float> rows(planeFloats * local.components());
+    for(int c=0; c < local.components(); ++c)
+        copy_n(local.plane(c) + owned0*WIDTH, planeFloats, &rows[c * planeFloats]);
+
+    vector<char> all;
+    if(!_transport.gather(rows.data(), rows.size() * sizeof(float), all))
+        return false;
+    if(_transport.rank() != 0)
+        return true;
+
+    whole.resize(WIDTH, HEIGHT, local.components());
+    const float* in = (const float*) all.data();
+    for(int r=0; r < _transport.size(); ++r)
+    {
+        int row0, nbRows;
+        split(HEIGHT, _transport.size(), r, HALO, row0, nbRows);
+        for(int c=0; c < whole.components(); ++c)
+        {
+            copy_n(in, (size_t) nbRows * WIDTH, whole.plane(c) + row0*WIDTH);
+            in += (size_t) nbRows * WIDTH;
+        }
+    }
+
+    return true;
+}
+
+void FluidDomainSolver::measureSpeed()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::TIMESTEP);
+    const float* u = _velocityGrid[FETCH_GRID].plane(0);
+    const float* v = _velocityGrid[FETCH_GRID].plane(1);
+    _tileSpeeds.assign(_scheduler->tileCount(WIDTH, _rows), 0.0f);
+
+    const int owned0 = _row0 - _first;
+    forEachTile(owned0, owned0 + _rows, [&](const FluidTile& tile, int index)
+    {
+        _tileSpeeds[index] = _kernels->maxSpeed2(u, v, WIDTH, tile);
+    });
+
+    vector<double> peak(1, 0.0);
+    for(float speed2 : _tileSpeeds)
+        peak[0] = max(peak[0], (double) speed2);
+    _transport.allMax(peak);
+    _maxSpeed = sqrt((float) peak[0]);
+
+    _dt = _maxDt;
+    if(_maxSpeed * _maxDt > _cfl * DX)
+        _dt = max(_minDt, _cfl * DX / _maxSpeed);
+}
+
+void FluidDomainSolver::advect()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::ADVECT);
+    FluidGrid* grids[] = {
+        _dyeGrid,
+        _heatGrid,
+        _velocityGrid
+    };
+    exchangeHalos({&_dyeGrid[FETCH_GRID], &_heatGrid[FETCH_GRID],
+                   &_velocityGrid[FETCH_GRID]}, HALO);
+
+    const float rDx = 1.0f / DX;
+    const float* u = _velocityGrid[FETCH_GRID].plane(0);
+    const float* v = _velocityGrid[FETCH_GRID].plane(1);
+    const bool lower = _first > 0;
+    const bool upper = _first + _localHeight < HEIGHT;
+    const int owned0 = _row0 - _first;
+    _tileClipped.assign(_scheduler->tileCount(WIDTH, _rows), 0);
+
+    // Traces run in grid coordinates and are sampled in local ones, the
+    // shift by a whole row count being exact
+    forEachTile(owned0, owned0 + _rows, [&](const FluidTile& tile, int index)
+    {
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                int cell = j*WIDTH + i;
+                float fx = i + 0.5f;
+                float fy = (j + _first) + 0.5f;
+                float nx = fx - _dt * rDx * u[cell];
+                float ny = fy - _dt * rDx * v[cell];
+
+                float a = _frontierGrid.fetch(0, (int)nx, localRow((int)ny));
+                nx = nx + (fx - nx) * a;
+                ny = ny + (fy - ny) * a;
+
+                float y = ny - _first;
+                if((lower && y < 0.5f) || (upper && y >= _localHeight - 0.5f))
+                    ++_tileClipped[index];
+
+                FluidGrid::Footprint fp;
+                _frontierGrid.footprint(nx, y, fp);
+                for(FluidGrid* grid : grids)
+                {
+                    float value[4];
+                    grid[FETCH_GRID].sample(fp, value);
+                    FluidGrid& dst = grid[DRAW_GRID];
+                    for(int c=0; c < dst.components(); ++c)
+                        dst.plane(c)[cell] = value[c];
+                }
+            }
+        }
+    });
+
+    for(long long clipped : _tileClipped)
+        _clippedTraces += clipped;
+
+    swap(_dyeGrid[FETCH_GRID],      _dyeGrid[DRAW_GRID]);
+    swap(_heatGrid[FETCH_GRID],     _heatGrid[DRAW_GRID]);
+    swap(_velocityGrid[FETCH_GRID], _velocityGrid[DRAW_GRID]);
+}
+
+void FluidDomainSolver::diffuse()
+{
+    // Velocity
+    {
+        FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::DIFFUSE_VELOCITY);
+        float alpha = DX*DX / (VISCOSITY*_dt);
+        float rBeta = 1.0f / (4.0f + DX*DX/(VISCOSITY*_dt));
+        _velocityDiffuseStats = jacobiSolve(_velocityGrid, nullptr,
+                                            alpha, rBeta, _diffuseCriterion);
+    }
+
+    // Heat
+    {
+        FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::DIFFUSE_HEAT);
+        float alpha = DX*DX / (HEATDIFF*_dt);
+        float rBeta = 1.0f / (4.0f + DX*DX/(HEATDIFF*_dt));
+        _heatDiffuseStats = jacobiSolve(_heatGrid, nullptr,
+                                        alpha, rBeta, _diffuseCriterion);
+    }
+}
+
+void FluidDomainSolver::heatDivergence()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::HEAT_DIVERGENCE);
+    // The lift of the rows bordering the slab reads two rows past it
+    exchangeHalos({&_heatGrid[FETCH_GRID], &_velocityGrid[FETCH_GRID]}, 2);
+
+    const float HalfrDx = 0.5f / DX;
+    const FluidGrid& heatSrc = _heatGrid[FETCH_GRID];
+    const FluidGrid& velSrc = _velocityGrid[FETCH_GRID];
+    FluidGrid& heatDst = _heatGrid[DRAW_GRID];
+    FluidGrid& velDst = _velocityGrid[DRAW_GRID];
+    float* div = _tempDivGrid.plane(0);
+    const Vec4f candle(1.0, 0, 0, 0);
+    const float timeScale = _dt / DT;
+
+    // Local rows clamped like FluidSolver::clampRow() clamps grid rows
+    auto clampRow = [&](int j) {return localRow(j + _first);};
+    const int owned0 = _row0 - _first;
+    forEachTile(owned0, owned0 + _rows, [&](const FluidTile& tile, int)
+    {
+        const int tileW = tile.i1 - tile.i0;
+        const int rows = tile.j1 - tile.j0 + 2;
+        static thread_local vector<float> lift;
+        lift.resize(tileW * rows);
+
+        for(int r=0; r < rows; ++r)
+        {
+            int j = clampRow(tile.j0 - 1 + r);
+            const float* hB = heatSrc.plane(0) + clampRow(j-1)*WIDTH;
+            const float* hC = heatSrc.plane(0) + j*WIDTH;
+            const float* hT = heatSrc.plane(0) + clampRow(j+1)*WIDTH;
+            float* out = &lift[r*tileW - tile.i0];
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                float hL = hC[i > 0 ? i-1 : 0];
+                float hR = hC[i < WIDTH-1 ? i+1 : WIDTH-1];
+                out[i] = HalfrDx * ((hL + hR + hB[i] + hT[i]) - hC[i]) * 0.05f * timeScale;
+            }
+        }
+
+        const float* uSrc = velSrc.plane(0);
+        const float* vSrc = velSrc.plane(1);
+        float* uDst = velDst.plane(0);
+        float* vDst = velDst.plane(1);
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            const int r = j - tile.j0 + 1;
+            const float* liftB = &lift[(r-1)*tileW - tile.i0];
+            const float* liftC = &lift[ r   *tileW - tile.i0];
+            const float* liftT = &lift[(r+1)*tileW - tile.i0];
+            const float* uC = uSrc + j*WIDTH;
+            const float* vB = vSrc + clampRow(j-1)*WIDTH;
+            const float* vC = vSrc + j*WIDTH;
+            const float* vT = vSrc + clampRow(j+1)*WIDTH;
+            float* divC = div + j*WIDTH;
+
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                float uL = uC[i > 0 ? i-1 : 0];
+                float uR = uC[i < WIDTH-1 ? i+1 : WIDTH-1];
+                divC[i] = HalfrDx * ((uR - uL) +
+                                     ((vT[i] + liftT[i]) - (vB[i] + liftB[i])));
+            }
+
+            int row = j*WIDTH + tile.i0;
+            copy_n(uC + tile.i0, tileW, uDst + row);
+            for(int i=tile.i0; i<tile.i1; ++i)
+                vDst[j*WIDTH + i] = vC[i] + liftC[i];
+            for(int c=2; c < velDst.components(); ++c)
+                copy_n(velSrc.plane(c) + row, tileW, velDst.plane(c) + row);
+
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                int cell = j*WIDTH + i;
+                bool lit = candleLit(i, j + _first);
+                for(int c=0; c < heatDst.components(); ++c)
+                    heatDst.plane(c)[cell] = lit ? candle[c] : heatSrc.plane(c)[cell];
+            }
+        }
+    });
+
+    swap(_heatGrid[FETCH_GRID],     _heatGrid[DRAW_GRID]);
+    swap(_velocityGrid[FETCH_GRID], _velocityGrid[DRAW_GRID]);
+}
+
+void FluidDomainSolver::solvePressure()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::PRESSURE_SOLVE);
+    if(_pressureSolver == EPressureSolver::MULTIGRID)
+    {
+        const int owned = (_row0 - _first) * WIDTH;
+        float* pressure = _pressureGrid[FETCH_GRID].plane(0) + owned;
+        const float* div = _tempDivGrid.plane(0) + owned;
+        for(int c=0; c < WIDTH*_rows; ++c)
+        {
+            _pressureX[c] = pressure[c];
+            _pressureB[c] = DX*DX * div[c];
+        }
+
+        const int MAX_CYCLES = 30;
+        _pressureStats.iterations = _multigrid.solve(
+            _pressureX, _pressureB, _pressureTolerance, MAX_CYCLES);
+        _pressureStats.residual = _multigrid.residual();
+
+        copy(_pressureX.begin(), _pressureX.end(), pressure);
+    }
+    else
+    {
+        // The right hand side is only read, one exchange covers the solve
+        exchangeHalos({&_tempDivGrid}, HALO);
+        _pressureStats = jacobiSolve(_pressureGrid, &_tempDivGrid,
+                                     -DX*DX, 1.0f / 4.0f, _pressureCriterion);
+    }
+}
+
+void FluidDomainSolver::substractGradientFrontier()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::GRADIENT_FRONTIER);
+    // Boundary cells of the slab's edge rows average the projected velocity
+    // of the row past them, which reads the pressure one row further
+    exchangeHalos({&_pressureGrid[FETCH_GRID], &_velocityGrid[FETCH_GRID]}, 2);
+
+    const float HalfrDx = 0.5f / DX;
+    const FluidGrid& velSrc = _velocityGrid[FETCH_GRID];
+    const FluidGrid& presSrc = _pressureGrid[FETCH_GRID];
+    FluidGrid& velDst = _velocityGrid[DRAW_GRID];
+    FluidGrid& presDst = _pressureGrid[DRAW_GRID];
+
+    const int owned0 = _row0 - _first;
+    forEachTile(owned0, owned0 + _rows, [&](const FluidTile& tile, int)
+    {
+        const int tileW = tile.i1 - tile.i0;
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            int row = j*WIDTH + tile.i0;
+            for(int c=0; c < velDst.components(); ++c)
+                copy_n(velSrc.plane(c) + row, tileW, velDst.plane(c) + row);
+            for(int c=0; c < presDst.components(); ++c)
+                copy_n(presSrc.plane(c) + row, tileW, presDst.plane(c) + row);
+        }
+
+        _kernels->gradSub(presSrc.plane(0), velDst.plane(0), velDst.plane(1),
+                          WIDTH, _localHeight, tile, HalfrDx);
+    });
+
+    if(!_ownedCells.empty())
+    {
+        _scheduler->forEachTile((int) _ownedCells.size(), 1, [&](const FluidTile& tile, int)
+        {
+            for(int k=tile.i0; k<tile.i1; ++k)
+            {
+                const FluidBoundary::Cell& cell = _ownedCells[k];
+                Vec4f moyVelocity;
+                Vec4f moyPressure;
+                for(int n=0; n < cell.count; ++n)
+                {
+                    const int neighbor = cell.neighbors[n];
+                    const float weight = cell.weights[n];
+                    Vec4f v = projectedVelocity(neighbor % WIDTH, neighbor / WIDTH);
+                    for(int c=0; c < velSrc.components(); ++c)
+                        moyVelocity[c] += v[c] * weight;
+                    for(int c=0; c < presSrc.components(); ++c)
+                        moyPressure[c] += presSrc.plane(c)[neighbor] * weight;
+                }
+
+                for(int c=0; c<4; ++c)
+                {
+                    moyVelocity[c] = -moyVelocity[c] / cell.accum;
+                    moyPressure[c] =  moyPressure[c] / cell.accum;
+                }
+                velDst.setTexel(cell.i, cell.j, moyVelocity);
+                presDst.setTexel(cell.i, cell.j, moyPressure);
+            }
+        });
+    }
+
+    clearBuried(velDst);
+
+    swap(_velocityGrid[FETCH_GRID], _velocityGrid[DRAW_GRID]);
+    swap(_pressureGrid[FETCH_GRID], _pressureGrid[DRAW_GRID]);
+}
+
+void FluidDomainSolver::forEachTile(int j0, int j1, const task_t& task)
+{
+    _scheduler->forEachTile(WIDTH, j1 - j0, [&](const FluidTile& tile, int index)
+    {
+        task(FluidTile(tile.i0, tile.j0 + j0, tile.i1, tile.j1 + j0), index);
+    });
+}
+
+void FluidDomainSolver::exchangeHalos(initializer_list<FluidGrid*> grids, int depth)
+{
+    const bool lower = _row0 > 0;
+    const bool upper = _row0 + _rows < HEIGHT;
+    depth = min(depth, min(HALO, _rows));
+    if(!lower && !upper)
+        return;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int planes = 0;
+    for(FluidGrid* grid : grids)
+        planes += grid->components();
+    const size_t block = (size_t) depth * WIDTH;
+    const size_t bytes = planes * block * sizeof(float);
+    _haloSend.resize(bytes);
+    _haloRecv.resize(bytes);
+
+    // Even ranks trade with the rank above first and odd ranks with the
+    // one below, so that both sides of every boundary meet
+    const int rank = _transport.rank();
+    const int owned0 = _row0 - _first;
+    for(int phase=0; phase < 2; ++phase)
+    {
+        bool up = (rank % 2 == 0) == (phase == 0);
+        if(up ? !upper : !lower)
+            continue;
+
+        const int sendRow = up ? owned0 + _rows - depth : owned0;
+        const int recvRow = up ? owned0 + _rows : owned0 - depth;
+        float* out = (float*) _haloSend.data();
+        for(FluidGrid* grid : grids)
+            for(int c=0; c < grid->components(); ++c, out += block)
+                copy_n(grid->plane(c) + sendRow*WIDTH, block, out);
+
+        if(!_transport.exchange(up ? rank+1 : rank-1,
+                                _haloSend.data(), _haloRecv.data(), bytes))
+            break;
+
+        const float* in = (const float*) _haloRecv.data();
+        for(FluidGrid* grid : grids)
+            for(int c=0; c < grid->components(); ++c, in += block)
+                copy_n(in, block, grid->plane(c) + recvRow*WIDTH);
+
+        _haloBytes += bytes;
+        ++_haloMessages;
+    }
+
+    _haloMs += chrono::duration<double, milli>(
+        chrono::steady_clock::now() - start).count();
+}
+
+ConvergenceStats FluidDomainSolver::jacobiSolve(
+        FluidGrid grids[2], const FluidGrid* b, float alpha, float rBeta,
+        const ConvergenceCriterion& criterion)
+{
+    ConvergenceStats stats;
+    const int nbIterations = (criterion.maxIterations/2)*2;
+    const bool early = criterion.tolerance > 0.0f && criterion.checkInterval > 0;
+    const int owned0 = _row0 - _first;
+    const int owned1 = owned0 + _rows;
+    const int tileW = _scheduler->tileWidth();
+    const int nbX = (WIDTH + tileW - 1) / tileW;
+
+    while(stats.iterations < nbIterations)
+    {
+        // One exchange feeds halo iterations, each of them being valid
+        // on one row less past the slab. Blocks stop at convergence checks.
+        int depth = min(HALO, nbIterations - stats.iterations);
+        if(early)
+            depth = min(depth, criterion.checkInterval -
+                               stats.iterations % criterion.checkInterval);
+
+        stats.iterations += depth;
+        bool check = stats.iterations == nbIterations ||
+            (early && stats.iterations % criterion.checkInterval == 0);
+        const ConvergenceCriterion::ENorm* measure = check ? &criterion.norm : nullptr;
+
+        exchangeHalos({&grids[FETCH_GRID]}, depth);
+        if(measure)
+            _rowNorms.assign(_rows * nbX, 0.0);
+
+        for(int k=1; k <= depth; ++k)
+        {
+            const int e = depth - k;
+            const bool last = k == depth;
+            const FluidGrid& x = grids[FETCH_GRID];
+            FluidGrid& dst = grids[DRAW_GRID];
+            forEachTile(max(0, owned0 - e), min(_localHeight, owned1 + e),
+                        [&](const FluidTile& tile, int)
+            {
+                for(int c=0; c < x.components(); ++c)
+                    _kernels->jacobi(x.plane(c), b ? b->plane(c) : x.plane(c),
+                                     dst.plane(c), WIDTH, _localHeight, tile,
+                                     alpha, rBeta);
+
+                if(!last || !measure)
+                    return;
+
+                // Per row and tile column, so that the sums do not depend
+                // on the slab
+                const int column = tile.i0 / tileW;
+                for(int j=max(tile.j0, owned0); j < min(tile.j1, owned1); ++j)
+                {
+                    double& norm = _rowNorms[(j - owned0)*nbX + column];
+                    for(int c=0; c < x.components(); ++c)
+                    {
+                        for(int i=tile.i0; i<tile.i1; ++i)
+                        {
+                            double d = dst.plane(c)[j*WIDTH + i] - x.plane(c)[j*WIDTH + i];
+                            if(*measure == ConvergenceCriterion::ENorm::LINF)
+                                norm = max(norm, fabs(d));
+                            else
+                                norm += d * d;
+                        }
+                    }
+                }
+            });
+            swap(grids[FETCH_GRID], grids[DRAW_GRID]);
+        }
+
+        if(check)
+        {
+            stats.residual = reduceNorms(measure);
+            if(early && stats.residual <= criterion.tolerance)
+                break;
+        }
+    }
+
+    return stats;
+}
+
+float FluidDomainSolver::reduceNorms(const ConvergenceCriterion::ENorm* measure)
+{
+    if(!measure)
+        return 0.0f;
+
+    const bool linf = *measure == ConvergenceCriterion::ENorm::LINF;
+    const int nbX = (int) _rowNorms.size() / max(1, _rows);
+    vector<double> rowNorms(_rows, 0.0);
+    for(int r=0; r < _rows; ++r)
+        for(int x=0; x < nbX; ++x)
+            rowNorms[r] = linf ? max(rowNorms[r], _rowNorms[r*nbX + x]) :
+                                 rowNorms[r] + _rowNorms[r*nbX + x];
+
+    vector<char> all;
+    const double* values = rowNorms.data();
+    size_t count = rowNorms.size();
+    if(_transport.size() > 1)
+    {
+        _transport.allGather(rowNorms.data(), count * sizeof(double), all);
+        values = (const double*) all.data();
+        count = all.size() / sizeof(double);
+    }
+
+    double norm = 0.0;
+    for(size_t r=0; r < count; ++r)
+        norm = linf ? max(norm, values[r]) : norm + values[r];
+
+    if(!linf)
+        return (float) sqrt(norm / ((double) WIDTH * HEIGHT));
+    return (float) norm;
+}
+
+bool FluidDomainSolver::candleLit(int i, int j) const
+{
+    float dx = _candlePos[0] - (i + 0.5f);
+    float dy = _candlePos[1] - (j + 0.5f);
+    return sqrt(dx*dx + dy*dy) < FluidSolver::CANDLE_RADIUS;
+}
+
+int FluidDomainSolver::localRow(int j) const
+{
+    return (j < 0 ? 0 : (j >= HEIGHT ? HEIGHT-1 : j)) - _first;
+}
+
+Vec4f FluidDomainSolver::projectedVelocity(int i, int j) const
+{
+    const float HalfrDx = 0.5f / DX;
+    const FluidGrid& pressure = _pressureGrid[FETCH_GRID];
+    float pL = pressure.fetch(0, i-1, j);
+    float pR = pressure.fetch(0, i+1, j);
+    float pB = pressure.fetch(0, i, j-1);
+    float pT = pressure.fetch(0, i, j+1);
+
+    Vec4f v = _velocityGrid[FETCH_GRID].texel(i, j);
+    v[0] = v[0] - HalfrDx * (pR - pL);
+    v[1] = v[1] - HalfrDx * (pT - pB);
+    return v;
+}
+
+void FluidDomainSolver::clearBuried(FluidGrid& velocity) const
+{
+    for(const FluidBoundary::Span& span : _boundary.buriedSpans())
+        for(int c=0; c < velocity.components(); ++c)
+            fill_n(velocity.plane(c) + span.j*WIDTH + span.i0,
+                   span.i1 - span.i0, 0.0f);
+}
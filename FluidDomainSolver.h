@@ -0,0 +1,355 @@
+#ifndef FLUID_DOMAIN_SOLVER_H
+#define FLUID_DOMAIN_SOLVER_H
+
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FluidBoundary.h"
+#include "FluidConvergence.h"
+#include "FluidDomainMultigrid.h"
+#include "FluidGrid.h"
+#include "FluidKernels.h"
+#include "FluidProfiler.h"
+#include "FluidScheduler.h"
+#include "FluidSolver.h"
+
+class FluidInitializer;
+class FluidTransport;
+
+
+// FluidSolver's default pipeline on the row slab of a grid owned by one
+// rank of a transport, the grid being split in as many slabs as ranks.
+// Fields keep halo rows of the neighboring slabs, on the sides that have
+// one, refreshed before the stages that read them. The Jacobi solves trade
+// halos once every halo iterations, iterating on the halo rows in between.
+// Every cell goes through the same kernels as FluidSolver's, so the fields
+// do not depend on the number of ranks. With Jacobi pressure they match
+// FluidSolver's as long as the solves stop after the same iterations.
+// Only float fields, fused stages and the Jacobi and multigrid pressure
+// solvers are supported. Scenes are not: reset() only generates the
+// initializer's fields, without stamping its regions.
+class FluidDomainSolver
+{
+public:
+    enum class EPressureSolver {JACOBI, MULTIGRID};
+
+    // At least MIN_HALO halo rows, the fused stages reading two rows past
+    // the slab. ok() is false when the slabs would be thinner, see split().
+    FluidDomainSolver(FluidTransport& transport, int width, int height,
+                      int halo = 4,
+                      const FluidSolver::Physics& physics = FluidSolver::Physics());
+    virtual ~FluidDomainSolver();
+
+    // Rows [row0, row0 + rows) of a grid of the given height owned by rank.
+    // Slabs start on multiples of a power of two so that multigrid levels
+    // stay split, the last one taking the remainder.
+    // False when the slabs would be thinner than halo or MIN_HALO.
+    static bool split(int height, int ranks, int rank, int halo,
+                      int& row0, int& rows);
+
+    // False when the grid cannot be split, error() telling why
+    bool ok() const;
+    const std::string& error() const;
+
+    void reset(FluidInitializer& initializer);
+    // False once the transport failed or when not ok(), the fields being
+    // left as they are
+    bool step();
+
+    void advect();
+    void diffuse();
+    void heatDivergence();
+    void solvePressure();
+    void substractGradientFrontier();
+    // Largest velocity magnitude over every rank, and the timestep it allows
+    void measureSpeed();
+
+    // In grid cells, like FluidSolver's
+    void setCandlePosition(const cellar::Vec2f& pos);
+
+    void setThreadCount(int threadCount);
+    FluidScheduler& scheduler();
+    void setKernels(const FluidKernels& kernels);
+    void setProfiler(FluidProfiler* profiler);
+
+    // See FluidSolver, traces longer than the halo are clipped to it
+    void setAdaptiveTimestep(bool adaptive, float cfl = 1.0f,
+                             float minDt = 0.0f, float maxDt = 0.0f);
+    bool adaptiveTimestep() const;
+    float timestep() const;
+    double time() const;
+    float maxSpeed() const;
+
+    void setPressureSolver(EPressureSolver solver);
+    void setDiffuseCriterion(const ConvergenceCriterion& criterion);
+    void setPressureCriterion(const ConvergenceCriterion& criterion);
+    void setPressureTolerance(float tolerance);
+    FluidDomainMultigrid& multigrid();
+
+    const ConvergenceStats& velocityDiffuseStats() const;
+    const ConvergenceStats& heatDiffuseStats() const;
+    const ConvergenceStats& pressureStats() const;
+
+    FluidTransport& transport() const;
+    int width() const;
+    int height() const;
+    int halo() const;
+    int row0() const;
+    int rows() const;
+    // Grid row held by the first row of the local grids
+    int firstRow() const;
+    unsigned long long stepCount() const;
+
+    // Local grids, from firstRow() on, halos included
+    const FluidGrid& dyeGrid() const;
+    const FluidGrid& velocityGrid() const;
+    const FluidGrid& pressureGrid() const;
+    const FluidGrid& heatGrid() const;
+    const FluidGrid& frontierGrid() const;
+
+    // Collects the owned rows of a local grid of every rank into whole on
+    // rank 0, other ranks leave whole untouched. Every rank must call it.
+    bool gather(const FluidGrid& local, FluidGrid& whole);
+
+    // Halo exchanges of this rank since reset()
+    unsigned long long haloBytes() const;
+    unsigned long long haloMessages() const;
+    double haloMs() const;
+    // Backtraces of this rank that reached past the halo rows
+    long long clippedTraces() const;
+
+
+protected:
+    typedef std::function<void(const FluidTile& tile, int index)> task_t;
+
+    // Tiles of local rows [j0, j1)
+    void forEachTile(int j0, int j1, const task_t& task);
+    // Sends depth owned rows of the grids to the neighbors and receives as
+    // many of theirs in the halos
+    void exchangeHalos(std::initializer_list<FluidGrid*> grids, int depth);
+
+    ConvergenceStats jacobiSolve(FluidGrid grids[2], const FluidGrid* b,
+                                 float alpha, float rBeta,
+                                 const ConvergenceCriterion& criterion);
+    // Row sums of every rank, added in row order
+    float reduceNorms(const ConvergenceCriterion::ENorm* measure);
+
+    bool candleLit(int i, int j) const;
+    // Local row of grid row j, clamped to the grid
+    int localRow(int j) const;
+    cellar::Vec4f projectedVelocity(int i, int j) const;
+    void clearBuried(FluidGrid& velocity) const;
+
+
+private:
+    static const int MIN_HALO;
+
+    const int WIDTH;
+    const int HEIGHT;
+    const int HALO;
+    const float DX;
+    const float DT;
+    const float VISCOSITY;
+    const float HEATDIFF;
+
+    const int DRAW_GRID;
+    const int FETCH_GRID;
+    FluidTransport& _transport;
+    std::string _error;
+    int _row0;
+    int _rows;
+    int _first;
+    int _localHeight;
+    FluidGrid _dyeGrid[2];
+    FluidGrid _velocityGrid[2];
+    FluidGrid _pressureGrid[2];
+    FluidGrid _heatGrid[2];
+    FluidGrid _frontierGrid;
+    FluidGrid _tempDivGrid;
+    FluidBoundary _boundary;
+    std::vector<FluidBoundary::Cell> _ownedCells;
+
+    const FluidKernels* _kernels;
+    std::unique_ptr<FluidScheduler> _scheduler;
+    FluidProfiler* _profiler;
+    std::vector<double> _rowNorms;
+    std::vector<char> _haloSend;
+    std::vector<char> _haloRecv;
+    cellar::Vec2f _candlePos;
+    unsigned long long _stepCount;
+
+    float _dt;
+    double _time;
+    bool _adaptiveTimestep;
+    float _cfl;
+    float _minDt;
+    float _maxDt;
+    float _maxSpeed;
+    std::vector<float> _tileSpeeds;
+
+    ConvergenceCriterion _diffuseCriterion;
+    ConvergenceCriterion _pressureCriterion;
+    ConvergenceStats _velocityDiffuseStats;
+    ConvergenceStats _heatDiffuseStats;
+    ConvergenceStats _pressureStats;
+
+    EPressureSolver _pressureSolver;
+    float _pressureTolerance;
+    FluidDomainMultigrid _multigrid;
+    std::vector<float> _pressureX;
+    std::vector<float> _pressureB;
+
+    unsigned long long _haloBytes;
+    unsigned long long _haloMessages;
+    double _haloMs;
+    std::vector<long long> _tileClipped;
+    long long _clippedTraces;
+};
+
+
+
+// IMPLEMENTATION //
+inline bool FluidDomainSolver::ok() const
+{
+    return _error.empty();
+}
+
+inline const std::string& FluidDomainSolver::error() const
+{
+    return _error;
+}
+
+inline FluidScheduler& FluidDomainSolver::scheduler()
+{
+    return *_scheduler;
+}
+
+inline bool FluidDomainSolver::adaptiveTimestep() const
+{
+    return _adaptiveTimestep;
+}
+
+inline float FluidDomainSolver::timestep() const
+{
+    return _dt;
+}
+
+inline double FluidDomainSolver::time() const
+{
+    return _time;
+}
+
+inline float FluidDomainSolver::maxSpeed() const
+{
+    return _maxSpeed;
+}
+
+inline FluidDomainMultigrid& FluidDomainSolver::multigrid()
+{
+    return _multigrid;
+}
+
+inline const ConvergenceStats& FluidDomainSolver::velocityDiffuseStats() const
+{
+    return _velocityDiffuseStats;
+}
+
+inline const ConvergenceStats& FluidDomainSolver::heatDiffuseStats() const
+{
+    return _heatDiffuseStats;
+}
+
+inline const ConvergenceStats& FluidDomainSolver::pressureStats() const
+{
+    return _pressureStats;
+}
+
+inline FluidTransport& FluidDomainSolver::transport() const
+{
+    return _transport;
+}
+
+inline int FluidDomainSolver::width() const
+{
+    return WIDTH;
+}
+
+inline int FluidDomainSolver::height() const
+{
+    return HEIGHT;
+}
+
+inline int FluidDomainSolver::halo() const
+{
+    return HALO;
+}
+
+inline int FluidDomainSolver::row0() const
+{
+    return _row0;
+}
+
+inline int FluidDomainSolver::rows() const
+{
+    return _rows;
+}
+
+inline int FluidDomainSolver::firstRow() const
+{
+    return _first;
+}
+
+inline unsigned long long FluidDomainSolver::stepCount() const
+{
+    return _stepCount;
+}
+
+inline const FluidGrid& FluidDomainSolver::dyeGrid() const
+{
+    return _dyeGrid[FETCH_GRID];
+}
+
+inline const FluidGrid& FluidDomainSolver::velocityGrid() const
+{
+    return _velocityGrid[FETCH_GRID];
+}
+
+inline const FluidGrid& FluidDomainSolver::pressureGrid() const
+{
+    return _pressureGrid[FETCH_GRID];
+}
+
+inline const FluidGrid& FluidDomainSolver::heatGrid() const
+{
+    return _heatGrid[FETCH_GRID];
+}
+
+inline const FluidGrid& FluidDomainSolver::frontierGrid() const
+{
+    return _frontierGrid;
+}
+
+inline unsigned long long FluidDomainSolver::haloBytes() const
+{
+    return _haloBytes;
+}
+
+inline unsigned long long FluidDomainSolver::haloMessages() const
+{
+    return _haloMessages;
+}
+
+inline double FluidDomainSolver::haloMs() const
+{
+    return _haloMs;
+}
+
+inline long long FluidDomainSolver::clippedTraces() const
+{
+    return _clippedTraces;
+}
+
+#endif // FLUID_DOMAIN_SOLVER_H
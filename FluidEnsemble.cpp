@@ -0,0 +1,273 @@
+#include "FluidEnsemble.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+using namespace std;
+
+using namespace cellar;
+
+#include "FluidInitializer.h"
+
+
+namespace
+{
+    // The default scene with its obstacle layout swapped
+    class EnsembleInitializer : public FluidInitializer
+    {
+    public:
+        EnsembleInitializer(FluidEnsemble::EObstacles obstacles) :
+            _obstacles(obstacles)
+        {
+        }
+
+        virtual Vec4f initFrontier(float s, float t)
+        {
+            const Vec4f block(1.0, 1.0, 1.0, 1.0);
+            const Vec4f fluid(0.0, 0.0, 0.0, 0.0);
+
+            switch(_obstacles)
+            {
+            case FluidEnsemble::EObstacles::BAFFLE :
+                return FluidInitializer::initFrontier(s, t);
+
+            case FluidEnsemble::EObstacles::OPEN :
+                break;
+
+            case FluidEnsemble::EObstacles::CYLINDER :
+                if(Vec2f(s, t).distanceTo(0.5, 0.5) < 0.1)
+                    return block;
+                break;
+            }
+
+            const float W = 0.03;
+            if(s < W || s > 1-W || t < W || t > 1-W)
+                return block;
+            return fluid;
+        }
+
+    private:
+        FluidEnsemble::EObstacles _obstacles;
+    };
+
+    vector<string> split(const string& text, char separator)
+    {
+        vector<string> parts;
+        stringstream stream(text);
+        string part;
+        while(getline(stream, part, separator))
+            parts.push_back(part);
+        return parts;
+    }
+
+    bool parseFloat(const string& text, float& value)
+    {
+        char* end = nullptr;
+        value = strtof(text.c_str(), &end);
+        return !text.empty() && *end == '\0';
+    }
+}
+
+
+FluidEnsemble::Member::Member() :
+    name(),
+    width(128),
+    height(128),
+    physics(),
+    obstacles(EObstacles::BAFFLE)
+{
+}
+
+FluidEnsemble::FluidEnsemble(int threadCount) :
+    _members(),
+    _solvers(),
+    _scheduler(threadCount)
+{
+    // One task per member
+    _scheduler.setTileSize(1, 1);
+}
+
+FluidEnsemble::~FluidEnsemble()
+{
+}
+
+bool FluidEnsemble::parse(istream& config, vector<Member>& members,
+                          string& error)
+{
+    members.clear();
+
+    string line;
+    for(int lineNumber=1; getline(config, line); ++lineNumber)
+    {
+        line = line.substr(0, line.find('#'));
+        stringstream tokens(line);
+        string token;
+
+        string baseName;
+        vector<pair<string, vector<string>>> keys;
+        while(tokens >> token)
+        {
+            size_t equal = token.find('=');
+            if(equal == string::npos)
+                baseName = token;
+            else
+                keys.push_back(make_pair(token.substr(0, equal),
+                                         split(token.substr(equal+1), ',')));
+        }
+        if(baseName.empty() && keys.empty())
+            continue;
+        if(baseName.empty())
+            baseName = "member" + to_string(members.size());
+
+        // Odometer over the swept values
+        vector<size_t> choice(keys.size(), 0);
+        for(;;)
+        {
+            Member member;
+            member.name = baseName;
+            for(size_t k=0; k < keys.size(); ++k)
+            {
+                const string& key = keys[k].first;
+                if(keys[k].second.empty())
+                {
+                    error = "Line " + to_string(lineNumber) + " : no value for " + key;
+                    return false;
+                }
+
+                const string& value = keys[k].second[choice[k]];
+                bool ok = true;
+                if(key == "size")
+                {
+                    int count = sscanf(value.c_str(), "%dx%d",
+                                       &member.width, &member.height);
+                    if(count == 1)
+                        member.height = member.width;
+                    ok = count >= 1 && member.width >= 2 && member.height >= 2;
+                }
+                else if(key == "dt")
+                    ok = parseFloat(value, member.physics.dt) && member.physics.dt > 0;
+                else if(key == "viscosity")
+                    ok = parseFloat(value, member.physics.viscosity) &&
+                         member.physics.viscosity > 0;
+                else if(key == "heat_diffusion")
+                    ok = parseFloat(value, member.physics.heatDiffusion) &&
+                         member.physics.heatDiffusion > 0;
+                else if(key == "obstacles")
+                    member.obstacles = obstaclesFromName(value, &ok);
+                else if(key == "name")
+                    member.name = value;
+                else
+                {
+                    error = "Line " + to_string(lineNumber) + " : unknown key " + key;
+                    return false;
+                }
+
+                if(!ok)
+                {
+                    error = "Line " + to_string(lineNumber) + " : invalid " +
+                            key + " '" + value + "'";
+                    return false;
+                }
+
+                if(keys[k].second.size() > 1)
+                    member.name += "/" + key + "=" + value;
+            }
+            members.push_back(member);
+
+            size_t k = 0;
+            while(k < keys.size() && ++choice[k] == keys[k].second.size())
+                choice[k++] = 0;
+            if(k == keys.size())
+                break;
+        }
+    }
+
+    if(members.empty())
+    {
+        error = "No member in the ensemble";
+        return false;
+    }
+
+    return true;
+}
+
+bool FluidEnsemble::load(const string& fileName, vector<Member>& members,
+                         string& error)
+{
+    ifstream config(fileName.c_str());
+    if(!config)
+    {
+        error = "Could not open '" + fileName + "'";
+        return false;
+    }
+
+    return parse(config, members, error);
+}
+
+void FluidEnsemble::setMembers(const vector<Member>& members,
+                               const function<void(FluidSolver&)>& configure)
+{
+    _members = members;
+    _solvers.clear();
+    for(const Member& member : _members)
+    {
+        _solvers.emplace_back(new FluidSolver(member.width, member.height,
+                                              FluidFieldLayout(), member.physics));
+        _solvers.back()->setThreadCount(1);
+        if(configure)
+            configure(*_solvers.back());
+    }
+
+    reset();
+}
+
+void FluidEnsemble::reset()
+{
+    _scheduler.forEachTile(memberCount(), 1, [this](const FluidTile&, int m)
+    {
+        EnsembleInitializer initializer(_members[m].obstacles);
+        _solvers[m]->reset(initializer);
+    });
+}
+
+void FluidEnsemble::step()
+{
+    _scheduler.forEachTile(memberCount(), 1, [this](const FluidTile&, int m)
+    {
+        _solvers[m]->step();
+    });
+}
+
+long long FluidEnsemble::cellCount() const
+{
+    long long cells = 0;
+    for(const Member& member : _members)
+        cells += (long long) member.width * member.height;
+    return cells;
+}
+
+const char* FluidEnsemble::obstaclesName(EObstacles obstacles)
+{
+    switch(obstacles)
+    {
+    case EObstacles::BAFFLE :   return "baffle";
+    case EObstacles::OPEN :     return "open";
+    case EObstacles::CYLINDER : return "cylinder";
+    }
+    return "";
+}
+
+FluidEnsemble::EObstacles FluidEnsemble::obstaclesFromName(const string& name, bool* ok)
+{
+    if(ok) *ok = true;
+    if(name == "baffle")
+        return EObstacles::BAFFLE;
+    if(name == "open")
+        return EObstacles::OPEN;
+    if(name == "cylinder")
+        return EObstacles::CYLINDER;
+
+    if(ok) *ok = false;
+    return EObstacles::BAFFLE;
+}
@@ -0,0 +1,100 @@
+#ifndef FLUID_ENSEMBLE_H
+#define FLUID_ENSEMBLE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <istream>
+#include <functional>
+
+#include "FluidScheduler.h"
+#include "FluidSolver.h"
+
+
+// Independent simulations advanced together in one process.
+// Every member owns a single threaded solver and a step of the ensemble
+// runs the members as the tasks of one dispatch over a shared pool, so
+// small grids fill the hardware threads that a lone one would leave idle.
+class FluidEnsemble
+{
+public:
+    enum class EObstacles {BAFFLE, OPEN, CYLINDER};
+
+    struct Member
+    {
+        Member();
+
+        std::string name;
+        int width;
+        int height;
+        FluidSolver::Physics physics;
+        EObstacles obstacles;
+    };
+
+    // 0 threads uses every hardware thread
+    FluidEnsemble(int threadCount = 0);
+    virtual ~FluidEnsemble();
+
+    // One member per line of space separated key=value pairs :
+    //   name size=WxH dt viscosity heat_diffusion obstacles=baffle|open|cylinder
+    // Comma separated values sweep, a line expands to every combination.
+    // '#' starts a comment.
+    static bool parse(std::istream& config, std::vector<Member>& members,
+                      std::string& error);
+    static bool load(const std::string& fileName, std::vector<Member>& members,
+                     std::string& error);
+
+    // Builds and resets a solver per member, configure() is called on
+    // each before its reset
+    void setMembers(const std::vector<Member>& members,
+                    const std::function<void(FluidSolver&)>& configure = nullptr);
+    void reset();
+
+    // Advances every member one step
+    void step();
+
+    int memberCount() const;
+    const Member& member(int index) const;
+    FluidSolver& solver(int index);
+    const FluidSolver& solver(int index) const;
+
+    // Summed over every member
+    long long cellCount() const;
+
+    static const char* obstaclesName(EObstacles obstacles);
+    static EObstacles obstaclesFromName(const std::string& name, bool* ok = nullptr);
+
+
+private:
+    FluidEnsemble(const FluidEnsemble&);
+    FluidEnsemble& operator=(const FluidEnsemble&);
+
+    std::vector<Member> _members;
+    std::vector<std::unique_ptr<FluidSolver>> _solvers;
+    FluidScheduler _scheduler;
+};
+
+
+
+// IMPLEMENTATION //
+inline int FluidEnsemble::memberCount() const
+{
+    return (int) _members.size();
+}
+
+inline const FluidEnsemble::Member& FluidEnsemble::member(int index) const
+{
+    return _members[index];
+}
+
+inline FluidSolver& FluidEnsemble::solver(int index)
+{
+    return *_solvers[index];
+}
+
+inline const FluidSolver& FluidEnsemble::solver(int index) const
+{
+    return *_solvers[index];
+}
+
+#endif // FLUID_ENSEMBLE_H
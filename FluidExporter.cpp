@@ -0,0 +1,582 @@
+#include "FluidExporter.h"
+#include "FluidGrid.h"
+
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+
+namespace
+{
+    const char MAGIC[8] = {'F', 'L', 'U', 'I', 'D', '2', 'D', 'X'};
+    const uint32_t VERSION = 1;
+    const uint32_t BYTE_ORDER_TAG = 0x01020304;
+    const uint32_t KEYFRAME = 1;
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        int32_t width;
+        int32_t height;
+        uint32_t fieldCount;
+        uint32_t encoding;
+        float quantizationStep;
+        uint32_t keyframeInterval;
+    };
+
+    struct FieldEntry
+    {
+        uint32_t field;
+        uint32_t components;
+    };
+
+    struct FrameHeader
+    {
+        uint64_t step;
+        uint32_t flags;
+        uint32_t reserved;
+        uint64_t bytes;
+    };
+
+    int32_t quantize(float value, float invStep)
+    {
+        float q = rintf(value * invStep);
+        // NaNs too end up at zero
+        if(!(q > -2147483520.0f && q < 2147483520.0f))
+            return q > 0.0f ? INT32_MAX : (q < 0.0f ? INT32_MIN : 0);
+        return (int32_t) q;
+    }
+
+    double elapsedMs(chrono::steady_clock::time_point start)
+    {
+        return chrono::duration<double, milli>(
+            chrono::steady_clock::now() - start).count();
+    }
+}
+
+
+FluidExporter::Stats::Stats() :
+    submitted(0),
+    written(0),
+    dropped(0),
+    failed(0),
+    blockedMs(0.0),
+    encodeMs(0.0),
+    writeMs(0.0),
+    maxQueued(0),
+    rawBytes(0),
+    fileBytes(0)
+{
+}
+
+FluidExporter::FluidExporter() :
+    _encoding(EEncoding::RAW),
+    _quantizationStep(1.0f / 4096.0f),
+    _keyframeInterval(60),
+    _queueCapacity(8),
+    _overflow(EOverflow::BLOCK),
+    _width(0),
+    _height(0),
+    _fields(),
+    _components(),
+    _frameFloats(0),
+    _file(nullptr),
+    _writer(),
+    _previous(),
+    _encoded(),
+    _framesWritten(0),
+    _writeFailed(false),
+    _mutex(),
+    _queueCond(),
+    _poolCond(),
+    _frames(),
+    _pool(),
+    _queue(),
+    _closing(false),
+    _stats()
+{
+}
+
+FluidExporter::~FluidExporter()
+{
+    string error;
+    close(error);
+}
+
+void FluidExporter::setEncoding(EEncoding encoding)
+{
+    _encoding = encoding;
+}
+
+void FluidExporter::setQuantizationStep(float step)
+{
+    if(step > 0.0f)
+        _quantizationStep = step;
+}
+
+void FluidExporter::setKeyframeInterval(int interval)
+{
+    _keyframeInterval = max(interval, 1);
+}
+
+void FluidExporter::setQueueCapacity(int capacity)
+{
+    _queueCapacity = max(capacity, 1);
+}
+
+void FluidExporter::setOverflow(EOverflow overflow)
+{
+    _overflow = overflow;
+}
+
+bool FluidExporter::open(const string& fileName, int width, int height,
+                         const vector<FluidFieldLayout::EField>& fields,
+                         const FluidFieldLayout& layout, string& error)
+{
+    string closeError;
+    close(closeError);
+
+    if(fields.empty() || width <= 0 || height <= 0)
+    {
+        error = "Nothing to export";
+        return false;
+    }
+
+    _file = fopen(fileName.c_str(), "wb");
+    if(_file == nullptr)
+    {
+        error = "Could not create '" + fileName + "'";
+        return false;
+    }
+
+    _width = width;
+    _height = height;
+    _fields = fields;
+    _components.clear();
+    _frameFloats = 0;
+    vector<FieldEntry> entries;
+    for(FluidFieldLayout::EField field : fields)
+    {
+        _components.push_back(layout.components(field));
+        _frameFloats += (size_t) width * height * _components.back();
+        entries.push_back({(uint32_t) field, (uint32_t) _components.back()});
+    }
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_TAG;
+    header.width = width;
+    header.height = height;
+    header.fieldCount = (uint32_t) fields.size();
+    header.encoding = (uint32_t) _encoding;
+    header.quantizationStep = _quantizationStep;
+    header.keyframeInterval = _keyframeInterval;
+    if(fwrite(&header, sizeof(header), 1, _file) != 1 ||
+       fwrite(entries.data(), sizeof(FieldEntry), entries.size(), _file) !=
+           entries.size())
+    {
+        fclose(_file);
+        _file = nullptr;
+        error = "Could not write '" + fileName + "'";
+        return false;
+    }
+
+    _stats = Stats();
+    _stats.fileBytes = sizeof(header) + entries.size() * sizeof(FieldEntry);
+    _framesWritten = 0;
+    _writeFailed = false;
+    _previous.assign(_encoding == EEncoding::QUANTIZED_DELTA ? _frameFloats : 0, 0);
+
+    _frames.clear();
+    _pool.clear();
+    _queue.clear();
+    for(int f=0; f < _queueCapacity; ++f)
+    {
+        _frames.emplace_back(new Frame());
+        _frames.back()->step = 0;
+        _frames.back()->data.resize(_frameFloats);
+        _pool.push_back(_frames.back().get());
+    }
+
+    _closing = false;
+    _writer = thread(&FluidExporter::writerLoop, this);
+    return true;
+}
+
+bool FluidExporter::close(string& error)
+{
+    if(_file == nullptr)
+        return true;
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        _closing = true;
+    }
+    _queueCond.notify_all();
+    _writer.join();
+
+    // Buffered frames may only fail to reach the disk here
+    bool closed = fclose(_file) == 0;
+    _file = nullptr;
+    _frames.clear();
+    _pool.clear();
+    _previous.clear();
+    _encoded.clear();
+
+    if(_writeFailed)
+        error = "Could not write every frame, " + to_string(_stats.failed) +
+                " failed";
+    else if(!closed)
+        error = "Could not write the end of the export";
+    return closed && !_writeFailed;
+}
+
+FluidExporter::Stats FluidExporter::stats() const
+{
+    lock_guard<mutex> lock(_mutex);
+    return _stats;
+}
+
+FluidExporter::Frame* FluidExporter::acquire()
+{
+    unique_lock<mutex> lock(_mutex);
+    if(_file == nullptr)
+        return nullptr;
+
+    if(_pool.empty())
+    {
+        if(_overflow == EOverflow::DROP)
+        {
+            ++_stats.dropped;
+            return nullptr;
+        }
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        _poolCond.wait(lock, [this]{ return !_pool.empty(); });
+        _stats.blockedMs += elapsedMs(start);
+    }
+
+    Frame* frame = _pool.back();
+    _pool.pop_back();
+    return frame;
+}
+
+void FluidExporter::submit(Frame* frame)
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _queue.push_back(frame);
+        ++_stats.submitted;
+        _stats.maxQueued = max(_stats.maxQueued, (int) _queue.size());
+    }
+    _queueCond.notify_one();
+}
+
+bool FluidExporter::submit(unsigned long long step, const FluidGrid* const grids[])
+{
+    Frame* frame = acquire();
+    if(frame == nullptr)
+        return false;
+
+    frame->step = step;
+    float* dst = frame->data.data();
+    for(int f=0; f < (int) _fields.size(); ++f)
+    {
+        const FluidGrid& grid = *grids[f];
+        const size_t area = (size_t) grid.area();
+        for(int c=0; c < _components[f]; ++c, dst += area)
+        {
+            if(c < grid.components())
+                grid.readCells(c, 0, (int) area, dst);
+            else
+                fill(dst, dst + area, c == 3 ? 1.0f : 0.0f);
+        }
+    }
+
+    submit(frame);
+    return true;
+}
+
+void FluidExporter::writerLoop()
+{
+    for(;;)
+    {
+        Frame* frame = nullptr;
+        {
+            unique_lock<mutex> lock(_mutex);
+            _queueCond.wait(lock, [this]{ return !_queue.empty() || _closing; });
+            if(_queue.empty())
+                return;
+
+            frame = _queue.front();
+            _queue.pop_front();
+        }
+
+        // Frames after a failed one could not be decoded anyway
+        if(_writeFailed)
+        {
+            {
+                lock_guard<mutex> lock(_mutex);
+                _pool.push_back(frame);
+                ++_stats.failed;
+            }
+            _poolCond.notify_one();
+            continue;
+        }
+
+        const bool keyframe = _framesWritten % _keyframeInterval == 0;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        const void* payload = frame->data.data();
+        size_t bytes = _frameFloats * sizeof(float);
+        if(_encoding == EEncoding::QUANTIZED_DELTA)
+        {
+            encode(*frame, keyframe);
+            payload = _encoded.data();
+            bytes = _encoded.size();
+        }
+        double encodeMs = elapsedMs(start);
+
+        start = chrono::steady_clock::now();
+        FrameHeader header;
+        header.step = frame->step;
+        header.flags = keyframe ? KEYFRAME : 0;
+        header.reserved = 0;
+        header.bytes = bytes;
+        _writeFailed = fwrite(&header, sizeof(header), 1, _file) != 1 ||
+                       fwrite(payload, 1, bytes, _file) != bytes;
+        double writeMs = elapsedMs(start);
+        ++_framesWritten;
+
+        {
+            lock_guard<mutex> lock(_mutex);
+            _pool.push_back(frame);
+            if(_writeFailed)
+                ++_stats.failed;
+            else
+            {
+                ++_stats.written;
+                _stats.encodeMs += encodeMs;
+                _stats.writeMs += writeMs;
+                _stats.rawBytes += _frameFloats * sizeof(float);
+                _stats.fileBytes += sizeof(header) + bytes;
+            }
+        }
+        _poolCond.notify_one();
+    }
+}
+
+void FluidExporter::encode(const Frame& frame, bool keyframe)
+{
+    // Zigzag LEB128 varints, at most 5 bytes per value
+    _encoded.resize(_frameFloats * 5);
+    unsigned char* out = _encoded.data();
+    const float invStep = 1.0f / _quantizationStep;
+    const float* values = frame.data.data();
+    int32_t* previous = _previous.data();
+
+    for(size_t i=0; i < _frameFloats; ++i)
+    {
+        int32_t q = quantize(values[i], invStep);
+        uint32_t delta = (uint32_t) q - (keyframe ? 0u : (uint32_t) previous[i]);
+        previous[i] = q;
+
+        uint32_t zigzag = (delta << 1) ^ (uint32_t) ((int32_t) delta >> 31);
+        while(zigzag >= 0x80)
+        {
+            *out++ = (unsigned char) (zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        *out++ = (unsigned char) zigzag;
+    }
+
+    _encoded.resize(out - _encoded.data());
+}
+
+FluidExporter::EEncoding FluidExporter::encodingFromName(const string& name, bool* ok)
+{
+    if(ok) *ok = true;
+    if(name == "raw")
+        return EEncoding::RAW;
+    if(name == "delta")
+        return EEncoding::QUANTIZED_DELTA;
+
+    if(ok) *ok = false;
+    return EEncoding::RAW;
+}
+
+const char* FluidExporter::encodingName(EEncoding encoding)
+{
+    switch(encoding)
+    {
+    case EEncoding::RAW :             return "raw";
+    case EEncoding::QUANTIZED_DELTA : return "delta";
+    }
+    return "";
+}
+
+bool FluidExporter::fieldsFromNames(const string& names,
+                                    vector<FluidFieldLayout::EField>& fields)
+{
+    fields.clear();
+    size_t begin = 0;
+    while(begin <= names.size())
+    {
+        size_t end = min(names.find(',', begin), names.size());
+        string name = names.substr(begin, end - begin);
+        int f = 0;
+        while(f < FluidFieldLayout::FIELD_COUNT &&
+              name != FluidFieldLayout::fieldName((FluidFieldLayout::EField) f))
+            ++f;
+        if(f == FluidFieldLayout::FIELD_COUNT)
+            return false;
+
+        fields.push_back((FluidFieldLayout::EField) f);
+        begin = end + 1;
+    }
+
+    return !fields.empty();
+}
+
+
+FluidExportReader::FluidExportReader() :
+    _error(),
+    _file(nullptr),
+    _width(0),
+    _height(0),
+    _encoding(FluidExporter::EEncoding::RAW),
+    _quantizationStep(1.0f),
+    _fields(),
+    _components(),
+    _frameFloats(0),
+    _previous(),
+    _payload()
+{
+}
+
+FluidExportReader::~FluidExportReader()
+{
+    close();
+}
+
+bool FluidExportReader::open(const string& fileName)
+{
+    close();
+
+    _file = fopen(fileName.c_str(), "rb");
+    if(_file == nullptr)
+        return fail("Could not open '" + fileName + "'");
+
+    FileHeader header;
+    if(fread(&header, sizeof(header), 1, _file) != 1 ||
+       memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+        return fail("Not a Fluid2D export");
+    if(header.byteOrder != BYTE_ORDER_TAG)
+        return fail("Export of a different byte order");
+    if(header.version > VERSION)
+        return fail("Export version is newer than this build");
+    if(header.width <= 0 || header.height <= 0 ||
+       header.encoding > (uint32_t) FluidExporter::EEncoding::QUANTIZED_DELTA ||
+       !(header.quantizationStep > 0.0f))
+        return fail("Corrupted export header");
+
+    _width = header.width;
+    _height = header.height;
+    _encoding = (FluidExporter::EEncoding) header.encoding;
+    _quantizationStep = header.quantizationStep;
+    for(uint32_t f=0; f < header.fieldCount; ++f)
+    {
+        FieldEntry entry;
+        if(fread(&entry, sizeof(entry), 1, _file) != 1 ||
+           entry.field >= (uint32_t) FluidFieldLayout::FIELD_COUNT ||
+           entry.components < 1 || entry.components > 4)
+            return fail("Corrupted export field list");
+
+        _fields.push_back((FluidFieldLayout::EField) entry.field);
+        _components.push_back(entry.components);
+        _frameFloats += (size_t) _width * _height * entry.components;
+    }
+    _previous.assign(_frameFloats, 0);
+
+    _error.clear();
+    return true;
+}
+
+void FluidExportReader::close()
+{
+    if(_file)
+        fclose(_file);
+
+    _file = nullptr;
+    _width = 0;
+    _height = 0;
+    _fields.clear();
+    _components.clear();
+    _frameFloats = 0;
+    _previous.clear();
+}
+
+bool FluidExportReader::next(unsigned long long& step, vector<float>& data)
+{
+    if(_file == nullptr)
+        return false;
+
+    FrameHeader header;
+    if(fread(&header, sizeof(header), 1, _file) != 1)
+        return false;
+
+    data.resize(_frameFloats);
+    step = header.step;
+
+    if(_encoding == FluidExporter::EEncoding::RAW)
+    {
+        if(header.bytes != _frameFloats * sizeof(float) ||
+           fread(data.data(), sizeof(float), _frameFloats, _file) != _frameFloats)
+            return fail("Truncated export frame");
+        return true;
+    }
+
+    if(header.bytes > _frameFloats * 5)
+        return fail("Corrupted export frame");
+    _payload.resize(header.bytes);
+    if(fread(_payload.data(), 1, _payload.size(), _file) != _payload.size())
+        return fail("Truncated export frame");
+
+    const bool keyframe = (header.flags & KEYFRAME) != 0;
+    const unsigned char* in = _payload.data();
+    const unsigned char* end = in + _payload.size();
+    for(size_t i=0; i < _frameFloats; ++i)
+    {
+        uint32_t zigzag = 0;
+        int shift = 0;
+        for(;;)
+        {
+            if(in == end || shift > 28)
+                return fail("Corrupted export frame");
+            unsigned char byte = *in++;
+            zigzag |= (uint32_t) (byte & 0x7f) << shift;
+            shift += 7;
+            if((byte & 0x80) == 0)
+                break;
+        }
+
+        uint32_t delta = (zigzag >> 1) ^ (0u - (zigzag & 1));
+        int32_t q = (int32_t) (delta + (keyframe ? 0u : (uint32_t) _previous[i]));
+        _previous[i] = q;
+        data[i] = q * _quantizationStep;
+    }
+
+    return true;
+}
+
+bool FluidExportReader::fail(const string& error)
+{
+    close();
+    _error = error;
+    return false;
+}
@@ -0,0 +1,259 @@
+#ifndef FLUID_EXPORTER_H
+#define FLUID_EXPORTER_H
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <condition_variable>
+
+#include "FluidFieldLayout.h"
+
+class FluidGrid;
+
+
+// Streams selected fields of every step to a file.
+// Producers fill frames taken from a fixed pool, which bounds the queue,
+// and a background thread encodes and writes them in submission order.
+// When the pool runs dry, acquire() either waits for the writer or drops
+// the frame, and both outcomes are counted in the stats. After a failed
+// write the frames are no longer written but counted as failed, the file
+// holding the frames up to that one.
+class FluidExporter
+{
+public:
+    // QUANTIZED_DELTA rounds values to multiples of the quantization step
+    // and stores zigzag varints of their difference with the last frame
+    // written. Keyframes restart from zero.
+    enum class EEncoding {RAW, QUANTIZED_DELTA};
+    enum class EOverflow {BLOCK, DROP};
+
+    struct Stats
+    {
+        Stats();
+
+        unsigned long long submitted;
+        unsigned long long written;
+        unsigned long long dropped;
+        unsigned long long failed;
+        // Time producers waited on a full queue
+        double blockedMs;
+        double encodeMs;
+        double writeMs;
+        int maxQueued;
+        unsigned long long rawBytes;
+        unsigned long long fileBytes;
+    };
+
+    // The fields of a frame are stored back to back as float planes
+    struct Frame
+    {
+        unsigned long long step;
+        std::vector<float> data;
+    };
+
+    FluidExporter();
+    virtual ~FluidExporter();
+
+    void setEncoding(EEncoding encoding);
+    EEncoding encoding() const;
+    void setQuantizationStep(float step);
+    void setKeyframeInterval(int interval);
+    void setQueueCapacity(int capacity);
+    void setOverflow(EOverflow overflow);
+
+    // Components of every field are taken from the layout
+    bool open(const std::string& fileName, int width, int height,
+              const std::vector<FluidFieldLayout::EField>& fields,
+              const FluidFieldLayout& layout, std::string& error);
+    // Writes every queued frame before returning, false when a frame or
+    // the file could not be written
+    bool close(std::string& error);
+    bool isOpen() const;
+
+    int width() const;
+    int height() const;
+    const std::vector<FluidFieldLayout::EField>& fields() const;
+    int components(int fieldIndex) const;
+    size_t frameFloats() const;
+    Stats stats() const;
+
+    // nullptr when the frame is dropped
+    Frame* acquire();
+    void submit(Frame* frame);
+
+    // Copies the grids, given in fields() order, as one frame
+    bool submit(unsigned long long step, const FluidGrid* const grids[]);
+
+    static EEncoding encodingFromName(const std::string& name, bool* ok = nullptr);
+    static const char* encodingName(EEncoding encoding);
+    // Comma separated field names, like "dye,velocity"
+    static bool fieldsFromNames(const std::string& names,
+                                std::vector<FluidFieldLayout::EField>& fields);
+
+
+private:
+    FluidExporter(const FluidExporter&);
+    FluidExporter& operator=(const FluidExporter&);
+
+    void writerLoop();
+    void encode(const Frame& frame, bool keyframe);
+
+    EEncoding _encoding;
+    float _quantizationStep;
+    int _keyframeInterval;
+    int _queueCapacity;
+    EOverflow _overflow;
+
+    int _width;
+    int _height;
+    std::vector<FluidFieldLayout::EField> _fields;
+    std::vector<int> _components;
+    size_t _frameFloats;
+
+    // Writer side
+    FILE* _file;
+    std::thread _writer;
+    std::vector<std::int32_t> _previous;
+    std::vector<unsigned char> _encoded;
+    unsigned long long _framesWritten;
+    bool _writeFailed;
+
+    // Shared, guarded by the mutex
+    mutable std::mutex _mutex;
+    std::condition_variable _queueCond;
+    std::condition_variable _poolCond;
+    std::vector<std::unique_ptr<Frame>> _frames;
+    std::vector<Frame*> _pool;
+    std::deque<Frame*> _queue;
+    bool _closing;
+    Stats _stats;
+};
+
+
+
+// Decodes the frames of a file written by FluidExporter, in order
+class FluidExportReader
+{
+public:
+    FluidExportReader();
+    virtual ~FluidExportReader();
+
+    bool open(const std::string& fileName);
+    void close();
+    const std::string& error() const;
+
+    int width() const;
+    int height() const;
+    FluidExporter::EEncoding encoding() const;
+    float quantizationStep() const;
+    const std::vector<FluidFieldLayout::EField>& fields() const;
+    int components(int fieldIndex) const;
+    size_t frameFloats() const;
+
+    // False at the end of the file or on a corrupted frame
+    bool next(unsigned long long& step, std::vector<float>& data);
+
+
+private:
+    FluidExportReader(const FluidExportReader&);
+    FluidExportReader& operator=(const FluidExportReader&);
+
+    bool fail(const std::string& error);
+
+    std::string _error;
+    FILE* _file;
+    int _width;
+    int _height;
+    FluidExporter::EEncoding _encoding;
+    float _quantizationStep;
+    std::vector<FluidFieldLayout::EField> _fields;
+    std::vector<int> _components;
+    size_t _frameFloats;
+    std::vector<std::int32_t> _previous;
+    std::vector<unsigned char> _payload;
+};
+
+
+
+// IMPLEMENTATION //
+inline FluidExporter::EEncoding FluidExporter::encoding() const
+{
+    return _encoding;
+}
+
+inline bool FluidExporter::isOpen() const
+{
+    return _file != nullptr;
+}
+
+inline int FluidExporter::width() const
+{
+    return _width;
+}
+
+inline int FluidExporter::height() const
+{
+    return _height;
+}
+
+inline const std::vector<FluidFieldLayout::EField>& FluidExporter::fields() const
+{
+    return _fields;
+}
+
+inline int FluidExporter::components(int fieldIndex) const
+{
+    return _components[fieldIndex];
+}
+
+inline size_t FluidExporter::frameFloats() const
+{
+    return _frameFloats;
+}
+
+inline const std::string& FluidExportReader::error() const
+{
+    return _error;
+}
+
+inline int FluidExportReader::width() const
+{
+    return _width;
+}
+
+inline int FluidExportReader::height() const
+{
+    return _height;
+}
+
+inline FluidExporter::EEncoding FluidExportReader::encoding() const
+{
+    return _encoding;
+}
+
+inline float FluidExportReader::quantizationStep() const
+{
+    return _quantizationStep;
+}
+
+inline const std::vector<FluidFieldLayout::EField>& FluidExportReader::fields() const
+{
+    return _fields;
+}
+
+inline int FluidExportReader::components(int fieldIndex) const
+{
+    return _components[fieldIndex];
+}
+
+inline size_t FluidExportReader::frameFloats() const
+{
+    return _frameFloats;
+}
+
+#endif // FLUID_EXPORTER_H
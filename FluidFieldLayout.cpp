@@ -0,0 +1,140 @@
+#include "FluidFieldLayout.h"
+
+#include <sstream>
+using namespace std;
+
+
+FluidFieldLayout::Format::Format(int components, EPrecision precision) :
+    components(components),
+    precision(precision)
+{
+}
+
+int FluidFieldLayout::Format::bytesPerCell() const
+{
+    return components * bytesPerComponent(precision);
+}
+
+FluidFieldLayout::FluidFieldLayout(bool halfDye)
+{
+    // Dye keeps its alpha : 3 components targets are not color renderable
+    setFormat(EField::DYE, Format(4,
+        halfDye ? EPrecision::FLOAT16 : EPrecision::FLOAT32));
+    setFormat(EField::VELOCITY,   Format(2, EPrecision::FLOAT32));
+    setFormat(EField::PRESSURE,   Format(1, EPrecision::FLOAT32));
+    setFormat(EField::HEAT,       Format(1, EPrecision::FLOAT32));
+    setFormat(EField::FRONTIER,   Format(1, EPrecision::UNORM8));
+    setFormat(EField::DIVERGENCE, Format(1, EPrecision::FLOAT32));
+}
+
+FluidFieldLayout FluidFieldLayout::rgba32f()
+{
+    FluidFieldLayout layout;
+    for(int f=0; f < FIELD_COUNT; ++f)
+        layout._formats[f] = Format(4, EPrecision::FLOAT32);
+    return layout;
+}
+
+void FluidFieldLayout::setFormat(EField field, const Format& format)
+{
+    _formats[(int) field] = format;
+}
+
+bool FluidFieldLayout::setPrecisions(const string& policy, string& error)
+{
+    stringstream entries(policy);
+    string entry;
+    while(getline(entries, entry, ','))
+    {
+        size_t equal = entry.find('=');
+        string name = entry.substr(0, equal);
+        EField field;
+        if(name == "dye")
+            field = EField::DYE;
+        else if(name == "heat")
+            field = EField::HEAT;
+        else
+        {
+            error = "Only dye and heat precisions can be set, not '" + name + "'";
+            return false;
+        }
+
+        bool ok = equal != string::npos;
+        EPrecision precision = precisionFromName(
+            ok ? entry.substr(equal+1) : string(), &ok);
+        if(!ok || precision == EPrecision::UNORM8)
+        {
+            error = "Invalid precision in '" + entry + "', use fp32, fp16 or bf16";
+            return false;
+        }
+
+        setFormat(field, Format(components(field), precision));
+    }
+
+    return true;
+}
+
+int FluidFieldLayout::bytesPerCell() const
+{
+    int bytes = 0;
+    for(int f=0; f < FIELD_COUNT; ++f)
+    {
+        EField field = (EField) f;
+        bool pingPong = field != EField::FRONTIER &&
+                        field != EField::DIVERGENCE;
+        bytes += _formats[f].bytesPerCell() * (pingPong ? 2 : 1);
+    }
+    return bytes;
+}
+
+int FluidFieldLayout::bytesPerComponent(EPrecision precision)
+{
+    switch(precision)
+    {
+    case EPrecision::FLOAT16 :  return 2;
+    case EPrecision::BFLOAT16 : return 2;
+    case EPrecision::UNORM8 :   return 1;
+    default :                   return 4;
+    }
+}
+
+const char* FluidFieldLayout::fieldName(EField field)
+{
+    switch(field)
+    {
+    case EField::DYE :        return "dye";
+    case EField::VELOCITY :   return "velocity";
+    case EField::PRESSURE :   return "pressure";
+    case EField::HEAT :       return "heat";
+    case EField::FRONTIER :   return "frontier";
+    default :                 return "divergence";
+    }
+}
+
+const char* FluidFieldLayout::precisionName(EPrecision precision)
+{
+    switch(precision)
+    {
+    case EPrecision::FLOAT16 :  return "fp16";
+    case EPrecision::BFLOAT16 : return "bf16";
+    case EPrecision::UNORM8 :   return "unorm8";
+    default :                   return "fp32";
+    }
+}
+
+FluidFieldLayout::EPrecision FluidFieldLayout::precisionFromName(
+        const string& name, bool* ok)
+{
+    if(ok) *ok = true;
+    if(name == "fp32")
+        return EPrecision::FLOAT32;
+    if(name == "fp16")
+        return EPrecision::FLOAT16;
+    if(name == "bf16")
+        return EPrecision::BFLOAT16;
+    if(name == "unorm8")
+        return EPrecision::UNORM8;
+
+    if(ok) *ok = false;
+    return EPrecision::FLOAT32;
+}
@@ -0,0 +1,67 @@
+#ifndef FLUID_FIELD_LAYOUT_H
+#define FLUID_FIELD_LAYOUT_H
+
+#include <string>
+
+
+// Component count and storage precision of every simulated quantity.
+// Shared by the GL textures and the CPU solver grids.
+class FluidFieldLayout
+{
+public:
+    enum class EField {DYE, VELOCITY, PRESSURE, HEAT, FRONTIER, DIVERGENCE};
+    // BFLOAT16 is CPU only, GL stores it as FLOAT16
+    enum class EPrecision {FLOAT32, FLOAT16, UNORM8, BFLOAT16};
+    static const int FIELD_COUNT = 6;
+
+    struct Format
+    {
+        Format(int components = 4, EPrecision precision = EPrecision::FLOAT32);
+        int bytesPerCell() const;
+
+        int components;
+        EPrecision precision;
+    };
+
+    // R32F pressure, heat and divergence, RG32F velocity,
+    // R8 frontier and RGBA dye in half or full precision
+    FluidFieldLayout(bool halfDye = false);
+
+    // Every field as RGBA32F
+    static FluidFieldLayout rgba32f();
+
+    void setFormat(EField field, const Format& format);
+
+    // Storage precision policy as "dye=fp16,heat=bf16".
+    // Only dye and heat may be narrowed : velocity, pressure and the
+    // divergence feeding the Poisson solve stay in fp32.
+    bool setPrecisions(const std::string& policy, std::string& error);
+    const Format& format(EField field) const;
+    int components(EField field) const;
+
+    // Simulation state per grid cell, ping-pong fields counted twice
+    int bytesPerCell() const;
+
+    static int bytesPerComponent(EPrecision precision);
+    static const char* fieldName(EField field);
+    static const char* precisionName(EPrecision precision);
+    static EPrecision precisionFromName(const std::string& name, bool* ok = nullptr);
+
+private:
+    Format _formats[FIELD_COUNT];
+};
+
+
+
+// IMPLEMENTATION //
+inline const FluidFieldLayout::Format& FluidFieldLayout::format(EField field) const
+{
+    return _formats[(int) field];
+}
+
+inline int FluidFieldLayout::components(EField field) const
+{
+    return _formats[(int) field].components;
+}
+
+#endif // FLUID_FIELD_LAYOUT_H
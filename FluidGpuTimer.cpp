@@ -0,0 +1,143 @@
+#include "FluidGpuTimer.h"
+
+#include <GL3/gl3w.h>
+
+using namespace std;
+
+
+FluidGpuTimer::FluidGpuTimer(int latency) :
+    LATENCY(latency < 1 ? 1 : latency),
+    _slots(),
+    _profiler(nullptr),
+    _current(-1),
+    _stallCount(0),
+    _running(false)
+{
+}
+
+FluidGpuTimer::~FluidGpuTimer()
+{
+}
+
+void FluidGpuTimer::init()
+{
+    _slots.resize(LATENCY);
+    for(Slot& slot : _slots)
+    {
+        slot.used = 0;
+        slot.frame = -1;
+        slot.pending = false;
+    }
+    _current = -1;
+}
+
+void FluidGpuTimer::release()
+{
+    // Frames left pending would hold back the profiler forever
+    end();
+    for(int k=1; k <= (int) _slots.size(); ++k)
+    {
+        Slot& slot = _slots[(_current + k) % LATENCY];
+        if(slot.pending)
+            readBack(slot, true);
+    }
+
+    for(Slot& slot : _slots)
+    {
+        if(!slot.queries.empty())
+            glDeleteQueries((GLsizei) slot.queries.size(), slot.queries.data());
+    }
+    _slots.clear();
+    _profiler = nullptr;
+}
+
+void FluidGpuTimer::beginFrame(FluidProfiler& profiler)
+{
+    if(_slots.empty())
+        return;
+
+    // Oldest first, so frames resolve in order
+    for(int k=1; k <= LATENCY; ++k)
+    {
+        Slot& slot = _slots[(_current + k) % LATENCY];
+        if(slot.pending && !readBack(slot, false))
+            break;
+    }
+
+    _profiler = &profiler;
+    _current = (_current + 1) % LATENCY;
+    Slot& slot = _slots[_current];
+    if(slot.pending)
+    {
+        ++_stallCount;
+        readBack(slot, true);
+    }
+
+    slot.frame = profiler.currentFrame();
+    slot.pending = true;
+    slot.used = 0;
+    profiler.await(slot.frame);
+}
+
+void FluidGpuTimer::endFrame()
+{
+    if(_running)
+        end();
+}
+
+void FluidGpuTimer::begin(FluidProfiler::EStage stage)
+{
+    if(_current < 0 || !_slots[_current].pending)
+        return;
+
+    Slot& slot = _slots[_current];
+    if(_running)
+        return;
+
+    if(slot.used == (int) slot.queries.size())
+    {
+        GLuint query = 0;
+        glGenQueries(1, &query);
+        slot.queries.push_back(query);
+        slot.stages.push_back(stage);
+    }
+
+    slot.stages[slot.used] = stage;
+    glBeginQuery(GL_TIME_ELAPSED, slot.queries[slot.used]);
+    ++slot.used;
+    _running = true;
+}
+
+void FluidGpuTimer::end()
+{
+    if(!_running)
+        return;
+
+    glEndQuery(GL_TIME_ELAPSED);
+    _running = false;
+}
+
+bool FluidGpuTimer::readBack(Slot& slot, bool wait)
+{
+    // Queries complete in order, the last one tells for the whole slot
+    if(!wait && slot.used > 0)
+    {
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(slot.queries[slot.used-1],
+                           GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available == GL_FALSE)
+            return false;
+    }
+
+    for(int q=0; q < slot.used; ++q)
+    {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(slot.queries[q], GL_QUERY_RESULT, &ns);
+        _profiler->record(slot.frame, slot.stages[q],
+                          FluidProfiler::EClock::GPU, ns * 1e-6);
+    }
+
+    slot.pending = false;
+    _profiler->resolve(slot.frame);
+    return true;
+}
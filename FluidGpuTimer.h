@@ -0,0 +1,64 @@
+#ifndef FLUID_GPU_TIMER_H
+#define FLUID_GPU_TIMER_H
+
+#include <vector>
+
+#include "FluidProfiler.h"
+
+
+// GL_TIME_ELAPSED queries of the stages of the last few frames.
+// Each frame owns a slot of the ring, one query per timed pass, and the
+// slots are only read back once their results are available so the
+// pipeline never stalls unless the GPU falls more than LATENCY frames behind.
+class FluidGpuTimer
+{
+public:
+    FluidGpuTimer(int latency = 4);
+    virtual ~FluidGpuTimer();
+
+    // Need a current GL context
+    void init();
+    void release();
+
+    // Reads back the finished slots and starts timing a new frame
+    void beginFrame(FluidProfiler& profiler);
+    void endFrame();
+
+    // Stages do not nest, those run more than once in a frame are summed
+    void begin(FluidProfiler::EStage stage);
+    void end();
+
+    // Frames whose slot had to be waited for before being reused
+    int stallCount() const;
+
+
+private:
+    struct Slot
+    {
+        // Queries are kept between frames, only the first used ones are issued
+        std::vector<unsigned int> queries;
+        std::vector<FluidProfiler::EStage> stages;
+        int used;
+        long long frame;
+        bool pending;
+    };
+
+    bool readBack(Slot& slot, bool wait);
+
+    const int LATENCY;
+    std::vector<Slot> _slots;
+    FluidProfiler* _profiler;
+    int _current;
+    int _stallCount;
+    bool _running;
+};
+
+
+
+// IMPLEMENTATION //
+inline int FluidGpuTimer::stallCount() const
+{
+    return _stallCount;
+}
+
+#endif // FLUID_GPU_TIMER_H
@@ -0,0 +1,270 @@
+#include "FluidGrid.h"
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+using namespace cellar;
+
+
+namespace
+{
+    // Every half decoded once, rows read through it skip the branches
+    // fromHalf() takes on subnormals
+    const vector<float>& halfTable()
+    {
+        static const vector<float> table = []()
+        {
+            vector<float> values(1 << 16);
+            for(int h=0; h < (int) values.size(); ++h)
+                values[h] = FluidGrid::fromHalf((uint16_t) h);
+            return values;
+        }();
+        return table;
+    }
+}
+
+
+FluidGrid::FluidGrid() :
+    _width(0),
+    _height(0),
+    _components(0),
+    _precision(EPrecision::FLOAT32),
+    _data(),
+    _packed()
+{
+}
+
+FluidGrid::FluidGrid(int width, int height, int components,
+                     EPrecision precision) :
+    _width(0),
+    _height(0),
+    _components(0),
+    _precision(EPrecision::FLOAT32),
+    _data(),
+    _packed()
+{
+    resize(width, height, components, precision);
+}
+
+void FluidGrid::resize(int width, int height, int components,
+                       EPrecision precision)
+{
+    _width = width;
+    _height = height;
+    _components = components;
+    _precision = precision == EPrecision::FLOAT16 ||
+                 precision == EPrecision::BFLOAT16 ?
+                     precision : EPrecision::FLOAT32;
+
+    if(packed())
+    {
+        _data.clear();
+        _packed.assign(width * height * components, 0);
+    }
+    else
+    {
+        _packed.clear();
+        _data.assign(width * height * components, 0.0f);
+    }
+}
+
+void FluidGrid::fill(const Vec4f& value)
+{
+    for(int c=0; c < _components; ++c)
+        for(int k=0; k < area(); ++k)
+            store(c, k, value[c]);
+}
+
+void FluidGrid::convert(EPrecision precision)
+{
+    FluidGrid converted(_width, _height, _components, precision);
+    if(converted._precision == _precision)
+        return;
+
+    vector<float> row(_width);
+    for(int c=0; c < _components; ++c)
+    {
+        for(int j=0; j < _height; ++j)
+        {
+            readCells(c, j*_width, _width, row.data());
+            converted.writeCells(c, j*_width, _width, row.data());
+        }
+    }
+    *this = converted;
+}
+
+void FluidGrid::readCells(int c, int first, int count, float* out) const
+{
+    switch(_precision)
+    {
+    case EPrecision::FLOAT16 :
+    {
+        const float* table = halfTable().data();
+        const uint16_t* in = packedPlane(c) + first;
+        for(int k=0; k < count; ++k)
+            out[k] = table[in[k]];
+        break;
+    }
+    case EPrecision::BFLOAT16 :
+        transform(packedPlane(c) + first, packedPlane(c) + first + count,
+                  out, fromBFloat);
+        break;
+    default :
+        copy_n(plane(c) + first, count, out);
+        break;
+    }
+}
+
+void FluidGrid::writeCells(int c, int first, int count, const float* in)
+{
+    switch(_precision)
+    {
+    case EPrecision::FLOAT16 :
+        transform(in, in + count, packedPlane(c) + first, toHalf);
+        break;
+    case EPrecision::BFLOAT16 :
+        transform(in, in + count, packedPlane(c) + first, toBFloat);
+        break;
+    default :
+        copy_n(in, count, plane(c) + first);
+        break;
+    }
+}
+
+void FluidGrid::copyCells(const FluidGrid& src, int c, int first, int count)
+{
+    if(packed())
+        copy_n(src.packedPlane(c) + first, count, packedPlane(c) + first);
+    else
+        copy_n(src.plane(c) + first, count, plane(c) + first);
+}
+
+Vec4f FluidGrid::texel(int i, int j) const
+{
+    Vec4f t(0, 0, 0, 1);
+    for(int c=0; c < _components; ++c)
+        t[c] = load(c, j*_width + i);
+    return t;
+}
+
+void FluidGrid::setTexel(int i, int j, const Vec4f& value)
+{
+    for(int c=0; c < _components; ++c)
+        store(c, j*_width + i, value[c]);
+}
+
+void FluidGrid::sample(float x, float y, float* out) const
+{
+    Footprint fp;
+    footprint(x, y, fp);
+    sample(fp, out);
+}
+
+void FluidGrid::footprint(float x, float y, Footprint& fp) const
+{
+    // Texel centers are at half coordinates
+    x -= 0.5f;
+    y -= 0.5f;
+
+    float fi = floor(x);
+    float fj = floor(y);
+    fp.a = x - fi;
+    fp.b = y - fj;
+    int i0 = (int) fi;
+    int j0 = (int) fj;
+    int i1 = i0 + 1;
+    int j1 = j0 + 1;
+    i0 = i0 < 0 ? 0 : (i0 >= _width  ? _width-1  : i0);
+    i1 = i1 < 0 ? 0 : (i1 >= _width  ? _width-1  : i1);
+    j0 = j0 < 0 ? 0 : (j0 >= _height ? _height-1 : j0);
+    j1 = j1 < 0 ? 0 : (j1 >= _height ? _height-1 : j1);
+
+    fp.c00 = j0*_width + i0;
+    fp.c10 = j0*_width + i1;
+    fp.c01 = j1*_width + i0;
+    fp.c11 = j1*_width + i1;
+}
+
+void FluidGrid::sample(const Footprint& fp, float* out) const
+{
+    // Halves are decoded through the table like readCells()
+    const float* table = _precision == EPrecision::FLOAT16 ?
+                             halfTable().data() : nullptr;
+    for(int c=0; c < _components; ++c)
+    {
+        float p00, p10, p01, p11;
+        if(table)
+        {
+            const uint16_t* p = packedPlane(c);
+            p00 = table[p[fp.c00]];
+            p10 = table[p[fp.c10]];
+            p01 = table[p[fp.c01]];
+            p11 = table[p[fp.c11]];
+        }
+        else if(packed())
+        {
+            p00 = load(c, fp.c00);
+            p10 = load(c, fp.c10);
+            p01 = load(c, fp.c01);
+            p11 = load(c, fp.c11);
+        }
+        else
+        {
+            const float* p = plane(c);
+            p00 = p[fp.c00];
+            p10 = p[fp.c10];
+            p01 = p[fp.c01];
+            p11 = p[fp.c11];
+        }
+        float bottom = p00 + (p10 - p00) * fp.a;
+        float top    = p01 + (p11 - p01) * fp.a;
+        out[c] = bottom + (top - bottom) * fp.b;
+    }
+}
+
+void FluidGrid::bounds(const Footprint& fp, float* low, float* high) const
+{
+    for(int c=0; c < _components; ++c)
+    {
+        float p00 = load(c, fp.c00);
+        float p10 = load(c, fp.c10);
+        float p01 = load(c, fp.c01);
+        float p11 = load(c, fp.c11);
+        low[c]  = min(min(p00, p10), min(p01, p11));
+        high[c] = max(max(p00, p10), max(p01, p11));
+    }
+}
+
+void FluidGrid::interleave(vector<float>& texels) const
+{
+    texels.resize(area() * _components);
+    vector<float> row(packed() ? _width : 0);
+    for(int c=0; c < _components; ++c)
+    {
+        for(int j=0; j < _height; ++j)
+        {
+            const float* p = row.data();
+            if(packed())
+                readCells(c, j*_width, _width, row.data());
+            else
+                p = plane(c) + j*_width;
+            for(int i=0; i < _width; ++i)
+                texels[(j*_width + i)*_components + c] = p[i];
+        }
+    }
+}
+
+void FluidGrid::deinterleave(const float* texels)
+{
+    vector<float> row(_width);
+    for(int c=0; c < _components; ++c)
+    {
+        for(int j=0; j < _height; ++j)
+        {
+            for(int i=0; i < _width; ++i)
+                row[i] = texels[(j*_width + i)*_components + c];
+            writeCells(c, j*_width, _width, row.data());
+        }
+    }
+}
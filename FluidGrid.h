@@ -0,0 +1,258 @@
+#ifndef FLUID_GRID_H
+#define FLUID_GRID_H
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#include <DataStructure/Vector.h>
+
+#include "FluidFieldLayout.h"
+
+
+// Host side field storage with one float plane per component.
+// Cells are addressed like texelFetch() : (i, j) with i along the width.
+// FLOAT16 and BFLOAT16 grids keep 16 bits planes instead, plane() is then
+// unavailable and cells go through load() and store() or the row copies.
+class FluidGrid
+{
+public:
+    typedef FluidFieldLayout::EPrecision EPrecision;
+
+    // Bilinear footprint of a sample, shared by grids of the same size
+    struct Footprint
+    {
+        int c00, c10, c01, c11;
+        float a, b;
+    };
+
+    FluidGrid();
+    FluidGrid(int width, int height, int components,
+              EPrecision precision = EPrecision::FLOAT32);
+
+    // Any precision but FLOAT16 and BFLOAT16 is stored as FLOAT32
+    void resize(int width, int height, int components,
+                EPrecision precision = EPrecision::FLOAT32);
+    void fill(const cellar::Vec4f& value);
+
+    // Rounds the values to nearest even when narrowing
+    void convert(EPrecision precision);
+
+    int width() const;
+    int height() const;
+    int area() const;
+    int components() const;
+    EPrecision precision() const;
+    bool packed() const;
+    int bytesPerComponent() const;
+
+    float* plane(int c);
+    const float* plane(int c) const;
+    uint16_t* packedPlane(int c);
+    const uint16_t* packedPlane(int c) const;
+
+    // Cell k = j*width + i of plane c, whatever the precision
+    float load(int c, int k) const;
+    void store(int c, int k, float value);
+
+    // count cells of plane c from cell first, converted to and from float
+    void readCells(int c, int first, int count, float* out) const;
+    void writeCells(int c, int first, int count, const float* in);
+    // Same cells of another grid of the same size and precision
+    void copyCells(const FluidGrid& src, int c, int first, int count);
+
+    // Missing components read like a GL texture : 0 for G and B, 1 for A
+    cellar::Vec4f texel(int i, int j) const;
+    void setTexel(int i, int j, const cellar::Vec4f& value);
+
+    // texelFetch() with out of range coordinates clamped to the edge
+    float fetch(int c, int i, int j) const;
+
+    // texture() with GL_LINEAR and GL_CLAMP_TO_EDGE, pos given in texels
+    void sample(float x, float y, float* out) const;
+    void footprint(float x, float y, Footprint& fp) const;
+    void sample(const Footprint& fp, float* out) const;
+    // Smallest and largest of the four texels the footprint blends
+    void bounds(const Footprint& fp, float* low, float* high) const;
+
+    // Packs the planes as texels of components() floats
+    void interleave(std::vector<float>& texels) const;
+    void deinterleave(const float* texels);
+
+    // IEEE half and bfloat16 with round to nearest even, NaN preserving
+    static uint16_t toHalf(float value);
+    static float fromHalf(uint16_t half);
+    static uint16_t toBFloat(float value);
+    static float fromBFloat(uint16_t bfloat);
+
+private:
+    int _width;
+    int _height;
+    int _components;
+    EPrecision _precision;
+    std::vector<float> _data;
+    std::vector<uint16_t> _packed;
+};
+
+
+
+// IMPLEMENTATION //
+inline int FluidGrid::width() const
+{
+    return _width;
+}
+
+inline int FluidGrid::height() const
+{
+    return _height;
+}
+
+inline int FluidGrid::area() const
+{
+    return _width * _height;
+}
+
+inline int FluidGrid::components() const
+{
+    return _components;
+}
+
+inline FluidGrid::EPrecision FluidGrid::precision() const
+{
+    return _precision;
+}
+
+inline bool FluidGrid::packed() const
+{
+    return _precision != EPrecision::FLOAT32;
+}
+
+inline int FluidGrid::bytesPerComponent() const
+{
+    return packed() ? (int) sizeof(uint16_t) : (int) sizeof(float);
+}
+
+inline float* FluidGrid::plane(int c)
+{
+    return _data.data() + c * _width * _height;
+}
+
+inline const float* FluidGrid::plane(int c) const
+{
+    return _data.data() + c * _width * _height;
+}
+
+inline uint16_t* FluidGrid::packedPlane(int c)
+{
+    return _packed.data() + c * _width * _height;
+}
+
+inline const uint16_t* FluidGrid::packedPlane(int c) const
+{
+    return _packed.data() + c * _width * _height;
+}
+
+inline float FluidGrid::load(int c, int k) const
+{
+    switch(_precision)
+    {
+    case EPrecision::FLOAT16 :  return fromHalf(packedPlane(c)[k]);
+    case EPrecision::BFLOAT16 : return fromBFloat(packedPlane(c)[k]);
+    default :                   return plane(c)[k];
+    }
+}
+
+inline void FluidGrid::store(int c, int k, float value)
+{
+    switch(_precision)
+    {
+    case EPrecision::FLOAT16 :  packedPlane(c)[k] = toHalf(value);   break;
+    case EPrecision::BFLOAT16 : packedPlane(c)[k] = toBFloat(value); break;
+    default :                   plane(c)[k] = value;                 break;
+    }
+}
+
+inline float FluidGrid::fetch(int c, int i, int j) const
+{
+    i = i < 0 ? 0 : (i >= _width  ? _width-1  : i);
+    j = j < 0 ? 0 : (j >= _height ? _height-1 : j);
+    if(packed())
+        return load(c, j*_width + i);
+    return _data[(c*_height + j)*_width + i];
+}
+
+inline uint16_t FluidGrid::toHalf(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    const uint32_t sign = f & 0x80000000u;
+    f ^= sign;
+
+    // Every case is computed and selected, fields decaying to subnormal
+    // halves would otherwise mispredict the branches
+    const uint32_t MAGIC = 0x3f000000u;
+    float fv, magic;
+    memcpy(&fv, &f, sizeof(fv));
+    memcpy(&magic, &MAGIC, sizeof(magic));
+    fv += magic;
+    uint32_t subnormal;
+    memcpy(&subnormal, &fv, sizeof(subnormal));
+    // The addition aligns the mantissa and rounds
+    subnormal -= MAGIC;
+
+    const uint32_t normal = (f + 0xc8000fffu + ((f >> 13) & 1u)) >> 13;
+
+    // Overflows to infinity, NaNs stay quiet NaNs
+    const uint32_t special = f > 0x7f800000u ? 0x7e00u : 0x7c00u;
+
+    uint32_t h = f < 0x38800000u ? subnormal : normal;
+    h = f >= 0x47800000u ? special : h;
+
+    return (uint16_t) (h | (sign >> 16));
+}
+
+inline float FluidGrid::fromHalf(uint16_t half)
+{
+    const uint32_t EXPONENT = 0x7c00u << 13;
+    uint32_t f = (half & 0x7fffu) << 13;
+    const uint32_t exponent = f & EXPONENT;
+    f += (127 - 15) << 23;
+    if(exponent == EXPONENT)
+        f += (128 - 16) << 23;
+    else if(exponent == 0)
+    {
+        // Subnormal, renormalized by the float unit
+        const uint32_t MAGIC = 113u << 23;
+        float fv, magic;
+        f += 1u << 23;
+        memcpy(&fv, &f, sizeof(fv));
+        memcpy(&magic, &MAGIC, sizeof(magic));
+        fv -= magic;
+        memcpy(&f, &fv, sizeof(f));
+    }
+    f |= (uint32_t) (half & 0x8000u) << 16;
+
+    float value;
+    memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
+inline uint16_t FluidGrid::toBFloat(float value)
+{
+    uint32_t f;
+    memcpy(&f, &value, sizeof(f));
+    if((f & 0x7fffffffu) > 0x7f800000u)
+        return (uint16_t) ((f >> 16) | 0x40u);
+    f += 0x7fffu + ((f >> 16) & 1u);
+    return (uint16_t) (f >> 16);
+}
+
+inline float FluidGrid::fromBFloat(uint16_t bfloat)
+{
+    uint32_t f = (uint32_t) bfloat << 16;
+    float value;
+    memcpy(&value, &f, sizeof(value));
+    return value;
+}
+
+#endif // FLUID_GRID_H
@@ -0,0 +1,172 @@
+#include "FluidInitializer.h"
+
+#include <vector>
+
+#include <Misc/CellarUtils.h>
+#include <Algorithm/Noise.h>
+using namespace std;
+using namespace cellar;
+
+#include "FluidGrid.h"
+#include "FluidScheduler.h"
+
+
+FluidInitializer::FluidInitializer()
+{
+}
+
+FluidInitializer::~FluidInitializer()
+{
+}
+
+Vec4f FluidInitializer::initDye(float s, float t)
+{
+    float zoom = 4.0f;
+    float dye = SimplexNoise::noise2d(s*zoom, t*zoom);
+    return Vec4f(dye, dye, dye, 1.0);
+}
+
+Vec4f FluidInitializer::initVelocity(float s, float t)
+{
+    /* Swirl
+    const float cx = 0.5f, cy = 0.5f;
+    const float ed = 0.35f;
+    float dist = Vec2f(s, t).distanceTo(cx, cy);
+    if(dist < ed)
+        return Vec4f(t-cx, -(s-cy), 0, 0) * 3.0 + Vec4f(1.0, 1.0, 0, 0) * 1.0;
+    return Vec4f();
+    //*/
+
+    /* Plank
+    if(cellar::inRange(s, 0.3f, 0.5f) &&
+       cellar::inRange(t, 0.2f, 0.40f))
+    {
+        return Vec4f(0.0, 1.0, 0.0, 0.0) * (0.1-absolute(t-0.3f))*10.0;
+    }
+    if(cellar::inRange(s, 0.5f, 0.7f) &&
+       cellar::inRange(t, 0.6f, 0.8f))
+    {
+        return Vec4f(0.0, -1.0, 0.0, 0.0) * (0.1-absolute(t-0.7f))*10.0;
+    }
+    return Vec4f();
+    //*/
+
+    return Vec4f();
+}
+
+Vec4f FluidInitializer::initPressure(float s, float t)
+{
+    return Vec4f();
+}
+
+Vec4f FluidInitializer::initHeat(float s, float t)
+{
+    if((Vec2f(s, t) - Vec2f(0.2, 0.8)).length() < 0.08)
+        return Vec4f(-5, 0, 0, 0);
+    if((Vec2f(s, t) - Vec2f(0.5, 0.2)).length() < 0.08)
+        return Vec4f(5, 0, 0, 0);
+    return Vec4f();
+}
+
+Vec4f FluidInitializer::initFrontier(float s, float t)
+{
+    const Vec4f block(1.0, 1.0, 1.0, 1.0);
+    const Vec4f fluid(0.0, 0.0, 0.0, 0.0);
+
+    const float W = 0.03;
+    if(s < W || s > 1-W || t < W || t > 1-W)
+        return block;
+
+    if((t > 0.45 && t < 0.52) && (
+        !inRange(s, 0.22f, 0.24f) &&
+        !inRange(s, 0.50f, 0.53f) &&
+        !inRange(s, 0.78f, 0.80f)))
+        return block;
+/*
+    if(Vec2f(s, t).distanceTo(0.75, 0.66) < 0.2)
+        return block;
+
+    if(Vec2f(s, t).distanceTo(0.3, 0.2) < 0.03)
+        return block;
+*/
+    return fluid;
+}
+
+void FluidInitializer::generate(FluidScheduler& scheduler,
+                                FluidGrid* dye, FluidGrid* velocity,
+                                FluidGrid* pressure, FluidGrid* heat,
+                                FluidGrid* frontier)
+{
+    FluidGrid* grids[] = {dye, velocity, pressure, heat, frontier};
+    for(FluidGrid* grid : grids)
+    {
+        if(grid != nullptr)
+        {
+            generateRows(scheduler, 0, grid->height(),
+                         dye, velocity, pressure, heat, frontier);
+            break;
+        }
+    }
+
+    stamp(scheduler, dye, velocity, pressure, heat, frontier);
+}
+
+void FluidInitializer::generateRows(FluidScheduler& scheduler,
+                                    int row0, int fullHeight,
+                                    FluidGrid* dye, FluidGrid* velocity,
+                                    FluidGrid* pressure, FluidGrid* heat,
+                                    FluidGrid* frontier)
+{
+    typedef Vec4f (FluidInitializer::*init_t)(float, float);
+    struct {FluidGrid* grid; init_t init;} fields[] = {
+        {dye,      &FluidInitializer::initDye},
+        {velocity, &FluidInitializer::initVelocity},
+        {pressure, &FluidInitializer::initPressure},
+        {heat,     &FluidInitializer::initHeat},
+        {frontier, &FluidInitializer::initFrontier}
+    };
+
+    const FluidGrid* size = nullptr;
+    for(const auto& f : fields)
+        if(f.grid != nullptr)
+            size = f.grid;
+    if(size == nullptr)
+        return;
+
+    // Each tile row is evaluated one field at a time, then written one
+    // plane at a time so that stores stay contiguous
+    const int width = size->width();
+    const int height = size->height();
+    scheduler.forEachTile(width, height, [&](const FluidTile& tile, int)
+    {
+        const int count = tile.i1 - tile.i0;
+        static thread_local vector<Vec4f> values;
+        static thread_local vector<float> row;
+        values.resize(count);
+        row.resize(count);
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            float t = (row0 + j)/(float)fullHeight;
+            for(const auto& f : fields)
+            {
+                if(f.grid == nullptr)
+                    continue;
+
+                for(int i=tile.i0; i<tile.i1; ++i)
+                    values[i - tile.i0] = (this->*f.init)(i/(float)width, t);
+
+                for(int c=0; c < f.grid->components(); ++c)
+                {
+                    for(int k=0; k < count; ++k)
+                        row[k] = values[k][c];
+                    f.grid->writeCells(c, j*width + tile.i0, count, row.data());
+                }
+            }
+        }
+    });
+}
+
+void FluidInitializer::stamp(FluidScheduler&, FluidGrid*, FluidGrid*,
+                             FluidGrid*, FluidGrid*, FluidGrid*)
+{
+}
@@ -0,0 +1,41 @@
+#ifndef FLUID_INITIALIZER_H
+#define FLUID_INITIALIZER_H
+
+#include <DataStructure/Vector.h>
+
+class FluidGrid;
+class FluidScheduler;
+
+
+class FluidInitializer
+{
+public:
+    FluidInitializer();
+    virtual ~FluidInitializer();
+
+    virtual cellar::Vec4f initDye(float s, float t);
+    virtual cellar::Vec4f initVelocity(float s, float t);
+    virtual cellar::Vec4f initPressure(float s, float t);
+    virtual cellar::Vec4f initHeat(float s, float t);
+    virtual cellar::Vec4f initFrontier(float s, float t);
+
+    // Fills the grids tile by tile on the scheduler's threads, cell (i, j)
+    // getting init*(i/width, j/height). The init functions are called
+    // concurrently and must not modify shared state.
+    // A null grid is skipped. stamp() is called once the cells are filled.
+    void generate(FluidScheduler& scheduler, FluidGrid* dye, FluidGrid* velocity,
+                  FluidGrid* pressure, FluidGrid* heat, FluidGrid* frontier);
+
+    // Same cells for a band of rows of a taller grid : row j of the grids
+    // gets init*(i/width, (row0 + j)/height). stamp() is not called.
+    void generateRows(FluidScheduler& scheduler, int row0, int height,
+                      FluidGrid* dye, FluidGrid* velocity, FluidGrid* pressure,
+                      FluidGrid* heat, FluidGrid* frontier);
+
+    // Draws shapes over the generated grids, does nothing by default
+    virtual void stamp(FluidScheduler& scheduler, FluidGrid* dye,
+                       FluidGrid* velocity, FluidGrid* pressure,
+                       FluidGrid* heat, FluidGrid* frontier);
+};
+
+#endif // FLUID_INITIALIZER_H
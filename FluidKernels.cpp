@@ -0,0 +1,89 @@
+#include "FluidKernels.h"
+
+using namespace std;
+
+
+static FluidKernels detectBest()
+{
+    FluidKernels kernels;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && fluidKernelsAvx512(kernels))
+        return kernels;
+    if(__builtin_cpu_supports("avx2") && fluidKernelsAvx2(kernels))
+        return kernels;
+    if(__builtin_cpu_supports("sse2") && fluidKernelsSse2(kernels))
+        return kernels;
+#elif defined(_M_X64)
+    if(fluidKernelsSse2(kernels))
+        return kernels;
+#else
+    if(fluidKernelsNeon(kernels))
+        return kernels;
+#endif
+
+    fluidKernelsScalar(kernels);
+    return kernels;
+}
+
+
+FluidKernels::FluidKernels() :
+    isa(EIsa::SCALAR),
+    jacobi(nullptr),
+    divergence(nullptr),
+    gradSub(nullptr),
+    maxSpeed2(nullptr)
+{
+}
+
+const FluidKernels& FluidKernels::best()
+{
+    static const FluidKernels kernels = detectBest();
+    return kernels;
+}
+
+const FluidKernels& FluidKernels::scalar()
+{
+    static FluidKernels kernels;
+    if(kernels.jacobi == nullptr)
+        fluidKernelsScalar(kernels);
+    return kernels;
+}
+
+vector<FluidKernels> FluidKernels::available()
+{
+    vector<FluidKernels> sets;
+    sets.push_back(scalar());
+
+    FluidKernels kernels;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("sse2") && fluidKernelsSse2(kernels))
+        sets.push_back(kernels);
+    if(__builtin_cpu_supports("avx2") && fluidKernelsAvx2(kernels))
+        sets.push_back(kernels);
+    if(__builtin_cpu_supports("avx512f") && fluidKernelsAvx512(kernels))
+        sets.push_back(kernels);
+#elif defined(_M_X64)
+    if(fluidKernelsSse2(kernels))
+        sets.push_back(kernels);
+#else
+    if(fluidKernelsNeon(kernels))
+        sets.push_back(kernels);
+#endif
+
+    return sets;
+}
+
+const char* FluidKernels::isaName(EIsa isa)
+{
+    switch(isa)
+    {
+    case EIsa::SSE2 :   return "sse2";
+    case EIsa::AVX2 :   return "avx2";
+    case EIsa::AVX512 : return "avx512";
+    case EIsa::NEON :   return "neon";
+    default :           return "scalar";
+    }
+}
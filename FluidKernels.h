@@ -0,0 +1,58 @@
+#ifndef FLUID_KERNELS_H
+#define FLUID_KERNELS_H
+
+#include <vector>
+
+#include "FluidTile.h"
+
+
+// 5-point stencils of jacobi.frag, divergence.frag and gradSub.frag on
+// single float planes, with texelFetch() clamped to the edge, and the
+// velocity reduction of the adaptive timestep.
+// Only the cells of the given tile are written.
+// Every instruction set evaluates the same operations in the same order,
+// so all of them are bit-compatible with the scalar kernels.
+class FluidKernels
+{
+public:
+    enum class EIsa {SCALAR, SSE2, AVX2, AVX512, NEON};
+
+    typedef void (*jacobi_t)(const float* x, const float* b, float* dst,
+                             int width, int height, const FluidTile& tile,
+                             float alpha, float rBeta);
+    typedef void (*divergence_t)(const float* u, const float* v, float* div,
+                                 int width, int height, const FluidTile& tile,
+                                 float halfrDx);
+    // Updates u and v in place
+    typedef void (*gradSub_t)(const float* p, float* u, float* v,
+                              int width, int height, const FluidTile& tile,
+                              float halfrDx);
+    // Largest u^2 + v^2 of the tile, 0 for an empty one
+    typedef float (*maxSpeed2_t)(const float* u, const float* v,
+                                 int width, const FluidTile& tile);
+
+    FluidKernels();
+
+    // Fastest kernels supported by both the build and the running CPU
+    static const FluidKernels& best();
+    static const FluidKernels& scalar();
+    static std::vector<FluidKernels> available();
+    static const char* isaName(EIsa isa);
+
+    EIsa isa;
+    jacobi_t jacobi;
+    divergence_t divergence;
+    gradSub_t gradSub;
+    maxSpeed2_t maxSpeed2;
+};
+
+
+// One per instruction set translation unit.
+// They return false when the set was not compiled in.
+bool fluidKernelsScalar(FluidKernels& kernels);
+bool fluidKernelsSse2(FluidKernels& kernels);
+bool fluidKernelsAvx2(FluidKernels& kernels);
+bool fluidKernelsAvx512(FluidKernels& kernels);
+bool fluidKernelsNeon(FluidKernels& kernels);
+
+#endif // FLUID_KERNELS_H
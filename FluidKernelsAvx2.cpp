@@ -0,0 +1,38 @@
+#include "FluidKernels.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#include "FluidKernelsImpl.h"
+
+
+namespace
+{
+    struct Avx2Traits
+    {
+        typedef __m256 reg;
+        static const int N = 8;
+
+        static inline reg set1(float a)              {return _mm256_set1_ps(a);}
+        static inline reg load(const float* p)       {return _mm256_loadu_ps(p);}
+        static inline void store(float* p, reg a)    {_mm256_storeu_ps(p, a);}
+        static inline reg add(reg a, reg b)          {return _mm256_add_ps(a, b);}
+        static inline reg sub(reg a, reg b)          {return _mm256_sub_ps(a, b);}
+        static inline reg mul(reg a, reg b)          {return _mm256_mul_ps(a, b);}
+        static inline reg max(reg a, reg b)          {return _mm256_max_ps(a, b);}
+    };
+}
+
+bool fluidKernelsAvx2(FluidKernels& kernels)
+{
+    FluidKernelsImpl<Avx2Traits>::fill(kernels, FluidKernels::EIsa::AVX2);
+    return true;
+}
+
+#else
+
+bool fluidKernelsAvx2(FluidKernels&)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#include "FluidKernels.h"
+
+#if defined(__AVX512F__)
+// GCC 12's _mm512_undefined_ps() reads itself to leave the register
+// undefined, which -Wmaybe-uninitialized reports in every max
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#include "FluidKernelsImpl.h"
+
+
+namespace
+{
+    struct Avx512Traits
+    {
+        typedef __m512 reg;
+        static const int N = 16;
+
+        static inline reg set1(float a)              {return _mm512_set1_ps(a);}
+        static inline reg load(const float* p)       {return _mm512_loadu_ps(p);}
+        static inline void store(float* p, reg a)    {_mm512_storeu_ps(p, a);}
+        static inline reg add(reg a, reg b)          {return _mm512_add_ps(a, b);}
+        static inline reg sub(reg a, reg b)          {return _mm512_sub_ps(a, b);}
+        static inline reg mul(reg a, reg b)          {return _mm512_mul_ps(a, b);}
+        static inline reg max(reg a, reg b)          {return _mm512_max_ps(a, b);}
+    };
+}
+
+bool fluidKernelsAvx512(FluidKernels& kernels)
+{
+    FluidKernelsImpl<Avx512Traits>::fill(kernels, FluidKernels::EIsa::AVX512);
+    return true;
+}
+
+#else
+
+bool fluidKernelsAvx512(FluidKernels&)
+{
+    return false;
+}
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef FLUID_KERNELS_IMPL_H
+#define FLUID_KERNELS_IMPL_H
+
+// Stencil bodies shared by every instruction set.
+// V provides reg, N, set1, load, store, add, sub, mul and max.
+// Only included by the FluidKernels*.cpp translation units.
+
+
+template<typename V>
+struct FluidKernelsImpl
+{
+    typedef typename V::reg reg;
+
+    static inline int clampRow(int j, int height)
+    {
+        return j < 0 ? 0 : (j >= height ? height-1 : j);
+    }
+
+    static void jacobi(const float* x, const float* b, float* dst,
+                       int width, int height, const FluidTile& tile,
+                       float alpha, float rBeta)
+    {
+        const reg vAlpha = V::set1(alpha);
+        const reg vrBeta = V::set1(rBeta);
+        const int vecEnd = tile.i1 < width-1 ? tile.i1 : width-1;
+
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            const float* xC = x + j*width;
+            const float* xB = x + clampRow(j-1, height)*width;
+            const float* xT = x + clampRow(j+1, height)*width;
+            const float* bC = b + j*width;
+            float* out = dst + j*width;
+
+            // The first and last columns clamp their outer neighbor
+            int i = tile.i0;
+            if(i == 0 && i < tile.i1)
+            {
+                float xR = xC[width > 1 ? 1 : 0];
+                out[0] = (xC[0] + xR + xB[0] + xT[0] + bC[0]*alpha) * rBeta;
+                i = 1;
+            }
+
+            for(; i + V::N <= vecEnd; i += V::N)
+            {
+                reg sum = V::add(V::load(xC + i-1), V::load(xC + i+1));
+                sum = V::add(sum, V::load(xB + i));
+                sum = V::add(sum, V::load(xT + i));
+                sum = V::add(sum, V::mul(V::load(bC + i), vAlpha));
+                V::store(out + i, V::mul(sum, vrBeta));
+            }
+
+            for(; i < tile.i1; ++i)
+            {
+                float xR = xC[i < width-1 ? i+1 : width-1];
+                out[i] = (xC[i-1] + xR + xB[i] + xT[i] + bC[i]*alpha) * rBeta;
+            }
+        }
+    }
+
+    static void divergence(const float* u, const float* v, float* div,
+                           int width, int height, const FluidTile& tile,
+                           float halfrDx)
+    {
+        const reg vHalfrDx = V::set1(halfrDx);
+        const int vecEnd = tile.i1 < width-1 ? tile.i1 : width-1;
+
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            const float* uC = u + j*width;
+            const float* vB = v + clampRow(j-1, height)*width;
+            const float* vT = v + clampRow(j+1, height)*width;
+            float* out = div + j*width;
+
+            int i = tile.i0;
+            if(i == 0 && i < tile.i1)
+            {
+                out[0] = halfrDx * ((uC[width > 1 ? 1 : 0] - uC[0]) +
+                                    (vT[0] - vB[0]));
+                i = 1;
+            }
+
+            for(; i + V::N <= vecEnd; i += V::N)
+            {
+                reg du = V::sub(V::load(uC + i+1), V::load(uC + i-1));
+                reg dv = V::sub(V::load(vT + i), V::load(vB + i));
+                V::store(out + i, V::mul(vHalfrDx, V::add(du, dv)));
+            }
+
+            for(; i < tile.i1; ++i)
+            {
+                float uL = uC[i-1];
+                float uR = uC[i < width-1 ? i+1 : width-1];
+                out[i] = halfrDx * ((uR - uL) + (vT[i] - vB[i]));
+            }
+        }
+    }
+
+    static void gradSub(const float* p, float* u, float* v,
+                        int width, int height, const FluidTile& tile,
+                        float halfrDx)
+    {
+        const reg vHalfrDx = V::set1(halfrDx);
+        const int vecEnd = tile.i1 < width-1 ? tile.i1 : width-1;
+
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            const float* pC = p + j*width;
+            const float* pB = p + clampRow(j-1, height)*width;
+            const float* pT = p + clampRow(j+1, height)*width;
+            float* uC = u + j*width;
+            float* vC = v + j*width;
+
+            int i = tile.i0;
+            if(i == 0 && i < tile.i1)
+            {
+                uC[0] = uC[0] - halfrDx * (pC[width > 1 ? 1 : 0] - pC[0]);
+                vC[0] = vC[0] - halfrDx * (pT[0] - pB[0]);
+                i = 1;
+            }
+
+            for(; i + V::N <= vecEnd; i += V::N)
+            {
+                reg dpx = V::sub(V::load(pC + i+1), V::load(pC + i-1));
+                reg dpy = V::sub(V::load(pT + i), V::load(pB + i));
+                V::store(uC + i, V::sub(V::load(uC + i), V::mul(vHalfrDx, dpx)));
+                V::store(vC + i, V::sub(V::load(vC + i), V::mul(vHalfrDx, dpy)));
+            }
+
+            for(; i < tile.i1; ++i)
+            {
+                float pL = pC[i-1];
+                float pR = pC[i < width-1 ? i+1 : width-1];
+                uC[i] = uC[i] - halfrDx * (pR - pL);
+                vC[i] = vC[i] - halfrDx * (pT[i] - pB[i]);
+            }
+        }
+    }
+
+    static float maxSpeed2(const float* u, const float* v,
+                           int width, const FluidTile& tile)
+    {
+        reg vMax = V::set1(0.0f);
+        float peak = 0.0f;
+
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            const float* uC = u + j*width;
+            const float* vC = v + j*width;
+
+            int i = tile.i0;
+            for(; i + V::N <= tile.i1; i += V::N)
+            {
+                reg uu = V::load(uC + i);
+                reg vv = V::load(vC + i);
+                vMax = V::max(vMax, V::add(V::mul(uu, uu), V::mul(vv, vv)));
+            }
+
+            for(; i < tile.i1; ++i)
+            {
+                float s = uC[i]*uC[i] + vC[i]*vC[i];
+                peak = s > peak ? s : peak;
+            }
+        }
+
+        float lanes[V::N];
+        V::store(lanes, vMax);
+        for(int l=0; l < V::N; ++l)
+            peak = lanes[l] > peak ? lanes[l] : peak;
+        return peak;
+    }
+
+    static void fill(FluidKernels& kernels, FluidKernels::EIsa isa)
+    {
+        kernels.isa = isa;
+        kernels.jacobi = &jacobi;
+        kernels.divergence = &divergence;
+        kernels.gradSub = &gradSub;
+        kernels.maxSpeed2 = &maxSpeed2;
+    }
+};
+
+#endif // FLUID_KERNELS_IMPL_H
@@ -0,0 +1,38 @@
+#include "FluidKernels.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#include "FluidKernelsImpl.h"
+
+
+namespace
+{
+    struct NeonTraits
+    {
+        typedef float32x4_t reg;
+        static const int N = 4;
+
+        static inline reg set1(float a)              {return vdupq_n_f32(a);}
+        static inline reg load(const float* p)       {return vld1q_f32(p);}
+        static inline void store(float* p, reg a)    {vst1q_f32(p, a);}
+        static inline reg add(reg a, reg b)          {return vaddq_f32(a, b);}
+        static inline reg sub(reg a, reg b)          {return vsubq_f32(a, b);}
+        static inline reg mul(reg a, reg b)          {return vmulq_f32(a, b);}
+        static inline reg max(reg a, reg b)          {return vmaxq_f32(a, b);}
+    };
+}
+
+bool fluidKernelsNeon(FluidKernels& kernels)
+{
+    FluidKernelsImpl<NeonTraits>::fill(kernels, FluidKernels::EIsa::NEON);
+    return true;
+}
+
+#else
+
+bool fluidKernelsNeon(FluidKernels&)
+{
+    return false;
+}
+
+#endif
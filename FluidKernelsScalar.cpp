@@ -0,0 +1,26 @@
+#include "FluidKernels.h"
+#include "FluidKernelsImpl.h"
+
+
+namespace
+{
+    struct ScalarTraits
+    {
+        typedef float reg;
+        static const int N = 1;
+
+        static inline reg set1(float a)              {return a;}
+        static inline reg load(const float* p)       {return *p;}
+        static inline void store(float* p, reg a)    {*p = a;}
+        static inline reg add(reg a, reg b)          {return a + b;}
+        static inline reg sub(reg a, reg b)          {return a - b;}
+        static inline reg mul(reg a, reg b)          {return a * b;}
+        static inline reg max(reg a, reg b)          {return a > b ? a : b;}
+    };
+}
+
+bool fluidKernelsScalar(FluidKernels& kernels)
+{
+    FluidKernelsImpl<ScalarTraits>::fill(kernels, FluidKernels::EIsa::SCALAR);
+    return true;
+}
@@ -0,0 +1,38 @@
+#include "FluidKernels.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#include "FluidKernelsImpl.h"
+
+
+namespace
+{
+    struct Sse2Traits
+    {
+        typedef __m128 reg;
+        static const int N = 4;
+
+        static inline reg set1(float a)              {return _mm_set1_ps(a);}
+        static inline reg load(const float* p)       {return _mm_loadu_ps(p);}
+        static inline void store(float* p, reg a)    {_mm_storeu_ps(p, a);}
+        static inline reg add(reg a, reg b)          {return _mm_add_ps(a, b);}
+        static inline reg sub(reg a, reg b)          {return _mm_sub_ps(a, b);}
+        static inline reg mul(reg a, reg b)          {return _mm_mul_ps(a, b);}
+        static inline reg max(reg a, reg b)          {return _mm_max_ps(a, b);}
+    };
+}
+
+bool fluidKernelsSse2(FluidKernels& kernels)
+{
+    FluidKernelsImpl<Sse2Traits>::fill(kernels, FluidKernels::EIsa::SSE2);
+    return true;
+}
+
+#else
+
+bool fluidKernelsSse2(FluidKernels&)
+{
+    return false;
+}
+
+#endif
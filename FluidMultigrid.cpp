@@ -0,0 +1,424 @@
+#include "FluidMultigrid.h"
+
+#include <cmath>
+using namespace std;
+
+#include "FluidGrid.h"
+
+
+const int FluidMultigrid::COARSEST_SIZE = 8;
+const int FluidMultigrid::COARSEST_ITERATIONS = 100;
+
+
+FluidMultigrid::FluidMultigrid() :
+    _cycle(ECycle::V),
+    _preSmoothing(2),
+    _postSmoothing(2),
+    _levels(),
+    _residual(0.0f),
+    _cycleCount(0)
+{
+}
+
+FluidMultigrid::~FluidMultigrid()
+{
+
+}
+
+void FluidMultigrid::setup(const FluidGrid& frontier)
+{
+    _levels.clear();
+
+    Level fine;
+    fine.width = frontier.width();
+    fine.height = frontier.height();
+    fine.h2 = 1.0f;
+    fine.fluid.resize(frontier.area());
+    for(int j=0; j<fine.height; ++j)
+        for(int i=0; i<fine.width; ++i)
+            fine.fluid[j*fine.width + i] = frontier.fetch(0, i, j) != 1.0f;
+
+    // A face is open when it separates two fluid cells
+    fine.wx.assign(frontier.area(), 0.0f);
+    fine.wy.assign(frontier.area(), 0.0f);
+    for(int j=0; j<fine.height; ++j)
+    {
+        for(int i=0; i<fine.width; ++i)
+        {
+            int c = j*fine.width + i;
+            if(i+1 < fine.width && fine.fluid[c] && fine.fluid[c+1])
+                fine.wx[c] = 1.0f;
+            if(j+1 < fine.height && fine.fluid[c] && fine.fluid[c+fine.width])
+                fine.wy[c] = 1.0f;
+        }
+    }
+    _levels.push_back(fine);
+
+    while(_levels.back().width  > COARSEST_SIZE &&
+          _levels.back().height > COARSEST_SIZE)
+    {
+        const Level& f = _levels.back();
+        Level c;
+        c.width  = (f.width  + 1) / 2;
+        c.height = (f.height + 1) / 2;
+        c.h2 = f.h2 * 4.0f;
+        c.fluid.assign(c.width * c.height, 0);
+        c.wx.assign(c.width * c.height, 0.0f);
+        c.wy.assign(c.width * c.height, 0.0f);
+
+        for(int j=0; j<f.height; ++j)
+        {
+            for(int i=0; i<f.width; ++i)
+            {
+                int fc = j*f.width + i;
+                int cc = (j/2)*c.width + i/2;
+                c.fluid[cc] |= f.fluid[fc];
+
+                // Fine faces lying on a coarse face
+                if(i & 1)
+                    c.wx[cc] += f.wx[fc] * 0.5f;
+                if(j & 1)
+                    c.wy[cc] += f.wy[fc] * 0.5f;
+            }
+        }
+        _levels.push_back(c);
+    }
+
+    for(Level& level : _levels)
+    {
+        level.x.assign(level.width * level.height, 0.0f);
+        level.f.assign(level.width * level.height, 0.0f);
+        level.r.assign(level.width * level.height, 0.0f);
+
+        int nbRegions = labelRegions(level.width, level.height, level.fluid,
+                                     level.wx, level.wy, level.region);
+        level.regionSizes.assign(nbRegions, 0);
+        level.regionSums.assign(nbRegions, 0.0);
+        for(int label : level.region)
+            if(label >= 0)
+                ++level.regionSizes[label];
+    }
+}
+
+void FluidMultigrid::setCycle(ECycle cycle)
+{
+    _cycle = cycle;
+}
+
+void FluidMultigrid::setSmoothingSteps(int preSmoothing, int postSmoothing)
+{
+    _preSmoothing = preSmoothing;
+    _postSmoothing = postSmoothing;
+}
+
+int FluidMultigrid::solve(vector<float>& x, const vector<float>& b,
+                          float tolerance, int maxCycles)
+{
+    Level& fine = _levels.front();
+    fine.x = x;
+    fine.f = b;
+
+    // Pure Neumann problem : only a zero mean right hand side has a solution
+    removeMean(fine);
+
+    double bNorm = 0.0;
+    for(size_t c=0; c < fine.f.size(); ++c)
+        if(fine.fluid[c])
+            bNorm += fine.f[c] * fine.f[c];
+    bNorm = sqrt(bNorm);
+
+    _cycleCount = 0;
+    if(bNorm == 0.0)
+    {
+        _residual = 0.0f;
+        return 0;
+    }
+
+    // Also stop once the residual stalls at single precision round-off
+    const float STALL_RATIO = 0.9f;
+    float lastResidual = computeResidual(fine) / bNorm;
+    _residual = lastResidual;
+    while(_residual > tolerance && _cycleCount < maxCycles)
+    {
+        cycle(0);
+        ++_cycleCount;
+        _residual = computeResidual(fine) / bNorm;
+
+        if(_residual > lastResidual * STALL_RATIO)
+            break;
+        lastResidual = _residual;
+    }
+
+    extrapolate(fine);
+    x = fine.x;
+
+    return _cycleCount;
+}
+
+void FluidMultigrid::precondition(const vector<float>& r, vector<float>& z)
+{
+    Level& fine = _levels.front();
+    for(size_t c=0; c < fine.f.size(); ++c)
+        fine.f[c] = -r[c];
+    fine.x.assign(fine.x.size(), 0.0f);
+
+    cycle(0);
+    z.swap(fine.x);
+}
+
+void FluidMultigrid::cycle(int l)
+{
+    Level& level = _levels[l];
+    if(l+1 == (int) _levels.size())
+    {
+        removeMean(level);
+        smooth(level, COARSEST_ITERATIONS);
+        return;
+    }
+
+    Level& coarse = _levels[l+1];
+    smooth(level, _preSmoothing);
+    computeResidual(level);
+    restrict(level, coarse);
+
+    coarse.x.assign(coarse.x.size(), 0.0f);
+    int nbVisits = _cycle == ECycle::W ? 2 : 1;
+    for(int v=0; v < nbVisits; ++v)
+        cycle(l+1);
+
+    prolongate(coarse, level);
+    smooth(level, _postSmoothing);
+}
+
+void FluidMultigrid::smooth(Level& level, int iterations)
+{
+    const int W = level.width;
+    const int H = level.height;
+    float* x = level.x.data();
+    const float* f = level.f.data();
+    const float* wx = level.wx.data();
+    const float* wy = level.wy.data();
+
+    // Red-black Gauss-Seidel
+    for(int it=0; it < iterations; ++it)
+    {
+        for(int color=0; color < 2; ++color)
+        {
+            for(int j=0; j<H; ++j)
+            {
+                for(int i=(j+color)&1; i<W; i+=2)
+                {
+                    int c = j*W + i;
+                    float wL = i > 0 ? wx[c-1] : 0.0f;
+                    float wR = wx[c];
+                    float wB = j > 0 ? wy[c-W] : 0.0f;
+                    float wT = wy[c];
+                    float diag = wL + wR + wB + wT;
+                    if(diag == 0.0f)
+                        continue;
+
+                    float sum = 0.0f;
+                    if(wL != 0.0f) sum += wL * x[c-1];
+                    if(wR != 0.0f) sum += wR * x[c+1];
+                    if(wB != 0.0f) sum += wB * x[c-W];
+                    if(wT != 0.0f) sum += wT * x[c+W];
+
+                    x[c] = (sum - level.h2 * f[c]) / diag;
+                }
+            }
+        }
+    }
+}
+
+float FluidMultigrid::computeResidual(Level& level)
+{
+    const int W = level.width;
+    const int H = level.height;
+    const float* x = level.x.data();
+    const float* wx = level.wx.data();
+    const float* wy = level.wy.data();
+    const unsigned char* fluid = level.fluid.data();
+    const float rH2 = 1.0f / level.h2;
+
+    double norm = 0.0;
+    for(int j=0; j<H; ++j)
+    {
+        for(int i=0; i<W; ++i)
+        {
+            int c = j*W + i;
+            if(!fluid[c])
+            {
+                level.r[c] = 0.0f;
+                continue;
+            }
+
+            float lap = 0.0f;
+            if(i > 0 && wx[c-1] != 0.0f) lap += wx[c-1] * (x[c-1] - x[c]);
+            if(wx[c] != 0.0f)            lap += wx[c]   * (x[c+1] - x[c]);
+            if(j > 0 && wy[c-W] != 0.0f) lap += wy[c-W] * (x[c-W] - x[c]);
+            if(wy[c] != 0.0f)            lap += wy[c]   * (x[c+W] - x[c]);
+
+            float r = level.f[c] - lap * rH2;
+            level.r[c] = r;
+            norm += r * r;
+        }
+    }
+
+    return (float) sqrt(norm);
+}
+
+void FluidMultigrid::restrict(const Level& fine, Level& coarse)
+{
+    coarse.f.assign(coarse.f.size(), 0.0f);
+
+    for(int j=0; j<fine.height; ++j)
+    {
+        for(int i=0; i<fine.width; ++i)
+        {
+            int c = j*fine.width + i;
+            if(!fine.fluid[c])
+                continue;
+
+            // Volume weighted : partially fluid coarse cells get a
+            // proportionally smaller right hand side, as do their faces
+            int C = (j/2)*coarse.width + i/2;
+            coarse.f[C] += 0.25f * fine.r[c];
+        }
+    }
+}
+
+void FluidMultigrid::prolongate(const Level& coarse, Level& fine)
+{
+    const int CW = coarse.width;
+    const int CH = coarse.height;
+
+    // Cell centered bilinear interpolation through open coarse faces only
+    for(int j=0; j<fine.height; ++j)
+    {
+        for(int i=0; i<fine.width; ++i)
+        {
+            int c = j*fine.width + i;
+            if(!fine.fluid[c])
+                continue;
+
+            int I = i/2;
+            int J = j/2;
+            int C = J*CW + I;
+            int nI = I + ((i & 1) ? 1 : -1);
+            int nJ = J + ((j & 1) ? 1 : -1);
+            bool openI = nI >= 0 && nI < CW &&
+                    coarse.wx[(i & 1) ? C : C-1] != 0.0f;
+            bool openJ = nJ >= 0 && nJ < CH &&
+                    coarse.wy[(j & 1) ? C : C-CW] != 0.0f;
+
+            float sum = 9.0f * coarse.x[C];
+            float weight = 9.0f;
+            if(openI)
+            {
+                sum += 3.0f * coarse.x[J*CW + nI];
+                weight += 3.0f;
+            }
+            if(openJ)
+            {
+                sum += 3.0f * coarse.x[nJ*CW + I];
+                weight += 3.0f;
+            }
+            if(openI && openJ)
+            {
+                sum += coarse.x[nJ*CW + nI];
+                weight += 1.0f;
+            }
+
+            fine.x[c] += sum / weight;
+        }
+    }
+}
+
+int FluidMultigrid::labelRegions(int width, int height,
+                                 const vector<unsigned char>& fluid,
+                                 const vector<float>& wx,
+                                 const vector<float>& wy,
+                                 vector<int>& labels)
+{
+    const int area = width * height;
+    labels.assign(area, -1);
+    vector<int> stack;
+    int count = 0;
+    for(int c=0; c < area; ++c)
+    {
+        if(!fluid[c] || labels[c] >= 0)
+            continue;
+
+        // Flood fill through the open faces
+        labels[c] = count;
+        stack.push_back(c);
+        while(!stack.empty())
+        {
+            int n = stack.back();
+            stack.pop_back();
+            auto reach = [&](int m, float w)
+            {
+                if(w != 0.0f && labels[m] < 0)
+                {
+                    labels[m] = count;
+                    stack.push_back(m);
+                }
+            };
+
+            int i = n % width;
+            if(i+1 < width)      reach(n+1, wx[n]);
+            if(i > 0)            reach(n-1, wx[n-1]);
+            if(n + width < area) reach(n+width, wy[n]);
+            if(n >= width)       reach(n-width, wy[n-width]);
+        }
+        ++count;
+    }
+
+    return count;
+}
+
+void FluidMultigrid::removeMean(Level& level)
+{
+    vector<double>& sums = level.regionSums;
+    sums.assign(sums.size(), 0.0);
+    for(size_t c=0; c < level.f.size(); ++c)
+        if(level.region[c] >= 0)
+            sums[level.region[c]] += level.f[c];
+
+    for(size_t r=0; r < sums.size(); ++r)
+        sums[r] = (float) (sums[r] / level.regionSizes[r]);
+
+    for(size_t c=0; c < level.f.size(); ++c)
+        if(level.region[c] >= 0)
+            level.f[c] -= (float) sums[level.region[c]];
+}
+
+void FluidMultigrid::extrapolate(Level& level)
+{
+    const int W = level.width;
+    const int H = level.height;
+    float* x = level.x.data();
+    const unsigned char* fluid = level.fluid.data();
+
+    // Obstacle cells take the mean of their fluid neighbors so that the
+    // pressure gradient has a zero normal component at the frontier
+    for(int j=0; j<H; ++j)
+    {
+        for(int i=0; i<W; ++i)
+        {
+            int c = j*W + i;
+            if(fluid[c])
+                continue;
+
+            float sum = 0.0f;
+            int nb = 0;
+            if(i > 0   && fluid[c-1]) {sum += x[c-1]; ++nb;}
+            if(i < W-1 && fluid[c+1]) {sum += x[c+1]; ++nb;}
+            if(j > 0   && fluid[c-W]) {sum += x[c-W]; ++nb;}
+            if(j < H-1 && fluid[c+W]) {sum += x[c+W]; ++nb;}
+
+            if(nb != 0)
+                x[c] = sum / nb;
+        }
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef FLUID_MULTIGRID_H
+#define FLUID_MULTIGRID_H
+
+#include <vector>
+
+class FluidGrid;
+
+
+// Geometric multigrid for the pressure Poisson equation.
+// Solves sum(x_n - x_c) = b_c on fluid cells, obstacle cells of the
+// frontier mask being treated as zero normal derivative boundaries.
+// Coarse levels weight each face by the open fraction of the fine faces
+// it covers, so thin obstacles are not lost when coarsening.
+class FluidMultigrid
+{
+public:
+    enum class ECycle {V, W};
+
+    FluidMultigrid();
+    virtual ~FluidMultigrid();
+
+    void setup(const FluidGrid& frontier);
+
+    void setCycle(ECycle cycle);
+    void setSmoothingSteps(int preSmoothing, int postSmoothing);
+
+    // x is used as initial guess, returns the number of cycles
+    int solve(std::vector<float>& x, const std::vector<float>& b,
+              float tolerance, int maxCycles);
+
+    // One cycle from a null guess on A z = r, A being the negated system,
+    // used as a conjugate gradient preconditioner
+    void precondition(const std::vector<float>& r, std::vector<float>& z);
+
+    // Relative L2 residual of the last solve
+    float residual() const;
+    int cycleCount() const;
+    int levelCount() const;
+
+    // Labels the regions of fluid cells joined by open faces from 0, in
+    // scan order, obstacle cells getting -1. Returns the region count.
+    static int labelRegions(int width, int height,
+                            const std::vector<unsigned char>& fluid,
+                            const std::vector<float>& wx,
+                            const std::vector<float>& wy,
+                            std::vector<int>& labels);
+
+
+protected:
+    struct Level
+    {
+        int width;
+        int height;
+        float h2;
+        std::vector<unsigned char> fluid;
+        std::vector<float> wx;
+        std::vector<float> wy;
+        std::vector<float> x;
+        std::vector<float> f;
+        std::vector<float> r;
+        std::vector<int> region;
+        std::vector<int> regionSizes;
+        std::vector<double> regionSums;
+    };
+
+    void cycle(int l);
+    void smooth(Level& level, int iterations);
+    float computeResidual(Level& level);
+    void restrict(const Level& fine, Level& coarse);
+    void prolongate(const Level& coarse, Level& fine);
+    // Each region is a Neumann problem of its own, f needs a zero mean
+    // on every one of them
+    void removeMean(Level& level);
+    void extrapolate(Level& level);
+
+
+private:
+    static const int COARSEST_SIZE;
+    static const int COARSEST_ITERATIONS;
+
+    ECycle _cycle;
+    int _preSmoothing;
+    int _postSmoothing;
+    std::vector<Level> _levels;
+    float _residual;
+    int _cycleCount;
+};
+
+
+
+// IMPLEMENTATION //
+inline float FluidMultigrid::residual() const
+{
+    return _residual;
+}
+
+inline int FluidMultigrid::cycleCount() const
+{
+    return _cycleCount;
+}
+
+inline int FluidMultigrid::levelCount() const
+{
+    return (int) _levels.size();
+}
+
+#endif // FLUID_MULTIGRID_H
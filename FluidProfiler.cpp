@@ -0,0 +1,209 @@
+#include "FluidProfiler.h"
+
+#include <iomanip>
+using namespace std;
+
+
+FluidProfiler::FluidProfiler() :
+    _frames(),
+    _nextFrame(0),
+    _completed(0),
+    _trace(),
+    _jsonTrace(false)
+{
+    for(int s=0; s < STAGE_COUNT; ++s)
+    {
+        _average[s] = -1.0;
+        _clock[s] = EClock::CPU;
+        _ran[s] = false;
+    }
+}
+
+FluidProfiler::~FluidProfiler()
+{
+    closeTrace();
+}
+
+const char* FluidProfiler::stageName(EStage stage)
+{
+    static const char* NAMES[STAGE_COUNT] = {
+        "advect", "diffuse_velocity", "diffuse_heat", "heat",
+        "divergence", "pressure_solve", "gradient_sub", "frontier",
+        "heat_divergence", "gradient_frontier", "upload", "draw",
+        "export", "force", "vorticity", "timestep"
+    };
+    return NAMES[(int) stage];
+}
+
+const char* FluidProfiler::clockName(EClock clock)
+{
+    return clock == EClock::GPU ? "gpu" : "cpu";
+}
+
+bool FluidProfiler::openTrace(const string& fileName)
+{
+    closeTrace();
+    _trace.open(fileName.c_str());
+    if(!_trace)
+        return false;
+
+    const string JSON = ".json";
+    _jsonTrace = fileName.size() >= JSON.size() &&
+        fileName.compare(fileName.size() - JSON.size(), JSON.size(), JSON) == 0;
+
+    if(!_jsonTrace)
+    {
+        _trace << "frame,steps,stages_ms";
+        for(int s=0; s < STAGE_COUNT; ++s)
+            _trace << "," << stageName((EStage) s) << "_ms";
+        _trace << endl;
+    }
+
+    return true;
+}
+
+void FluidProfiler::closeTrace()
+{
+    if(_trace.is_open())
+        _trace.close();
+}
+
+long long FluidProfiler::beginFrame()
+{
+    Frame frame;
+    frame.index = _nextFrame++;
+    for(int s=0; s < STAGE_COUNT; ++s)
+    {
+        frame.ms[s] = -1.0;
+        frame.clock[s] = EClock::CPU;
+    }
+    frame.steps = 0;
+    frame.pending = 0;
+    frame.ended = false;
+    _frames.push_back(frame);
+
+    return frame.index;
+}
+
+void FluidProfiler::endFrame()
+{
+    if(Frame* current = frame(currentFrame()))
+        current->ended = true;
+    flush();
+}
+
+void FluidProfiler::countStep()
+{
+    if(Frame* current = frame(currentFrame()))
+        ++current->steps;
+}
+
+void FluidProfiler::record(EStage stage, EClock clock, double ms)
+{
+    record(currentFrame(), stage, clock, ms);
+}
+
+void FluidProfiler::record(long long index, EStage stage, EClock clock, double ms)
+{
+    Frame* f = frame(index);
+    if(f == nullptr)
+        return;
+
+    int s = (int) stage;
+    f->ms[s] = f->ms[s] < 0.0 ? ms : f->ms[s] + ms;
+    f->clock[s] = clock;
+}
+
+void FluidProfiler::await(long long index)
+{
+    if(Frame* f = frame(index))
+        ++f->pending;
+}
+
+void FluidProfiler::resolve(long long index)
+{
+    if(Frame* f = frame(index))
+        --f->pending;
+    flush();
+}
+
+FluidProfiler::Frame* FluidProfiler::frame(long long index)
+{
+    if(_frames.empty() || index < _frames.front().index)
+        return nullptr;
+
+    long long offset = index - _frames.front().index;
+    if(offset >= (long long) _frames.size())
+        return nullptr;
+
+    return &_frames[offset];
+}
+
+void FluidProfiler::flush()
+{
+    const double WEIGHT = 0.1;
+
+    // Frames complete in order, a late one holds back the next
+    while(!_frames.empty() &&
+          _frames.front().ended &&
+          _frames.front().pending <= 0)
+    {
+        const Frame& f = _frames.front();
+        for(int s=0; s < STAGE_COUNT; ++s)
+        {
+            _ran[s] = f.ms[s] >= 0.0;
+            if(!_ran[s])
+                continue;
+
+            _average[s] = _average[s] < 0.0 ? f.ms[s] :
+                _average[s] + WEIGHT * (f.ms[s] - _average[s]);
+            _clock[s] = f.clock[s];
+        }
+
+        if(_trace.is_open())
+            writeTrace(f);
+
+        ++_completed;
+        _frames.pop_front();
+    }
+}
+
+void FluidProfiler::writeTrace(const Frame& frame)
+{
+    double total = 0.0;
+    for(int s=0; s < STAGE_COUNT; ++s)
+        total += frame.ms[s] > 0.0 ? frame.ms[s] : 0.0;
+
+    _trace << setprecision(6);
+    if(_jsonTrace)
+    {
+        _trace << "{\"frame\":" << frame.index
+               << ",\"steps\":" << frame.steps
+               << ",\"stages_ms\":" << total
+               << ",\"stages\":[";
+        bool first = true;
+        for(int s=0; s < STAGE_COUNT; ++s)
+        {
+            if(frame.ms[s] < 0.0)
+                continue;
+
+            _trace << (first ? "" : ",")
+                   << "{\"name\":\"" << stageName((EStage) s) << "\""
+                   << ",\"clock\":\"" << clockName(frame.clock[s]) << "\""
+                   << ",\"ms\":" << frame.ms[s] << "}";
+            first = false;
+        }
+        _trace << "]}\n";
+    }
+    else
+    {
+        _trace << frame.index << "," << frame.steps << "," << total;
+        for(int s=0; s < STAGE_COUNT; ++s)
+        {
+            _trace << ",";
+            if(frame.ms[s] >= 0.0)
+                _trace << frame.ms[s];
+        }
+        _trace << "\n";
+    }
+}
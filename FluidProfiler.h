@@ -0,0 +1,145 @@
+#ifndef FLUID_PROFILER_H
+#define FLUID_PROFILER_H
+
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <string>
+
+
+// Time spent in each stage of a frame.
+// CPU stages are measured by steady_clock scopes while GL stages report
+// their GL_TIME_ELAPSED results some frames later, once read back.
+// A frame is only averaged and written to the trace when it was ended
+// and none of its GPU results are pending anymore.
+class FluidProfiler
+{
+public:
+    enum class EStage {ADVECT, DIFFUSE_VELOCITY, DIFFUSE_HEAT, HEAT,
+                       DIVERGENCE, PRESSURE_SOLVE, GRADIENT_SUB, FRONTIER,
+                       HEAT_DIVERGENCE, GRADIENT_FRONTIER, UPLOAD, DRAW,
+                       EXPORT, FORCE, VORTICITY, TIMESTEP};
+    enum class EClock {CPU, GPU};
+    static const int STAGE_COUNT = 16;
+
+    // Times a CPU stage of the current frame, does nothing without profiler
+    class Scope
+    {
+    public:
+        Scope(FluidProfiler* profiler, EStage stage);
+        ~Scope();
+
+    private:
+        FluidProfiler* _profiler;
+        EStage _stage;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+    FluidProfiler();
+    virtual ~FluidProfiler();
+
+    static const char* stageName(EStage stage);
+    static const char* clockName(EClock clock);
+
+    // .json files get one object per frame and line, others are CSV
+    bool openTrace(const std::string& fileName);
+    void closeTrace();
+
+    long long beginFrame();
+    void endFrame();
+    long long currentFrame() const;
+
+    // Simulation steps taken during the current frame
+    void countStep();
+
+    // Times of a stage run more than once in a frame are summed
+    void record(EStage stage, EClock clock, double ms);
+    void record(long long frame, EStage stage, EClock clock, double ms);
+
+    // GPU results of the frame that are yet to be recorded
+    void await(long long frame);
+    void resolve(long long frame);
+
+    // Moving average of the completed frames in which the stage ran,
+    // negative until it ran once
+    double average(EStage stage) const;
+    EClock clock(EStage stage) const;
+    // Whether the stage ran in the last completed frame
+    bool ran(EStage stage) const;
+    long long completedFrames() const;
+
+
+private:
+    struct Frame
+    {
+        long long index;
+        double ms[STAGE_COUNT];
+        EClock clock[STAGE_COUNT];
+        int steps;
+        int pending;
+        bool ended;
+    };
+
+    Frame* frame(long long index);
+    void flush();
+    void writeTrace(const Frame& frame);
+
+    std::deque<Frame> _frames;
+    long long _nextFrame;
+    long long _completed;
+    double _average[STAGE_COUNT];
+    EClock _clock[STAGE_COUNT];
+    bool _ran[STAGE_COUNT];
+
+    std::ofstream _trace;
+    bool _jsonTrace;
+};
+
+
+
+// IMPLEMENTATION //
+inline FluidProfiler::Scope::Scope(FluidProfiler* profiler, EStage stage) :
+    _profiler(profiler),
+    _stage(stage),
+    _start()
+{
+    if(_profiler)
+        _start = std::chrono::steady_clock::now();
+}
+
+inline FluidProfiler::Scope::~Scope()
+{
+    if(_profiler)
+    {
+        _profiler->record(_stage, EClock::CPU,
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - _start).count());
+    }
+}
+
+inline long long FluidProfiler::currentFrame() const
+{
+    return _nextFrame - 1;
+}
+
+inline double FluidProfiler::average(EStage stage) const
+{
+    return _average[(int) stage];
+}
+
+inline FluidProfiler::EClock FluidProfiler::clock(EStage stage) const
+{
+    return _clock[(int) stage];
+}
+
+inline bool FluidProfiler::ran(EStage stage) const
+{
+    return _ran[(int) stage];
+}
+
+inline long long FluidProfiler::completedFrames() const
+{
+    return _completed;
+}
+
+#endif // FLUID_PROFILER_H
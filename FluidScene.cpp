@@ -0,0 +1,544 @@
+#include "FluidScene.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+using namespace std;
+
+#include "FluidGrid.h"
+#include "FluidScheduler.h"
+using namespace cellar;
+
+
+namespace
+{
+    bool parseFloats(const string& text, float* values, int minCount,
+                     int maxCount, int& count)
+    {
+        stringstream stream(text);
+        string part;
+        count = 0;
+        while(getline(stream, part, ','))
+        {
+            if(count == maxCount)
+                return false;
+            char* end = nullptr;
+            values[count++] = strtof(part.c_str(), &end);
+            if(part.empty() || *end != '\0')
+                return false;
+        }
+        return count >= minCount;
+    }
+
+    bool parseInt(const string& text, int& value)
+    {
+        char* end = nullptr;
+        value = (int) strtol(text.c_str(), &end, 10);
+        return !text.empty() && *end == '\0';
+    }
+}
+
+
+FluidScene::Region::Region() :
+    kind(EKind::OBSTACLE),
+    shape(EShape::BOX),
+    coords{0, 0, 0, 0},
+    hasDye(false),
+    hasHeat(false),
+    hasVelocity(false),
+    dye(),
+    heat(0.0f),
+    velocity(),
+    start(0),
+    stop(-1),
+    period(0)
+{
+}
+
+bool FluidScene::Region::covers(float s, float t) const
+{
+    if(shape == EShape::CIRCLE)
+    {
+        float dx = s - coords[0];
+        float dy = t - coords[1];
+        return dx*dx + dy*dy < coords[2]*coords[2];
+    }
+
+    return s >= coords[0] && s < coords[2] && t >= coords[1] && t < coords[3];
+}
+
+FluidScene::FluidScene() :
+    _base(EBase::DEFAULT),
+    _regions(),
+    _rasterWidth(0),
+    _rasterHeight(0),
+    _rasters()
+{
+}
+
+FluidScene::~FluidScene()
+{
+}
+
+bool FluidScene::parse(istream& scene, string& error)
+{
+    _base = EBase::DEFAULT;
+    _regions.clear();
+    _rasters.clear();
+
+    string line;
+    for(int lineNumber=1; getline(scene, line); ++lineNumber)
+    {
+        line = line.substr(0, line.find('#'));
+        stringstream tokens(line);
+        string directive;
+        if(!(tokens >> directive))
+            continue;
+
+        const string at = "Line " + to_string(lineNumber) + " : ";
+        if(directive == "base")
+        {
+            string name;
+            tokens >> name;
+            if(name == "default")
+                _base = EBase::DEFAULT;
+            else if(name == "empty")
+                _base = EBase::EMPTY;
+            else
+            {
+                error = at + "invalid base '" + name + "', use default or empty";
+                return false;
+            }
+            continue;
+        }
+
+        Region region;
+        if(directive == "obstacle")
+            region.kind = EKind::OBSTACLE;
+        else if(directive == "initial")
+            region.kind = EKind::INITIAL;
+        else if(directive == "source")
+            region.kind = EKind::SOURCE;
+        else if(directive == "emitter")
+            region.kind = EKind::EMITTER;
+        else if(directive == "force")
+            region.kind = EKind::FORCE;
+        else
+        {
+            error = at + "unknown directive " + directive;
+            return false;
+        }
+
+        bool hasShape = false;
+        bool timed = false;
+        string token;
+        while(tokens >> token)
+        {
+            size_t equal = token.find('=');
+            string key = token.substr(0, equal);
+            string value = equal != string::npos ? token.substr(equal+1) : string();
+
+            float values[4];
+            int count = 0;
+            bool ok = true;
+            if(key == "box")
+            {
+                ok = parseFloats(value, region.coords, 4, 4, count) &&
+                     region.coords[0] < region.coords[2] &&
+                     region.coords[1] < region.coords[3];
+                region.shape = EShape::BOX;
+                hasShape = true;
+            }
+            else if(key == "circle")
+            {
+                ok = parseFloats(value, region.coords, 3, 3, count) &&
+                     region.coords[2] > 0.0f;
+                region.shape = EShape::CIRCLE;
+                hasShape = true;
+            }
+            else if(key == "dye" && region.kind != EKind::FORCE &&
+                    region.kind != EKind::OBSTACLE)
+            {
+                ok = parseFloats(value, values, 1, 4, count);
+                if(count == 1)
+                    region.dye = Vec4f(values[0], values[0], values[0], 1);
+                else if(count >= 3)
+                    region.dye = Vec4f(values[0], values[1], values[2],
+                                       count == 4 ? values[3] : 1.0f);
+                else
+                    ok = false;
+                region.hasDye = true;
+            }
+            else if(key == "heat" && region.kind != EKind::FORCE &&
+                    region.kind != EKind::OBSTACLE)
+            {
+                ok = parseFloats(value, &region.heat, 1, 1, count);
+                region.hasHeat = true;
+            }
+            else if((key == "velocity" && region.kind != EKind::FORCE &&
+                     region.kind != EKind::OBSTACLE) ||
+                    (key == "acceleration" && region.kind == EKind::FORCE))
+            {
+                ok = parseFloats(value, values, 2, 2, count);
+                region.velocity = Vec2f(values[0], values[1]);
+                region.hasVelocity = true;
+            }
+            else if(key == "start" || key == "stop" || key == "period")
+            {
+                int& field = key == "start" ? region.start :
+                             key == "stop" ? region.stop : region.period;
+                ok = parseInt(value, field) && field >= 0;
+                timed = true;
+            }
+            else
+            {
+                error = at + "unknown key " + key + " for " + directive;
+                return false;
+            }
+
+            if(!ok)
+            {
+                error = at + "invalid " + key + " '" + value + "'";
+                return false;
+            }
+        }
+
+        if(!hasShape)
+        {
+            error = at + directive + " needs a box or a circle";
+            return false;
+        }
+        if(timed && (region.kind == EKind::OBSTACLE || region.kind == EKind::INITIAL))
+        {
+            error = at + "only sources, emitters and forces take start, stop and period";
+            return false;
+        }
+        if(region.kind == EKind::FORCE && !region.hasVelocity)
+        {
+            error = at + "force needs an acceleration";
+            return false;
+        }
+        if(region.kind != EKind::OBSTACLE && region.kind != EKind::FORCE &&
+           !region.hasDye && !region.hasHeat && !region.hasVelocity)
+        {
+            error = at + directive + " needs a dye, heat or velocity";
+            return false;
+        }
+
+        _regions.push_back(region);
+    }
+
+    return true;
+}
+
+bool FluidScene::load(const string& fileName, string& error)
+{
+    ifstream scene(fileName.c_str());
+    if(!scene)
+    {
+        error = "Could not open '" + fileName + "'";
+        return false;
+    }
+
+    return parse(scene, error);
+}
+
+void FluidScene::setBase(EBase base)
+{
+    _base = base;
+}
+
+void FluidScene::addRegion(const Region& region)
+{
+    _regions.push_back(region);
+    _rasters.clear();
+}
+
+Vec4f FluidScene::initDye(float s, float t)
+{
+    if(_base == EBase::DEFAULT)
+        return FluidInitializer::initDye(s, t);
+    return Vec4f(0, 0, 0, 1);
+}
+
+Vec4f FluidScene::initVelocity(float s, float t)
+{
+    if(_base == EBase::DEFAULT)
+        return FluidInitializer::initVelocity(s, t);
+    return Vec4f();
+}
+
+Vec4f FluidScene::initPressure(float s, float t)
+{
+    if(_base == EBase::DEFAULT)
+        return FluidInitializer::initPressure(s, t);
+    return Vec4f();
+}
+
+Vec4f FluidScene::initHeat(float s, float t)
+{
+    if(_base == EBase::DEFAULT)
+        return FluidInitializer::initHeat(s, t);
+    return Vec4f();
+}
+
+Vec4f FluidScene::initFrontier(float s, float t)
+{
+    if(_base == EBase::DEFAULT)
+        return FluidInitializer::initFrontier(s, t);
+
+    const float W = 0.03f;
+    if(s < W || s > 1-W || t < W || t > 1-W)
+        return Vec4f(1, 1, 1, 1);
+    return Vec4f();
+}
+
+void FluidScene::stamp(FluidScheduler& scheduler, FluidGrid* dye,
+                       FluidGrid* velocity, FluidGrid*, FluidGrid* heat,
+                       FluidGrid* frontier)
+{
+    const FluidGrid* size = frontier ? frontier : dye ? dye : velocity ? velocity : heat;
+    if(size == nullptr)
+        return;
+    if(!rasterized(size->width(), size->height()))
+        rasterize(scheduler, size->width(), size->height());
+
+    vector<char> picked(_regions.size());
+    for(size_t r=0; r < _regions.size(); ++r)
+        picked[r] = _regions[r].kind == EKind::OBSTACLE ||
+                    _regions[r].kind == EKind::INITIAL;
+
+    const int W = _rasterWidth;
+    forEachSpan(scheduler, picked, [&](int j, int r, int i0, int i1)
+    {
+        const Region& region = _regions[r];
+        for(int k=j*W + i0; k < j*W + i1; ++k)
+        {
+            if(region.kind == EKind::OBSTACLE)
+            {
+                if(frontier)
+                    for(int c=0; c < frontier->components(); ++c)
+                        frontier->store(c, k, 1.0f);
+                continue;
+            }
+
+            if(dye && region.hasDye)
+                for(int c=0; c < dye->components(); ++c)
+                    dye->store(c, k, region.dye[c]);
+            if(heat && region.hasHeat)
+                heat->store(0, k, region.heat);
+            if(velocity && region.hasVelocity)
+            {
+                velocity->store(0, k, region.velocity[0]);
+                velocity->store(1, k, region.velocity[1]);
+            }
+        }
+    });
+}
+
+void FluidScene::rasterize(FluidScheduler& scheduler, int width, int height)
+{
+    _rasterWidth = width;
+    _rasterHeight = height;
+    _rasters.assign(_regions.size(), Raster());
+    if(_regions.empty())
+        return;
+
+    // Rows that may hold cells, a row over on each side since the
+    // exact test is left to rasterizeRow()
+    for(size_t r=0; r < _regions.size(); ++r)
+    {
+        const Region& region = _regions[r];
+        float t0 = region.shape == EShape::BOX ?
+                    region.coords[1] : region.coords[1] - region.coords[2];
+        float t1 = region.shape == EShape::BOX ?
+                    region.coords[3] : region.coords[1] + region.coords[2];
+        int j0 = max(0, (int) floor(t0 * height) - 1);
+        int j1 = min(height, (int) ceil(t1 * height) + 1);
+
+        Raster& raster = _rasters[r];
+        raster.row0 = j0;
+        raster.i0.assign(max(0, j1 - j0), 0);
+        raster.i1.assign(max(0, j1 - j0), 0);
+    }
+
+    // Tasks over rows and regions
+    scheduler.forEachTile(height, (int) _regions.size(), [&](const FluidTile& tile, int)
+    {
+        for(int r=tile.j0; r < tile.j1; ++r)
+        {
+            Raster& raster = _rasters[r];
+            int j0 = max(tile.i0, raster.row0);
+            int j1 = min(tile.i1, raster.row0 + (int) raster.i0.size());
+            for(int j=j0; j<j1; ++j)
+                rasterizeRow(_regions[r], j, raster.i0[j - raster.row0],
+                                             raster.i1[j - raster.row0]);
+        }
+    });
+
+    for(Raster& raster : _rasters)
+    {
+        raster.cells = 0;
+        raster.bounds = FluidTile(width, height, 0, 0);
+        for(size_t k=0; k < raster.i0.size(); ++k)
+        {
+            if(raster.i0[k] == raster.i1[k])
+                continue;
+            int j = raster.row0 + (int) k;
+            raster.cells += raster.i1[k] - raster.i0[k];
+            raster.bounds.i0 = min(raster.bounds.i0, raster.i0[k]);
+            raster.bounds.i1 = max(raster.bounds.i1, raster.i1[k]);
+            raster.bounds.j0 = min(raster.bounds.j0, j);
+            raster.bounds.j1 = max(raster.bounds.j1, j + 1);
+        }
+        if(raster.cells == 0)
+            raster.bounds = FluidTile();
+    }
+}
+
+void FluidScene::rasterizeRow(const Region& region, int j, int& i0, int& i1) const
+{
+    const int W = _rasterWidth;
+    const float t = j/(float)_rasterHeight;
+    auto covers = [&](int i) {return region.covers(i/(float)W, t);};
+
+    // Estimate from the shape, then moved to the exact test's edges.
+    // Both shapes are convex, a row holds a single span.
+    float s0, s1;
+    if(region.shape == EShape::BOX)
+    {
+        s0 = region.coords[0];
+        s1 = region.coords[2];
+    }
+    else
+    {
+        float dy = t - region.coords[1];
+        float half = sqrt(max(0.0f, region.coords[2]*region.coords[2] - dy*dy));
+        s0 = region.coords[0] - half;
+        s1 = region.coords[0] + half;
+    }
+
+    int a = max(0, min(W, (int) ceil(s0 * W)));
+    int b = max(a, min(W, (int) ceil(s1 * W)));
+    while(a < b && !covers(a))   ++a;
+    while(b > a && !covers(b-1)) --b;
+    while(b < W && covers(b))    ++b;
+    while(a > 0 && covers(a-1))  --a;
+
+    i0 = a;
+    i1 = b;
+}
+
+template<typename Visit>
+void FluidScene::forEachSpan(FluidScheduler& scheduler, const vector<char>& picked,
+                             const Visit& visit) const
+{
+    int row0 = _rasterHeight;
+    int row1 = 0;
+    for(size_t r=0; r < _rasters.size(); ++r)
+    {
+        if(picked[r] && _rasters[r].cells != 0)
+        {
+            row0 = min(row0, _rasters[r].bounds.j0);
+            row1 = max(row1, _rasters[r].bounds.j1);
+        }
+    }
+    if(row0 >= row1)
+        return;
+
+    scheduler.forEachTile(row1 - row0, 1, [&](const FluidTile& tile, int)
+    {
+        for(int j=row0 + tile.i0; j < row0 + tile.i1; ++j)
+        {
+            for(size_t r=0; r < _rasters.size(); ++r)
+            {
+                const Raster& raster = _rasters[r];
+                int k = j - raster.row0;
+                if(!picked[r] || k < 0 || k >= (int) raster.i0.size() ||
+                   raster.i0[k] == raster.i1[k])
+                    continue;
+                visit(j, (int) r, raster.i0[k], raster.i1[k]);
+            }
+        }
+    });
+}
+
+bool FluidScene::active(const Region& region, double step)
+{
+    if(region.kind != EKind::SOURCE && region.kind != EKind::EMITTER &&
+       region.kind != EKind::FORCE)
+        return false;
+    return step >= region.start && (region.stop < 0 || step < region.stop);
+}
+
+float FluidScene::amplitude(const Region& region, double step)
+{
+    if(region.period <= 0)
+        return 1.0f;
+    const double PI = 3.14159265358979323846;
+    return (float) cos(2.0 * PI * fmod(step, region.period) / region.period);
+}
+
+bool FluidScene::hasForcing() const
+{
+    for(const Region& region : _regions)
+        if(region.kind == EKind::SOURCE || region.kind == EKind::EMITTER ||
+           region.kind == EKind::FORCE)
+            return true;
+    return false;
+}
+
+long long FluidScene::force(FluidScheduler& scheduler, double step,
+                            float dt, FluidGrid& dye, FluidGrid& velocity,
+                            FluidGrid& heat, const FluidGrid& frontier) const
+{
+    vector<char> picked(_regions.size());
+    vector<float> scale(_regions.size());
+    long long cells = 0;
+    for(size_t r=0; r < _regions.size(); ++r)
+    {
+        picked[r] = active(_regions[r], step);
+        scale[r] = amplitude(_regions[r], step);
+        if(picked[r])
+            cells += _rasters[r].cells;
+    }
+
+    const int W = _rasterWidth;
+    forEachSpan(scheduler, picked, [&](int j, int r, int i0, int i1)
+    {
+        const Region& region = _regions[r];
+        const bool hold = region.kind == EKind::SOURCE;
+        const float a = hold ? scale[r] : scale[r] * dt;
+        for(int k=j*W + i0; k < j*W + i1; ++k)
+        {
+            if(frontier.load(0, k) == 1.0f)
+                continue;
+
+            if(region.hasDye)
+                for(int c=0; c < dye.components(); ++c)
+                    dye.store(c, k, a * region.dye[c] + (hold ? 0.0f : dye.load(c, k)));
+            if(region.hasHeat)
+                heat.store(0, k, a * region.heat + (hold ? 0.0f : heat.load(0, k)));
+            if(region.hasVelocity)
+                for(int c=0; c < 2; ++c)
+                    velocity.store(c, k, a * region.velocity[c] +
+                                         (hold ? 0.0f : velocity.load(c, k)));
+        }
+    });
+
+    return cells;
+}
+
+const char* FluidScene::kindName(EKind kind)
+{
+    switch(kind)
+    {
+    case EKind::OBSTACLE : return "obstacle";
+    case EKind::INITIAL :  return "initial";
+    case EKind::SOURCE :   return "source";
+    case EKind::EMITTER :  return "emitter";
+    default :              return "force";
+    }
+}
@@ -0,0 +1,166 @@
+#ifndef FLUID_SCENE_H
+#define FLUID_SCENE_H
+
+#include <string>
+#include <vector>
+#include <istream>
+
+#include "FluidInitializer.h"
+#include "FluidTile.h"
+
+class FluidGrid;
+class FluidScheduler;
+
+
+// Obstacles, initial fields and forcing of a simulation, as a file.
+// Shapes are given in the [0, 1] coordinates of the init functions and
+// rasterized once per grid size into one span of cells per row, so that
+// stamping and forcing only visit the cells a region covers.
+class FluidScene : public FluidInitializer
+{
+public:
+    // DEFAULT is the built-in scene, EMPTY a still box with walls
+    enum class EBase {DEFAULT, EMPTY};
+    // SOURCE holds its values on the region every step, EMITTER adds them
+    // per unit of time and FORCE accelerates the velocity
+    enum class EKind {OBSTACLE, INITIAL, SOURCE, EMITTER, FORCE};
+    enum class EShape {BOX, CIRCLE};
+
+    struct Region
+    {
+        Region();
+
+        // Cells with x0 <= s < x1 and y0 <= t < y1 for boxes,
+        // closer than r to (cx, cy) for circles
+        bool covers(float s, float t) const;
+
+        EKind kind;
+        EShape shape;
+        // x0, y0, x1, y1 or cx, cy, r
+        float coords[4];
+        bool hasDye;
+        bool hasHeat;
+        bool hasVelocity;
+        cellar::Vec4f dye;
+        float heat;
+        // Acceleration of a FORCE
+        cellar::Vec2f velocity;
+        // Active from step start to stop excluded, a negative stop never
+        // ends. A period scales the values by cos(2 pi step / period).
+        // Steps are of the base timestep, a step of an adaptive timestep dt
+        // counting dt / DT of one so that regions follow simulated time.
+        int start;
+        int stop;
+        int period;
+    };
+
+    FluidScene();
+    virtual ~FluidScene();
+
+    // One directive per line, '#' starts a comment :
+    //   base default|empty
+    //   obstacle box=X0,Y0,X1,Y1|circle=CX,CY,R
+    //   initial|source|emitter SHAPE [dye=R,G,B] [heat=H] [velocity=U,V]
+    //   force SHAPE acceleration=AX,AY
+    // Sources, emitters and forces also take [start=N] [stop=N] [period=N].
+    // Regions apply in file order, later ones over earlier ones.
+    bool parse(std::istream& scene, std::string& error);
+    bool load(const std::string& fileName, std::string& error);
+
+    void setBase(EBase base);
+    EBase base() const;
+    void addRegion(const Region& region);
+    const std::vector<Region>& regions() const;
+
+    virtual cellar::Vec4f initDye(float s, float t);
+    virtual cellar::Vec4f initVelocity(float s, float t);
+    virtual cellar::Vec4f initPressure(float s, float t);
+    virtual cellar::Vec4f initHeat(float s, float t);
+    virtual cellar::Vec4f initFrontier(float s, float t);
+
+    // Draws the obstacles and initial regions over the base
+    virtual void stamp(FluidScheduler& scheduler, FluidGrid* dye,
+                       FluidGrid* velocity, FluidGrid* pressure,
+                       FluidGrid* heat, FluidGrid* frontier);
+
+    // Spans of every region for a grid of that size, rows run as tasks
+    void rasterize(FluidScheduler& scheduler, int width, int height);
+    bool rasterized(int width, int height) const;
+    // Cells of the region in the last rasterization, and their bounds
+    long long cellCount(int region) const;
+    const FluidTile& bounds(int region) const;
+
+    // Whether the region forces at step, and the scale of its values then
+    static bool active(const Region& region, double step);
+    static float amplitude(const Region& region, double step);
+    bool hasForcing() const;
+
+    // Applies the sources, emitters and forces active at step, obstacle
+    // cells excepted. Only the rows the regions cover run as tasks.
+    // Returns the number of cells visited.
+    long long force(FluidScheduler& scheduler, double step, float dt,
+                    FluidGrid& dye, FluidGrid& velocity, FluidGrid& heat,
+                    const FluidGrid& frontier) const;
+
+    static const char* kindName(EKind kind);
+
+
+protected:
+    // Cells [i0, i1) of the region's rows from row0 on
+    struct Raster
+    {
+        int row0;
+        std::vector<int> i0;
+        std::vector<int> i1;
+        FluidTile bounds;
+        long long cells;
+    };
+
+    void rasterizeRow(const Region& region, int j, int& i0, int& i1) const;
+
+    // Runs visit(j, region, i0, i1) on the spans of the regions picked,
+    // blocks of rows as tasks and regions in order within a row
+    template<typename Visit>
+    void forEachSpan(FluidScheduler& scheduler, const std::vector<char>& picked,
+                     const Visit& visit) const;
+
+
+private:
+    EBase _base;
+    std::vector<Region> _regions;
+
+    int _rasterWidth;
+    int _rasterHeight;
+    std::vector<Raster> _rasters;
+};
+
+
+
+// IMPLEMENTATION //
+inline FluidScene::EBase FluidScene::base() const
+{
+    return _base;
+}
+
+inline const std::vector<FluidScene::Region>& FluidScene::regions() const
+{
+    return _regions;
+}
+
+inline bool FluidScene::rasterized(int width, int height) const
+{
+    return _rasterWidth == width && _rasterHeight == height &&
+           _rasters.size() == _regions.size();
+}
+
+inline long long FluidScene::cellCount(int region) const
+{
+    return _rasters[region].cells;
+}
+
+inline const FluidTile& FluidScene::bounds(int region) const
+{
+    return _rasters[region].bounds;
+}
+
+#endif // FLUID_SCENE_H
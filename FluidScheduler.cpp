@@ -0,0 +1,154 @@
+#include "FluidScheduler.h"
+
+#include <algorithm>
+using namespace std;
+
+
+FluidScheduler::FluidScheduler(int threadCount) :
+    _tileWidth(256),
+    _tileHeight(64),
+    _workers(),
+    _threads(),
+    _generation(0),
+    _quit(false),
+    _task(nullptr),
+    _tiles(),
+    _pending(0)
+{
+    if(threadCount <= 0)
+        threadCount = max(1, (int) thread::hardware_concurrency());
+
+    for(int w=0; w < threadCount; ++w)
+        _workers.push_back(unique_ptr<Worker>(new Worker()));
+
+    // Worker 0 is the thread calling forEachTile()
+    for(int w=1; w < threadCount; ++w)
+        _threads.push_back(thread(&FluidScheduler::workerLoop, this, w));
+}
+
+FluidScheduler::~FluidScheduler()
+{
+    {
+        lock_guard<mutex> lock(_mutex);
+        _quit = true;
+    }
+    _wakeCond.notify_all();
+
+    for(thread& t : _threads)
+        t.join();
+}
+
+void FluidScheduler::setTileSize(int width, int height)
+{
+    _tileWidth = max(1, width);
+    _tileHeight = max(1, height);
+}
+
+int FluidScheduler::tileCount(int width, int height) const
+{
+    int nbX = (width  + _tileWidth  - 1) / _tileWidth;
+    int nbY = (height + _tileHeight - 1) / _tileHeight;
+    return nbX * nbY;
+}
+
+void FluidScheduler::forEachTile(int width, int height, const task_t& task)
+{
+    _tiles.clear();
+    for(int j=0; j < height; j += _tileHeight)
+        for(int i=0; i < width; i += _tileWidth)
+            _tiles.push_back(FluidTile(i, j,
+                                       min(i + _tileWidth,  width),
+                                       min(j + _tileHeight, height)));
+
+    const int nbTiles = (int) _tiles.size();
+    const int nbWorkers = (int) _workers.size();
+    if(nbWorkers == 1 || nbTiles == 1)
+    {
+        for(int t=0; t < nbTiles; ++t)
+            task(_tiles[t], t);
+        return;
+    }
+
+    // Contiguous tiles per worker keep neighbor rows in the same cache
+    _task = &task;
+    _pending = nbTiles;
+    for(int w=0; w < nbWorkers; ++w)
+    {
+        lock_guard<mutex> lock(_workers[w]->mutex);
+        for(int t = w*nbTiles/nbWorkers; t < (w+1)*nbTiles/nbWorkers; ++t)
+            _workers[w]->tiles.push_back(t);
+    }
+
+    {
+        lock_guard<mutex> lock(_mutex);
+        ++_generation;
+    }
+    _wakeCond.notify_all();
+
+    runTiles(0);
+
+    unique_lock<mutex> lock(_mutex);
+    _doneCond.wait(lock, [this]{return _pending == 0;});
+    _task = nullptr;
+}
+
+void FluidScheduler::workerLoop(int id)
+{
+    unsigned int generation = 0;
+    while(true)
+    {
+        {
+            unique_lock<mutex> lock(_mutex);
+            _wakeCond.wait(lock, [&]{return _quit || _generation != generation;});
+            if(_quit)
+                return;
+            generation = _generation;
+        }
+
+        runTiles(id);
+    }
+}
+
+void FluidScheduler::runTiles(int id)
+{
+    int tile;
+    while(popTile(id, tile))
+    {
+        (*_task)(_tiles[tile], tile);
+
+        if(--_pending == 0)
+        {
+            lock_guard<mutex> lock(_mutex);
+            _doneCond.notify_all();
+        }
+    }
+}
+
+bool FluidScheduler::popTile(int id, int& tile)
+{
+    {
+        Worker& own = *_workers[id];
+        lock_guard<mutex> lock(own.mutex);
+        if(!own.tiles.empty())
+        {
+            tile = own.tiles.front();
+            own.tiles.pop_front();
+            return true;
+        }
+    }
+
+    const int nbWorkers = (int) _workers.size();
+    for(int v=1; v < nbWorkers; ++v)
+    {
+        Worker& victim = *_workers[(id + v) % nbWorkers];
+        lock_guard<mutex> lock(victim.mutex);
+        if(!victim.tiles.empty())
+        {
+            tile = victim.tiles.back();
+            victim.tiles.pop_back();
+            return true;
+        }
+    }
+
+    return false;
+}
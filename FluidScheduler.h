@@ -0,0 +1,87 @@
+#ifndef FLUID_SCHEDULER_H
+#define FLUID_SCHEDULER_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "FluidTile.h"
+
+
+// Work-stealing thread pool running one task per grid tile.
+// Every worker owns a deque of contiguous tiles, pops from its front and
+// steals from the back of the others once it runs dry.
+class FluidScheduler
+{
+public:
+    typedef std::function<void(const FluidTile& tile, int index)> task_t;
+
+    // 0 threads uses every hardware thread
+    FluidScheduler(int threadCount = 0);
+    virtual ~FluidScheduler();
+
+    int threadCount() const;
+
+    void setTileSize(int width, int height);
+    int tileWidth() const;
+    int tileHeight() const;
+
+    // Tile indices run from 0 to tileCount() in row major order
+    int tileCount(int width, int height) const;
+
+    // Returns once every tile is done, which acts as the stage barrier.
+    // The calling thread works alongside the pool.
+    void forEachTile(int width, int height, const task_t& task);
+
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<int> tiles;
+    };
+
+    void workerLoop(int id);
+    void runTiles(int id);
+    bool popTile(int id, int& tile);
+
+    int _tileWidth;
+    int _tileHeight;
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::vector<std::thread> _threads;
+
+    std::mutex _mutex;
+    std::condition_variable _wakeCond;
+    std::condition_variable _doneCond;
+    unsigned int _generation;
+    bool _quit;
+
+    const task_t* _task;
+    std::vector<FluidTile> _tiles;
+    std::atomic<int> _pending;
+};
+
+
+
+// IMPLEMENTATION //
+inline int FluidScheduler::threadCount() const
+{
+    return (int) _workers.size();
+}
+
+inline int FluidScheduler::tileWidth() const
+{
+    return _tileWidth;
+}
+
+inline int FluidScheduler::tileHeight() const
+{
+    return _tileHeight;
+}
+
+#endif // FLUID_SCHEDULER_H
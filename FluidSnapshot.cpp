@@ -0,0 +1,386 @@
+#include "FluidSnapshot.h"
+#include "FluidGrid.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+using namespace std;
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+namespace
+{
+    const char MAGIC[8] = {'F', 'L', 'U', 'I', 'D', '2', 'D', 'S'};
+    const uint32_t BYTE_ORDER_TAG = 0x01020304;
+    const uint64_t ALIGNMENT = 64;
+    const int PARAMETER_COUNT = 6;
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t byteOrder;
+        int32_t width;
+        int32_t height;
+        uint64_t stepCount;
+        float parameters[PARAMETER_COUNT];
+        uint32_t fieldCount;
+        uint32_t headerSize;
+        // Of the header, with this member zeroed, and of the directory
+        uint64_t checksum;
+        // Since version 2
+        double time;
+        double sceneStep;
+    };
+
+    const uint64_t V1_HEADER_SIZE = offsetof(FileHeader, time);
+
+    struct FieldEntry
+    {
+        uint32_t field;
+        uint32_t components;
+        uint64_t offset;
+        uint64_t bytes;
+        uint64_t checksum;
+    };
+
+    uint64_t fnv1a(const void* data, size_t size,
+                   uint64_t hash = 14695981039346656037ULL)
+    {
+        const unsigned char* bytes = (const unsigned char*) data;
+        for(size_t b=0; b < size; ++b)
+        {
+            hash ^= bytes[b];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    uint64_t align(uint64_t offset)
+    {
+        return (offset + ALIGNMENT-1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    uint64_t headerChecksum(FileHeader header, uint64_t headerBytes,
+                            const FieldEntry* entries)
+    {
+        header.checksum = 0;
+        uint64_t hash = fnv1a(&header, headerBytes);
+        return fnv1a(entries, header.fieldCount * sizeof(FieldEntry), hash);
+    }
+}
+
+
+FluidSnapshot::Parameters::Parameters() :
+    dx(1.0f),
+    dt(1.0f),
+    viscosity(0.0f),
+    heatDiffusion(0.0f),
+    candleX(0.0f),
+    candleY(0.0f),
+    time(0.0),
+    sceneStep(0.0)
+{
+}
+
+FluidSnapshot::FluidSnapshot() :
+    _error(),
+    _data(nullptr),
+    _size(0),
+    _mapping(nullptr),
+    _width(0),
+    _height(0),
+    _stepCount(0),
+    _parameters()
+{
+    for(int f=0; f < FIELD_COUNT; ++f)
+    {
+        _components[f] = 0;
+        _offsets[f] = 0;
+    }
+}
+
+FluidSnapshot::~FluidSnapshot()
+{
+    close();
+}
+
+bool FluidSnapshot::save(const string& fileName,
+                         unsigned long long stepCount,
+                         const Parameters& parameters,
+                         const FluidGrid* const grids[FIELD_COUNT],
+                         string& error)
+{
+    // Packed fields are saved widened, they narrow back to the same bits
+    FluidGrid widened[FIELD_COUNT];
+    const FluidGrid* fields[FIELD_COUNT];
+    for(int f=0; f < FIELD_COUNT; ++f)
+    {
+        fields[f] = grids[f];
+        if(grids[f]->packed())
+        {
+            widened[f] = *grids[f];
+            widened[f].convert(FluidFieldLayout::EPrecision::FLOAT32);
+            fields[f] = &widened[f];
+        }
+    }
+
+    const int width = fields[0]->width();
+    const int height = fields[0]->height();
+    const uint64_t area = (uint64_t) width * height;
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrder = BYTE_ORDER_TAG;
+    header.width = width;
+    header.height = height;
+    header.stepCount = stepCount;
+    const float params[PARAMETER_COUNT] = {
+        parameters.dx, parameters.dt,
+        parameters.viscosity, parameters.heatDiffusion,
+        parameters.candleX, parameters.candleY
+    };
+    copy(params, params + PARAMETER_COUNT, header.parameters);
+    header.time = parameters.time;
+    header.sceneStep = parameters.sceneStep;
+    header.fieldCount = FIELD_COUNT;
+    header.headerSize = sizeof(FileHeader) + FIELD_COUNT * sizeof(FieldEntry);
+
+    FieldEntry entries[FIELD_COUNT];
+    uint64_t offset = align(header.headerSize);
+    for(int f=0; f < FIELD_COUNT; ++f)
+    {
+        const FluidGrid& grid = *fields[f];
+        if(grid.width() != width || grid.height() != height)
+        {
+            error = "Fields of different sizes";
+            return false;
+        }
+
+        // Planes are contiguous in the grid
+        entries[f].field = f;
+        entries[f].components = grid.components();
+        entries[f].offset = offset;
+        entries[f].bytes = area * grid.components() * sizeof(float);
+        entries[f].checksum = fnv1a(grid.plane(0), entries[f].bytes);
+        offset = align(offset + entries[f].bytes);
+    }
+    header.checksum = headerChecksum(header, sizeof(header), entries);
+
+    ofstream file(fileName.c_str(), ios::binary | ios::trunc);
+    if(!file)
+    {
+        error = "Could not create '" + fileName + "'";
+        return false;
+    }
+
+    static const char PADDING[ALIGNMENT] = {};
+    file.write((const char*) &header, sizeof(header));
+    file.write((const char*) entries, sizeof(entries));
+    uint64_t position = header.headerSize;
+    for(int f=0; f < FIELD_COUNT; ++f)
+    {
+        file.write(PADDING, entries[f].offset - position);
+        file.write((const char*) fields[f]->plane(0), entries[f].bytes);
+        position = entries[f].offset + entries[f].bytes;
+    }
+
+    if(!file)
+    {
+        error = "Could not write '" + fileName + "'";
+        return false;
+    }
+
+    return true;
+}
+
+bool FluidSnapshot::open(const string& fileName, bool verify)
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return fail("Could not open '" + fileName + "'");
+
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    _size = size.QuadPart;
+    HANDLE mapping = _size != 0 ?
+        CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) :
+        nullptr;
+    CloseHandle(file);
+    if(mapping == nullptr)
+        return fail("Could not map '" + fileName + "'");
+
+    _mapping = mapping;
+    _data = (const unsigned char*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(_data == nullptr)
+        return fail("Could not map '" + fileName + "'");
+#else
+    int file = ::open(fileName.c_str(), O_RDONLY);
+    if(file < 0)
+        return fail("Could not open '" + fileName + "'");
+
+    struct stat status;
+    fstat(file, &status);
+    _size = status.st_size;
+    void* data = _size != 0 ?
+        mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, file, 0) :
+        MAP_FAILED;
+    ::close(file);
+    if(data == MAP_FAILED)
+        return fail("Could not map '" + fileName + "'");
+
+    _data = (const unsigned char*) data;
+#endif
+
+    // Header, version 1 ends before the time
+    if(_size < V1_HEADER_SIZE)
+        return fail("Truncated snapshot header");
+
+    FileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(&header, _data, V1_HEADER_SIZE);
+    if(memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+        return fail("Not a Fluid2D snapshot");
+    if(header.byteOrder != BYTE_ORDER_TAG)
+        return fail("Snapshot of a different byte order");
+    if(header.version > VERSION)
+        return fail("Snapshot version is newer than this build");
+
+    const uint64_t headerBytes = header.version < 2 ? V1_HEADER_SIZE : sizeof(header);
+    if(_size < headerBytes)
+        return fail("Truncated snapshot header");
+    memcpy(&header, _data, headerBytes);
+    if(header.headerSize != headerBytes + header.fieldCount * sizeof(FieldEntry) ||
+       header.headerSize > _size)
+        return fail("Corrupted snapshot directory");
+
+    const FieldEntry* entries = (const FieldEntry*) (_data + headerBytes);
+    if(headerChecksum(header, headerBytes, entries) != header.checksum)
+        return fail("Snapshot header checksum mismatch");
+
+    _width = header.width;
+    _height = header.height;
+    _stepCount = header.stepCount;
+    _parameters.dx            = header.parameters[0];
+    _parameters.dt            = header.parameters[1];
+    _parameters.viscosity     = header.parameters[2];
+    _parameters.heatDiffusion = header.parameters[3];
+    _parameters.candleX       = header.parameters[4];
+    _parameters.candleY       = header.parameters[5];
+    if(header.version < 2)
+    {
+        // Steps were taken as of dt
+        _parameters.time      = 0.0;
+        _parameters.sceneStep = (double) header.stepCount;
+    }
+    else
+    {
+        _parameters.time      = header.time;
+        _parameters.sceneStep = header.sceneStep;
+    }
+
+    // Fields, unknown ones are skipped
+    const uint64_t area = (uint64_t) _width * _height;
+    for(uint32_t e=0; e < header.fieldCount; ++e)
+    {
+        FieldEntry entry;
+        memcpy(&entry, &entries[e], sizeof(entry));
+        if(entry.field >= (uint32_t) FIELD_COUNT)
+            continue;
+
+        if(entry.components < 1 || entry.components > 4 ||
+           entry.bytes != area * entry.components * sizeof(float) ||
+           entry.offset % sizeof(float) != 0 ||
+           entry.offset > _size || entry.bytes > _size - entry.offset)
+            return fail(string("Corrupted field ") +
+                FluidFieldLayout::fieldName((FluidFieldLayout::EField) entry.field));
+
+        if(verify && fnv1a(_data + entry.offset, entry.bytes) != entry.checksum)
+            return fail(string("Checksum mismatch on field ") +
+                FluidFieldLayout::fieldName((FluidFieldLayout::EField) entry.field));
+
+        _components[entry.field] = entry.components;
+        _offsets[entry.field] = entry.offset;
+    }
+
+    _error.clear();
+    return true;
+}
+
+void FluidSnapshot::close()
+{
+#ifdef _WIN32
+    if(_data)
+        UnmapViewOfFile(_data);
+    if(_mapping)
+        CloseHandle((HANDLE) _mapping);
+#else
+    if(_data)
+        munmap((void*) _data, _size);
+#endif
+
+    _data = nullptr;
+    _mapping = nullptr;
+    _size = 0;
+    _width = 0;
+    _height = 0;
+    _stepCount = 0;
+    for(int f=0; f < FIELD_COUNT; ++f)
+    {
+        _components[f] = 0;
+        _offsets[f] = 0;
+    }
+}
+
+const float* FluidSnapshot::plane(FluidFieldLayout::EField field, int c) const
+{
+    if(c >= components(field))
+        return nullptr;
+
+    uint64_t area = (uint64_t) _width * _height;
+    return (const float*) (_data + _offsets[(int) field]) + c * area;
+}
+
+bool FluidSnapshot::read(FluidFieldLayout::EField field, FluidGrid& grid) const
+{
+    if(components(field) == 0 ||
+       grid.width() != _width || grid.height() != _height)
+        return false;
+
+    for(int c=0; c < grid.components(); ++c)
+    {
+        if(const float* src = plane(field, c))
+            grid.writeCells(c, 0, grid.area(), src);
+        else
+        {
+            vector<float> value(grid.area(), c == 3 ? 1.0f : 0.0f);
+            grid.writeCells(c, 0, grid.area(), value.data());
+        }
+    }
+
+    return true;
+}
+
+bool FluidSnapshot::fail(const string& error)
+{
+    close();
+    _error = error;
+    return false;
+}
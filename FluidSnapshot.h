@@ -0,0 +1,134 @@
+#ifndef FLUID_SNAPSHOT_H
+#define FLUID_SNAPSHOT_H
+
+#include <string>
+
+#include "FluidFieldLayout.h"
+
+class FluidGrid;
+
+
+// Binary checkpoint of the simulation state.
+// A fixed header and a directory of fields are followed by the float
+// planes of every field, each aligned on 64 bytes so a mapped file is
+// read in place. The header and every field carry a 64 bits FNV-1a
+// checksum. Files are little endian, a byte order tag rejects others.
+class FluidSnapshot
+{
+public:
+    static const unsigned int VERSION = 2;
+
+    // Saved fields, indexed like FluidFieldLayout::EField.
+    // The divergence is scratch recomputed every step and is left out.
+    static const int FIELD_COUNT = 5;
+
+    struct Parameters
+    {
+        Parameters();
+
+        float dx;
+        float dt;
+        float viscosity;
+        float heatDiffusion;
+        float candleX;
+        float candleY;
+        // Simulated time and the scene's clock in steps of dt,
+        // version 1 files read as 0 and the step count
+        double time;
+        double sceneStep;
+    };
+
+    FluidSnapshot();
+    virtual ~FluidSnapshot();
+
+    // fields holds FIELD_COUNT grids of the same size
+    static bool save(const std::string& fileName,
+                     unsigned long long stepCount,
+                     const Parameters& parameters,
+                     const FluidGrid* const fields[FIELD_COUNT],
+                     std::string& error);
+
+    // Maps the file, checksums are only verified when asked
+    bool open(const std::string& fileName, bool verify = true);
+    void close();
+    bool isOpen() const;
+    const std::string& error() const;
+
+    int width() const;
+    int height() const;
+    unsigned long long stepCount() const;
+    const Parameters& parameters() const;
+    unsigned long long fileSize() const;
+
+    // 0 components when the field is absent from the file
+    int components(FluidFieldLayout::EField field) const;
+    // Points into the mapped file
+    const float* plane(FluidFieldLayout::EField field, int c) const;
+
+    // Copies the field into grid, missing components read like texel()
+    bool read(FluidFieldLayout::EField field, FluidGrid& grid) const;
+
+
+private:
+    FluidSnapshot(const FluidSnapshot&);
+    FluidSnapshot& operator=(const FluidSnapshot&);
+
+    bool fail(const std::string& error);
+
+    std::string _error;
+    const unsigned char* _data;
+    unsigned long long _size;
+    void* _mapping;
+
+    int _width;
+    int _height;
+    unsigned long long _stepCount;
+    Parameters _parameters;
+    int _components[FIELD_COUNT];
+    unsigned long long _offsets[FIELD_COUNT];
+};
+
+
+
+// IMPLEMENTATION //
+inline bool FluidSnapshot::isOpen() const
+{
+    return _data != nullptr;
+}
+
+inline const std::string& FluidSnapshot::error() const
+{
+    return _error;
+}
+
+inline int FluidSnapshot::width() const
+{
+    return _width;
+}
+
+inline int FluidSnapshot::height() const
+{
+    return _height;
+}
+
+inline unsigned long long FluidSnapshot::stepCount() const
+{
+    return _stepCount;
+}
+
+inline const FluidSnapshot::Parameters& FluidSnapshot::parameters() const
+{
+    return _parameters;
+}
+
+inline unsigned long long FluidSnapshot::fileSize() const
+{
+    return _size;
+}
+
+inline int FluidSnapshot::components(FluidFieldLayout::EField field) const
+{
+    return (int) field < FIELD_COUNT ? _components[(int) field] : 0;
+}
+
+#endif // FLUID_SNAPSHOT_H
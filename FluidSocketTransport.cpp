@@ -0,0 +1,266 @@
+#include "FluidSocketTransport.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+#if defined(__unix__) || defined(__APPLE__)
+#define FLUID_SOCKETS
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+
+FluidSocketTransport::FluidSocketTransport(int rank, const vector<int>& sockets) :
+    FluidTransport(rank, (int) sockets.size()),
+    _sockets(sockets)
+{
+}
+
+FluidSocketTransport::~FluidSocketTransport()
+{
+#ifdef FLUID_SOCKETS
+    for(int fd : _sockets)
+        if(fd >= 0)
+            close(fd);
+#endif
+}
+
+#ifdef FLUID_SOCKETS
+static string systemError(const string& what)
+{
+    return what + " : " + strerror(errno);
+}
+#endif
+
+int FluidSocketTransport::run(int size, const body_t& body, string& error)
+{
+#ifdef FLUID_SOCKETS
+    if(size < 1)
+    {
+        error = "At least one rank is needed";
+        return -1;
+    }
+
+    // ends[a][b] is rank a's end of the pair joining it to rank b
+    vector<vector<int>> ends(size, vector<int>(size, -1));
+    auto closeRanks = [&](int keep)
+    {
+        for(int a=0; a < size; ++a)
+        {
+            if(a == keep)
+                continue;
+            for(int& fd : ends[a])
+            {
+                if(fd >= 0)
+                    close(fd);
+                fd = -1;
+            }
+        }
+    };
+
+    for(int a=0; a < size; ++a)
+    {
+        for(int b=a+1; b < size; ++b)
+        {
+            int pair[2];
+            if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+            {
+                error = systemError("Could not create socket pair");
+                closeRanks(-1);
+                return -1;
+            }
+            ends[a][b] = pair[0];
+            ends[b][a] = pair[1];
+        }
+    }
+
+    // Buffered output would be written once per process
+    cout.flush();
+    cerr.flush();
+
+    vector<pid_t> children;
+    for(int r=1; r < size; ++r)
+    {
+        pid_t pid = fork();
+        if(pid == 0)
+        {
+            closeRanks(r);
+            int result = 1;
+            {
+                FluidSocketTransport transport(r, ends[r]);
+                try
+                {
+                    result = body(transport);
+                }
+                catch(exception& e)
+                {
+                    cerr << "Rank " << r << " : " << e.what() << endl;
+                }
+            }
+            cout.flush();
+            cerr.flush();
+            _exit(result);
+        }
+        if(pid < 0)
+        {
+            // Started ranks see their sockets close and give up
+            error = systemError("Could not start rank " + to_string(r));
+            closeRanks(-1);
+            for(pid_t child : children)
+                waitpid(child, nullptr, 0);
+            return -1;
+        }
+        children.push_back(pid);
+    }
+
+    closeRanks(0);
+    int result;
+    {
+        FluidSocketTransport transport(0, ends[0]);
+        result = body(transport);
+        if(!transport.ok())
+            error = transport.error();
+    }
+
+    for(size_t c=0; c < children.size(); ++c)
+    {
+        int status = 0;
+        while(waitpid(children[c], &status, 0) < 0 && errno == EINTR)
+            continue;
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            if(error.empty())
+                error = "Rank " + to_string(c+1) + " failed";
+            result = -1;
+        }
+    }
+
+    return result;
+#else
+    (void) size;
+    (void) body;
+    error = "Socket transport is only available on POSIX systems";
+    return -1;
+#endif
+}
+
+bool FluidSocketTransport::exchange(int peer, const void* sendData,
+                                    void* recvData, size_t bytes)
+{
+    if(!ok())
+        return false;
+    if(peer == rank())
+    {
+        memmove(recvData, sendData, bytes);
+        return true;
+    }
+
+#ifdef FLUID_SOCKETS
+    // Both directions progress together, so that large halos cannot fill
+    // both socket buffers and block the two ranks on their sends
+    const int fd = _sockets[peer];
+    const char* out = (const char*) sendData;
+    char* in = (char*) recvData;
+    size_t sent = 0;
+    size_t received = 0;
+    while(sent < bytes || received < bytes)
+    {
+        pollfd p;
+        p.fd = fd;
+        p.events = (sent < bytes ? POLLOUT : 0) | (received < bytes ? POLLIN : 0);
+        p.revents = 0;
+        if(poll(&p, 1, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return fail(systemError("Could not poll rank " + to_string(peer)));
+        }
+        if(p.revents & (POLLERR | POLLNVAL))
+            return fail("Lost rank " + to_string(peer));
+
+        if(received < bytes && (p.revents & (POLLIN | POLLHUP)))
+        {
+            ssize_t n = ::recv(fd, in + received, bytes - received, MSG_DONTWAIT);
+            if(n == 0)
+                return fail("Rank " + to_string(peer) + " closed its socket");
+            if(n > 0)
+                received += n;
+            else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return fail(systemError("Could not receive from rank " + to_string(peer)));
+        }
+
+        if(sent < bytes && (p.revents & POLLOUT))
+        {
+            ssize_t n = ::send(fd, out + sent, bytes - sent,
+                               MSG_DONTWAIT | MSG_NOSIGNAL);
+            if(n > 0)
+                sent += n;
+            else if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                return fail(systemError("Could not send to rank " + to_string(peer)));
+        }
+    }
+
+    countSent(bytes);
+    return true;
+#else
+    return fail("Socket transport is only available on POSIX systems");
+#endif
+}
+
+bool FluidSocketTransport::send(int peer, const void* data, size_t bytes)
+{
+    if(!ok())
+        return false;
+
+#ifdef FLUID_SOCKETS
+    const char* out = (const char*) data;
+    size_t sent = 0;
+    while(sent < bytes)
+    {
+        ssize_t n = ::send(_sockets[peer], out + sent, bytes - sent, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return fail(systemError("Could not send to rank " + to_string(peer)));
+        sent += n;
+    }
+
+    countSent(bytes);
+    return true;
+#else
+    return fail("Socket transport is only available on POSIX systems");
+#endif
+}
+
+bool FluidSocketTransport::recv(int peer, void* data, size_t bytes)
+{
+    if(!ok())
+        return false;
+
+#ifdef FLUID_SOCKETS
+    char* in = (char*) data;
+    size_t received = 0;
+    while(received < bytes)
+    {
+        ssize_t n = ::recv(_sockets[peer], in + received, bytes - received, 0);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n == 0)
+            return fail("Rank " + to_string(peer) + " closed its socket");
+        if(n < 0)
+            return fail(systemError("Could not receive from rank " + to_string(peer)));
+        received += n;
+    }
+
+    return true;
+#else
+    return fail("Socket transport is only available on POSIX systems");
+#endif
+}
@@ -0,0 +1,45 @@
+#ifndef FLUID_SOCKET_TRANSPORT_H
+#define FLUID_SOCKET_TRANSPORT_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "FluidTransport.h"
+
+
+// Ranks as processes of this machine, every two of them joined by a Unix
+// domain socket pair created before forking.
+// Only available on POSIX systems, run() fails elsewhere.
+class FluidSocketTransport : public FluidTransport
+{
+public:
+    typedef std::function<int(FluidTransport& transport)> body_t;
+
+    virtual ~FluidSocketTransport();
+
+    // Forks size-1 processes, the caller being rank 0, and runs body on
+    // every rank. Children exit with body's result. Returns rank 0's
+    // result, or -1 with error when a rank could not start or another
+    // rank did not return 0.
+    // Threads of the caller are not carried over by fork(), so body must
+    // build its thread pools itself.
+    static int run(int size, const body_t& body, std::string& error);
+
+    virtual bool exchange(int peer, const void* send, void* recv,
+                          size_t bytes);
+
+
+protected:
+    // sockets[r] is the end joined to rank r, -1 for this rank
+    FluidSocketTransport(int rank, const std::vector<int>& sockets);
+
+    virtual bool send(int peer, const void* data, size_t bytes);
+    virtual bool recv(int peer, void* data, size_t bytes);
+
+
+private:
+    std::vector<int> _sockets;
+};
+
+#endif // FLUID_SOCKET_TRANSPORT_H
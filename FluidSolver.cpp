@@ -0,0 +1,1523 @@
+#include "FluidSolver.h"
+
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+using namespace cellar;
+
+#include "FluidExporter.h"
+#include "FluidInitializer.h"
+#include "FluidSnapshot.h"
+
+
+const float FluidSolver::CANDLE_RADIUS = 10.0f;
+
+
+FluidSolver::Physics::Physics() :
+    dx(1.0f),
+    dt(1.0f),
+    viscosity(0.01f),
+    heatDiffusion(0.01f)
+{
+}
+
+FluidSolver::FluidSolver(int width, int height,
+                         const FluidFieldLayout& layout,
+                         const Physics& physics) :
+    WIDTH(width),
+    HEIGHT(height),
+    DX(physics.dx),
+    DT(physics.dt),
+    VISCOSITY(physics.viscosity),
+    HEATDIFF(physics.heatDiffusion),
+    DRAW_GRID(1),
+    FETCH_GRID(0),
+    _layout(layout),
+    _kernels(&FluidKernels::best()),
+    _scheduler(new FluidScheduler()),
+    _profiler(nullptr),
+    _tileNorms(),
+    _tileTraffic(),
+    _candlePos(0, 0),
+    _scene(),
+    _forcedCells(0),
+    _stepCount(0),
+    _dt(physics.dt),
+    _time(0.0),
+    _sceneStep(0.0),
+    _adaptiveTimestep(false),
+    _cfl(1.0f),
+    _minDt(physics.dt / 8),
+    _maxDt(physics.dt * 4),
+    _maxSpeed(0.0f),
+    _tileSpeeds(),
+    _diffuseCriterion(60),
+    _pressureCriterion(200),
+    _velocityDiffuseStats(),
+    _heatDiffuseStats(),
+    _pressureStats(),
+    _fusedAdvection(true),
+    _advection(),
+    _advectGrid(),
+    _fusedProjection(true),
+    _vorticity(0.0f),
+    _curlGrid(),
+    _jacobiBlocking(1),
+    _jacobiTraffic(0),
+    _sparse(false),
+    _sparseThreshold(1e-4f),
+    _activeTiles(),
+    _activeFraction(1.0f),
+    _pressureSolver(EPressureSolver::JACOBI),
+    _pressureTolerance(1e-3f),
+    _multigrid(),
+    _conjugateGradient(),
+    _pressureX(width * height),
+    _pressureB(width * height)
+{
+    typedef FluidFieldLayout::EField EField;
+    for(int i=0; i<2; ++i)
+    {
+        _dyeGrid[i].resize(WIDTH, HEIGHT, layout.components(EField::DYE),
+                           layout.format(EField::DYE).precision);
+        _velocityGrid[i].resize(WIDTH, HEIGHT, layout.components(EField::VELOCITY));
+        _pressureGrid[i].resize(WIDTH, HEIGHT, layout.components(EField::PRESSURE));
+        _heatGrid[i].resize(WIDTH, HEIGHT, layout.components(EField::HEAT),
+                            layout.format(EField::HEAT).precision);
+    }
+    _frontierGrid.resize(WIDTH, HEIGHT, layout.components(EField::FRONTIER));
+    _tempDivGrid.resize(WIDTH, HEIGHT, layout.components(EField::DIVERGENCE));
+}
+
+FluidSolver::~FluidSolver()
+{
+
+}
+
+void FluidSolver::reset(FluidInitializer& initializer)
+{
+    initializer.generate(*_scheduler,
+                         &_dyeGrid[FETCH_GRID], &_velocityGrid[FETCH_GRID],
+                         &_pressureGrid[FETCH_GRID], &_heatGrid[FETCH_GRID],
+                         &_frontierGrid);
+
+    _dyeGrid[DRAW_GRID]      = _dyeGrid[FETCH_GRID];
+    _velocityGrid[DRAW_GRID] = _velocityGrid[FETCH_GRID];
+    _pressureGrid[DRAW_GRID] = _pressureGrid[FETCH_GRID];
+    _heatGrid[DRAW_GRID]     = _heatGrid[FETCH_GRID];
+    _tempDivGrid.fill(Vec4f());
+    _boundary.build(_frontierGrid);
+    _multigrid.setup(_frontierGrid);
+    _conjugateGradient.setup(_frontierGrid);
+
+    _stepCount = 0;
+    _time = 0.0;
+    _sceneStep = 0.0;
+    if(_adaptiveTimestep)
+        measureSpeed();
+}
+
+void FluidSolver::step()
+{
+    if(_scene.hasForcing())
+        force();
+    if(_sparse)
+        updateActivity();
+
+    advect();
+    diffuse();
+    if(_vorticity > 0.0f)
+        confineVorticity();
+    if(_fusedProjection)
+    {
+        heatDivergence();
+        solvePressure();
+        substractGradientFrontier();
+    }
+    else
+    {
+        heat();
+        computePressure();
+        substractPressureGradient();
+        frontier();
+    }
+
+    _time += _dt;
+    _sceneStep += (double) _dt / DT;
+    ++_stepCount;
+    if(_adaptiveTimestep)
+        measureSpeed();
+    if(_profiler)
+        _profiler->countStep();
+}
+
+bool FluidSolver::saveSnapshot(const string& fileName, string& error) const
+{
+    FluidSnapshot::Parameters parameters;
+    parameters.dx = DX;
+    parameters.dt = DT;
+    parameters.viscosity = VISCOSITY;
+    parameters.heatDiffusion = HEATDIFF;
+    parameters.candleX = _candlePos[0];
+    parameters.candleY = _candlePos[1];
+    parameters.time = _time;
+    parameters.sceneStep = _sceneStep;
+
+    const FluidGrid* fields[FluidSnapshot::FIELD_COUNT] = {
+        &_dyeGrid[FETCH_GRID],
+        &_velocityGrid[FETCH_GRID],
+        &_pressureGrid[FETCH_GRID],
+        &_heatGrid[FETCH_GRID],
+        &_frontierGrid
+    };
+
+    return FluidSnapshot::save(fileName, _stepCount, parameters, fields, error);
+}
+
+bool FluidSolver::exportFields(FluidExporter& exporter) const
+{
+    typedef FluidFieldLayout::EField EField;
+
+    vector<const FluidGrid*> grids;
+    for(EField field : exporter.fields())
+    {
+        switch(field)
+        {
+        case EField::DYE :        grids.push_back(&_dyeGrid[FETCH_GRID]);      break;
+        case EField::VELOCITY :   grids.push_back(&_velocityGrid[FETCH_GRID]); break;
+        case EField::PRESSURE :   grids.push_back(&_pressureGrid[FETCH_GRID]); break;
+        case EField::HEAT :       grids.push_back(&_heatGrid[FETCH_GRID]);     break;
+        case EField::FRONTIER :   grids.push_back(&_frontierGrid);             break;
+        case EField::DIVERGENCE : grids.push_back(&_tempDivGrid);              break;
+        }
+    }
+
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::EXPORT);
+    return exporter.submit(_stepCount, grids.data());
+}
+
+bool FluidSolver::loadSnapshot(const FluidSnapshot& snapshot, string& error)
+{
+    typedef FluidFieldLayout::EField EField;
+
+    if(snapshot.width() != WIDTH || snapshot.height() != HEIGHT)
+    {
+        error = "Snapshot size does not match the solver";
+        return false;
+    }
+
+    const FluidSnapshot::Parameters& parameters = snapshot.parameters();
+    if(parameters.dx != DX || parameters.dt != DT ||
+       parameters.viscosity != VISCOSITY || parameters.heatDiffusion != HEATDIFF)
+    {
+        error = "Snapshot was taken with other simulation parameters";
+        return false;
+    }
+
+    struct {EField field; FluidGrid* grid;} fields[] = {
+        {EField::DYE,      &_dyeGrid[FETCH_GRID]},
+        {EField::VELOCITY, &_velocityGrid[FETCH_GRID]},
+        {EField::PRESSURE, &_pressureGrid[FETCH_GRID]},
+        {EField::HEAT,     &_heatGrid[FETCH_GRID]},
+        {EField::FRONTIER, &_frontierGrid}
+    };
+    for(const auto& f : fields)
+    {
+        if(!snapshot.read(f.field, *f.grid))
+        {
+            error = string("Snapshot has no ") + FluidFieldLayout::fieldName(f.field);
+            return false;
+        }
+    }
+
+    _dyeGrid[DRAW_GRID]      = _dyeGrid[FETCH_GRID];
+    _velocityGrid[DRAW_GRID] = _velocityGrid[FETCH_GRID];
+    _pressureGrid[DRAW_GRID] = _pressureGrid[FETCH_GRID];
+    _heatGrid[DRAW_GRID]     = _heatGrid[FETCH_GRID];
+    _tempDivGrid.fill(Vec4f());
+    _boundary.build(_frontierGrid);
+    _multigrid.setup(_frontierGrid);
+    _conjugateGradient.setup(_frontierGrid);
+
+    _candlePos = Vec2f(parameters.candleX, parameters.candleY);
+    _stepCount = snapshot.stepCount();
+    _time = parameters.time;
+    _sceneStep = parameters.sceneStep;
+    if(_adaptiveTimestep)
+        measureSpeed();
+
+    return true;
+}
+
+void FluidSolver::setCandlePosition(const Vec2f& pos)
+{
+    _candlePos = pos;
+}
+
+void FluidSolver::setScene(const FluidScene& scene)
+{
+    _scene = scene;
+    _scene.rasterize(*_scheduler, WIDTH, HEIGHT);
+    _forcedCells = 0;
+}
+
+void FluidSolver::editFrontier(const FluidTile& region, float value)
+{
+    FluidTile clipped(max(region.i0, 0), max(region.j0, 0),
+                      min(region.i1, WIDTH), min(region.j1, HEIGHT));
+    if(clipped.i0 >= clipped.i1 || clipped.j0 >= clipped.j1)
+        return;
+
+    for(int c=0; c < _frontierGrid.components(); ++c)
+        for(int j=clipped.j0; j<clipped.j1; ++j)
+            fill_n(_frontierGrid.plane(c) + j*WIDTH + clipped.i0,
+                   clipped.i1 - clipped.i0, value);
+
+    _boundary.update(_frontierGrid, clipped);
+    _multigrid.setup(_frontierGrid);
+    _conjugateGradient.setup(_frontierGrid);
+}
+
+int FluidSolver::bytesPerCell() const
+{
+    const FluidGrid* grids[] = {
+        _dyeGrid, _velocityGrid, _pressureGrid, _heatGrid,
+        &_frontierGrid, &_tempDivGrid
+    };
+    int bytes = 0;
+    for(int g=0; g < 6; ++g)
+        bytes += (g < 4 ? 2 : 1) * grids[g]->components() *
+                 grids[g]->bytesPerComponent();
+    return bytes;
+}
+
+void FluidSolver::setThreadCount(int threadCount)
+{
+    int tileWidth = _scheduler->tileWidth();
+    int tileHeight = _scheduler->tileHeight();
+    _scheduler.reset(new FluidScheduler(threadCount));
+    _scheduler->setTileSize(tileWidth, tileHeight);
+}
+
+void FluidSolver::setKernels(const FluidKernels& kernels)
+{
+    _kernels = &kernels;
+}
+
+void FluidSolver::setProfiler(FluidProfiler* profiler)
+{
+    _profiler = profiler;
+}
+
+void FluidSolver::setFusedAdvection(bool fused)
+{
+    _fusedAdvection = fused;
+}
+
+void FluidSolver::setAdvection(const FluidAdvection& advection)
+{
+    _advection = advection;
+}
+
+void FluidSolver::setFusedProjection(bool fused)
+{
+    _fusedProjection = fused;
+}
+
+void FluidSolver::setAdaptiveTimestep(bool adaptive, float cfl,
+                                      float minDt, float maxDt)
+{
+    _adaptiveTimestep = adaptive;
+    _cfl = cfl;
+    _minDt = minDt > 0.0f ? minDt : DT / 8;
+    _maxDt = maxDt > 0.0f ? max(maxDt, _minDt) : max(DT * 4, _minDt);
+    if(_adaptiveTimestep)
+        measureSpeed();
+    else
+        _dt = DT;
+}
+
+void FluidSolver::setVorticityConfinement(float strength)
+{
+    _vorticity = max(0.0f, strength);
+    if(_vorticity > 0.0f && _curlGrid.width() != WIDTH)
+        _curlGrid.resize(WIDTH, HEIGHT, 1);
+}
+
+void FluidSolver::setJacobiBlocking(int depth)
+{
+    _jacobiBlocking = max(1, depth);
+}
+
+void FluidSolver::setSparse(bool sparse, float threshold)
+{
+    _sparse = sparse;
+    _sparseThreshold = threshold;
+    _activeTiles.clear();
+    _activeFraction = 1.0f;
+}
+
+void FluidSolver::resetJacobiTraffic()
+{
+    _jacobiTraffic = 0;
+}
+
+void FluidSolver::setPressureSolver(EPressureSolver solver)
+{
+    _pressureSolver = solver;
+}
+
+void FluidSolver::setDiffuseCriterion(const ConvergenceCriterion& criterion)
+{
+    _diffuseCriterion = criterion;
+}
+
+void FluidSolver::setPressureCriterion(const ConvergenceCriterion& criterion)
+{
+    _pressureCriterion = criterion;
+}
+
+void FluidSolver::setPressureTolerance(float tolerance)
+{
+    _pressureTolerance = tolerance;
+}
+
+float FluidSolver::pressureResidual() const
+{
+    if(_pressureSolver == EPressureSolver::MULTIGRID)
+        return _multigrid.residual();
+    if(_pressureSolver == EPressureSolver::CONJUGATE_GRADIENT)
+        return _conjugateGradient.residual();
+
+    // Residual of the system iterated by jacobi() : sum(xn) - 4xc = Dx*Dx div
+    const FluidGrid& x = _pressureGrid[FETCH_GRID];
+    const float* div = _tempDivGrid.plane(0);
+    double rNorm = 0.0;
+    double bNorm = 0.0;
+    for(int j=0; j<HEIGHT; ++j)
+    {
+        for(int i=0; i<WIDTH; ++i)
+        {
+            float b = DX*DX * div[j*WIDTH + i];
+            float lap = x.fetch(0, i-1, j) + x.fetch(0, i+1, j) +
+                        x.fetch(0, i, j-1) + x.fetch(0, i, j+1) -
+                        4.0f * x.fetch(0, i, j);
+            rNorm += (b - lap) * (b - lap);
+            bNorm += b * b;
+        }
+    }
+
+    return bNorm == 0.0 ? 0.0f : (float) sqrt(rNorm / bNorm);
+}
+
+void FluidSolver::measureSpeed()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::TIMESTEP);
+    const float* u = _velocityGrid[FETCH_GRID].plane(0);
+    const float* v = _velocityGrid[FETCH_GRID].plane(1);
+    _tileSpeeds.assign(_scheduler->tileCount(WIDTH, HEIGHT), 0.0f);
+
+    _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+    {
+        _tileSpeeds[index] = _kernels->maxSpeed2(u, v, WIDTH, tile);
+    });
+
+    float peak = 0.0f;
+    for(float speed2 : _tileSpeeds)
+        peak = max(peak, speed2);
+    _maxSpeed = sqrt(peak);
+
+    _dt = _maxDt;
+    if(_maxSpeed * _maxDt > _cfl * DX)
+        _dt = max(_minDt, _cfl * DX / _maxSpeed);
+}
+
+void FluidSolver::force()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::FORCE);
+    _forcedCells = _scene.force(*_scheduler, _sceneStep, _dt,
+                                _dyeGrid[FETCH_GRID], _velocityGrid[FETCH_GRID],
+                                _heatGrid[FETCH_GRID], _frontierGrid);
+}
+
+void FluidSolver::advect()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::ADVECT);
+    FluidGrid* grids[] = {
+        _dyeGrid,
+        _heatGrid,
+        _velocityGrid
+    };
+
+    if(_fusedAdvection)
+    {
+        // One backtrace and footprint per cell for every field
+        _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+        {
+            if(!tileActive(index))
+            {
+                for(FluidGrid* grid : grids)
+                    copyTile(grid[FETCH_GRID], grid[DRAW_GRID], tile);
+                return;
+            }
+
+            // Packed fields are narrowed a row at a time
+            const int tileW = tile.i1 - tile.i0;
+            static thread_local vector<float> staged;
+            staged.resize(3 * 4 * tileW);
+
+            for(int j=tile.j0; j<tile.j1; ++j)
+            {
+                for(int i=tile.i0; i<tile.i1; ++i)
+                {
+                    int cell = j*WIDTH + i;
+                    float nx, ny;
+                    backtrace(i, j, nx, ny);
+
+                    FluidGrid::Footprint fp;
+                    _frontierGrid.footprint(nx, ny, fp);
+                    for(int g=0; g<3; ++g)
+                    {
+                        float value[4];
+                        grids[g][FETCH_GRID].sample(fp, value);
+                        FluidGrid& dst = grids[g][DRAW_GRID];
+                        for(int c=0; c < dst.components(); ++c)
+                        {
+                            if(dst.packed())
+                                staged[(g*4 + c)*tileW + i - tile.i0] = value[c];
+                            else
+                                dst.plane(c)[cell] = value[c];
+                        }
+                    }
+                }
+
+                for(int g=0; g<3; ++g)
+                {
+                    FluidGrid& dst = grids[g][DRAW_GRID];
+                    if(!dst.packed())
+                        continue;
+                    for(int c=0; c < dst.components(); ++c)
+                        dst.writeCells(c, j*WIDTH + tile.i0, tileW,
+                                       &staged[(g*4 + c)*tileW]);
+                }
+            }
+        });
+    }
+    else
+    {
+        for(FluidGrid* grid : grids)
+        {
+            const FluidGrid& src = grid[FETCH_GRID];
+            FluidGrid& dst = grid[DRAW_GRID];
+            const int nbComp = dst.components();
+
+            _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+            {
+                if(!tileActive(index))
+                {
+                    copyTile(src, dst, tile);
+                    return;
+                }
+
+                for(int j=tile.j0; j<tile.j1; ++j)
+                {
+                    for(int i=tile.i0; i<tile.i1; ++i)
+                    {
+                        float nx, ny;
+                        backtrace(i, j, nx, ny);
+
+                        float value[4];
+                        src.sample(nx, ny, value);
+                        for(int c=0; c < nbComp; ++c)
+                            dst.store(c, j*WIDTH + i, value[c]);
+                    }
+                }
+            });
+        }
+    }
+
+    // Every correction traces through the velocity before it is advected
+    if(_advection.highOrder())
+    {
+        const FluidFieldLayout::EField fields[] = {
+            FluidFieldLayout::EField::DYE,
+            FluidFieldLayout::EField::HEAT,
+            FluidFieldLayout::EField::VELOCITY
+        };
+        for(int f=0; f<3; ++f)
+        {
+            FluidAdvection::EScheme scheme = _advection.scheme(fields[f]);
+            if(scheme != FluidAdvection::EScheme::SEMI_LAGRANGIAN)
+                correctAdvection(grids[f], scheme, _advectGrid[f]);
+        }
+    }
+
+    // The velocity is swapped last since dye and heat are advected by it
+    swap(_dyeGrid[FETCH_GRID],      _dyeGrid[DRAW_GRID]);
+    swap(_heatGrid[FETCH_GRID],     _heatGrid[DRAW_GRID]);
+    swap(_velocityGrid[FETCH_GRID], _velocityGrid[DRAW_GRID]);
+}
+
+void FluidSolver::backtrace(int i, int j, float& nx, float& ny) const
+{
+    const float rDx = 1.0f / DX;
+    const FluidGrid& velocity = _velocityGrid[FETCH_GRID];
+    int cell = j*WIDTH + i;
+
+    float fx = i + 0.5f;
+    float fy = j + 0.5f;
+    nx = fx - _dt * rDx * velocity.plane(0)[cell];
+    ny = fy - _dt * rDx * velocity.plane(1)[cell];
+
+    float a = _frontierGrid.fetch(0, (int)nx, (int)ny);
+    nx = nx + (fx - nx) * a;
+    ny = ny + (fy - ny) * a;
+}
+
+void FluidSolver::forwardtrace(int i, int j, float& nx, float& ny) const
+{
+    const float rDx = 1.0f / DX;
+    const FluidGrid& velocity = _velocityGrid[FETCH_GRID];
+    int cell = j*WIDTH + i;
+
+    float fx = i + 0.5f;
+    float fy = j + 0.5f;
+    nx = fx + _dt * rDx * velocity.plane(0)[cell];
+    ny = fy + _dt * rDx * velocity.plane(1)[cell];
+
+    float a = _frontierGrid.fetch(0, (int)nx, (int)ny);
+    nx = nx + (fx - nx) * a;
+    ny = ny + (fy - ny) * a;
+}
+
+void FluidSolver::correctAdvection(FluidGrid grid[2],
+                                   FluidAdvection::EScheme scheme,
+                                   FluidGrid& scratch)
+{
+    const FluidGrid& src = grid[FETCH_GRID];
+    FluidGrid& dst = grid[DRAW_GRID];
+    const int nbComp = dst.components();
+    const bool revert = _advection.limiter() == FluidAdvection::ELimiter::REVERT;
+    if(scratch.width() != WIDTH || scratch.height() != HEIGHT ||
+       scratch.components() != nbComp || scratch.precision() != dst.precision())
+        scratch.resize(WIDTH, HEIGHT, nbComp, dst.precision());
+
+    // Value of the semi-Lagrangian step limited by the source texels its
+    // backtrace blends
+    auto limit = [&](int i, int j, int cell, float* value)
+    {
+        float nx, ny;
+        backtrace(i, j, nx, ny);
+        FluidGrid::Footprint fp;
+        _frontierGrid.footprint(nx, ny, fp);
+        float low[4], high[4];
+        src.bounds(fp, low, high);
+
+        bool inside = true;
+        for(int c=0; c < nbComp; ++c)
+            inside = inside && value[c] >= low[c] && value[c] <= high[c];
+        for(int c=0; c < nbComp; ++c)
+        {
+            if(revert && !inside)
+                value[c] = dst.load(c, cell);
+            else
+                value[c] = min(max(value[c], low[c]), high[c]);
+        }
+    };
+
+    // Half the error of the backward step on the forward one
+    auto backward = [&](int i, int j, int cell, float* error)
+    {
+        float nx, ny;
+        forwardtrace(i, j, nx, ny);
+        dst.sample(nx, ny, error);
+        for(int c=0; c < nbComp; ++c)
+            error[c] = 0.5f * (src.load(c, cell) - error[c]);
+    };
+
+    if(scheme == FluidAdvection::EScheme::MACCORMACK)
+    {
+        _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+        {
+            if(!tileActive(index))
+            {
+                copyTile(dst, scratch, tile);
+                return;
+            }
+
+            for(int j=tile.j0; j<tile.j1; ++j)
+            {
+                for(int i=tile.i0; i<tile.i1; ++i)
+                {
+                    int cell = j*WIDTH + i;
+                    float value[4];
+                    backward(i, j, cell, value);
+                    for(int c=0; c < nbComp; ++c)
+                        value[c] += dst.load(c, cell);
+                    limit(i, j, cell, value);
+                    for(int c=0; c < nbComp; ++c)
+                        scratch.store(c, cell, value[c]);
+                }
+            }
+        });
+        swap(scratch, dst);
+    }
+    else
+    {
+        // Source compensated by the error
+        _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+        {
+            if(!tileActive(index))
+            {
+                copyTile(src, scratch, tile);
+                return;
+            }
+
+            for(int j=tile.j0; j<tile.j1; ++j)
+            {
+                for(int i=tile.i0; i<tile.i1; ++i)
+                {
+                    int cell = j*WIDTH + i;
+                    float value[4];
+                    backward(i, j, cell, value);
+                    for(int c=0; c < nbComp; ++c)
+                        scratch.store(c, cell, src.load(c, cell) + value[c]);
+                }
+            }
+        });
+
+        _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+        {
+            if(!tileActive(index))
+                return;
+
+            for(int j=tile.j0; j<tile.j1; ++j)
+            {
+                for(int i=tile.i0; i<tile.i1; ++i)
+                {
+                    int cell = j*WIDTH + i;
+                    float nx, ny;
+                    backtrace(i, j, nx, ny);
+                    float value[4];
+                    scratch.sample(nx, ny, value);
+                    limit(i, j, cell, value);
+                    for(int c=0; c < nbComp; ++c)
+                        dst.store(c, cell, value[c]);
+                }
+            }
+        });
+    }
+}
+
+void FluidSolver::diffuse()
+{
+    // Velocity
+    {
+        FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::DIFFUSE_VELOCITY);
+        float alpha = DX*DX / (VISCOSITY*_dt);
+        float rBeta = 1.0f / (4.0f + DX*DX/(VISCOSITY*_dt));
+        _velocityDiffuseStats = jacobiSolve(_velocityGrid, nullptr,
+                                            alpha, rBeta, _diffuseCriterion,
+                                            _sparse);
+    }
+
+    // Heat
+    {
+        FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::DIFFUSE_HEAT);
+        float alpha = DX*DX / (HEATDIFF*_dt);
+        float rBeta = 1.0f / (4.0f + DX*DX/(HEATDIFF*_dt));
+        _heatDiffuseStats = jacobiSolve(_heatGrid, nullptr,
+                                        alpha, rBeta, _diffuseCriterion,
+                                        _sparse);
+    }
+}
+
+void FluidSolver::confineVorticity()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::VORTICITY);
+    const float HalfrDx = 0.5f / DX;
+    const float scale = _vorticity * DX * _dt;
+    const FluidGrid& velSrc = _velocityGrid[FETCH_GRID];
+    FluidGrid& velDst = _velocityGrid[DRAW_GRID];
+    const float* u = velSrc.plane(0);
+    const float* v = velSrc.plane(1);
+    const float* frontier = _frontierGrid.plane(0);
+    float* curl = _curlGrid.plane(0);
+
+    // Neighbours out of the grid or in an obstacle read as the cell itself
+    auto neighbour = [&](int i, int j, int cell)
+    {
+        if(i < 0 || i >= WIDTH || j < 0 || j >= HEIGHT)
+            return cell;
+        int n = j*WIDTH + i;
+        return frontier[n] == 1.0f ? cell : n;
+    };
+
+    _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int)
+    {
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                int cell = j*WIDTH + i;
+                if(frontier[cell] == 1.0f)
+                {
+                    curl[cell] = 0.0f;
+                    continue;
+                }
+                int l = neighbour(i-1, j, cell);
+                int r = neighbour(i+1, j, cell);
+                int b = neighbour(i, j-1, cell);
+                int t = neighbour(i, j+1, cell);
+                curl[cell] = HalfrDx * ((v[r] - v[l]) - (u[t] - u[b]));
+            }
+        }
+    });
+
+    _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+    {
+        if(!tileActive(index))
+        {
+            copyTile(velSrc, velDst, tile);
+            return;
+        }
+
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                int cell = j*WIDTH + i;
+                for(int c=0; c < velDst.components(); ++c)
+                    velDst.plane(c)[cell] = velSrc.plane(c)[cell];
+                if(frontier[cell] == 1.0f)
+                    continue;
+
+                // Force along N x curl, N pointing up the curl's magnitude
+                float gx = HalfrDx * (fabs(curl[neighbour(i+1, j, cell)]) -
+                                      fabs(curl[neighbour(i-1, j, cell)]));
+                float gy = HalfrDx * (fabs(curl[neighbour(i, j+1, cell)]) -
+                                      fabs(curl[neighbour(i, j-1, cell)]));
+                float f = scale * curl[cell] / (sqrt(gx*gx + gy*gy) + 1e-5f);
+                velDst.plane(0)[cell] += f * gy;
+                velDst.plane(1)[cell] -= f * gx;
+            }
+        }
+    });
+
+    swap(_velocityGrid[FETCH_GRID], _velocityGrid[DRAW_GRID]);
+}
+
+void FluidSolver::heat()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::HEAT);
+    const FluidGrid& heatSrc = _heatGrid[FETCH_GRID];
+    const FluidGrid& velSrc = _velocityGrid[FETCH_GRID];
+    FluidGrid& heatDst = _heatGrid[DRAW_GRID];
+    FluidGrid& velDst = _velocityGrid[DRAW_GRID];
+    const Vec4f candle(1.0, 0, 0, 0);
+
+    _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+    {
+        if(!tileActive(index))
+        {
+            copyTile(velSrc, velDst, tile);
+            copyTile(heatSrc, heatDst, tile);
+            return;
+        }
+
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                int cell = j*WIDTH + i;
+                for(int c=0; c < velDst.components(); ++c)
+                    velDst.plane(c)[cell] = velSrc.plane(c)[cell];
+                velDst.plane(1)[cell] += buoyancy(i, j);
+
+                bool lit = candleLit(i, j);
+                for(int c=0; c < heatDst.components(); ++c)
+                    heatDst.store(c, cell, lit ? candle[c] : heatSrc.load(c, cell));
+            }
+        }
+    });
+
+    swap(_heatGrid[FETCH_GRID],     _heatGrid[DRAW_GRID]);
+    swap(_velocityGrid[FETCH_GRID], _velocityGrid[DRAW_GRID]);
+}
+
+void FluidSolver::computePressure()
+{
+    const float HalfrDx = 0.5f / DX;
+    const FluidGrid& velocity = _velocityGrid[FETCH_GRID];
+    {
+        FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::DIVERGENCE);
+        _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int)
+        {
+            _kernels->divergence(velocity.plane(0), velocity.plane(1),
+                                 _tempDivGrid.plane(0), WIDTH, HEIGHT, tile, HalfrDx);
+        });
+    }
+
+    solvePressure();
+}
+
+void FluidSolver::solvePressure()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::PRESSURE_SOLVE);
+    if(_pressureSolver != EPressureSolver::JACOBI)
+    {
+        float* pressure = _pressureGrid[FETCH_GRID].plane(0);
+        const float* div = _tempDivGrid.plane(0);
+        for(int c=0; c < WIDTH*HEIGHT; ++c)
+        {
+            _pressureX[c] = pressure[c];
+            _pressureB[c] = DX*DX * div[c];
+        }
+
+        if(_pressureSolver == EPressureSolver::MULTIGRID)
+        {
+            const int MAX_CYCLES = 30;
+            _pressureStats.iterations = _multigrid.solve(
+                _pressureX, _pressureB, _pressureTolerance, MAX_CYCLES);
+            _pressureStats.residual = _multigrid.residual();
+        }
+        else
+        {
+            const int MAX_ITERATIONS = 4 * max(WIDTH, HEIGHT);
+            _pressureStats.iterations = _conjugateGradient.solve(
+                *_scheduler, _pressureX, _pressureB, _pressureTolerance,
+                MAX_ITERATIONS, &_multigrid);
+            _pressureStats.residual = _conjugateGradient.residual();
+        }
+
+        copy(_pressureX.begin(), _pressureX.end(), pressure);
+    }
+    else
+    {
+        _pressureStats = jacobiSolve(_pressureGrid, &_tempDivGrid,
+                                     -DX*DX, 1.0f / 4.0f, _pressureCriterion);
+    }
+}
+
+void FluidSolver::substractPressureGradient()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::GRADIENT_SUB);
+    const float HalfrDx = 0.5f / DX;
+    FluidGrid& velocity = _velocityGrid[FETCH_GRID];
+    const float* pressure = _pressureGrid[FETCH_GRID].plane(0);
+    _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int)
+    {
+        _kernels->gradSub(pressure, velocity.plane(0), velocity.plane(1),
+                          WIDTH, HEIGHT, tile, HalfrDx);
+    });
+}
+
+void FluidSolver::frontier()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::FRONTIER);
+    FluidGrid& velocity = _velocityGrid[FETCH_GRID];
+    FluidGrid& pressure = _pressureGrid[FETCH_GRID];
+    const vector<FluidBoundary::Cell>& cells = _boundary.cells();
+
+    // Boundary cells only read fluid cells, so the grids are updated in place
+    if(!cells.empty())
+    {
+        _scheduler->forEachTile((int) cells.size(), 1, [&](const FluidTile& tile, int)
+        {
+            for(int k=tile.i0; k<tile.i1; ++k)
+            {
+                const FluidBoundary::Cell& cell = cells[k];
+                const int at = cell.j*WIDTH + cell.i;
+                for(int c=0; c < velocity.components(); ++c)
+                {
+                    float* plane = velocity.plane(c);
+                    float moy = 0.0f;
+                    for(int n=0; n < cell.count; ++n)
+                        moy += plane[cell.neighbors[n]] * cell.weights[n];
+                    plane[at] = -moy / cell.accum;
+                }
+                for(int c=0; c < pressure.components(); ++c)
+                {
+                    float* plane = pressure.plane(c);
+                    float moy = 0.0f;
+                    for(int n=0; n < cell.count; ++n)
+                        moy += plane[cell.neighbors[n]] * cell.weights[n];
+                    plane[at] = moy / cell.accum;
+                }
+            }
+        });
+    }
+
+    clearBuried(velocity);
+}
+
+void FluidSolver::heatDivergence()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::HEAT_DIVERGENCE);
+    const float HalfrDx = 0.5f / DX;
+    const FluidGrid& heatSrc = _heatGrid[FETCH_GRID];
+    const FluidGrid& velSrc = _velocityGrid[FETCH_GRID];
+    FluidGrid& heatDst = _heatGrid[DRAW_GRID];
+    FluidGrid& velDst = _velocityGrid[DRAW_GRID];
+    float* div = _tempDivGrid.plane(0);
+    const Vec4f candle(1.0, 0, 0, 0);
+    const float timeScale = _dt / DT;
+
+    _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+    {
+        // Quiet tiles have no buoyancy to speak of, only their divergence
+        // is needed by the pressure solve
+        if(!tileActive(index))
+        {
+            copyTile(velSrc, velDst, tile);
+            copyTile(heatSrc, heatDst, tile);
+            _kernels->divergence(velSrc.plane(0), velSrc.plane(1),
+                                 div, WIDTH, HEIGHT, tile, HalfrDx);
+            return;
+        }
+
+        // Buoyancy only changes v.y, so it is kept for the rows
+        // bordering the tile too to feed the divergence stencil
+        const int tileW = tile.i1 - tile.i0;
+        const int rows = tile.j1 - tile.j0 + 2;
+        static thread_local vector<float> lift;
+        lift.resize(tileW * rows);
+
+        // Packed heat is widened once, over the columns the stencil reads
+        static thread_local vector<float> wide;
+        const int hi0 = max(tile.i0 - 1, 0);
+        const int hj0 = clampRow(tile.j0 - 2);
+        const int wideW = min(tile.i1 + 1, WIDTH) - hi0;
+        if(heatSrc.packed())
+        {
+            const int wideH = clampRow(tile.j1 + 1) - hj0 + 1;
+            wide.resize(wideW * wideH);
+            for(int r=0; r < wideH; ++r)
+                heatSrc.readCells(0, (hj0 + r)*WIDTH + hi0, wideW, &wide[r*wideW]);
+        }
+        auto heatRow = [&](int j) -> const float*
+        {
+            if(heatSrc.packed())
+                return &wide[(j - hj0)*wideW] - hi0;
+            return heatSrc.plane(0) + j*WIDTH;
+        };
+
+        for(int r=0; r < rows; ++r)
+        {
+            int j = clampRow(tile.j0 - 1 + r);
+            const float* hB = heatRow(clampRow(j-1));
+            const float* hC = heatRow(j);
+            const float* hT = heatRow(clampRow(j+1));
+            float* out = &lift[r*tileW - tile.i0];
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                float hL = hC[i > 0 ? i-1 : 0];
+                float hR = hC[i < WIDTH-1 ? i+1 : WIDTH-1];
+                out[i] = HalfrDx * ((hL + hR + hB[i] + hT[i]) - hC[i]) * 0.05f * timeScale;
+            }
+        }
+
+        const float* uSrc = velSrc.plane(0);
+        const float* vSrc = velSrc.plane(1);
+        float* uDst = velDst.plane(0);
+        float* vDst = velDst.plane(1);
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            const int r = j - tile.j0 + 1;
+            const float* liftB = &lift[(r-1)*tileW - tile.i0];
+            const float* liftC = &lift[ r   *tileW - tile.i0];
+            const float* liftT = &lift[(r+1)*tileW - tile.i0];
+            const float* uC = uSrc + j*WIDTH;
+            const float* vB = vSrc + clampRow(j-1)*WIDTH;
+            const float* vC = vSrc + j*WIDTH;
+            const float* vT = vSrc + clampRow(j+1)*WIDTH;
+            float* divC = div + j*WIDTH;
+
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                float uL = uC[i > 0 ? i-1 : 0];
+                float uR = uC[i < WIDTH-1 ? i+1 : WIDTH-1];
+                divC[i] = HalfrDx * ((uR - uL) +
+                                     ((vT[i] + liftT[i]) - (vB[i] + liftB[i])));
+            }
+
+            int row = j*WIDTH + tile.i0;
+            copy_n(uC + tile.i0, tile.i1 - tile.i0, uDst + row);
+            for(int i=tile.i0; i<tile.i1; ++i)
+                vDst[j*WIDTH + i] = vC[i] + liftC[i];
+            for(int c=2; c < velDst.components(); ++c)
+                copy_n(velSrc.plane(c) + row, tileW, velDst.plane(c) + row);
+
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                int cell = j*WIDTH + i;
+                bool lit = candleLit(i, j);
+                for(int c=0; c < heatDst.components(); ++c)
+                    heatDst.store(c, cell, lit ? candle[c] : heatSrc.load(c, cell));
+            }
+        }
+    });
+
+    swap(_heatGrid[FETCH_GRID],     _heatGrid[DRAW_GRID]);
+    swap(_velocityGrid[FETCH_GRID], _velocityGrid[DRAW_GRID]);
+}
+
+void FluidSolver::substractGradientFrontier()
+{
+    FluidProfiler::Scope scope(_profiler, FluidProfiler::EStage::GRADIENT_FRONTIER);
+    const float HalfrDx = 0.5f / DX;
+    const FluidGrid& velSrc = _velocityGrid[FETCH_GRID];
+    const FluidGrid& presSrc = _pressureGrid[FETCH_GRID];
+    FluidGrid& velDst = _velocityGrid[DRAW_GRID];
+    FluidGrid& presDst = _pressureGrid[DRAW_GRID];
+
+    _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int)
+    {
+        const int tileW = tile.i1 - tile.i0;
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            int row = j*WIDTH + tile.i0;
+            for(int c=0; c < velDst.components(); ++c)
+                copy_n(velSrc.plane(c) + row, tileW, velDst.plane(c) + row);
+            for(int c=0; c < presDst.components(); ++c)
+                copy_n(presSrc.plane(c) + row, tileW, presDst.plane(c) + row);
+        }
+
+        // Fluid cells take the gradient subtraction as is
+        _kernels->gradSub(presSrc.plane(0), velDst.plane(0), velDst.plane(1),
+                          WIDTH, HEIGHT, tile, HalfrDx);
+    });
+
+    // Obstacle cells average the projected velocities around them
+    const vector<FluidBoundary::Cell>& cells = _boundary.cells();
+    if(!cells.empty())
+    {
+        _scheduler->forEachTile((int) cells.size(), 1, [&](const FluidTile& tile, int)
+        {
+            for(int k=tile.i0; k<tile.i1; ++k)
+            {
+                const FluidBoundary::Cell& cell = cells[k];
+                Vec4f moyVelocity;
+                Vec4f moyPressure;
+                for(int n=0; n < cell.count; ++n)
+                {
+                    const int neighbor = cell.neighbors[n];
+                    const float weight = cell.weights[n];
+                    Vec4f v = projectedVelocity(neighbor % WIDTH, neighbor / WIDTH);
+                    for(int c=0; c < velSrc.components(); ++c)
+                        moyVelocity[c] += v[c] * weight;
+                    for(int c=0; c < presSrc.components(); ++c)
+                        moyPressure[c] += presSrc.plane(c)[neighbor] * weight;
+                }
+
+                for(int c=0; c<4; ++c)
+                {
+                    moyVelocity[c] = -moyVelocity[c] / cell.accum;
+                    moyPressure[c] =  moyPressure[c] / cell.accum;
+                }
+                velDst.setTexel(cell.i, cell.j, moyVelocity);
+                presDst.setTexel(cell.i, cell.j, moyPressure);
+            }
+        });
+    }
+
+    clearBuried(velDst);
+
+    swap(_velocityGrid[FETCH_GRID], _velocityGrid[DRAW_GRID]);
+    swap(_pressureGrid[FETCH_GRID], _pressureGrid[DRAW_GRID]);
+}
+
+float FluidSolver::buoyancy(int i, int j) const
+{
+    const float HalfrDx = 0.5f / DX;
+    const FluidGrid& heat = _heatGrid[FETCH_GRID];
+    float hC = heat.load(0, j*WIDTH + i);
+    float hL = heat.fetch(0, i-1, j);
+    float hR = heat.fetch(0, i+1, j);
+    float hB = heat.fetch(0, i, j-1);
+    float hT = heat.fetch(0, i, j+1);
+    // Lift per unit of the fixed timestep
+    return HalfrDx * ((hL + hR + hB + hT) - hC) * 0.05f * (_dt / DT);
+}
+
+bool FluidSolver::candleLit(int i, int j) const
+{
+    float dx = _candlePos[0] - (i + 0.5f);
+    float dy = _candlePos[1] - (j + 0.5f);
+    return sqrt(dx*dx + dy*dy) < CANDLE_RADIUS;
+}
+
+int FluidSolver::clampRow(int j) const
+{
+    return j < 0 ? 0 : (j >= HEIGHT ? HEIGHT-1 : j);
+}
+
+Vec4f FluidSolver::projectedVelocity(int i, int j) const
+{
+    const float HalfrDx = 0.5f / DX;
+    const FluidGrid& pressure = _pressureGrid[FETCH_GRID];
+    float pL = pressure.fetch(0, i-1, j);
+    float pR = pressure.fetch(0, i+1, j);
+    float pB = pressure.fetch(0, i, j-1);
+    float pT = pressure.fetch(0, i, j+1);
+
+    Vec4f v = _velocityGrid[FETCH_GRID].texel(i, j);
+    v[0] = v[0] - HalfrDx * (pR - pL);
+    v[1] = v[1] - HalfrDx * (pT - pB);
+    return v;
+}
+
+ConvergenceStats FluidSolver::jacobiSolve(
+        FluidGrid grids[2], const FluidGrid* b, float alpha, float rBeta,
+        const ConvergenceCriterion& criterion, bool sparse)
+{
+    // Packed grids are iterated in the float pair, so that they are only
+    // rounded once whatever the blocking
+    const bool packed = grids[FETCH_GRID].packed();
+    FluidGrid* iterates = grids;
+    if(packed)
+    {
+        const int nbComp = grids[FETCH_GRID].components();
+        for(FluidGrid& wide : _wideGrid)
+        {
+            if(wide.width() != WIDTH || wide.height() != HEIGHT ||
+               wide.components() != nbComp)
+                wide.resize(WIDTH, HEIGHT, nbComp);
+        }
+        iterates = _wideGrid;
+    }
+
+    // Both buffers of a skipped tile must hold its values
+    if(sparse)
+    {
+        _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+        {
+            if(tileActive(index))
+                return;
+            if(packed)
+            {
+                widenTile(grids[FETCH_GRID], iterates[FETCH_GRID], tile);
+                widenTile(grids[FETCH_GRID], iterates[DRAW_GRID], tile);
+            }
+            else
+                copyTile(grids[FETCH_GRID], grids[DRAW_GRID], tile);
+        });
+    }
+
+    ConvergenceStats stats;
+    const int nbIterations = (criterion.maxIterations/2)*2;
+    const bool early = criterion.tolerance > 0.0f && criterion.checkInterval > 0;
+
+    while(stats.iterations < nbIterations)
+    {
+        // Blocks never step over a convergence check
+        int depth = min(_jacobiBlocking, nbIterations - stats.iterations);
+        if(early)
+            depth = min(depth, criterion.checkInterval -
+                               stats.iterations % criterion.checkInterval);
+
+        stats.iterations += depth;
+        bool check = stats.iterations == nbIterations ||
+            (early && stats.iterations % criterion.checkInterval == 0);
+
+        // The first block of a packed solve reads the packed planes
+        const FluidGrid& x = stats.iterations == depth ?
+                                 grids[FETCH_GRID] : iterates[FETCH_GRID];
+        float residual;
+        if(depth == 1 && !x.packed())
+            residual = jacobi(x, b ? *b : x, iterates[DRAW_GRID], alpha, rBeta,
+                              check ? &criterion.norm : nullptr, sparse);
+        else
+            residual = jacobiBlock(x, b, iterates[DRAW_GRID],
+                                   alpha, rBeta, depth,
+                                   check ? &criterion.norm : nullptr, sparse);
+        swap(iterates[FETCH_GRID], iterates[DRAW_GRID]);
+
+        if(check)
+        {
+            stats.residual = residual;
+            if(early && residual <= criterion.tolerance)
+                break;
+        }
+    }
+
+    if(packed && stats.iterations > 0)
+    {
+        FluidGrid& dst = grids[FETCH_GRID];
+        const FluidGrid& src = iterates[FETCH_GRID];
+        _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+        {
+            if(sparse && !tileActive(index))
+                return;
+            for(int c=0; c < dst.components(); ++c)
+                for(int j=tile.j0; j<tile.j1; ++j)
+                    dst.writeCells(c, j*WIDTH + tile.i0, tile.i1 - tile.i0,
+                                   src.plane(c) + j*WIDTH + tile.i0);
+        });
+        _jacobiTraffic += (unsigned long long) dst.components() * WIDTH * HEIGHT *
+                          (sizeof(float) + dst.bytesPerComponent());
+    }
+
+    return stats;
+}
+
+float FluidSolver::jacobi(const FluidGrid& x, const FluidGrid& b, FluidGrid& dst,
+                          float alpha, float rBeta,
+                          const ConvergenceCriterion::ENorm* measure,
+                          bool sparse)
+{
+    _tileNorms.assign(_scheduler->tileCount(WIDTH, HEIGHT), 0.0);
+
+    _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+    {
+        if(sparse && !tileActive(index))
+            return;
+
+        for(int c=0; c < x.components(); ++c)
+            _kernels->jacobi(x.plane(c), b.plane(c), dst.plane(c),
+                             WIDTH, HEIGHT, tile, alpha, rBeta);
+
+        if(measure)
+            _tileNorms[index] = updateNorm(x, dst, tile, *measure);
+    });
+
+    int streams = &b == &x ? 2 : 3;
+    _jacobiTraffic += (unsigned long long) streams * x.components() *
+                      WIDTH * HEIGHT * sizeof(float);
+
+    return reduceNorms(measure);
+}
+
+float FluidSolver::jacobiBlock(const FluidGrid& x, const FluidGrid* b,
+                               FluidGrid& dst, float alpha, float rBeta,
+                               int depth,
+                               const ConvergenceCriterion::ENorm* measure,
+                               bool sparse)
+{
+    const int nbTiles = _scheduler->tileCount(WIDTH, HEIGHT);
+    _tileNorms.assign(nbTiles, 0.0);
+    _tileTraffic.assign(nbTiles, 0);
+
+    _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+    {
+        if(sparse && !tileActive(index))
+            return;
+
+        // Halo wide enough for depth iterations, clamped to the grid
+        // since texelFetch() clamping happens there anyway
+        const FluidTile halo(max(0, tile.i0 - depth), max(0, tile.j0 - depth),
+                             min(WIDTH, tile.i1 + depth),
+                             min(HEIGHT, tile.j1 + depth));
+        const int lw = halo.i1 - halo.i0;
+        const int lh = halo.j1 - halo.j0;
+
+        static thread_local vector<float> scratch;
+        scratch.resize(3 * lw * lh);
+        float* curr = scratch.data();
+        float* next = curr + lw * lh;
+        float* bLocal = next + lw * lh;
+
+        for(int c=0; c < x.components(); ++c)
+        {
+            for(int j=0; j<lh; ++j)
+                x.readCells(c, (halo.j0 + j)*WIDTH + halo.i0, lw, curr + j*lw);
+            if(b)
+            {
+                for(int j=0; j<lh; ++j)
+                    b->readCells(c, (halo.j0 + j)*WIDTH + halo.i0, lw, bLocal + j*lw);
+            }
+
+            // Each iteration is valid on a region one cell smaller.
+            // Halo edges that are not grid edges are never computed,
+            // so the kernel's clamping only applies at the grid edges.
+            for(int k=1; k <= depth; ++k)
+            {
+                int e = depth - k;
+                FluidTile region(max(0, tile.i0 - e) - halo.i0,
+                                 max(0, tile.j0 - e) - halo.j0,
+                                 min(WIDTH, tile.i1 + e) - halo.i0,
+                                 min(HEIGHT, tile.j1 + e) - halo.j0);
+                _kernels->jacobi(curr, b ? bLocal : curr, next,
+                                 lw, lh, region, alpha, rBeta);
+                swap(curr, next);
+            }
+
+            for(int j=tile.j0; j<tile.j1; ++j)
+            {
+                const float* row = curr + (j - halo.j0)*lw + (tile.i0 - halo.i0);
+                dst.writeCells(c, j*WIDTH + tile.i0, tile.i1 - tile.i0, row);
+            }
+
+            if(measure)
+            {
+                // next holds the iteration before the last one
+                for(int j=tile.j0; j<tile.j1; ++j)
+                {
+                    for(int i=tile.i0; i<tile.i1; ++i)
+                    {
+                        int l = (j - halo.j0)*lw + (i - halo.i0);
+                        double d = curr[l] - next[l];
+                        if(*measure == ConvergenceCriterion::ENorm::LINF)
+                            _tileNorms[index] = max(_tileNorms[index], fabs(d));
+                        else
+                            _tileNorms[index] += d * d;
+                    }
+                }
+            }
+        }
+
+        int streams = b ? 2 : 1;
+        _tileTraffic[index] = ((unsigned long long) streams * lw * lh +
+                               tile.area()) * x.components() * x.bytesPerComponent();
+    });
+
+    for(unsigned long long traffic : _tileTraffic)
+        _jacobiTraffic += traffic;
+
+    return reduceNorms(measure);
+}
+
+void FluidSolver::updateActivity()
+{
+    const char QUIET = 0;
+    const char ACTIVE = 1;
+    const char SOLID = 2;
+
+    const int tileW = _scheduler->tileWidth();
+    const int tileH = _scheduler->tileHeight();
+    const int nbX = (WIDTH  + tileW - 1) / tileW;
+    const int nbY = (HEIGHT + tileH - 1) / tileH;
+    const FluidGrid& velocity = _velocityGrid[FETCH_GRID];
+    const float* u = velocity.plane(0);
+    const float* v = velocity.plane(1);
+    const FluidGrid& heat = _heatGrid[FETCH_GRID];
+    const float* front = _frontierGrid.plane(0);
+
+    // The buoyancy stencil reads one row past the tile, so a lit cell
+    // bordering a tile activates it too
+    const float CANDLE_REACH = CANDLE_RADIUS + 1.0f;
+
+    vector<char> seeds(nbX * nbY, QUIET);
+    _scheduler->forEachTile(WIDTH, HEIGHT, [&](const FluidTile& tile, int index)
+    {
+        // The candle heats any tile it reaches
+        float cx = max((float) tile.i0, min(_candlePos[0], (float) tile.i1));
+        float cy = max((float) tile.j0, min(_candlePos[1], (float) tile.j1));
+        if(Vec2f(cx, cy).distanceTo(_candlePos[0], _candlePos[1]) < CANDLE_REACH)
+        {
+            seeds[index] = ACTIVE;
+            return;
+        }
+
+        float peak = 0.0f;
+        bool solid = true;
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            for(int i=j*WIDTH + tile.i0; i < j*WIDTH + tile.i1; ++i)
+            {
+                peak = max(peak, max(fabs(heat.load(0, i)),
+                                     max(fabs(u[i]), fabs(v[i]))));
+                solid = solid && front[i] == 1.0f;
+            }
+        }
+
+        // Solid tiles bordering fluid hold the frontier's boundary values
+        for(int i=tile.i0-1; solid && i <= tile.i1; ++i)
+            solid = _frontierGrid.fetch(0, i, tile.j0-1) == 1.0f &&
+                    _frontierGrid.fetch(0, i, tile.j1) == 1.0f;
+        for(int j=tile.j0; solid && j < tile.j1; ++j)
+            solid = _frontierGrid.fetch(0, tile.i0-1, j) == 1.0f &&
+                    _frontierGrid.fetch(0, tile.i1, j) == 1.0f;
+
+        seeds[index] = solid ? SOLID : (peak > _sparseThreshold ? ACTIVE : QUIET);
+    });
+
+    int activeCount = 0;
+    _activeTiles.assign(nbX * nbY, 0);
+    for(int ty=0; ty < nbY; ++ty)
+    {
+        for(int tx=0; tx < nbX; ++tx)
+        {
+            char& active = _activeTiles[ty*nbX + tx];
+            if(seeds[ty*nbX + tx] == SOLID)
+                continue;
+
+            for(int y=max(0, ty-1); y <= min(nbY-1, ty+1) && !active; ++y)
+                for(int x=max(0, tx-1); x <= min(nbX-1, tx+1) && !active; ++x)
+                    active = seeds[y*nbX + x] == ACTIVE;
+            activeCount += active;
+        }
+    }
+
+    _activeFraction = activeCount / (float) (nbX * nbY);
+}
+
+void FluidSolver::clearBuried(FluidGrid& velocity) const
+{
+    for(const FluidBoundary::Span& span : _boundary.buriedSpans())
+        for(int c=0; c < velocity.components(); ++c)
+            fill_n(velocity.plane(c) + span.j*WIDTH + span.i0,
+                   span.i1 - span.i0, 0.0f);
+}
+
+void FluidSolver::copyTile(const FluidGrid& src, FluidGrid& dst,
+                           const FluidTile& tile) const
+{
+    for(int c=0; c < dst.components(); ++c)
+        for(int j=tile.j0; j<tile.j1; ++j)
+            dst.copyCells(src, c, j*WIDTH + tile.i0, tile.i1 - tile.i0);
+}
+
+void FluidSolver::widenTile(const FluidGrid& src, FluidGrid& dst,
+                            const FluidTile& tile) const
+{
+    for(int c=0; c < dst.components(); ++c)
+        for(int j=tile.j0; j<tile.j1; ++j)
+            src.readCells(c, j*WIDTH + tile.i0, tile.i1 - tile.i0,
+                          dst.plane(c) + j*WIDTH + tile.i0);
+}
+
+float FluidSolver::reduceNorms(const ConvergenceCriterion::ENorm* measure) const
+{
+    if(!measure)
+        return 0.0f;
+
+    // Reduced in tile order so the norm does not depend on the thread count
+    double norm = 0.0;
+    for(double tileNorm : _tileNorms)
+    {
+        if(*measure == ConvergenceCriterion::ENorm::LINF)
+            norm = max(norm, tileNorm);
+        else
+            norm += tileNorm;
+    }
+
+    if(*measure == ConvergenceCriterion::ENorm::L2)
+        return (float) sqrt(norm / (WIDTH * HEIGHT));
+    return (float) norm;
+}
+
+double FluidSolver::updateNorm(const FluidGrid& x, const FluidGrid& dst,
+                               const FluidTile& tile,
+                               ConvergenceCriterion::ENorm norm) const
+{
+    double sum = 0.0;
+    for(int c=0; c < x.components(); ++c)
+    {
+        for(int j=tile.j0; j<tile.j1; ++j)
+        {
+            for(int i=tile.i0; i<tile.i1; ++i)
+            {
+                int k = j*WIDTH + i;
+                double d = dst.plane(c)[k] - x.plane(c)[k];
+                if(norm == ConvergenceCriterion::ENorm::LINF)
+                    sum = max(sum, fabs(d));
+                else
+                    sum += d * d;
+            }
+        }
+    }
+
+    return sum;
+}
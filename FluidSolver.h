@@ -0,0 +1,489 @@
+#ifndef FLUID_SOLVER_H
+#define FLUID_SOLVER_H
+
+#include "FluidAdvection.h"
+#include "FluidBoundary.h"
+#include "FluidConvergence.h"
+#include "FluidFieldLayout.h"
+#include "FluidGrid.h"
+#include "FluidKernels.h"
+#include "FluidConjugateGradient.h"
+#include "FluidMultigrid.h"
+#include "FluidProfiler.h"
+#include "FluidScene.h"
+#include "FluidScheduler.h"
+
+#include <string>
+
+class FluidExporter;
+class FluidInitializer;
+class FluidSnapshot;
+
+
+// CPU implementation of the FluidCharacter shader pipeline.
+// Each stage has the same semantics as its fragment shader.
+class FluidSolver
+{
+public:
+    enum class EPressureSolver {JACOBI, MULTIGRID, CONJUGATE_GRADIENT};
+
+    struct Physics
+    {
+        Physics();
+
+        float dx;
+        float dt;
+        float viscosity;
+        float heatDiffusion;
+    };
+
+    FluidSolver(int width, int height,
+                const FluidFieldLayout& layout = FluidFieldLayout(),
+                const Physics& physics = Physics());
+    virtual ~FluidSolver();
+
+    void reset(FluidInitializer& initializer);
+    void step();
+
+    // Steps taken after loading a snapshot are bit-identical to those
+    // the saved run took, given the same solver settings
+    bool saveSnapshot(const std::string& fileName, std::string& error) const;
+    bool loadSnapshot(const FluidSnapshot& snapshot, std::string& error);
+
+    // Queues the exporter's fields as a frame, false when it was dropped
+    bool exportFields(FluidExporter& exporter) const;
+
+    // The candle heats the cells whose center is within CANDLE_RADIUS,
+    // like the heat shaders do
+    static const float CANDLE_RADIUS;
+    void setCandlePosition(const cellar::Vec2f& pos);
+
+    // Sources, emitters and forces of the scene apply at the start of
+    // every step, its obstacles and initial regions come from reset()
+    void setScene(const FluidScene& scene);
+    const FluidScene& scene() const;
+    // Cells forced by the last step
+    long long forcedCells() const;
+
+    // Sets the frontier of the cells in region, 1 being an obstacle.
+    // The boundary index is only rebuilt around the region.
+    void editFrontier(const FluidTile& region, float value);
+
+    // Stages run as tile tasks, copies of the solver share the same pool
+    void setThreadCount(int threadCount);
+    FluidScheduler& scheduler();
+
+    void setKernels(const FluidKernels& kernels);
+    const FluidKernels& kernels() const;
+
+    // Stages record their time in the profiler's current frame, may be null
+    void setProfiler(FluidProfiler* profiler);
+    FluidProfiler* profiler() const;
+
+    // Advects dye, heat and velocity in a single pass over the grid
+    void setFusedAdvection(bool fused);
+    bool fusedAdvection() const;
+
+    // Higher order fields take the semi-Lagrangian result of advect()
+    // through one or two more passes over the grid
+    void setAdvection(const FluidAdvection& advection);
+    const FluidAdvection& advection() const;
+
+    // The timestep follows the flow as cfl * dx / max |velocity|, within
+    // [minDt, maxDt], 1/8 and 4 times Physics::dt when 0. The maximum is
+    // reduced over the tiles after each step and sets the next one.
+    void setAdaptiveTimestep(bool adaptive, float cfl = 1.0f,
+                             float minDt = 0.0f, float maxDt = 0.0f);
+    bool adaptiveTimestep() const;
+    // Timestep the next step takes
+    float timestep() const;
+    // Simulated time since reset() or loadSnapshot()
+    double time() const;
+    // Largest velocity magnitude of the last reduction
+    float maxSpeed() const;
+
+    // Adds back the small swirls dissipated by the grid, scaled by strength,
+    // between diffuse() and the projection. 0 disables it.
+    void setVorticityConfinement(float strength);
+    float vorticityConfinement() const;
+
+    // step() folds heat() into the divergence of computePressure()
+    // and frontier() into substractPressureGradient()
+    void setFusedProjection(bool fused);
+    bool fusedProjection() const;
+
+    // Jacobi iterations applied per tile while it is cache resident,
+    // 1 is the plain ping-pong. Results are identical for every depth.
+    void setJacobiBlocking(int depth);
+    int jacobiBlocking() const;
+
+    // Tiles whose velocity and heat stay under threshold, along with those
+    // buried in obstacles, are skipped by advect(), diffuse() and heat().
+    // The activity map is rebuilt at every step and grown by
+    // one tile so that flows entering a quiet tile wake it up in time.
+    // The pressure solve and the gradient subtraction stay global.
+    void setSparse(bool sparse, float threshold = 1e-4f);
+    bool sparse() const;
+    // Fraction of the tiles the last step ran, 1 when dense
+    float activeFraction() const;
+
+    // Bytes streamed from and to the grids by the Jacobi solves
+    unsigned long long jacobiTraffic() const;
+    void resetJacobiTraffic();
+
+    void setPressureSolver(EPressureSolver solver);
+    // 60 and 200 iterations by default, without early termination
+    void setDiffuseCriterion(const ConvergenceCriterion& criterion);
+    void setPressureCriterion(const ConvergenceCriterion& criterion);
+    void setPressureTolerance(float tolerance);
+    FluidMultigrid& multigrid();
+    FluidConjugateGradient& conjugateGradient();
+
+    // Convergence of the last step's solves.
+    // Multigrid pressure solves report cycles and relative residual,
+    // conjugate gradient ones iterations and relative residual.
+    const ConvergenceStats& velocityDiffuseStats() const;
+    const ConvergenceStats& heatDiffuseStats() const;
+    const ConvergenceStats& pressureStats() const;
+
+    // Relative L2 residual of the current pressure field
+    float pressureResidual() const;
+
+    int width() const;
+    int height() const;
+    unsigned long long stepCount() const;
+
+    // The layout gives the component counts of the grids, dye and heat
+    // may be stored in 16 bits, the other fields are always float
+    const FluidFieldLayout& layout() const;
+    Physics physics() const;
+    int bytesPerCell() const;
+
+    const FluidGrid& dyeGrid() const;
+    const FluidGrid& velocityGrid() const;
+    const FluidGrid& pressureGrid() const;
+    const FluidGrid& heatGrid() const;
+    const FluidGrid& frontierGrid() const;
+    const FluidBoundary& boundary() const;
+
+    void force();
+    // Largest velocity magnitude, and the timestep it allows when adaptive
+    void measureSpeed();
+    void advect();
+    void diffuse();
+    // Curl of the velocity, then the confinement force on the fluid cells
+    void confineVorticity();
+    void heat();
+    void computePressure();
+    void substractPressureGradient();
+    // Only visits the obstacle cells of the boundary index, in place
+    void frontier();
+
+    // Fused stages, same results as the sequences they replace
+    void heatDivergence();
+    void solvePressure();
+    void substractGradientFrontier();
+
+
+protected:
+    // Position advect.frag samples at for cell (i, j), in texels
+    void backtrace(int i, int j, float& nx, float& ny) const;
+    // Same trace forward in time, for the backward step of MacCormack and BFECC
+    void forwardtrace(int i, int j, float& nx, float& ny) const;
+
+    // grid[DRAW_GRID] holds the semi-Lagrangian step of grid[FETCH_GRID].
+    // scratch is resized to it and keeps the intermediate field.
+    void correctAdvection(FluidGrid grid[2], FluidAdvection::EScheme scheme,
+                          FluidGrid& scratch);
+
+    // Per cell terms of heat.frag and gradSub.frag on the FETCH grids
+    float buoyancy(int i, int j) const;
+    bool candleLit(int i, int j) const;
+    int clampRow(int j) const;
+    cellar::Vec4f projectedVelocity(int i, int j) const;
+
+    // Sparse activity map of the tiles, see setSparse()
+    void updateActivity();
+    bool tileActive(int index) const;
+    void copyTile(const FluidGrid& src, FluidGrid& dst, const FluidTile& tile) const;
+    // Packed src into float dst
+    void widenTile(const FluidGrid& src, FluidGrid& dst, const FluidTile& tile) const;
+
+    // Obstacle cells away from the fluid hold a null velocity
+    void clearBuried(FluidGrid& velocity) const;
+
+    // b == nullptr uses the current iterate as right hand side.
+    // A sparse solve leaves the inactive tiles as they are. Packed grids
+    // are widened by the first block, iterated in float and narrowed once.
+    ConvergenceStats jacobiSolve(FluidGrid grids[2], const FluidGrid* b,
+                                 float alpha, float rBeta,
+                                 const ConvergenceCriterion& criterion,
+                                 bool sparse = false);
+
+    // One iteration on every plane, returns the update norm when measure is given
+    float jacobi(const FluidGrid& x, const FluidGrid& b, FluidGrid& dst,
+                 float alpha, float rBeta,
+                 const ConvergenceCriterion::ENorm* measure = nullptr,
+                 bool sparse = false);
+    // depth iterations per tile on a halo copy, b == nullptr like jacobiSolve()
+    float jacobiBlock(const FluidGrid& x, const FluidGrid* b, FluidGrid& dst,
+                      float alpha, float rBeta, int depth,
+                      const ConvergenceCriterion::ENorm* measure,
+                      bool sparse = false);
+    float reduceNorms(const ConvergenceCriterion::ENorm* measure) const;
+
+    // Squared sum for L2, maximum for LINF
+    double updateNorm(const FluidGrid& x, const FluidGrid& dst,
+                      const FluidTile& tile,
+                      ConvergenceCriterion::ENorm norm) const;
+
+
+private:
+    const int WIDTH;
+    const int HEIGHT;
+    const float DX;
+    const float DT;
+    const float VISCOSITY;
+    const float HEATDIFF;
+
+    const int DRAW_GRID;
+    const int FETCH_GRID;
+    const FluidFieldLayout _layout;
+    FluidGrid _dyeGrid[2];
+    FluidGrid _velocityGrid[2];
+    FluidGrid _pressureGrid[2];
+    FluidGrid _heatGrid[2];
+    FluidGrid _frontierGrid;
+    FluidGrid _tempDivGrid;
+    FluidGrid _wideGrid[2];
+    FluidBoundary _boundary;
+
+    const FluidKernels* _kernels;
+    std::shared_ptr<FluidScheduler> _scheduler;
+    FluidProfiler* _profiler;
+    std::vector<double> _tileNorms;
+    std::vector<unsigned long long> _tileTraffic;
+    cellar::Vec2f _candlePos;
+    FluidScene _scene;
+    long long _forcedCells;
+    unsigned long long _stepCount;
+
+    // Timestep, DT when fixed
+    float _dt;
+    double _time;
+    // Steps of DT simulated, the scene's clock
+    double _sceneStep;
+    bool _adaptiveTimestep;
+    float _cfl;
+    float _minDt;
+    float _maxDt;
+    float _maxSpeed;
+    std::vector<float> _tileSpeeds;
+
+    // Iterative solves
+    ConvergenceCriterion _diffuseCriterion;
+    ConvergenceCriterion _pressureCriterion;
+    ConvergenceStats _velocityDiffuseStats;
+    ConvergenceStats _heatDiffuseStats;
+    ConvergenceStats _pressureStats;
+    bool _fusedAdvection;
+    FluidAdvection _advection;
+    FluidGrid _advectGrid[3];
+    bool _fusedProjection;
+    float _vorticity;
+    FluidGrid _curlGrid;
+    int _jacobiBlocking;
+    unsigned long long _jacobiTraffic;
+
+    // Sparse tiles
+    bool _sparse;
+    float _sparseThreshold;
+    std::vector<char> _activeTiles;
+    float _activeFraction;
+    EPressureSolver _pressureSolver;
+    float _pressureTolerance;
+    FluidMultigrid _multigrid;
+    FluidConjugateGradient _conjugateGradient;
+    std::vector<float> _pressureX;
+    std::vector<float> _pressureB;
+};
+
+
+
+// IMPLEMENTATION //
+inline int FluidSolver::width() const
+{
+    return WIDTH;
+}
+
+inline int FluidSolver::height() const
+{
+    return HEIGHT;
+}
+
+inline unsigned long long FluidSolver::stepCount() const
+{
+    return _stepCount;
+}
+
+inline const FluidFieldLayout& FluidSolver::layout() const
+{
+    return _layout;
+}
+
+inline bool FluidSolver::sparse() const
+{
+    return _sparse;
+}
+
+inline float FluidSolver::activeFraction() const
+{
+    return _activeFraction;
+}
+
+inline bool FluidSolver::tileActive(int index) const
+{
+    return !_sparse || index >= (int) _activeTiles.size() || _activeTiles[index];
+}
+
+inline FluidSolver::Physics FluidSolver::physics() const
+{
+    Physics physics;
+    physics.dx = DX;
+    physics.dt = DT;
+    physics.viscosity = VISCOSITY;
+    physics.heatDiffusion = HEATDIFF;
+    return physics;
+}
+
+inline bool FluidSolver::fusedAdvection() const
+{
+    return _fusedAdvection;
+}
+
+inline const FluidAdvection& FluidSolver::advection() const
+{
+    return _advection;
+}
+
+inline bool FluidSolver::fusedProjection() const
+{
+    return _fusedProjection;
+}
+
+inline int FluidSolver::jacobiBlocking() const
+{
+    return _jacobiBlocking;
+}
+
+inline unsigned long long FluidSolver::jacobiTraffic() const
+{
+    return _jacobiTraffic;
+}
+
+inline FluidScheduler& FluidSolver::scheduler()
+{
+    return *_scheduler;
+}
+
+inline const FluidKernels& FluidSolver::kernels() const
+{
+    return *_kernels;
+}
+
+inline FluidProfiler* FluidSolver::profiler() const
+{
+    return _profiler;
+}
+
+inline const FluidScene& FluidSolver::scene() const
+{
+    return _scene;
+}
+
+inline long long FluidSolver::forcedCells() const
+{
+    return _forcedCells;
+}
+
+inline bool FluidSolver::adaptiveTimestep() const
+{
+    return _adaptiveTimestep;
+}
+
+inline float FluidSolver::timestep() const
+{
+    return _dt;
+}
+
+inline double FluidSolver::time() const
+{
+    return _time;
+}
+
+inline float FluidSolver::maxSpeed() const
+{
+    return _maxSpeed;
+}
+
+inline float FluidSolver::vorticityConfinement() const
+{
+    return _vorticity;
+}
+
+inline FluidMultigrid& FluidSolver::multigrid()
+{
+    return _multigrid;
+}
+
+inline FluidConjugateGradient& FluidSolver::conjugateGradient()
+{
+    return _conjugateGradient;
+}
+
+inline const ConvergenceStats& FluidSolver::velocityDiffuseStats() const
+{
+    return _velocityDiffuseStats;
+}
+
+inline const ConvergenceStats& FluidSolver::heatDiffuseStats() const
+{
+    return _heatDiffuseStats;
+}
+
+inline const ConvergenceStats& FluidSolver::pressureStats() const
+{
+    return _pressureStats;
+}
+
+inline const FluidGrid& FluidSolver::dyeGrid() const
+{
+    return _dyeGrid[FETCH_GRID];
+}
+
+inline const FluidGrid& FluidSolver::velocityGrid() const
+{
+    return _velocityGrid[FETCH_GRID];
+}
+
+inline const FluidGrid& FluidSolver::pressureGrid() const
+{
+    return _pressureGrid[FETCH_GRID];
+}
+
+inline const FluidGrid& FluidSolver::heatGrid() const
+{
+    return _heatGrid[FETCH_GRID];
+}
+
+inline const FluidGrid& FluidSolver::frontierGrid() const
+{
+    return _frontierGrid;
+}
+
+inline const FluidBoundary& FluidSolver::boundary() const
+{
+    return _boundary;
+}
+
+#endif // FLUID_SOLVER_H
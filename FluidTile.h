@@ -0,0 +1,34 @@
+#ifndef FLUID_TILE_H
+#define FLUID_TILE_H
+
+
+// Cells [i0, i1) x [j0, j1) of a grid
+struct FluidTile
+{
+    FluidTile(int i0 = 0, int j0 = 0, int i1 = 0, int j1 = 0);
+
+    int area() const;
+
+    int i0;
+    int j0;
+    int i1;
+    int j1;
+};
+
+
+
+// IMPLEMENTATION //
+inline FluidTile::FluidTile(int i0, int j0, int i1, int j1) :
+    i0(i0),
+    j0(j0),
+    i1(i1),
+    j1(j1)
+{
+}
+
+inline int FluidTile::area() const
+{
+    return (i1 - i0) * (j1 - j0);
+}
+
+#endif // FLUID_TILE_H
@@ -0,0 +1,122 @@
+#include "FluidTransport.h"
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+using namespace std;
+
+
+FluidTransport::FluidTransport(int rank, int size) :
+    _rank(rank),
+    _size(size),
+    _ok(true),
+    _error(),
+    _bytesSent(0),
+    _messageCount(0)
+{
+}
+
+FluidTransport::~FluidTransport()
+{
+
+}
+
+bool FluidTransport::gather(const void* data, size_t bytes,
+                            vector<char>& out, int root)
+{
+    if(!_ok)
+        return false;
+
+    if(_rank != root)
+    {
+        uint64_t count = bytes;
+        out.clear();
+        return send(root, &count, sizeof(count)) &&
+               (bytes == 0 || send(root, data, bytes));
+    }
+
+    // Sizes may differ from one rank to the next
+    out.clear();
+    for(int r=0; r < _size; ++r)
+    {
+        size_t offset = out.size();
+        if(r == _rank)
+        {
+            out.resize(offset + bytes);
+            if(bytes != 0)
+                memcpy(out.data() + offset, data, bytes);
+            continue;
+        }
+
+        uint64_t count = 0;
+        if(!recv(r, &count, sizeof(count)))
+            return false;
+        out.resize(offset + count);
+        if(count != 0 && !recv(r, out.data() + offset, count))
+            return false;
+    }
+
+    return true;
+}
+
+bool FluidTransport::allGather(const void* data, size_t bytes, vector<char>& out)
+{
+    if(!gather(data, bytes, out, 0))
+        return false;
+
+    uint64_t count = out.size();
+    if(_rank == 0)
+    {
+        for(int r=1; r < _size; ++r)
+        {
+            if(!send(r, &count, sizeof(count)) ||
+               (count != 0 && !send(r, out.data(), count)))
+                return false;
+        }
+        return true;
+    }
+
+    if(!recv(0, &count, sizeof(count)))
+        return false;
+    out.resize(count);
+    return count == 0 || recv(0, out.data(), count);
+}
+
+bool FluidTransport::allMax(vector<double>& values)
+{
+    vector<char> all;
+    size_t bytes = values.size() * sizeof(double);
+    if(!allGather(values.data(), bytes, all))
+        return false;
+
+    for(int r=0; r < _size; ++r)
+    {
+        const double* rankValues = (const double*) (all.data() + r * bytes);
+        for(size_t k=0; k < values.size(); ++k)
+            values[k] = max(values[k], rankValues[k]);
+    }
+
+    return true;
+}
+
+bool FluidTransport::barrier()
+{
+    vector<char> none;
+    return allGather(nullptr, 0, none);
+}
+
+bool FluidTransport::fail(const string& error)
+{
+    if(_ok)
+    {
+        _ok = false;
+        _error = error;
+    }
+    return false;
+}
+
+void FluidTransport::countSent(size_t bytes)
+{
+    _bytesSent += bytes;
+    ++_messageCount;
+}
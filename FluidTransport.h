@@ -0,0 +1,95 @@
+#ifndef FLUID_TRANSPORT_H
+#define FLUID_TRANSPORT_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+
+// Messages between the ranks of a decomposed simulation.
+// Implementations only move bytes between two ranks, collectives are built
+// on top of them through rank 0 so that every transport combines the
+// contributions in rank order.
+// Once a message failed the transport stays failed, later calls returning
+// false without blocking, and error() tells why.
+class FluidTransport
+{
+public:
+    FluidTransport(int rank, int size);
+    virtual ~FluidTransport();
+
+    int rank() const;
+    int size() const;
+    bool ok() const;
+    const std::string& error() const;
+
+    // Sends bytes to peer while receiving as many from it, both sides
+    // calling it with the same count
+    virtual bool exchange(int peer, const void* send, void* recv,
+                          size_t bytes) = 0;
+
+    // Every rank's bytes, in rank order, end up on root only or on all
+    bool gather(const void* send, size_t bytes, std::vector<char>& recv,
+                int root = 0);
+    bool allGather(const void* send, size_t bytes, std::vector<char>& recv);
+    // Largest of the values of every rank, element wise
+    bool allMax(std::vector<double>& values);
+    bool barrier();
+
+    // Totals of the messages this rank sent
+    unsigned long long bytesSent() const;
+    unsigned long long messageCount() const;
+
+
+protected:
+    // Blocks until the whole message is through
+    virtual bool send(int peer, const void* data, size_t bytes) = 0;
+    virtual bool recv(int peer, void* data, size_t bytes) = 0;
+
+    bool fail(const std::string& error);
+    void countSent(size_t bytes);
+
+
+private:
+    int _rank;
+    int _size;
+    bool _ok;
+    std::string _error;
+    unsigned long long _bytesSent;
+    unsigned long long _messageCount;
+};
+
+
+
+// IMPLEMENTATION //
+inline int FluidTransport::rank() const
+{
+    return _rank;
+}
+
+inline int FluidTransport::size() const
+{
+    return _size;
+}
+
+inline bool FluidTransport::ok() const
+{
+    return _ok;
+}
+
+inline const std::string& FluidTransport::error() const
+{
+    return _error;
+}
+
+inline unsigned long long FluidTransport::bytesSent() const
+{
+    return _bytesSent;
+}
+
+inline unsigned long long FluidTransport::messageCount() const
+{
+    return _messageCount;
+}
+
+#endif // FLUID_TRANSPORT_H
@@ -1,15 +1,26 @@
 # Qt
-FIND_PACKAGE(Qt4 REQUIRED)
-SET(QT_USE_QTOPENGL TRUE)
-INCLUDE(${QT_USE_FILE})
+IF(FLUID2D_BUILD_GUI)
+    FIND_PACKAGE(Qt4 REQUIRED)
+    SET(QT_USE_QTOPENGL TRUE)
+    INCLUDE(${QT_USE_FILE})
+ENDIF()
+
+# Solver thread pool
+FIND_PACKAGE(Threads REQUIRED)
 
 SET(FLUID2D_LIBRARIES
     ${QT_LIBRARIES}
+    ${CMAKE_THREAD_LIBS_INIT}
     CellarWorkbench
     MediaWorkbench
     PropRoom2D
     Scaena
 )
+
+SET(FLUID2D_HEADLESS_LIBRARIES
+    ${CMAKE_THREAD_LIBS_INIT}
+    CellarWorkbench
+)
     
 SET(FLUID2D_INCLUDE_DIRS
     ${FLUID2D_SRC_DIR}
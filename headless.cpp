@@ -0,0 +1,624 @@
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "FluidBenchmark.h"
+#include "FluidDomainSolver.h"
+#include "FluidEnsemble.h"
+#include "FluidExporter.h"
+#include "FluidScene.h"
+#include "FluidSnapshot.h"
+#include "FluidSocketTransport.h"
+#include "FluidSolver.h"
+
+using namespace std;
+using namespace cellar;
+
+
+static void printUsage(const char* exe)
+{
+    cout << "Usage: " << exe << " [--size WxH] [--steps N] [--report N]"
+         << " [--pressure jacobi|multigrid-v|multigrid-w|cg|cg-ic|cg-mg]"
+         << " [--tolerance T]"
+         << " [--jacobi-tolerance T] [--jacobi-check K] [--jacobi-norm l2|linf]"
+         << " [--kernels scalar|sse2|avx2|avx512|neon] [--threads N] [--tile WxH]"
+         << " [--jacobi-blocking D] [--separate-advection]"
+         << " [--separate-projection] [--trace FILE.csv|FILE.json]"
+         << " [--load-snapshot FILE] [--save-snapshot FILE]"
+         << " [--export FILE] [--export-fields dye,velocity,...]"
+         << " [--export-encoding raw|delta] [--ensemble FILE] [--scene FILE]"
+         << " [--sparse THRESHOLD] [--precision dye=fp16,heat=bf16]"
+         << " [--advection dye=bfecc,velocity=maccormack,limiter=clamp|revert]"
+         << " [--vorticity STRENGTH] [--adaptive-dt CFL] [--ranks N] [--halo ROWS]"
+         << " [--bench NAME]" << endl;
+    cout << "Benchmarks :" << endl;
+    FluidBenchmark(cout).listBenchmarks();
+}
+
+static void printStats(const string& name, const ConvergenceStats& stats)
+{
+    cout << "  " << name << " " << stats.iterations
+         << " it, residual " << stats.residual;
+}
+
+// Adds the cells [first, first + count) of the grid to sum and sqSum
+static void sumCells(const FluidGrid& grid, int first, int count,
+                     double& sum, double& sqSum)
+{
+    for(int k=first; k < first + count; ++k)
+    {
+        for(int c=0; c < grid.components(); ++c)
+        {
+            float t = grid.load(c, k);
+            sum   += t;
+            sqSum += t * t;
+        }
+    }
+}
+
+static void printChecksum(const string& name, double sum, double sqSum)
+{
+    cout << setw(10) << left << name
+         << " sum=" << setprecision(9) << sum
+         << " l2="  << setprecision(9) << sqrt(sqSum) << endl;
+}
+
+static void printChecksum(const string& name, const FluidGrid& grid)
+{
+    double sum = 0.0;
+    double sqSum = 0.0;
+    sumCells(grid, 0, grid.area(), sum, sqSum);
+    printChecksum(name, sum, sqSum);
+}
+
+static int runEnsemble(const string& fileName, int threads, int nbSteps, int report,
+                       const function<void(FluidSolver&)>& configure)
+{
+    vector<FluidEnsemble::Member> members;
+    string error;
+    if(!FluidEnsemble::load(fileName, members, error))
+    {
+        cerr << "Could not load ensemble : " << error << endl;
+        return 1;
+    }
+
+    FluidEnsemble ensemble(threads);
+    ensemble.setMembers(members, configure);
+    cout << ensemble.memberCount() << " members, "
+         << ensemble.cellCount() << " cells" << endl;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point last = start;
+    for(int s=1; s <= nbSteps; ++s)
+    {
+        ensemble.step();
+
+        if(report > 0 && s % report == 0)
+        {
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            double elapsed = chrono::duration<double>(now - last).count();
+            cout << "step " << s << " : "
+                 << ensemble.cellCount() * report / elapsed << " cells/s" << endl;
+            last = now;
+        }
+    }
+    double total = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    for(int m=0; m < ensemble.memberCount(); ++m)
+    {
+        const FluidEnsemble::Member& member = ensemble.member(m);
+        cout << setprecision(6) << member.name << " (" << member.width << "x" << member.height
+             << ", dt " << member.physics.dt
+             << ", viscosity " << member.physics.viscosity
+             << ", heat diffusion " << member.physics.heatDiffusion << ", "
+             << FluidEnsemble::obstaclesName(member.obstacles) << ")" << endl;
+        printChecksum("  dye",  ensemble.solver(m).dyeGrid());
+        printChecksum("  heat", ensemble.solver(m).heatGrid());
+    }
+
+    cout << setprecision(6) << nbSteps << " steps of " << ensemble.memberCount() << " members in "
+         << total << " s (" << ensemble.cellCount() * nbSteps / total
+         << " cells/s)" << endl;
+    return 0;
+}
+
+// Runs the grid split over ranks processes, rank 0 reporting
+static int runDomain(int ranks, int halo, int width, int height,
+                     int nbSteps, int report, int threads,
+                     FluidInitializer& initializer,
+                     const function<void(FluidDomainSolver&)>& configure)
+{
+    int row0, rows;
+    if(!FluidDomainSolver::split(height, ranks, 0, halo, row0, rows))
+    {
+        cerr << "Slabs of " << height << " rows over " << ranks
+             << " ranks would be thinner than the halo" << endl;
+        return 1;
+    }
+
+    string error;
+    int result = FluidSocketTransport::run(ranks, [&](FluidTransport& transport)
+    {
+        const bool root = transport.rank() == 0;
+        FluidDomainSolver solver(transport, width, height, halo);
+        if(!solver.ok())
+        {
+            if(root)
+                cerr << solver.error() << endl;
+            return 1;
+        }
+        solver.setThreadCount(threads);
+        configure(solver);
+        solver.reset(initializer);
+        if(root)
+            cout << ranks << " ranks of " << solver.rows() << " rows" << endl;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        chrono::steady_clock::time_point last = start;
+        for(int s=0; s<nbSteps; ++s)
+        {
+            if(!solver.step())
+                return 1;
+
+            if(root && report > 0 && solver.stepCount() % report == 0)
+            {
+                chrono::steady_clock::time_point now = chrono::steady_clock::now();
+                double elapsed = chrono::duration<double>(now - last).count();
+                cout << "step " << solver.stepCount() << " : "
+                     << report / elapsed << " UPS";
+                printStats("velocity", solver.velocityDiffuseStats());
+                printStats("heat",     solver.heatDiffuseStats());
+                printStats("pressure", solver.pressureStats());
+                if(solver.adaptiveTimestep())
+                    cout << "  dt " << solver.timestep();
+                cout << endl;
+                last = now;
+            }
+        }
+        double total = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        // Busiest rank's halo traffic
+        vector<double> halos = {(double) solver.haloBytes(),
+                                (double) solver.haloMessages(),
+                                solver.haloMs(), (double) solver.clippedTraces()};
+        transport.allMax(halos);
+
+        // Sums of every slab, added in rank order on rank 0
+        const FluidGrid* grids[] = {
+            &solver.dyeGrid(), &solver.velocityGrid(),
+            &solver.pressureGrid(), &solver.heatGrid()
+        };
+        double sums[8] = {};
+        const int owned = (solver.row0() - solver.firstRow()) * width;
+        for(int g=0; g < 4; ++g)
+            sumCells(*grids[g], owned, solver.rows() * width, sums[2*g], sums[2*g+1]);
+        vector<char> slabSums;
+        if(!transport.gather(sums, sizeof(sums), slabSums))
+            return 1;
+        if(!root)
+            return 0;
+
+        fill_n(sums, 8, 0.0);
+        const double* slab = (const double*) slabSums.data();
+        for(int r=0; r < ranks; ++r)
+            for(int k=0; k < 8; ++k)
+                sums[k] += slab[r*8 + k];
+
+        cout << solver.stepCount() << " steps in " << total << " s ("
+             << solver.stepCount() / total << " UPS)" << endl;
+        if(solver.adaptiveTimestep())
+            cout << "Simulated time " << solver.time() << ", max speed "
+                 << solver.maxSpeed() << endl;
+        cout << "Halos " << halos[0] / 1048576.0 << " MB in " << halos[1]
+             << " messages, " << halos[2] << " ms ("
+             << 100.0 * halos[2] / (total * 1000.0) << "% of the run), "
+             << halos[3] << " clipped traces" << endl;
+
+        printChecksum("dye",      sums[0], sums[1]);
+        printChecksum("velocity", sums[2], sums[3]);
+        printChecksum("pressure", sums[4], sums[5]);
+        printChecksum("heat",     sums[6], sums[7]);
+        return 0;
+    }, error);
+
+    if(result != 0)
+        cerr << "Domain run failed : " << error << endl;
+    return result == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) try
+{
+    int width = 256;
+    int height = 256;
+    int nbSteps = 100;
+    int report = 10;
+    string pressure = "jacobi";
+    float tolerance = 1e-3f;
+    float jacobiTolerance = 0.0f;
+    int jacobiCheck = 10;
+    ConvergenceCriterion::ENorm jacobiNorm = ConvergenceCriterion::ENorm::L2;
+    string isa = FluidKernels::isaName(FluidKernels::best().isa);
+    int threads = 0;
+    int tileWidth = 0;
+    int tileHeight = 0;
+    int blocking = 1;
+    bool fusedAdvection = true;
+    bool fusedProjection = true;
+    string traceFile;
+    string loadFile;
+    string saveFile;
+    string exportFile;
+    string exportFields = "dye,velocity,heat";
+    string exportEncoding = "raw";
+    string ensembleFile;
+    string sceneFile;
+    float sparseThreshold = -1.0f;
+    string precisions;
+    string advectionPolicy;
+    float vorticity = 0.0f;
+    float cfl = 0.0f;
+    int ranks = 0;
+    int halo = 4;
+
+    for(int a=1; a<argc; ++a)
+    {
+        string arg = argv[a];
+        if(arg == "--size" && a+1 < argc)
+        {
+            if(sscanf(argv[++a], "%dx%d", &width, &height) == 1)
+                height = width;
+        }
+        else if(arg == "--steps" && a+1 < argc)
+            nbSteps = atoi(argv[++a]);
+        else if(arg == "--report" && a+1 < argc)
+            report = atoi(argv[++a]);
+        else if(arg == "--pressure" && a+1 < argc)
+            pressure = argv[++a];
+        else if(arg == "--tolerance" && a+1 < argc)
+            tolerance = (float) atof(argv[++a]);
+        else if(arg == "--jacobi-tolerance" && a+1 < argc)
+            jacobiTolerance = (float) atof(argv[++a]);
+        else if(arg == "--jacobi-check" && a+1 < argc)
+            jacobiCheck = atoi(argv[++a]);
+        else if(arg == "--jacobi-norm" && a+1 < argc)
+            jacobiNorm = string(argv[++a]) == "linf" ?
+                ConvergenceCriterion::ENorm::LINF :
+                ConvergenceCriterion::ENorm::L2;
+        else if(arg == "--kernels" && a+1 < argc)
+            isa = argv[++a];
+        else if(arg == "--threads" && a+1 < argc)
+            threads = atoi(argv[++a]);
+        else if(arg == "--jacobi-blocking" && a+1 < argc)
+            blocking = atoi(argv[++a]);
+        else if(arg == "--separate-advection")
+            fusedAdvection = false;
+        else if(arg == "--separate-projection")
+            fusedProjection = false;
+        else if(arg == "--trace" && a+1 < argc)
+            traceFile = argv[++a];
+        else if(arg == "--load-snapshot" && a+1 < argc)
+            loadFile = argv[++a];
+        else if(arg == "--save-snapshot" && a+1 < argc)
+            saveFile = argv[++a];
+        else if(arg == "--export" && a+1 < argc)
+            exportFile = argv[++a];
+        else if(arg == "--export-fields" && a+1 < argc)
+            exportFields = argv[++a];
+        else if(arg == "--export-encoding" && a+1 < argc)
+            exportEncoding = argv[++a];
+        else if(arg == "--sparse" && a+1 < argc)
+            sparseThreshold = (float) atof(argv[++a]);
+        else if(arg == "--precision" && a+1 < argc)
+            precisions = argv[++a];
+        else if(arg == "--advection" && a+1 < argc)
+            advectionPolicy = argv[++a];
+        else if(arg == "--vorticity" && a+1 < argc)
+            vorticity = (float) atof(argv[++a]);
+        else if(arg == "--adaptive-dt" && a+1 < argc)
+            cfl = (float) atof(argv[++a]);
+        else if(arg == "--ranks" && a+1 < argc)
+            ranks = atoi(argv[++a]);
+        else if(arg == "--halo" && a+1 < argc)
+            halo = atoi(argv[++a]);
+        else if(arg == "--ensemble" && a+1 < argc)
+            ensembleFile = argv[++a];
+        else if(arg == "--scene" && a+1 < argc)
+            sceneFile = argv[++a];
+        else if(arg == "--tile" && a+1 < argc)
+        {
+            if(sscanf(argv[++a], "%dx%d", &tileWidth, &tileHeight) == 1)
+                tileHeight = tileWidth;
+        }
+        else if(arg == "--bench" && a+1 < argc)
+        {
+            FluidBenchmark benchmark(cout);
+            if(benchmark.run(argv[++a]))
+                return 0;
+
+            printUsage(argv[0]);
+            return 1;
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    // A loaded snapshot dictates the grid size
+    FluidSnapshot snapshot;
+    if(!loadFile.empty())
+    {
+        if(!snapshot.open(loadFile))
+        {
+            cerr << "Could not load snapshot : " << snapshot.error() << endl;
+            return 1;
+        }
+        width = snapshot.width();
+        height = snapshot.height();
+    }
+
+    // The built-in scene without file
+    FluidScene scene;
+    string sceneError;
+    if(!sceneFile.empty() && !scene.load(sceneFile, sceneError))
+    {
+        cerr << "Could not load scene : " << sceneError << endl;
+        return 1;
+    }
+
+    if(width < 2 || height < 2)
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    vector<FluidKernels> kernelSets = FluidKernels::available();
+    auto kernels = find_if(kernelSets.begin(), kernelSets.end(),
+        [&isa](const FluidKernels& k) {return isa == FluidKernels::isaName(k.isa);});
+    if(kernels == kernelSets.end())
+    {
+        cerr << "Kernels '" << isa << "' are not available on this CPU" << endl;
+        return 1;
+    }
+
+    if(pressure != "jacobi" && pressure != "multigrid-v" && pressure != "multigrid-w" &&
+       pressure != "cg" && pressure != "cg-ic" && pressure != "cg-mg")
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    FluidFieldLayout layout;
+    string precisionError;
+    if(!layout.setPrecisions(precisions, precisionError))
+    {
+        cerr << precisionError << endl;
+        return 1;
+    }
+
+    FluidAdvection advection;
+    string advectionError;
+    if(!advection.parse(advectionPolicy, advectionError))
+    {
+        cerr << advectionError << endl;
+        return 1;
+    }
+
+    // Settings shared by the single run and every ensemble member.
+    // Members take the scene's forcing, not its obstacles.
+    auto configure = [&](FluidSolver& s)
+    {
+        s.setScene(scene);
+        s.setKernels(*kernels);
+        s.setJacobiBlocking(blocking);
+        s.setFusedAdvection(fusedAdvection);
+        s.setAdvection(advection);
+        s.setFusedProjection(fusedProjection);
+        s.setVorticityConfinement(vorticity);
+        if(cfl > 0.0f)
+            s.setAdaptiveTimestep(true, cfl);
+        if(sparseThreshold >= 0.0f)
+            s.setSparse(true, sparseThreshold);
+        if(tileWidth > 0 && tileHeight > 0)
+            s.scheduler().setTileSize(tileWidth, tileHeight);
+        s.setDiffuseCriterion(ConvergenceCriterion(
+            60, jacobiCheck, jacobiTolerance, jacobiNorm));
+        s.setPressureCriterion(ConvergenceCriterion(
+            200, jacobiCheck, jacobiTolerance, jacobiNorm));
+
+        if(pressure == "multigrid-v" || pressure == "multigrid-w")
+        {
+            s.setPressureSolver(FluidSolver::EPressureSolver::MULTIGRID);
+            s.setPressureTolerance(tolerance);
+            s.multigrid().setCycle(pressure == "multigrid-w" ?
+                FluidMultigrid::ECycle::W : FluidMultigrid::ECycle::V);
+        }
+        else if(pressure != "jacobi")
+        {
+            typedef FluidConjugateGradient::EPreconditioner EPreconditioner;
+            s.setPressureSolver(FluidSolver::EPressureSolver::CONJUGATE_GRADIENT);
+            s.setPressureTolerance(tolerance);
+            s.conjugateGradient().setPreconditioner(
+                pressure == "cg-mg" ? EPreconditioner::MULTIGRID :
+                pressure == "cg-ic" ? EPreconditioner::INCOMPLETE_CHOLESKY :
+                                      EPreconditioner::NONE);
+        }
+    };
+
+    if(ranks > 0)
+    {
+        // The domain solver only runs the default float pipeline
+        if(!ensembleFile.empty() || !sceneFile.empty() || !loadFile.empty() ||
+           !saveFile.empty() || !exportFile.empty() || !traceFile.empty() ||
+           sparseThreshold >= 0.0f || !precisions.empty() ||
+           !advectionPolicy.empty() || vorticity > 0.0f || blocking != 1 ||
+           !fusedAdvection || !fusedProjection ||
+           (pressure != "jacobi" && pressure != "multigrid-v" &&
+            pressure != "multigrid-w"))
+        {
+            cerr << "--ranks only supports the size, steps, report, threads, tile,"
+                 << " kernels, halo, adaptive-dt, jacobi and multigrid options" << endl;
+            return 1;
+        }
+
+        return runDomain(ranks, halo, width, height, nbSteps, report, threads, scene,
+                         [&](FluidDomainSolver& s)
+        {
+            s.setKernels(*kernels);
+            if(cfl > 0.0f)
+                s.setAdaptiveTimestep(true, cfl);
+            if(tileWidth > 0 && tileHeight > 0)
+                s.scheduler().setTileSize(tileWidth, tileHeight);
+            s.setDiffuseCriterion(ConvergenceCriterion(
+                60, jacobiCheck, jacobiTolerance, jacobiNorm));
+            s.setPressureCriterion(ConvergenceCriterion(
+                200, jacobiCheck, jacobiTolerance, jacobiNorm));
+            if(pressure != "jacobi")
+            {
+                s.setPressureSolver(FluidDomainSolver::EPressureSolver::MULTIGRID);
+                s.setPressureTolerance(tolerance);
+                s.multigrid().setCycle(pressure == "multigrid-w" ?
+                    FluidMultigrid::ECycle::W : FluidMultigrid::ECycle::V);
+            }
+        });
+    }
+
+    if(!ensembleFile.empty())
+        return runEnsemble(ensembleFile, threads, nbSteps, report, configure);
+
+    FluidSolver solver(width, height, layout);
+    solver.setThreadCount(threads);
+    configure(solver);
+    solver.reset(scene);
+    if(snapshot.isOpen())
+    {
+        string error;
+        if(!solver.loadSnapshot(snapshot, error))
+        {
+            cerr << "Could not load snapshot : " << error << endl;
+            return 1;
+        }
+        snapshot.close();
+    }
+
+    FluidProfiler profiler;
+    if(!traceFile.empty())
+    {
+        if(!profiler.openTrace(traceFile))
+        {
+            cerr << "Could not open trace file '" << traceFile << "'" << endl;
+            return 1;
+        }
+        solver.setProfiler(&profiler);
+    }
+
+    FluidExporter exporter;
+    if(!exportFile.empty())
+    {
+        bool encodingOk = false;
+        vector<FluidFieldLayout::EField> fields;
+        exporter.setEncoding(FluidExporter::encodingFromName(exportEncoding, &encodingOk));
+        if(!encodingOk || !FluidExporter::fieldsFromNames(exportFields, fields))
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+
+        string error;
+        if(!exporter.open(exportFile, width, height, fields, solver.layout(), error))
+        {
+            cerr << "Could not start export : " << error << endl;
+            return 1;
+        }
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::steady_clock::time_point last = start;
+
+    for(int s=0; s<nbSteps; ++s)
+    {
+        profiler.beginFrame();
+        solver.step();
+        if(exporter.isOpen())
+            solver.exportFields(exporter);
+        profiler.endFrame();
+
+        if(report > 0 && solver.stepCount() % report == 0)
+        {
+            chrono::steady_clock::time_point now = chrono::steady_clock::now();
+            double elapsed = chrono::duration<double>(now - last).count();
+            cout << "step " << solver.stepCount() << " : "
+                 << report / elapsed << " UPS";
+            printStats("velocity", solver.velocityDiffuseStats());
+            printStats("heat",     solver.heatDiffuseStats());
+            printStats("pressure", solver.pressureStats());
+            if(solver.sparse())
+                cout << "  active " << solver.activeFraction();
+            if(solver.scene().hasForcing())
+                cout << "  forced " << solver.forcedCells();
+            if(solver.adaptiveTimestep())
+                cout << "  dt " << solver.timestep();
+            cout << endl;
+            last = now;
+        }
+    }
+
+    double total = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << solver.stepCount() << " steps in " << total << " s ("
+         << solver.stepCount() / total << " UPS)" << endl;
+    if(solver.adaptiveTimestep())
+        cout << "Simulated time " << solver.time() << ", max speed "
+             << solver.maxSpeed() << endl;
+
+    if(exporter.isOpen())
+    {
+        string error;
+        if(!exporter.close(error))
+            cerr << "Export incomplete : " << error << endl;
+        FluidExporter::Stats stats = exporter.stats();
+        cout << "Exported " << stats.written << " frames, "
+             << stats.fileBytes / 1048576.0 << " MB ("
+             << (double) stats.rawBytes / max(stats.fileBytes, 1ULL) << "x), "
+             << "blocked " << stats.blockedMs << " ms, "
+             << "max queue " << stats.maxQueued << endl;
+    }
+
+    if(solver.profiler())
+    {
+        cout << "Stage times (moving average) :" << endl;
+        for(int st=0; st < FluidProfiler::STAGE_COUNT; ++st)
+        {
+            FluidProfiler::EStage stage = (FluidProfiler::EStage) st;
+            if(profiler.average(stage) >= 0.0)
+                cout << "  " << setw(18) << left << FluidProfiler::stageName(stage)
+                     << " " << profiler.average(stage) << " ms" << endl;
+        }
+    }
+
+    if(!saveFile.empty())
+    {
+        string error;
+        if(!solver.saveSnapshot(saveFile, error))
+            cerr << "Could not save snapshot : " << error << endl;
+    }
+
+    printChecksum("dye",      solver.dyeGrid());
+    printChecksum("velocity", solver.velocityGrid());
+    printChecksum("pressure", solver.pressureGrid());
+    printChecksum("heat",     solver.heatGrid());
+
+    return 0;
+}
+catch(exception& e)
+{
+    cerr << "Exception caught : " << e.what() << endl;
+    return 1;
+}
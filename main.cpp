@@ -1,3 +1,8 @@
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
 #include <Misc/Log.h>
 
 #include <ScaenaApplication/Application.h>
@@ -14,22 +19,142 @@ using namespace scaena;
 
 int main(int argc, char** argv) try
 {
+    FluidCharacter::EBackend backend = FluidCharacter::EBackend::GL;
+    int width = 256;
+    int height = 256;
+    int pointSize = 0;
+    FluidFieldLayout layout;
+    FluidAdvection advection;
+    FluidScene scene;
+    float vorticity = 0.0f;
+    float cfl = 0.0f;
+    string traceFile;
+    string snapshotFile;
+    double stepRate = 50.0;
+    int substeps = 4;
+    int renderInterval = 0;
+    string exportFile;
+    string exportFields = "dye,velocity,heat";
+    string exportEncoding = "raw";
+    for(int a=1; a<argc; ++a)
+    {
+        string arg = argv[a];
+        if(arg == "--cpu")
+            backend = FluidCharacter::EBackend::CPU;
+        else if(arg == "--size" && a+1 < argc)
+        {
+            // WxH or N for a square grid
+            if(sscanf(argv[++a], "%dx%d", &width, &height) == 1)
+                height = width;
+        }
+        else if(arg == "--point-size" && a+1 < argc)
+            pointSize = atoi(argv[++a]);
+        else if(arg == "--half-dye")
+            layout = FluidFieldLayout(true);
+        else if(arg == "--rgba32f")
+            layout = FluidFieldLayout::rgba32f();
+        else if(arg == "--precision" && a+1 < argc)
+        {
+            string error;
+            if(!layout.setPrecisions(argv[++a], error))
+            {
+                cerr << error << endl;
+                return 1;
+            }
+        }
+        else if(arg == "--advection" && a+1 < argc)
+        {
+            string error;
+            if(!advection.parse(argv[++a], error))
+            {
+                cerr << error << endl;
+                return 1;
+            }
+        }
+        else if(arg == "--scene" && a+1 < argc)
+        {
+            string error;
+            if(!scene.load(argv[++a], error))
+            {
+                cerr << "Could not load scene : " << error << endl;
+                return 1;
+            }
+        }
+        else if(arg == "--vorticity" && a+1 < argc)
+            vorticity = (float) atof(argv[++a]);
+        else if(arg == "--adaptive-dt" && a+1 < argc)
+            cfl = (float) atof(argv[++a]);
+        else if(arg == "--trace" && a+1 < argc)
+            traceFile = argv[++a];
+        else if(arg == "--snapshot" && a+1 < argc)
+            snapshotFile = argv[++a];
+        else if(arg == "--step-rate" && a+1 < argc)
+            stepRate = atof(argv[++a]);
+        else if(arg == "--substeps" && a+1 < argc)
+            substeps = atoi(argv[++a]);
+        else if(arg == "--max-throughput" && a+1 < argc)
+            renderInterval = atoi(argv[++a]);
+        else if(arg == "--export" && a+1 < argc)
+            exportFile = argv[++a];
+        else if(arg == "--export-fields" && a+1 < argc)
+            exportFields = argv[++a];
+        else if(arg == "--export-encoding" && a+1 < argc)
+            exportEncoding = argv[++a];
+    }
+
+    if(width < 2 || height < 2)
+    {
+        cerr << "Grid size must be at least 2x2" << endl;
+        return 1;
+    }
+
+    // Keep the window around 768 pixels unless told otherwise
+    if(pointSize <= 0)
+        pointSize = max(1, 768 / max(width, height));
+
     getLog().setOuput(cout);
     getApplication().init(argc, argv);
 
     QGLStage* stage = new QGLStage();
     stage->setDrawSynch(true);
+    // Updates run back to back, the character steps at its own fixed rate
     stage->setDrawInterval(20);
     stage->setUpdateInterval(0);
     getApplication().addCustomStage(stage);
 
     GlMainWindow window(stage);
-    window.setGlWindowSpace(FluidCharacter::WIDTH  * FluidCharacter::POINT_SIZE,
-                            FluidCharacter::HEIGHT * FluidCharacter::POINT_SIZE);
+    window.setGlWindowSpace(width  * pointSize,
+                            height * pointSize);
     window.centerOnScreen();
     window.show();
 
-    shared_ptr<AbstractCharacter> character(new FluidCharacter(*stage));
+    shared_ptr<FluidCharacter> character(new FluidCharacter(
+        *stage, width, height, pointSize, backend, layout));
+    if(!traceFile.empty() && !character->openTrace(traceFile))
+        cerr << "Could not open trace file '" << traceFile << "'" << endl;
+    if(!snapshotFile.empty())
+        character->setSnapshotFile(snapshotFile);
+    character->setAdvection(advection);
+    character->setScene(scene);
+    character->setVorticityConfinement(vorticity);
+    if(cfl > 0.0f)
+        character->setAdaptiveTimestep(true, cfl);
+    character->setStepRate(stepRate > 0.0 ? stepRate : 50.0);
+    character->setMaxSubsteps(substeps);
+    if(renderInterval > 0)
+        character->setMaxThroughput(true, renderInterval);
+    if(!exportFile.empty())
+    {
+        bool encodingOk = false;
+        vector<FluidFieldLayout::EField> fields;
+        FluidExporter::EEncoding encoding =
+            FluidExporter::encodingFromName(exportEncoding, &encodingOk);
+        if(encodingOk && FluidExporter::fieldsFromNames(exportFields, fields))
+            character->setExport(exportFile, fields, encoding);
+        else
+            cerr << "Invalid export fields '" << exportFields
+                 << "' or encoding '" << exportEncoding << "'" << endl;
+    }
     shared_ptr<AbstractPlay> play(new TrivialPlay("Fluid2D",character));
     getApplication().setPlay(play);
 
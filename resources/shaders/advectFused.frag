@@ -0,0 +1,28 @@
+#version 400
+
+uniform sampler2D DyeTex;
+uniform sampler2D HeatTex;
+uniform sampler2D VelocityTex;
+uniform sampler2D FrontierTex;
+uniform vec2 Size;
+uniform float rDx;
+uniform float Dt;
+
+out vec4 Dye;
+out vec4 Heat;
+out vec4 Velocity;
+
+void main(void)
+{
+    vec2 nPos = gl_FragCoord.xy - Dt * rDx *
+            texelFetch(VelocityTex, ivec2(gl_FragCoord.xy), 0).xy;
+
+    nPos = mix(nPos,
+               gl_FragCoord.xy,
+               texelFetch(FrontierTex, ivec2(nPos), 0).x);
+
+    vec2 coord = nPos / Size;
+    Dye      = texture(DyeTex,      coord);
+    Heat     = texture(HeatTex,     coord);
+    Velocity = texture(VelocityTex, coord);
+}
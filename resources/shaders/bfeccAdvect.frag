@@ -0,0 +1,41 @@
+#version 400
+
+uniform sampler2D FragInTex;
+uniform sampler2D CompensatedTex;
+uniform sampler2D VelocityTex;
+uniform sampler2D FrontierTex;
+uniform vec2 Size;
+uniform float rDx;
+uniform float Dt;
+uniform int Revert;
+
+out vec4 FragOut;
+
+void main(void)
+{
+    vec2 nPos = gl_FragCoord.xy - Dt * rDx *
+            texelFetch(VelocityTex, ivec2(gl_FragCoord.xy), 0).xy;
+
+    nPos = mix(nPos,
+               gl_FragCoord.xy,
+               texelFetch(FrontierTex, ivec2(nPos), 0).x);
+
+    // Texels of FragInTex the semi-Lagrangian sample blends
+    ivec2 size = ivec2(Size) - 1;
+    ivec2 c0 = ivec2(floor(nPos - 0.5));
+    ivec2 c1 = clamp(c0 + 1, ivec2(0), size);
+    c0 = clamp(c0, ivec2(0), size);
+
+    vec4 p00 = texelFetch(FragInTex, c0, 0);
+    vec4 p10 = texelFetch(FragInTex, ivec2(c1.x, c0.y), 0);
+    vec4 p01 = texelFetch(FragInTex, ivec2(c0.x, c1.y), 0);
+    vec4 p11 = texelFetch(FragInTex, c1, 0);
+    vec4 low  = min(min(p00, p10), min(p01, p11));
+    vec4 high = max(max(p00, p10), max(p01, p11));
+
+    vec4 value = texture(CompensatedTex, nPos / Size);
+    vec4 limited = clamp(value, low, high);
+
+    bool outside = any(notEqual(value, limited));
+    FragOut = (Revert != 0 && outside) ? texture(FragInTex, nPos / Size) : limited;
+}
@@ -0,0 +1,41 @@
+#version 400
+
+uniform sampler2D VelocityTex;
+uniform sampler2D CurlTex;
+uniform sampler2D FrontierTex;
+uniform vec2 Size;
+uniform float HalfrDx;
+// Strength * Dx * Dt
+uniform float Scale;
+
+out vec4 FragOut;
+
+
+ivec2 neighbour(ivec2 pos, ivec2 dir)
+{
+    ivec2 n = pos + dir;
+    if(any(lessThan(n, ivec2(0))) || any(greaterThanEqual(n, ivec2(Size))) ||
+       texelFetch(FrontierTex, n, 0).x == 1.0)
+        return pos;
+    return n;
+}
+
+void main(void)
+{
+    ivec2 pos = ivec2(gl_FragCoord.xy);
+    FragOut = texelFetch(VelocityTex, pos, 0);
+
+    if(texelFetch(FrontierTex, pos, 0).x == 1.0)
+        return;
+
+    // Force along N x curl, N pointing up the curl's magnitude
+    float cL = abs(texelFetch(CurlTex, neighbour(pos, ivec2(-1,  0)), 0).x);
+    float cR = abs(texelFetch(CurlTex, neighbour(pos, ivec2( 1,  0)), 0).x);
+    float cB = abs(texelFetch(CurlTex, neighbour(pos, ivec2( 0, -1)), 0).x);
+    float cT = abs(texelFetch(CurlTex, neighbour(pos, ivec2( 0,  1)), 0).x);
+    vec2 eta = HalfrDx * vec2(cR - cL, cT - cB);
+
+    float curl = texelFetch(CurlTex, pos, 0).x;
+    float f = Scale * curl / (length(eta) + 1e-5);
+    FragOut.xy += f * vec2(eta.y, -eta.x);
+}
@@ -0,0 +1,31 @@
+#version 400
+
+uniform sampler2D FrontierTex;
+uniform vec2 Size;
+// x0, y0, x1, y1 of a box or cx, cy, r of a circle
+uniform vec4 Coords;
+uniform int Circle;
+uniform vec4 Value;
+
+out vec4 FragOut;
+
+
+void main(void)
+{
+    ivec2 pos = ivec2(gl_FragCoord.xy);
+    vec2 st = vec2(pos) / Size;
+
+    if(Circle == 1)
+    {
+        vec2 d = st - Coords.xy;
+        if(dot(d, d) >= Coords.z * Coords.z)
+            discard;
+    }
+    else if(any(lessThan(st, Coords.xy)) || any(greaterThanEqual(st, Coords.zw)))
+        discard;
+
+    if(texelFetch(FrontierTex, pos, 0).x == 1.0)
+        discard;
+
+    FragOut = Value;
+}
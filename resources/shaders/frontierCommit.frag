@@ -0,0 +1,16 @@
+#version 400
+
+uniform sampler2D VelocityTex;
+uniform sampler2D PressureTex;
+
+flat in ivec2 Cell;
+
+out vec4 Velocity;
+out vec4 Pressure;
+
+
+void main(void)
+{
+    Velocity = texelFetch(VelocityTex, Cell, 0);
+    Pressure = texelFetch(PressureTex, Cell, 0);
+}
@@ -0,0 +1,45 @@
+#version 400
+
+uniform sampler2D VelocityTex;
+uniform sampler2D PressureTex;
+uniform vec2 Size;
+
+flat in ivec2 Cell;
+flat in vec4 Weights;
+
+out vec4 Velocity;
+out vec4 Pressure;
+
+
+void main(void)
+{
+    float accum = 0.0;
+    vec4 moyVelocity = vec4(0.0);
+    vec4 moyPressure = vec4(0.0);
+
+    ivec2 dir[4];
+    dir[0] = ivec2(-1,  0);
+    dir[1] = ivec2( 1,  0);
+    dir[2] = ivec2( 0, -1);
+    dir[3] = ivec2( 0,  1);
+
+    ivec2 last = ivec2(Size) - 1;
+    for(int i=0; i<4; ++i)
+    {
+        ivec2 pos = clamp(Cell + dir[i], ivec2(0), last);
+        moyVelocity += texelFetch(VelocityTex, pos, 0) * Weights[i];
+        moyPressure += texelFetch(PressureTex, pos, 0) * Weights[i];
+        accum += Weights[i];
+    }
+
+    if(accum != 0.0)
+    {
+        Velocity = -moyVelocity / accum;
+        Pressure = moyPressure / accum;
+    }
+    else
+    {
+        Velocity = vec4(0.0);
+        Pressure = texelFetch(PressureTex, Cell, 0);
+    }
+}
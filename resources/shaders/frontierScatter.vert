@@ -0,0 +1,16 @@
+#version 400
+
+uniform vec2 Size;
+
+in vec2 cell;
+in vec4 weights;
+
+flat out ivec2 Cell;
+flat out vec4 Weights;
+
+void main(void)
+{
+    Cell = ivec2(cell);
+    Weights = weights;
+    gl_Position = vec4((cell + 0.5) / Size * 2.0 - 1.0, 0, 1);
+}
@@ -4,6 +4,8 @@ uniform sampler2D VelocityTex;
 uniform sampler2D HeatTex;
 uniform vec2 Size;
 uniform float HalfrDx;
+// Timestep over the fixed one
+uniform float TimeScale;
 uniform vec2 MousePos;
 
 out vec4 Velocity;
@@ -20,7 +22,7 @@ void main(void)
     float hT = texelFetch(HeatTex, pos + ivec2(0, 1), 0).x;
 
     vec4 v = texelFetch(VelocityTex, pos, 0);
-    v.y += HalfrDx * ((hL + hR + hB + hT) - hC.x) * 0.05;
+    v.y += HalfrDx * ((hL + hR + hB + hT) - hC.x) * 0.05 * TimeScale;
 
     Velocity = v;
 
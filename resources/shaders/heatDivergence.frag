@@ -0,0 +1,55 @@
+#version 400
+
+uniform sampler2D VelocityTex;
+uniform sampler2D HeatTex;
+uniform vec2 Size;
+uniform float HalfrDx;
+// Timestep over the fixed one
+uniform float TimeScale;
+uniform vec2 MousePos;
+
+out vec4 Velocity;
+out vec4 Heat;
+out vec4 Divergence;
+
+float buoyancy(ivec2 pos)
+{
+    float hC = texelFetch(HeatTex, pos, 0).x;
+    float hL = texelFetch(HeatTex, pos - ivec2(1, 0), 0).x;
+    float hR = texelFetch(HeatTex, pos + ivec2(1, 0), 0).x;
+    float hB = texelFetch(HeatTex, pos - ivec2(0, 1), 0).x;
+    float hT = texelFetch(HeatTex, pos + ivec2(0, 1), 0).x;
+
+    return HalfrDx * ((hL + hR + hB + hT) - hC) * 0.05 * TimeScale;
+}
+
+void main(void)
+{
+    ivec2 pos = ivec2(gl_FragCoord.xy);
+
+    vec4 v = texelFetch(VelocityTex, pos, 0);
+    v.y += buoyancy(pos);
+    Velocity = v;
+
+
+    if(distance(MousePos, gl_FragCoord.xy) < 10.0)
+    {
+        Heat =  vec4(1.0, 0, 0, 0);
+    }
+    else
+    {
+        Heat = texelFetch(HeatTex, pos, 0);
+    }
+
+
+    // Buoyancy only moves v.y, so it is redone for the bottom and top cells
+    ivec2 posB = pos - ivec2(0, 1);
+    ivec2 posT = pos + ivec2(0, 1);
+    float uL = texelFetch(VelocityTex, pos - ivec2(1, 0), 0).x;
+    float uR = texelFetch(VelocityTex, pos + ivec2(1, 0), 0).x;
+    float vB = texelFetch(VelocityTex, posB, 0).y + buoyancy(posB);
+    float vT = texelFetch(VelocityTex, posT, 0).y + buoyancy(posT);
+
+    float div = HalfrDx * ((uR - uL) + (vT - vB));
+    Divergence = vec4(div, 0, 0, 0);
+}
@@ -0,0 +1,53 @@
+#version 400
+
+uniform sampler2D FragInTex;
+uniform sampler2D ForwardTex;
+uniform sampler2D VelocityTex;
+uniform sampler2D FrontierTex;
+uniform vec2 Size;
+uniform float rDx;
+uniform float Dt;
+uniform int Revert;
+
+out vec4 FragOut;
+
+vec2 trace(float direction)
+{
+    vec2 nPos = gl_FragCoord.xy + direction * Dt * rDx *
+            texelFetch(VelocityTex, ivec2(gl_FragCoord.xy), 0).xy;
+
+    return mix(nPos,
+               gl_FragCoord.xy,
+               texelFetch(FrontierTex, ivec2(nPos), 0).x);
+}
+
+// Texels of FragInTex the bilinear sample at pos blends
+void bounds(vec2 pos, out vec4 low, out vec4 high)
+{
+    ivec2 size = ivec2(Size) - 1;
+    ivec2 c0 = ivec2(floor(pos - 0.5));
+    ivec2 c1 = clamp(c0 + 1, ivec2(0), size);
+    c0 = clamp(c0, ivec2(0), size);
+
+    vec4 p00 = texelFetch(FragInTex, c0, 0);
+    vec4 p10 = texelFetch(FragInTex, ivec2(c1.x, c0.y), 0);
+    vec4 p01 = texelFetch(FragInTex, ivec2(c0.x, c1.y), 0);
+    vec4 p11 = texelFetch(FragInTex, c1, 0);
+    low  = min(min(p00, p10), min(p01, p11));
+    high = max(max(p00, p10), max(p01, p11));
+}
+
+void main(void)
+{
+    ivec2 cell = ivec2(gl_FragCoord.xy);
+    vec4 forward = texelFetch(ForwardTex, cell, 0);
+    vec4 backward = texture(ForwardTex, trace(1.0) / Size);
+    vec4 value = forward + 0.5 * (texelFetch(FragInTex, cell, 0) - backward);
+
+    vec4 low, high;
+    bounds(trace(-1.0), low, high);
+    vec4 limited = clamp(value, low, high);
+
+    bool outside = any(notEqual(value, limited));
+    FragOut = (Revert != 0 && outside) ? forward : limited;
+}
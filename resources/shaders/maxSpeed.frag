@@ -0,0 +1,29 @@
+#version 400
+
+uniform sampler2D SrcTex;
+uniform vec2 Size;
+// The first level reads the velocity, the next ones the previous level
+uniform int FromVelocity;
+
+out vec4 FragOut;
+
+
+// Each texel holds the max of the squared speed over a 4x4 block
+void main(void)
+{
+    ivec2 base = ivec2(gl_FragCoord.xy) * 4;
+    ivec2 last = ivec2(Size) - 1;
+
+    float peak = 0.0;
+    for(int j=0; j < 4; ++j)
+    {
+        for(int i=0; i < 4; ++i)
+        {
+            vec4 texel = texelFetch(SrcTex, min(base + ivec2(i, j), last), 0);
+            float value = FromVelocity != 0 ? dot(texel.xy, texel.xy) : texel.x;
+            peak = max(peak, value);
+        }
+    }
+
+    FragOut = vec4(peak, 0, 0, 0);
+}
@@ -0,0 +1,14 @@
+#version 400
+
+uniform sampler2D NewTex;
+uniform sampler2D OldTex;
+
+out vec4 FragOut;
+
+void main(void)
+{
+    ivec2 pos = ivec2(gl_FragCoord.xy);
+    vec4 d = texelFetch(NewTex, pos, 0) - texelFetch(OldTex, pos, 0);
+
+    FragOut = vec4(dot(d, d), 0, 0, 0);
+}
@@ -0,0 +1,38 @@
+#version 400
+
+uniform sampler2D VelocityTex;
+uniform sampler2D FrontierTex;
+uniform vec2 Size;
+uniform float HalfrDx;
+
+out vec4 FragOut;
+
+
+// Neighbours out of the grid or in an obstacle read as the cell itself
+ivec2 neighbour(ivec2 pos, ivec2 dir)
+{
+    ivec2 n = pos + dir;
+    if(any(lessThan(n, ivec2(0))) || any(greaterThanEqual(n, ivec2(Size))) ||
+       texelFetch(FrontierTex, n, 0).x == 1.0)
+        return pos;
+    return n;
+}
+
+void main(void)
+{
+    ivec2 pos = ivec2(gl_FragCoord.xy);
+
+    if(texelFetch(FrontierTex, pos, 0).x == 1.0)
+    {
+        FragOut = vec4(0.0);
+        return;
+    }
+
+    vec4 vL = texelFetch(VelocityTex, neighbour(pos, ivec2(-1,  0)), 0);
+    vec4 vR = texelFetch(VelocityTex, neighbour(pos, ivec2( 1,  0)), 0);
+    vec4 vB = texelFetch(VelocityTex, neighbour(pos, ivec2( 0, -1)), 0);
+    vec4 vT = texelFetch(VelocityTex, neighbour(pos, ivec2( 0,  1)), 0);
+
+    float curl = HalfrDx * ((vR.y - vL.y) - (vT.x - vB.x));
+    FragOut = vec4(curl, 0, 0, 0);
+}